@@ -0,0 +1,354 @@
+#include "batch_classifier.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "tensorflow/core/platform/logging.h"
+
+bool ImageSource::Next(uint64_t& index, std::string& name) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    while (!_done) {
+        if (_archive != nullptr) {
+            if (_next >= _archive->Size()) {
+                _done = true;
+                break;
+            }
+            name = _archive->Name(_next);
+        } else if (_lines != nullptr) {
+            std::string line;
+
+            if (!std::getline(*_lines, line)) {
+                _done = true;
+                break;
+            }
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            name = line;
+        } else {
+            if (_next >= _paths.size()) {
+                _done = true;
+                break;
+            }
+            name = _paths[_next];
+        }
+
+        index = _next++;
+        return true;
+    }
+
+    return false;
+}
+
+Status ImageSource::Load(uint64_t index, const std::string& name,
+        std::unique_ptr<MappedFile>& file, tensorflow::StringPiece& jpeg) {
+    if (_archive != nullptr) {
+        jpeg = _archive->Image(index);
+        return Status::OK();
+    }
+
+    TF_RETURN_IF_ERROR(MappedFile::Open(name, MapAccess::SEQUENTIAL, file));
+    jpeg = file->Data();
+
+    return Status::OK();
+}
+
+uint64_t ImageSource::Count() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _next;
+}
+
+static
+bool HasJpegExtension(const std::string& name) {
+    size_t dot = name.rfind('.');
+    std::string extension;
+
+    if (dot == std::string::npos) {
+        return false;
+    }
+
+    extension = name.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+            [](unsigned char c) { return std::tolower(c); });
+
+    return extension == "jpg" || extension == "jpeg";
+}
+
+bool ListImages(const std::string& dir, std::vector<std::string>& paths) {
+    DIR* handle = opendir(dir.c_str());
+    size_t first = paths.size();
+
+    if (handle == nullptr) {
+        return false;
+    }
+
+    while (struct dirent* entry = readdir(handle)) {
+        std::string name = entry->d_name;
+
+        if (entry->d_type != DT_DIR && HasJpegExtension(name)) {
+            paths.push_back(dir + "/" + name);
+        }
+    }
+    closedir(handle);
+
+    std::sort(paths.begin() + first, paths.end());
+
+    return true;
+}
+
+bool ParseResultFormat(const std::string& value, ResultFormat& format) {
+    if (value == "csv") {
+        format = ResultFormat::CSV;
+    } else if (value == "jsonl") {
+        format = ResultFormat::JSONL;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static
+void WriteCsvField(std::ostream& output, const std::string& value) {
+    if (value.find_first_of(",\"\r\n") == std::string::npos) {
+        output << value;
+        return;
+    }
+
+    output << '"';
+    for (char c : value) {
+        if (c == '"') {
+            output << '"';
+        }
+        output << c;
+    }
+    output << '"';
+}
+
+static
+void WriteJsonString(std::ostream& output, const std::string& value) {
+    output << '"';
+    for (unsigned char c : value) {
+        switch (c) {
+        case '"':  output << "\\\""; break;
+        case '\\': output << "\\\\"; break;
+        case '\n': output << "\\n"; break;
+        case '\r': output << "\\r"; break;
+        case '\t': output << "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                output << escaped;
+            } else {
+                output << c;
+            }
+        }
+    }
+    output << '"';
+}
+
+BatchClassifier::BatchClassifier(ClassificationModel& model,
+        const BatchOptions& options) :
+    _model(model),
+    _options(options) {
+    _options.batch_size = std::max<size_t>(_options.batch_size, 1);
+    _options.prefetch = std::max<size_t>(_options.prefetch, 1);
+    if (_options.prefetch_threads <= 0) {
+        _options.prefetch_threads =
+            std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+}
+
+void BatchClassifier::Prefetch(ImageSource& source) {
+    std::unique_ptr<JpegPreprocessor> preprocessor = _model.NewPreprocessor();
+    uint64_t index;
+    std::string name;
+
+    while (source.Next(index, name)) {
+        std::unique_ptr<MappedFile> file;
+        tensorflow::StringPiece jpeg;
+        Tensor image;
+
+        /* Slots are a ring, wait until the image that used this slot
+         * before has been taken by the batching thread.
+         * */
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _slot_free.wait(lock, [&] {
+                return index < _consumed + _slots.size();
+            });
+        }
+
+        Status status = source.Load(index, name, file, jpeg);
+        if (status.ok()) {
+            status = _model.Preprocess(jpeg, image, preprocessor.get());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Slot& slot = _slots[index % _slots.size()];
+
+            slot.ready = true;
+            slot.name = std::move(name);
+            slot.image = image;
+            slot.status = status;
+        }
+        _slot_ready.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _input_done = true;
+        _total = source.Count();
+    }
+    _slot_ready.notify_all();
+}
+
+void BatchClassifier::WriteHeader(std::ostream& output) {
+    if (_options.format == ResultFormat::CSV) {
+        output << "image,rank,index,label,score,error\n";
+    }
+}
+
+void BatchClassifier::WriteResult(std::ostream& output,
+        const std::string& name, const std::vector<ScoredLabel>& labels,
+        const Status& status) {
+    if (_options.format == ResultFormat::CSV) {
+        if (!status.ok()) {
+            WriteCsvField(output, name);
+            output << ",,,,,";
+            WriteCsvField(output, status.ToString());
+            output << '\n';
+            return;
+        }
+
+        for (size_t i = 0; i < labels.size(); ++i) {
+            WriteCsvField(output, name);
+            output << ',' << i + 1 << ',' << labels[i].index << ',';
+            WriteCsvField(output, _model.Label(labels[i].index));
+            output << ',' << labels[i].score << ",\n";
+        }
+        return;
+    }
+
+    output << "{\"image\":";
+    WriteJsonString(output, name);
+    if (!status.ok()) {
+        output << ",\"error\":";
+        WriteJsonString(output, status.ToString());
+    } else {
+        output << ",\"labels\":[";
+        for (size_t i = 0; i < labels.size(); ++i) {
+            output << (i > 0 ? "," : "") << "{\"index\":" << labels[i].index
+                   << ",\"label\":";
+            WriteJsonString(output, _model.Label(labels[i].index));
+            output << ",\"score\":" << labels[i].score << '}';
+        }
+        output << ']';
+    }
+    output << "}\n";
+}
+
+uint64_t BatchClassifier::Run(ImageSource& source, std::ostream& output) {
+    struct Pending {
+        std::string name;
+        Status status;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<Pending> pending;
+    std::vector<Tensor> images;
+    std::vector<std::vector<ScoredLabel>> top_labels;
+    uint64_t count = 0;
+    uint64_t failed = 0;
+    bool more = true;
+
+    _slots.assign(_options.prefetch, Slot());
+    _consumed = 0;
+    _total = 0;
+    _input_done = false;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < _options.prefetch_threads; ++i) {
+        workers.emplace_back(&BatchClassifier::Prefetch, this,
+                std::ref(source));
+    }
+
+    WriteHeader(output);
+
+    while (more) {
+        pending.clear();
+        images.clear();
+
+        /* Slots are taken in input order, failed images stay in pending
+         * so their rows are written between the neighbouring results.
+         * */
+        while (images.size() < _options.batch_size) {
+            Slot taken;
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                Slot& slot = _slots[_consumed % _slots.size()];
+
+                _slot_ready.wait(lock, [&] {
+                    return slot.ready || (_input_done && _consumed >= _total);
+                });
+                if (!slot.ready) {
+                    more = false;
+                    break;
+                }
+
+                taken = std::move(slot);
+                slot = Slot();
+                ++_consumed;
+            }
+            _slot_free.notify_all();
+
+            if (taken.status.ok()) {
+                images.push_back(taken.image);
+            }
+            pending.push_back({std::move(taken.name), taken.status});
+        }
+
+        Status status = _model.PredictBatch(images, top_labels);
+        size_t next = 0;
+
+        for (const Pending& entry : pending) {
+            if (!entry.status.ok()) {
+                WriteResult(output, entry.name, {}, entry.status);
+                ++failed;
+            } else if (!status.ok()) {
+                WriteResult(output, entry.name, {}, status);
+                ++failed;
+            } else {
+                WriteResult(output, entry.name, top_labels[next++], status);
+            }
+        }
+        count += pending.size();
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    output.flush();
+
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+    LOG(INFO) << "Classified " << count << " images, failed " << failed
+              << ", " << seconds << " s, "
+              << (seconds > 0 ? count / seconds : 0) << " images/sec";
+
+    return failed;
+}
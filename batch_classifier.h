@@ -0,0 +1,108 @@
+#ifndef __BATCH_CLASSIFIER_H__
+#define __BATCH_CLASSIFIER_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "classification_model.h"
+
+/* Images to classify: paths, lines of a stream (stdin) or the entries
+ * of an archive. Next is called by all prefetch threads and hands out
+ * consecutive indices, which fix the output order.
+ * */
+class ImageSource {
+private:
+    std::mutex _mutex;
+    std::vector<std::string> _paths;
+    std::istream* _lines = nullptr;
+    const ImageArchive* _archive = nullptr;
+    uint64_t _next = 0;
+    bool _done = false;
+
+public:
+    explicit ImageSource(const std::vector<std::string>& paths) :
+        _paths(paths) {}
+    explicit ImageSource(std::istream& lines) : _lines(&lines) {}
+    explicit ImageSource(const ImageArchive& archive) : _archive(&archive) {}
+
+    ImageSource(const ImageSource&) = delete;
+    ImageSource& operator=(const ImageSource&) = delete;
+
+    /* False when the input is over. */
+    bool Next(uint64_t& index, std::string& name);
+
+    /* Encoded bytes of the image; file is the mapping to keep alive. */
+    Status Load(uint64_t index, const std::string& name,
+            std::unique_ptr<MappedFile>& file, tensorflow::StringPiece& jpeg);
+
+    /* Count of images, valid once Next has returned false. */
+    uint64_t Count();
+};
+
+/* *.jpg and *.jpeg files of a directory, sorted by name. */
+bool ListImages(const std::string& dir, std::vector<std::string>& paths);
+
+enum class ResultFormat {
+    CSV,   // image,rank,index,label,score,error
+    JSONL, // {"image": ..., "labels": [{"index", "label", "score"}...]}
+};
+
+/* "--output_format" value: csv or jsonl. */
+bool ParseResultFormat(const std::string& value, ResultFormat& format);
+
+struct BatchOptions {
+    size_t batch_size = 32;
+    int prefetch_threads = 0; // 0 - one per core
+    size_t prefetch = 64;     // Decoded images waiting for a batch
+    ResultFormat format = ResultFormat::CSV;
+};
+
+/* Classifies a whole image set with one loaded model.
+ *
+ * Prefetch threads map and decode images ahead of the model, at most
+ * prefetch images at a time. The calling thread packs decoded images
+ * into batches in input order, runs them and writes one result per
+ * image, so output order always matches input order. Images that fail
+ * to decode are reported as errors and do not stop the run.
+ * */
+class BatchClassifier {
+private:
+    struct Slot {
+        bool ready = false;
+        std::string name;
+        Tensor image;
+        Status status;
+    };
+
+    ClassificationModel& _model;
+    BatchOptions _options;
+
+    std::mutex _mutex;
+    std::condition_variable _slot_free;
+    std::condition_variable _slot_ready;
+    std::vector<Slot> _slots;
+    uint64_t _consumed = 0;
+    uint64_t _total = 0;
+    bool _input_done = false;
+
+    void Prefetch(ImageSource& source);
+    void WriteHeader(std::ostream& output);
+    void WriteResult(std::ostream& output, const std::string& name,
+            const std::vector<ScoredLabel>& labels, const Status& status);
+
+public:
+    BatchClassifier(ClassificationModel& model, const BatchOptions& options);
+
+    BatchClassifier(const BatchClassifier&) = delete;
+    BatchClassifier& operator=(const BatchClassifier&) = delete;
+
+    /* Returns count of images that failed. */
+    uint64_t Run(ImageSource& source, std::ostream& output);
+};
+
+#endif /* __BATCH_CLASSIFIER_H__ */
@@ -0,0 +1,14 @@
+#ifndef __BENCHMARK_CHECKS_H__
+#define __BENCHMARK_CHECKS_H__
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+/* Correctness check inside a benchmark failed: the benchmark reports the
+ * error and the benchmarks binary exits with a non-zero code, so a run
+ * in CI fails instead of only showing a skipped case.
+ * */
+void FailCheck(benchmark::State& state, const std::string& message);
+
+#endif /* __BENCHMARK_CHECKS_H__ */
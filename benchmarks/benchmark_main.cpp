@@ -0,0 +1,34 @@
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+#include <benchmark/benchmark.h>
+
+#include "benchmark_checks.h"
+
+static std::atomic<int> failed_checks{0};
+
+void FailCheck(benchmark::State& state, const std::string& message) {
+    failed_checks.fetch_add(1);
+    state.SkipWithError(message.c_str());
+}
+
+int main(int argc, char** argv) {
+    /* Models log every run at INFO level, keep the report readable.
+     * Explicit TF_CPP_MIN_LOG_LEVEL of the environment wins.
+     * */
+    setenv("TF_CPP_MIN_LOG_LEVEL", "1", 0);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+
+    if (failed_checks.load() > 0) {
+        std::cerr << failed_checks.load() << " benchmark checks failed\n";
+        return 1;
+    }
+
+    return 0;
+}
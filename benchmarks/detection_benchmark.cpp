@@ -0,0 +1,392 @@
+/*
+ * Stages of object_detection on a tiny generated SavedModel.
+ *
+ * "MatToTensor" compares a copy into a new tensor with the zero-copy
+ * bridge. "SwsScale" compares a conversion context created per frame,
+ * as the old decode loop did, with FrameConverter. "PredictBatch" is
+ * Session::Run of the model at several batch sizes. "EndToEnd" cases
+ * report frames per second: images/*.jpg through Testing(path), the
+ * same images packed in one ImageArchive through PredictEncoded, and a
+ * synthetic MPEG-4 video through decode, conversion and inference.
+ *
+ * Set BENCHMARK_MODEL to a SavedModel directory to measure a real model.
+ * */
+
+#include <glob.h>
+
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+#include "detection_model.h"
+#include "frame_converter.h"
+#include "tensor_buffer.h"
+#include "tiny_saved_model.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef BENCHMARK_IMAGES_DIR
+#define BENCHMARK_IMAGES_DIR "images"
+#endif
+
+namespace {
+
+struct AVFrame_Deleter {
+    void operator() (AVFrame* ptr) { av_frame_free(&ptr); }
+};
+
+struct AVPacket_Deleter {
+    void operator() (AVPacket* ptr) { av_packet_free(&ptr); }
+};
+
+struct AVCodecContext_Deleter {
+    void operator() (AVCodecContext* ptr) { avcodec_free_context(&ptr); }
+};
+
+using FramePtr = std::unique_ptr<AVFrame, AVFrame_Deleter>;
+using PacketPtr = std::unique_ptr<AVPacket, AVPacket_Deleter>;
+using CodecContextPtr = std::unique_ptr<AVCodecContext, AVCodecContext_Deleter>;
+
+/* Model is loaded once for all cases, and never freed so it
+ * outlives every benchmark regardless of static destruction order.
+ * */
+DetectionModel& Model() {
+    static DetectionModel* model = nullptr;
+
+    if (model == nullptr) {
+        const char* path = std::getenv("BENCHMARK_MODEL");
+        std::string export_dir;
+
+        if (path != nullptr) {
+            export_dir = path;
+        } else {
+            std::vector<std::string> temp_dirs;
+            tensorflow::Env::Default()->GetLocalTempDirectories(&temp_dirs);
+            export_dir = tensorflow::io::JoinPath(
+                    temp_dirs.empty() ? "/tmp" : temp_dirs[0],
+                    "tiny_detection_model");
+            TF_CHECK_OK(WriteTinyDetectionModel(export_dir));
+        }
+
+        model = new DetectionModel(export_dir);
+    }
+
+    return *model;
+}
+
+cv::Mat RandomImage(int rows, int cols) {
+    cv::Mat image(rows, cols, CV_8UC3);
+    std::mt19937 generator(42);
+
+    for (size_t i = 0; i < image.total() * image.elemSize(); ++i) {
+        image.data[i] = static_cast<uint8_t>(generator());
+    }
+
+    return image;
+}
+
+/* YUV420P gradient that moves with index, so the encoder
+ * gets both intra and inter frames to work on.
+ * */
+FramePtr SyntheticFrame(int width, int height, int index) {
+    FramePtr frame(av_frame_alloc());
+
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width;
+    frame->height = height;
+    frame->pts = index;
+    if (av_frame_get_buffer(frame.get(), 0) < 0) {
+        throw std::runtime_error("Failed to allocate synthetic frame");
+    }
+
+    for (int y = 0; y < height; ++y) {
+        uint8_t* row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < width; ++x) {
+            row[x] = static_cast<uint8_t>(x + y + index * 4);
+        }
+    }
+    for (int plane = 1; plane < 3; ++plane) {
+        for (int y = 0; y < height / 2; ++y) {
+            uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+            for (int x = 0; x < width / 2; ++x) {
+                row[x] = static_cast<uint8_t>(128 + plane * 16 + index);
+            }
+        }
+    }
+
+    return frame;
+}
+
+/* Receive every packet the encoder has ready. */
+void ReceivePackets(AVCodecContext* encoder, std::vector<PacketPtr>& packets) {
+    for (;;) {
+        PacketPtr packet(av_packet_alloc());
+
+        if (avcodec_receive_packet(encoder, packet.get()) != 0) {
+            return;
+        }
+        packets.push_back(std::move(packet));
+    }
+}
+
+/* Encode frame_count synthetic frames with the native MPEG-4 encoder,
+ * headers are in-band so a decoder needs no extradata.
+ * */
+std::vector<PacketPtr> SyntheticVideo(int width, int height, int frame_count) {
+    std::vector<PacketPtr> packets;
+    const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+
+    if (codec == nullptr) {
+        throw std::runtime_error("MPEG-4 encoder is not available");
+    }
+
+    CodecContextPtr encoder(avcodec_alloc_context3(codec));
+    encoder->width = width;
+    encoder->height = height;
+    encoder->time_base = {1, 25};
+    encoder->framerate = {25, 1};
+    encoder->pix_fmt = AV_PIX_FMT_YUV420P;
+    encoder->gop_size = 12;
+    encoder->max_b_frames = 0;
+    encoder->bit_rate = 2000000;
+
+    if (avcodec_open2(encoder.get(), codec, nullptr) < 0) {
+        throw std::runtime_error("Failed to open MPEG-4 encoder");
+    }
+
+    for (int i = 0; i < frame_count; ++i) {
+        FramePtr frame = SyntheticFrame(width, height, i);
+        if (avcodec_send_frame(encoder.get(), frame.get()) < 0) {
+            throw std::runtime_error("Failed to encode synthetic frame");
+        }
+        ReceivePackets(encoder.get(), packets);
+    }
+
+    avcodec_send_frame(encoder.get(), nullptr);
+    ReceivePackets(encoder.get(), packets);
+
+    return packets;
+}
+
+void BM_MatToTensor_Copy(benchmark::State& state) {
+    cv::Mat image = RandomImage(state.range(0), state.range(1));
+
+    for (auto _ : state) {
+        Tensor tensor(DT_UINT8, TensorShape({1, image.rows, image.cols, 3}));
+        cv::Mat view(image.rows, image.cols, CV_8UC3,
+                tensor.flat<tensorflow::uint8>().data());
+        image.copyTo(view);
+        benchmark::DoNotOptimize(tensor);
+    }
+
+    state.SetBytesProcessed(state.iterations() * image.total() * 3);
+}
+BENCHMARK(BM_MatToTensor_Copy)->Args({480, 640})->Args({1080, 1920})
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_MatToTensor_ZeroCopy(benchmark::State& state) {
+    cv::Mat image = RandomImage(state.range(0), state.range(1));
+
+    for (auto _ : state) {
+        Tensor tensor;
+        TF_CHECK_OK(MatToTensor(image, tensor));
+        benchmark::DoNotOptimize(tensor);
+    }
+
+    state.SetBytesProcessed(state.iterations() * image.total() * 3);
+}
+BENCHMARK(BM_MatToTensor_ZeroCopy)->Args({480, 640})->Args({1080, 1920})
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_SwsScale_ContextPerFrame(benchmark::State& state) {
+    FramePtr frame = SyntheticFrame(state.range(1), state.range(0), 0);
+
+    for (auto _ : state) {
+        SwsContext* sws_ctx = sws_getContext(frame->width, frame->height,
+                AV_PIX_FMT_YUV420P, frame->width, frame->height,
+                AV_PIX_FMT_RGB24, SWS_BICUBIC, nullptr, nullptr, nullptr);
+        cv::Mat image(frame->height, frame->width, CV_8UC3);
+        uint8_t* dst_data[] = {image.data};
+        int dst_linesize[] = {static_cast<int>(image.step[0])};
+
+        sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height,
+                dst_data, dst_linesize);
+        sws_freeContext(sws_ctx);
+        benchmark::DoNotOptimize(image.data);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SwsScale_ContextPerFrame)->Args({480, 640})->Args({1080, 1920})
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_SwsScale_FrameConverter(benchmark::State& state) {
+    FramePtr frame = SyntheticFrame(state.range(1), state.range(0), 0);
+    FrameConverter converter;
+
+    for (auto _ : state) {
+        /* Buffer goes back to the pool at the end of iteration. */
+        std::shared_ptr<FrameBuffer> buffer = converter.Convert(frame.get());
+        benchmark::DoNotOptimize(buffer->image.data);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SwsScale_FrameConverter)->Args({480, 640})->Args({1080, 1920})
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_PredictBatch(benchmark::State& state) {
+    const int batch_size = state.range(0);
+    DetectionModel& model = Model();
+    std::vector<Tensor> images;
+    std::vector<std::vector<Detection>> detections;
+
+    for (int i = 0; i < batch_size; ++i) {
+        Tensor tensor;
+        TF_CHECK_OK(MatToTensor(RandomImage(480, 640), tensor));
+        images.push_back(tensor);
+    }
+
+    for (auto _ : state) {
+        model.PredictBatch(images, detections);
+        benchmark::DoNotOptimize(detections.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+BENCHMARK(BM_PredictBatch)->Arg(1)->Arg(2)->Arg(4)->Arg(8)
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_EndToEnd_Jpeg(benchmark::State& state) {
+    DetectionModel& model = Model();
+    std::vector<std::string> paths;
+    glob_t matches;
+
+    if (glob(BENCHMARK_IMAGES_DIR "/*.jpg", 0, nullptr, &matches) == 0) {
+        paths.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+    }
+    globfree(&matches);
+
+    if (paths.empty()) {
+        state.SkipWithError("No images in " BENCHMARK_IMAGES_DIR);
+        return;
+    }
+
+    for (auto _ : state) {
+        for (const auto& path : paths) {
+            benchmark::DoNotOptimize(model.Testing(path));
+        }
+    }
+
+    state.counters["fps"] = benchmark::Counter(
+            static_cast<double>(state.iterations() * paths.size()),
+            benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_EndToEnd_Jpeg)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_EndToEnd_JpegArchive(benchmark::State& state) {
+    DetectionModel& model = Model();
+    std::vector<std::string> temp_dirs;
+    std::unique_ptr<ImageArchive> archive;
+    ImageArchiveWriter writer;
+    glob_t matches;
+
+    tensorflow::Env::Default()->GetLocalTempDirectories(&temp_dirs);
+    const std::string path = tensorflow::io::JoinPath(
+            temp_dirs.empty() ? "/tmp" : temp_dirs[0], "benchmark_images.pack");
+
+    Status status = writer.Open(path);
+    if (glob(BENCHMARK_IMAGES_DIR "/*.jpg", 0, nullptr, &matches) == 0) {
+        for (size_t i = 0; status.ok() && i < matches.gl_pathc; ++i) {
+            std::unique_ptr<MappedFile> file;
+
+            status = MappedFile::Open(matches.gl_pathv[i],
+                    MapAccess::SEQUENTIAL, file);
+            if (status.ok()) {
+                status = writer.Add(matches.gl_pathv[i], file->Data());
+            }
+        }
+    }
+    globfree(&matches);
+
+    if (status.ok()) {
+        status = writer.Finish();
+    }
+    if (status.ok()) {
+        status = ImageArchive::Open(path, archive);
+    }
+    if (!status.ok() || archive->Size() == 0) {
+        state.SkipWithError(status.ok() ? "No images in " BENCHMARK_IMAGES_DIR :
+                status.error_message().c_str());
+        return;
+    }
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < archive->Size(); ++i) {
+            benchmark::DoNotOptimize(model.PredictEncoded(archive->Image(i)));
+        }
+    }
+
+    state.counters["fps"] = benchmark::Counter(
+            static_cast<double>(state.iterations() * archive->Size()),
+            benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_EndToEnd_JpegArchive)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+void BM_EndToEnd_SyntheticVideo(benchmark::State& state) {
+    const int frame_count = 48;
+    DetectionModel& model = Model();
+    std::vector<PacketPtr> packets = SyntheticVideo(state.range(1),
+            state.range(0), frame_count);
+    const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_MPEG4);
+    CodecContextPtr decoder(avcodec_alloc_context3(codec));
+    FramePtr frame(av_frame_alloc());
+    FrameConverter converter;
+    std::vector<Tensor> images(1);
+    std::vector<std::vector<Detection>> detections;
+    int64_t frames = 0;
+
+    if (avcodec_open2(decoder.get(), codec, nullptr) < 0) {
+        state.SkipWithError("Failed to open MPEG-4 decoder");
+        return;
+    }
+
+    for (auto _ : state) {
+        for (size_t i = 0; i <= packets.size(); ++i) {
+            /* nullptr after the last packet drains the decoder. */
+            avcodec_send_packet(decoder.get(),
+                    i < packets.size() ? packets[i].get() : nullptr);
+
+            while (avcodec_receive_frame(decoder.get(), frame.get()) == 0) {
+                std::shared_ptr<FrameBuffer> buffer =
+                        converter.Convert(frame.get());
+                images[0] = buffer->tensor;
+                model.PredictBatch(images, detections);
+                ++frames;
+            }
+        }
+        avcodec_flush_buffers(decoder.get());
+    }
+
+    state.counters["fps"] = benchmark::Counter(static_cast<double>(frames),
+            benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_EndToEnd_SyntheticVideo)->Args({480, 640})
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+} // namespace
@@ -0,0 +1,320 @@
+/*
+ * Per-image overhead of preprocessing and postprocessing graphs.
+ *
+ * "PerCall" cases reproduce the old code: a new ClientSession or Session
+ * is created for every image. "Callable" cases build the session once and
+ * run a prepared Session::MakeCallable handle, as Model and DetectionModel
+ * do now. The difference between the two is the per-call graph setup.
+ * "Native" is the C++ top-K used by Model instead of the TopK graph.
+ *
+ * "Preprocess" cases compare the image graph of Model with libjpeg DCT
+ * scaled decoding plus the fused resize, scalar and SIMD.
+ * "Preprocess_MatchesTf" checks that the fused resize gives the same
+ * floats as Cast + ResizeBilinear of TF, any difference fails the run:
+ * the benchmarks binary exits with a non-zero code.
+ * */
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "tensorflow/cc/client/client_session.h"
+#include "tensorflow/cc/framework/scope.h"
+#include "tensorflow/cc/ops/standard_ops.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/public/session.h"
+
+#include "benchmark_checks.h"
+#include "classification_postprocess.h"
+#include "encoded_image.h"
+#include "jpeg_preprocess.h"
+
+#ifndef BENCHMARK_IMAGE
+#define BENCHMARK_IMAGE "images/test1.jpg"
+#endif
+
+using namespace tensorflow;
+
+namespace {
+
+struct ImageGraph {
+    Scope root = Scope::NewRootScope();
+    Output input;
+    Output output;
+
+    ImageGraph() {
+        input = ops::Placeholder(root.WithOpName("input"), DT_STRING);
+        auto file_reader = ops::ReadFile(root.WithOpName("file_reader"), input);
+        auto image_reader = ops::DecodeJpeg(root.WithOpName("image_decoder"),
+                file_reader, ops::DecodeJpeg::Channels(3));
+        auto cast_image = ops::Cast(root.WithOpName("cast"), image_reader,
+                DT_FLOAT);
+        auto dims = ops::ExpandDims(root.WithOpName("dims"), cast_image, 0);
+        output = ops::ResizeBilinear(root.WithOpName("resize"), dims,
+                ops::Const(root.WithOpName("size"), {96, 96}));
+        TF_CHECK_OK(root.status());
+    }
+};
+
+/* Session with one prepared callable from input to output. */
+struct PreparedGraph {
+    std::unique_ptr<Session> session;
+    Session::CallableHandle handle;
+
+    PreparedGraph(const Scope& root, const Output& input, const Output& output) :
+        session(NewSession(SessionOptions())) {
+        GraphDef graph_def;
+        CallableOptions options;
+
+        TF_CHECK_OK(root.ToGraphDef(&graph_def));
+        TF_CHECK_OK(session->Create(graph_def));
+        options.add_feed(input.name());
+        options.add_fetch(output.name());
+        TF_CHECK_OK(session->MakeCallable(options, &handle));
+    }
+
+    ~PreparedGraph() {
+        session->ReleaseCallable(handle);
+    }
+
+    Tensor Run(const Tensor& input) {
+        std::vector<Tensor> outputs;
+        TF_CHECK_OK(session->RunCallable(handle, {input}, &outputs, nullptr));
+        return outputs[0];
+    }
+};
+
+std::string ReadImage() {
+    std::string data;
+    TF_CHECK_OK(ReadFileToString(Env::Default(), BENCHMARK_IMAGE, &data));
+    return data;
+}
+
+Tensor RandomScores(int classes) {
+    Tensor scores(DT_FLOAT, TensorShape({1, classes}));
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<float> distribution(0.f, 1.f);
+    auto flat = scores.flat<float>();
+
+    for (int i = 0; i < classes; ++i) {
+        flat(i) = distribution(generator);
+    }
+
+    return scores;
+}
+
+void BM_DecodeJpeg_ClientSessionPerCall(benchmark::State& state) {
+    ImageGraph graph;
+    std::vector<Tensor> outputs;
+
+    for (auto _ : state) {
+        ClientSession session(graph.root);
+        TF_CHECK_OK(session.Run({{graph.input, BENCHMARK_IMAGE}},
+                {graph.output}, &outputs));
+        benchmark::DoNotOptimize(outputs);
+    }
+}
+BENCHMARK(BM_DecodeJpeg_ClientSessionPerCall)->Unit(benchmark::kMicrosecond);
+
+void BM_DecodeJpeg_Callable(benchmark::State& state) {
+    ImageGraph graph;
+    GraphDef graph_def;
+    CallableOptions options;
+    Session::CallableHandle handle;
+    std::vector<Tensor> outputs;
+    std::unique_ptr<Session> session(NewSession(SessionOptions()));
+
+    TF_CHECK_OK(graph.root.ToGraphDef(&graph_def));
+    TF_CHECK_OK(session->Create(graph_def));
+    options.add_feed(graph.input.name());
+    options.add_fetch(graph.output.name());
+    TF_CHECK_OK(session->MakeCallable(options, &handle));
+
+    Tensor path(DT_STRING, TensorShape());
+    path.scalar<tstring>()() = BENCHMARK_IMAGE;
+
+    for (auto _ : state) {
+        TF_CHECK_OK(session->RunCallable(handle, {path}, &outputs, nullptr));
+        benchmark::DoNotOptimize(outputs);
+    }
+
+    TF_CHECK_OK(session->ReleaseCallable(handle));
+}
+BENCHMARK(BM_DecodeJpeg_Callable)->Unit(benchmark::kMicrosecond);
+
+/* Image graph of Model: encoded bytes to [1, 96, 96, 3] float. */
+void BM_Preprocess_Graph(benchmark::State& state) {
+    const std::string jpeg = ReadImage();
+    Scope root = Scope::NewRootScope();
+    Tensor contents;
+
+    Output input = ops::Placeholder(root.WithOpName("input"), DT_STRING);
+    auto image = ops::DecodeJpeg(root.WithOpName("image_decoder"), input,
+            ops::DecodeJpeg::Channels(3));
+    auto cast_image = ops::Cast(root.WithOpName("cast"), image, DT_FLOAT);
+    auto dims = ops::ExpandDims(root.WithOpName("dims"), cast_image, 0);
+    auto output = ops::ResizeBilinear(root.WithOpName("resize"), dims,
+            ops::Const(root.WithOpName("size"), {96, 96}));
+    TF_CHECK_OK(root.status());
+
+    PreparedGraph graph(root, input, output);
+    TF_CHECK_OK(EncodedToTensor(jpeg, contents));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(graph.Run(contents));
+    }
+}
+BENCHMARK(BM_Preprocess_Graph)->Unit(benchmark::kMicrosecond);
+
+/* Args: kernel (0 - scalar, 1 - SIMD), DCT scaling (0 - off, 1 - on). */
+void BM_Preprocess_Native(benchmark::State& state) {
+    const std::string jpeg = ReadImage();
+    const ResizeKernel kernel = state.range(0) ?
+            ResizeKernel::SIMD : ResizeKernel::SCALAR;
+    JpegPreprocessOptions options;
+    Tensor tensor;
+
+    if (kernel == ResizeKernel::SIMD && !ResizeSimdAvailable()) {
+        state.SkipWithError("No AVX2 or NEON on this CPU");
+        return;
+    }
+
+    options.dct_scaling = state.range(1) != 0;
+    JpegPreprocessor preprocessor(options);
+
+    for (auto _ : state) {
+        TF_CHECK_OK(preprocessor.Run(jpeg, tensor, kernel));
+        benchmark::DoNotOptimize(tensor);
+    }
+}
+BENCHMARK(BM_Preprocess_Native)->Args({0, 0})->Args({0, 1})->Args({1, 0})
+    ->Args({1, 1})->Unit(benchmark::kMicrosecond);
+
+void BM_Preprocess_MatchesTf(benchmark::State& state) {
+    const std::string jpeg = ReadImage();
+    const int size = 96;
+    std::vector<uint8_t> pixels;
+    int height = 0;
+    int width = 0;
+    JpegPreprocessOptions options;
+    std::vector<float> resized(size * size * 3);
+    int64_t mismatches = 0;
+    float max_difference = 0.f;
+
+    TF_CHECK_OK(DecodeJpegScaled(jpeg, 3, 0, 0, pixels, height, width));
+
+    /* TF path on the same decoded pixels, so only resize is compared. */
+    Scope root = Scope::NewRootScope();
+    Output input = ops::Placeholder(root.WithOpName("input"), DT_UINT8);
+    auto cast_image = ops::Cast(root.WithOpName("cast"), input, DT_FLOAT);
+    auto output = ops::ResizeBilinear(root.WithOpName("resize"), cast_image,
+            ops::Const(root.WithOpName("size"), {size, size}));
+    TF_CHECK_OK(root.status());
+
+    PreparedGraph graph(root, input, output);
+    Tensor image(DT_UINT8, TensorShape({1, height, width, 3}));
+    std::copy(pixels.begin(), pixels.begin() + image.NumElements(),
+            image.flat<uint8_t>().data());
+    const Tensor expected = graph.Run(image);
+    const float* expected_data = expected.flat<float>().data();
+
+    for (ResizeKernel kernel : {ResizeKernel::SCALAR, ResizeKernel::SIMD}) {
+        ResizeBilinearFused(pixels.data(), height, width, 3, resized.data(),
+                size, size, options, kernel);
+
+        for (size_t i = 0; i < resized.size(); ++i) {
+            if (resized[i] != expected_data[i]) {
+                ++mismatches;
+                max_difference = std::max(max_difference,
+                        std::abs(resized[i] - expected_data[i]));
+            }
+        }
+    }
+
+    for (auto _ : state) {
+        ResizeBilinearFused(pixels.data(), height, width, 3, resized.data(),
+                size, size, options);
+        benchmark::DoNotOptimize(resized.data());
+    }
+
+    state.counters["mismatches"] = mismatches;
+    state.counters["max_difference"] = max_difference;
+    if (mismatches > 0) {
+        FailCheck(state, "Fused resize differs from TF ResizeBilinear");
+    }
+}
+BENCHMARK(BM_Preprocess_MatchesTf)->Unit(benchmark::kMicrosecond);
+
+void BM_TopK_SessionPerCall(benchmark::State& state) {
+    const int classes = state.range(0);
+    Tensor scores = RandomScores(classes);
+    std::vector<Tensor> outputs;
+
+    for (auto _ : state) {
+        GraphDef graph;
+        std::unique_ptr<Session> session(NewSession(SessionOptions()));
+        auto tmp_root = Scope::NewRootScope();
+
+        ops::TopK(tmp_root.WithOpName("top_k"), scores, classes);
+
+        TF_CHECK_OK(tmp_root.ToGraphDef(&graph));
+        TF_CHECK_OK(session->Create(graph));
+        TF_CHECK_OK(session->Run({}, {"top_k:0", "top_k:1"}, {}, &outputs));
+        benchmark::DoNotOptimize(outputs);
+    }
+}
+BENCHMARK(BM_TopK_SessionPerCall)->Arg(10)->Arg(1000)->Arg(10000)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_TopK_Callable(benchmark::State& state) {
+    const int classes = state.range(0);
+    Tensor scores = RandomScores(classes);
+    Scope root = Scope::NewRootScope();
+    GraphDef graph;
+    CallableOptions options;
+    Session::CallableHandle handle;
+    std::vector<Tensor> outputs;
+    std::unique_ptr<Session> session(NewSession(SessionOptions()));
+
+    Output input = ops::Placeholder(root.WithOpName("top_k_input"), DT_FLOAT);
+    auto top_k = ops::TopK(root.WithOpName("top_k"), input,
+            ops::Const(root.WithOpName("top_k_size"), classes));
+
+    TF_CHECK_OK(root.ToGraphDef(&graph));
+    TF_CHECK_OK(session->Create(graph));
+    options.add_feed(input.name());
+    options.add_fetch(top_k.values.name());
+    options.add_fetch(top_k.indices.name());
+    TF_CHECK_OK(session->MakeCallable(options, &handle));
+
+    for (auto _ : state) {
+        TF_CHECK_OK(session->RunCallable(handle, {scores}, &outputs, nullptr));
+        benchmark::DoNotOptimize(outputs);
+    }
+
+    TF_CHECK_OK(session->ReleaseCallable(handle));
+}
+BENCHMARK(BM_TopK_Callable)->Arg(10)->Arg(1000)->Arg(10000)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_TopK_Native(benchmark::State& state) {
+    const int classes = state.range(0);
+    const int k = state.range(1);
+    Tensor scores = RandomScores(classes);
+    std::vector<ScoredLabel> top_labels;
+
+    for (auto _ : state) {
+        TopK(scores.flat<float>().data(), classes, k, top_labels);
+        benchmark::DoNotOptimize(top_labels.data());
+    }
+}
+BENCHMARK(BM_TopK_Native)->Args({10, 1})->Args({1000, 1})->Args({10000, 1})
+    ->Args({10, 5})->Args({1000, 5})->Args({10000, 5})->Args({10000, 10000})
+    ->Unit(benchmark::kMicrosecond);
+
+} // namespace
@@ -0,0 +1,110 @@
+#include "tiny_saved_model.h"
+
+#include <random>
+#include <vector>
+
+#include "tensorflow/cc/framework/scope.h"
+#include "tensorflow/cc/ops/standard_ops.h"
+#include "tensorflow/cc/saved_model/constants.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/protobuf/saved_model.pb.h"
+
+using namespace tensorflow;
+
+/* Weights in [-1, 1), the same for every run. */
+static
+Tensor random_weights(std::mt19937& generator, int64 rows, int64 cols) {
+    Tensor weights(DT_FLOAT, TensorShape({rows, cols}));
+    std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+    auto flat = weights.flat<float>();
+
+    for (int64 i = 0; i < flat.size(); ++i) {
+        flat(i) = distribution(generator);
+    }
+
+    return weights;
+}
+
+static
+void add_tensor_info(google::protobuf::Map<std::string, TensorInfo>* infos,
+        const std::string& key, const std::string& name, DataType dtype) {
+    TensorInfo& info = (*infos)[key];
+    info.set_name(name);
+    info.set_dtype(dtype);
+}
+
+Status WriteTinyDetectionModel(const std::string& export_dir,
+        int max_detections) {
+    using namespace tensorflow::ops;
+
+    const int features = 8;
+    std::mt19937 generator(42);
+    Scope root = Scope::NewRootScope();
+
+    /* Small conv net on a 64x64 copy of the image, so the cost still
+     * grows with batch size and input resolution (resize).
+     * */
+    auto input = Placeholder(root.WithOpName("serving_default_input_tensor"),
+            DT_UINT8, Placeholder::Shape(PartialTensorShape({-1, -1, -1, 3})));
+    auto image = Multiply(root, Cast(root, input, DT_FLOAT), 1.f / 255.f);
+    auto resized = ResizeBilinear(root, image, Const(root, {64, 64}));
+
+    Tensor filter;
+    if (!filter.CopyFrom(random_weights(generator, 3 * 3 * 3, features),
+            TensorShape({3, 3, 3, features}))) {
+        return errors::Internal("Can't reshape conv filter");
+    }
+    auto conv = Relu(root, Conv2D(root, resized, Const(root, filter),
+            {1, 2, 2, 1}, "SAME"));
+    auto pooled = Mean(root, conv, {1, 2});
+
+    auto boxes = Reshape(root, Sigmoid(root, MatMul(root, pooled,
+            Const(root, random_weights(generator, features,
+                    max_detections * 4)))), {-1, max_detections, 4});
+    auto scores = Sigmoid(root, MatMul(root, pooled,
+            Const(root, random_weights(generator, features, max_detections))));
+    auto classes = Add(root, Floor(root, Multiply(root, scores, 90.f)), 1.f);
+    auto multiclass_scores = Reshape(root, Sigmoid(root, MatMul(root, pooled,
+            Const(root, random_weights(generator, features,
+                    max_detections * 2)))), {-1, max_detections, 2});
+    auto anchor_indices = ZerosLike(root, scores);
+    auto num_detections = Sum(root, OnesLike(root, scores), 1);
+
+    /* One node with six outputs gives the "StatefulPartitionedCall:i"
+     * names of a TF2 exported detection model.
+     * */
+    IdentityN(root.WithOpName("StatefulPartitionedCall"), {
+            anchor_indices, boxes, classes, multiclass_scores, scores,
+            num_detections});
+
+    SavedModel saved_model;
+    saved_model.set_saved_model_schema_version(1);
+
+    MetaGraphDef* meta_graph = saved_model.add_meta_graphs();
+    TF_RETURN_IF_ERROR(root.ToGraphDef(meta_graph->mutable_graph_def()));
+
+    SignatureDef& signature = (*meta_graph->mutable_signature_def())[
+            "serving_default"];
+    signature.set_method_name("tensorflow/serving/predict");
+    add_tensor_info(signature.mutable_inputs(), "input_tensor",
+            "serving_default_input_tensor:0", DT_UINT8);
+
+    const std::vector<std::string> output_keys = {
+        "detection_anchor_indices",
+        "detection_boxes",
+        "detection_classes",
+        "detection_multiclass_scores",
+        "detection_scores",
+        "num_detections",
+    };
+    for (size_t i = 0; i < output_keys.size(); ++i) {
+        add_tensor_info(signature.mutable_outputs(), output_keys[i],
+                "StatefulPartitionedCall:" + std::to_string(i), DT_FLOAT);
+    }
+
+    TF_RETURN_IF_ERROR(Env::Default()->RecursivelyCreateDir(export_dir));
+
+    return WriteBinaryProto(Env::Default(),
+            io::JoinPath(export_dir, kSavedModelFilenamePb), saved_model);
+}
@@ -0,0 +1,20 @@
+#ifndef __TINY_SAVED_MODEL_H__
+#define __TINY_SAVED_MODEL_H__
+
+#include <string>
+
+#include "tensorflow/core/lib/core/status.h"
+
+/* Write a tiny detection SavedModel to export_dir.
+ *
+ * It has the interface DetectionModel expects: uint8 [N, H, W, 3] fed to
+ * "serving_default_input_tensor:0" and six float outputs
+ * "StatefulPartitionedCall:0..5" with max_detections detections per
+ * image. Weights are constants, so there is no variables directory and
+ * the model loads without a checkpoint. Meta graph has no tags, the same
+ * as the models DetectionModel is written for.
+ * */
+tensorflow::Status WriteTinyDetectionModel(const std::string& export_dir,
+        int max_detections = 100);
+
+#endif /* __TINY_SAVED_MODEL_H__ */
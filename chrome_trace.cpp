@@ -0,0 +1,60 @@
+#include "chrome_trace.h"
+
+#include <sstream>
+
+/* Node and device names come from the graph, escape them anyway. */
+static
+std::string escape_json(const std::string& value) {
+    std::string result;
+
+    result.reserve(value.size());
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+            result.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            result.push_back(' ');
+        } else {
+            result.push_back(c);
+        }
+    }
+
+    return result;
+}
+
+std::string StepStatsToChromeTrace(const tensorflow::StepStats& step_stats) {
+    std::ostringstream os;
+    bool first = true;
+
+    os << "{\"traceEvents\":[";
+
+    for (int pid = 0; pid < step_stats.dev_stats_size(); ++pid) {
+        const auto& device = step_stats.dev_stats(pid);
+
+        os << (first ? "" : ",")
+           << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+           << ",\"args\":{\"name\":\"" << escape_json(device.device())
+           << "\"}}";
+        first = false;
+
+        for (const auto& node : device.node_stats()) {
+            /* Ops that finished within the same microsecond still
+             * get a visible slice.
+             * */
+            const int64_t duration = node.all_end_rel_micros() > 0 ?
+                    node.all_end_rel_micros() : 1;
+
+            os << ",{\"name\":\"" << escape_json(node.node_name())
+               << "\",\"cat\":\"Op\",\"ph\":\"X\",\"pid\":" << pid
+               << ",\"tid\":" << node.thread_id()
+               << ",\"ts\":" << node.all_start_micros()
+               << ",\"dur\":" << duration
+               << ",\"args\":{\"label\":\"" << escape_json(node.timeline_label())
+               << "\"}}";
+        }
+    }
+
+    os << "],\"displayTimeUnit\":\"ms\"}\n";
+
+    return os.str();
+}
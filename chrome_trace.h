@@ -0,0 +1,14 @@
+#ifndef __CHROME_TRACE_H__
+#define __CHROME_TRACE_H__
+
+#include <string>
+
+#include "tensorflow/core/framework/step_stats.pb.h"
+
+/* Convert step stats of RunMetadata to Chrome trace event JSON,
+ * loadable by chrome://tracing or Perfetto.
+ * Every device is a process, every executor thread a thread of it.
+ * */
+std::string StepStatsToChromeTrace(const tensorflow::StepStats& step_stats);
+
+#endif /* __CHROME_TRACE_H__ */
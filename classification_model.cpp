@@ -0,0 +1,409 @@
+#include "classification_model.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "tensorflow/core/platform/hash.h"
+
+/* View of a [1, H, W, C] float input as an image. */
+static
+cv::Mat tensor_image(const Tensor& tensor) {
+    return cv::Mat(tensor.dim_size(1), tensor.dim_size(2),
+            CV_32FC(tensor.dim_size(3)),
+            const_cast<float*>(tensor.flat<float>().data()));
+}
+
+ClassificationModel::ClassificationModel(const std::string& model_path,
+        const std::string& file_labels, const std::string& input_layer,
+        const std::string& output_layer, size_t top_k, bool native_preprocess,
+        const ModelConfig& config)
+        : _root(Scope::NewRootScope()),  _input_layer(input_layer),
+        _output_layer(output_layer), _top_k(top_k) {
+    /* SessionOption - configuration information for a Session.
+     * export_dir - the path of directory.
+     * tags("serve" by default) - used at SavedModel build time.
+     * Bundle - model bundle.
+     * */
+    _config = config;
+    auto status = ResolveModelPath(model_path, config, _export_dir);
+    if (status.ok()) {
+        status = ApplyModelConfig(config, _session_options);
+    }
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    status = LoadSavedModelCached(_session_options, _run_options,
+            _export_dir, config, &_bundle);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+    LogModelConfig(config, _session_options);
+
+    status = ReadLabelsFile(file_labels);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    status = CreateGraphForImage();
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    status = CreateCallables();
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    _native_preprocess = native_preprocess;
+    _preprocessor = NewPreprocessor();
+}
+
+ClassificationModel::~ClassificationModel() {
+    if (_cache) {
+        auto status = _cache->Save();
+        if (!status.ok()) {
+            LOG(ERROR) << status.ToString();
+        }
+    }
+    if (_session) {
+        _session->ReleaseCallable(_image_callable);
+        _session->Close();
+    }
+    _bundle.GetSession()->ReleaseCallable(_predict_callable);
+}
+
+void ClassificationModel::SetResultCache(const CacheOptions& options) {
+    using namespace tensorflow;
+
+    std::ostringstream settings;
+    uint64_t key = 0;
+
+    if (options.capacity == 0) {
+        _cache.reset();
+        return;
+    }
+
+    auto status = ModelCacheKey(_export_dir, _config, key);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    settings << _input_layer << "," << _output_layer << "," << _top_k << ","
+             << _native_preprocess << "," << _labels.size();
+    key = Hash64Combine(key, Hash64(settings.str()));
+
+    _cache.reset(new ResultCache(options, key));
+
+    /* A broken file only costs the results it held. */
+    status = _cache->Load();
+    if (!status.ok()) {
+        LOG(WARNING) << "Result cache file not fully loaded: "
+                     << status.ToString();
+    }
+}
+
+CacheKey ClassificationModel::ImageCacheKey(const Tensor& image) const {
+    return PixelCacheKey(tensor_image(image),
+            _cache->NearEnabled() && image.dim_size(3) == 3);
+}
+
+Status ClassificationModel::ReadLabelsFile(const std::string& file_name) {
+    using namespace tensorflow;
+
+    if (!_labels.Load(file_name)) {
+        return errors::NotFound("Labels file ", file_name, " not found.");
+    }
+
+    return Status::OK();
+}
+
+Status ClassificationModel::CreateGraphForImage() {
+    using namespace tensorflow;
+
+    /* Add receiving encoded image, files are mapped by the caller
+     * Return tensorflow::Output
+     * */
+    _input_of_graph = ops::Placeholder(_root.WithOpName("input"), DT_STRING);
+
+    /* Receive Jpeg file
+     * Return tensorflow::Output
+     * */
+    auto image_reader = ops::DecodeJpeg(_root.WithOpName("image_decoder"),
+            _input_of_graph, ops::DecodeJpeg::Channels(_image_channels));
+
+    /* Casting data to float type
+     * Return tensorflow::Output
+     * */
+    auto cast_image = ops::Cast(_root.WithOpName("cast"), image_reader,
+            DT_FLOAT);
+
+    /* Add number of banch
+     * (height, width, channels) -> (banch, height, width, channels)
+     * Return tensorflow::Output
+     * */
+    auto dims = ops::ExpandDims(_root.WithOpName("dims"),
+            cast_image, _expand_dims_axis);
+
+    /* Resize images
+     * Return tensorflow::Output
+     * */
+    _output_of_graph = ops::ResizeBilinear(_root.WithOpName("resize"), dims,
+            ops::Const(_root.WithOpName("size"), {_input_height, _input_width}));
+
+    /* Delete datas on convert_data_value
+     * Return tensorflow::Output
+     * Normalized isn't used because rescaling is used in graph of model.
+     * */
+    /* _output_of_graph = Div(_root.WithOpName("div"), resize, */
+    /*         {_convert_data_value}); */
+
+    return _root.status();
+}
+
+Status ClassificationModel::CreateCallables() {
+    using namespace tensorflow;
+
+    GraphDef graph;
+    CallableOptions image_options;
+    CallableOptions predict_options;
+
+    TF_RETURN_IF_ERROR(_root.ToGraphDef(&graph));
+    _session.reset(NewSession(_session_options));
+    TF_RETURN_IF_ERROR(_session->Create(graph));
+
+    image_options.add_feed(_input_of_graph.name());
+    image_options.add_fetch(_output_of_graph.name());
+    TF_RETURN_IF_ERROR(_session->MakeCallable(image_options, &_image_callable));
+
+    predict_options.add_feed(_input_layer);
+    predict_options.add_fetch(_output_layer);
+
+    return _bundle.GetSession()->MakeCallable(predict_options,
+            &_predict_callable);
+}
+
+std::unique_ptr<JpegPreprocessor>
+ClassificationModel::NewPreprocessor() const {
+    JpegPreprocessOptions options;
+
+    if (!_native_preprocess) {
+        return nullptr;
+    }
+
+    options.height = _input_height;
+    options.width = _input_width;
+    options.channels = _image_channels;
+
+    return std::unique_ptr<JpegPreprocessor>(new JpegPreprocessor(options));
+}
+
+Status ClassificationModel::ReadImageToTensor(tensorflow::StringPiece jpeg,
+        Tensor& out_tensor) {
+    return Preprocess(jpeg, out_tensor, _preprocessor.get());
+}
+
+Status ClassificationModel::Preprocess(tensorflow::StringPiece jpeg,
+        Tensor& out_tensor, JpegPreprocessor* preprocessor) {
+    using namespace tensorflow;
+
+    std::vector<Tensor> out_tensors;
+    Tensor contents;
+
+    if (preprocessor != nullptr) {
+        return preprocessor->Run(jpeg, out_tensor);
+    }
+
+    /* Callable of the image graph is shared, RunCallable is thread safe. */
+    TF_RETURN_IF_ERROR(EncodedToTensor(jpeg, contents));
+    TF_RETURN_IF_ERROR(_session->RunCallable(_image_callable, {contents},
+            &out_tensors, nullptr));
+
+    out_tensor = out_tensors[0]; // shallow copy
+
+    return Status::OK();
+}
+
+std::tuple<int32_t, float> ClassificationModel::Testing(
+        const std::string& file_path) {
+    std::unique_ptr<MappedFile> file;
+
+    auto status = MappedFile::Open(file_path, MapAccess::SEQUENTIAL, file);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    return TestingEncoded(file->Data());
+}
+
+std::tuple<int32_t, float> ClassificationModel::TestingEncoded(
+        tensorflow::StringPiece jpeg) {
+    Tensor out_tensor;
+    std::vector<Tensor> outputs;
+    std::vector<ScoredLabel> top_labels;
+    CacheKey key;
+    std::string cached;
+
+    /* Same bytes are answered before decoding. */
+    if (_cache) {
+        key = EncodedCacheKey(jpeg);
+        if (_cache->Find(key, cached) && UnpackValues(cached, top_labels) &&
+            !top_labels.empty()) {
+            PrintTopLabels(top_labels);
+            return std::make_tuple(top_labels[0].index, top_labels[0].score);
+        }
+    }
+
+    auto status = ReadImageToTensor(jpeg, out_tensor);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    if (_cache) {
+        const CacheKey pixels = ImageCacheKey(out_tensor);
+
+        key.dhash = pixels.dhash;
+        key.has_dhash = pixels.has_dhash;
+        if (_cache->Lookup(key, cached) && UnpackValues(cached, top_labels) &&
+            !top_labels.empty()) {
+            PrintTopLabels(top_labels);
+            return std::make_tuple(top_labels[0].index, top_labels[0].score);
+        }
+    }
+
+    status = _bundle.GetSession()->RunCallable(_predict_callable,
+            {out_tensor}, &outputs, nullptr);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    status = GetTopLabels(outputs, top_labels);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    if (_cache) {
+        _cache->Insert(key, PackValues(top_labels));
+    }
+
+    PrintTopLabels(top_labels);
+
+    return std::make_tuple(top_labels[0].index, top_labels[0].score);
+}
+
+Status ClassificationModel::PredictBatch(const std::vector<Tensor>& images,
+        std::vector<std::vector<ScoredLabel>>& top_labels) {
+    std::vector<CacheKey> keys;
+    std::vector<size_t> misses;
+    std::vector<Tensor> missed;
+    std::vector<std::vector<ScoredLabel>> results;
+    std::string cached;
+
+    if (!_cache) {
+        return RunBatch(images, top_labels);
+    }
+
+    /* Only images without cached results are run, as one smaller batch. */
+    top_labels.assign(images.size(), std::vector<ScoredLabel>());
+    for (size_t i = 0; i < images.size(); ++i) {
+        keys.push_back(ImageCacheKey(images[i]));
+        if (!_cache->Lookup(keys[i], cached) ||
+            !UnpackValues(cached, top_labels[i]) || top_labels[i].empty()) {
+            misses.push_back(i);
+            missed.push_back(images[i]);
+        }
+    }
+    if (missed.empty()) {
+        return Status::OK();
+    }
+
+    TF_RETURN_IF_ERROR(RunBatch(missed, results));
+
+    for (size_t i = 0; i < misses.size(); ++i) {
+        _cache->Insert(keys[misses[i]], PackValues(results[i]));
+        top_labels[misses[i]] = std::move(results[i]);
+    }
+
+    return Status::OK();
+}
+
+Status ClassificationModel::RunBatch(const std::vector<Tensor>& images,
+        std::vector<std::vector<ScoredLabel>>& top_labels) {
+    using namespace tensorflow;
+
+    const int64 count = static_cast<int64>(images.size());
+    const int64 image_size = static_cast<int64>(_input_height) *
+            _input_width * _image_channels;
+    std::vector<Tensor> outputs;
+    Tensor batch;
+
+    top_labels.resize(images.size());
+    if (images.empty()) {
+        return Status::OK();
+    }
+
+    /* Single image is fed as is, others are packed into one tensor. */
+    if (count == 1) {
+        batch = images[0];
+    } else {
+        batch = Tensor(DT_FLOAT, TensorShape({count, _input_height,
+                _input_width, _image_channels}));
+        float* data = batch.flat<float>().data();
+
+        for (int64 i = 0; i < count; ++i) {
+            if (images[i].NumElements() != image_size) {
+                return errors::InvalidArgument("Image ", i, " has shape ",
+                        images[i].shape().DebugString());
+            }
+            std::copy_n(images[i].flat<float>().data(), image_size,
+                    data + i * image_size);
+        }
+    }
+
+    TF_RETURN_IF_ERROR(_bundle.GetSession()->RunCallable(_predict_callable,
+            {batch}, &outputs, nullptr));
+
+    for (int64 i = 0; i < count; ++i) {
+        TF_RETURN_IF_ERROR(GetTopLabels(outputs, top_labels[i], i));
+    }
+
+    return Status::OK();
+}
+
+Status ClassificationModel::GetTopLabels(const std::vector<Tensor>& inputs,
+        std::vector<ScoredLabel>& top_labels, int64_t row) {
+    using namespace tensorflow;
+
+    if (inputs.size() == 0) {
+        return errors::NotFound("No found output from model");
+    }
+
+    /* Scores of the row-th image in batch */
+    const Tensor& scores = inputs[0];
+    const int64 classes = scores.dim_size(scores.dims() - 1);
+
+    if (classes != static_cast<int64>(_labels.size())) {
+        return errors::InvalidArgument("Model has ", classes,
+                " classes, labels file has ", _labels.size());
+    }
+    if (row >= scores.NumElements() / std::max<int64>(classes, 1)) {
+        return errors::NotFound("No found scores of image ", row);
+    }
+
+    TopK(scores.flat<float>().data() + row * classes, classes, _top_k,
+            top_labels);
+
+    if (top_labels.empty()) {
+        return errors::NotFound("No found result from top_k");
+    }
+
+    return Status::OK();
+}
+
+void ClassificationModel::PrintTopLabels(
+        const std::vector<ScoredLabel>& top_labels) {
+    for (const auto& label : top_labels) {
+        LOG(INFO) << _labels[label.index] << " (" << label.index << "): "
+                  << label.score;
+    }
+}
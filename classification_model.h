@@ -0,0 +1,144 @@
+#ifndef __CLASSIFICATION_MODEL_H__
+#define __CLASSIFICATION_MODEL_H__
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "tensorflow/cc/framework/scope.h"
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/core/public/session.h"
+#include "tensorflow/cc/client/client_session.h"
+#include "tensorflow/cc/ops/standard_ops.h"
+
+#include "classification_postprocess.h"
+#include "encoded_image.h"
+#include "jpeg_preprocess.h"
+#include "model_config.h"
+#include "model_startup.h"
+#include "result_cache.h"
+
+using tensorflow::Status;
+using tensorflow::Tensor;
+using tensorflow::Scope;
+using tensorflow::GraphDef;
+using tensorflow::Output;
+using tensorflow::SessionOptions;
+using tensorflow::ClientSession;
+using tensorflow::Session;
+using tensorflow::RunOptions;
+using tensorflow::SavedModelBundle;
+
+class ClassificationModel {
+private: /* Variables */
+    /* scope for graph */
+    Scope _root;
+
+    /* Layers in model */
+    std::string _input_layer;
+    std::string _output_layer;
+
+    /* Labels, stored in one buffer */
+    LabelArena _labels;
+
+    /* Count of best labels to print */
+    size_t _top_k;
+
+    /* Read SavedModel type */
+    SessionOptions _session_options;
+    RunOptions _run_options;
+    SavedModelBundle _bundle;
+
+    /* Variables for graph */
+    Output _input_of_graph;
+    Output _output_of_graph;
+
+    /* Native decode and fused resize instead of the image graph */
+    bool _native_preprocess = false;
+    std::unique_ptr<JpegPreprocessor> _preprocessor;
+
+    /* Loaded SavedModel and its settings, identify cached results */
+    std::string _export_dir;
+    ModelConfig _config;
+    std::unique_ptr<ResultCache> _cache;
+
+    /* Session for graphs of _root, created once */
+    std::unique_ptr<Session> _session;
+    Session::CallableHandle _image_callable;
+    Session::CallableHandle _predict_callable;
+
+    int _image_channels = 3; // RGB - 3, Gray - 2
+    int _expand_dims_axis = 0; // Index for inserting
+    int _input_height = 96;
+    int _input_width = 96;
+    float _convert_data_value = 255.f;
+
+private: /* Functions */
+    Status ReadLabelsFile(const std::string& file_name);
+    Status CreateGraphForImage();
+    Status CreateCallables();
+    Status ReadImageToTensor(tensorflow::StringPiece jpeg, Tensor& out_tensor);
+    Status GetTopLabels(const std::vector<Tensor>& outputs,
+            std::vector<ScoredLabel>& top_labels, int64_t row = 0);
+    void PrintTopLabels(const std::vector<ScoredLabel>& top_labels);
+    Status RunBatch(const std::vector<Tensor>& images,
+            std::vector<std::vector<ScoredLabel>>& top_labels);
+    CacheKey ImageCacheKey(const Tensor& image) const;
+
+public:
+    /* Read only SavedModel type.
+     * Have 2 folders, "assets" and "variables", and one file "save_model.pb".
+     * native_preprocess - decode with libjpeg DCT scaling and resize with
+     * one fused pass instead of the DecodeJpeg ... ResizeBilinear graph.
+     * config - tags, threads and graph optimizations used to load.
+     * */
+    ClassificationModel(const std::string& model_path,
+            const std::string& file_labels, const std::string& input_layer,
+            const std::string& output_layer, size_t top_k = 5,
+            bool native_preprocess = false,
+            const ModelConfig& config = ModelConfig());
+    ~ClassificationModel();
+
+    ClassificationModel(const ClassificationModel&) = delete;
+    ClassificationModel& operator=(const ClassificationModel&) = delete;
+
+    /* JPEG file is mapped and decoded from the mapping. */
+    std::tuple<int32_t, float> Testing(const std::string& file_path);
+
+    /* JPEG bytes from memory or an ImageArchive entry, not copied. */
+    std::tuple<int32_t, float> TestingEncoded(tensorflow::StringPiece jpeg);
+
+    size_t TopKCount() const { return _top_k; }
+
+    /* Answer repeated images and, with near_distance, near-duplicates
+     * from a result cache. Entries of options.file are loaded now and
+     * saved when the model is destroyed.
+     * */
+    void SetResultCache(const CacheOptions& options);
+
+    /* Empty for indices past the end of the labels file. */
+    const char* Label(int32_t index) const {
+        return index >= 0 && static_cast<size_t>(index) < _labels.size() ?
+            _labels[index] : "";
+    }
+
+    /* Preprocessor for one decoding thread,
+     * nullptr when the image graph is used.
+     * */
+    std::unique_ptr<JpegPreprocessor> NewPreprocessor() const;
+
+    /* JPEG bytes -> [1, H, W, C] float input. Safe to call from several
+     * threads, each with its own preprocessor from NewPreprocessor.
+     * */
+    Status Preprocess(tensorflow::StringPiece jpeg, Tensor& image,
+            JpegPreprocessor* preprocessor);
+
+    /* Classify [1, H, W, C] inputs in one Session::Run,
+     * top_labels[i] holds the best labels of images[i].
+     * */
+    Status PredictBatch(const std::vector<Tensor>& images,
+            std::vector<std::vector<ScoredLabel>>& top_labels);
+};
+
+#endif /* __CLASSIFICATION_MODEL_H__ */
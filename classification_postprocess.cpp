@@ -0,0 +1,143 @@
+#include "classification_postprocess.h"
+
+#include <algorithm>
+#include <fstream>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+bool LabelArena::Load(const std::string& file_name) {
+    std::string line;
+    std::ifstream file(file_name);
+
+    if (!file) {
+        return false;
+    }
+
+    _data.clear();
+    _offsets.clear();
+
+    while (std::getline(file, line)) {
+        _offsets.push_back(static_cast<uint32_t>(_data.size()));
+        _data.append(line);
+        _data.push_back('\0');
+    }
+
+    _data.shrink_to_fit();
+    _offsets.shrink_to_fit();
+
+    return true;
+}
+
+/* Maximum value of scores, count must be positive. */
+static
+float max_value(const float* scores, size_t count) {
+    size_t pos = 0;
+    float result = scores[0];
+
+#if defined(__AVX__)
+    if (count >= 8) {
+        __m256 max8 = _mm256_loadu_ps(scores);
+        for (pos = 8; pos + 8 <= count; pos += 8) {
+            max8 = _mm256_max_ps(max8, _mm256_loadu_ps(scores + pos));
+        }
+
+        __m128 max4 = _mm_max_ps(_mm256_castps256_ps128(max8),
+                _mm256_extractf128_ps(max8, 1));
+        max4 = _mm_max_ps(max4, _mm_movehl_ps(max4, max4));
+        max4 = _mm_max_ss(max4, _mm_shuffle_ps(max4, max4, 1));
+        result = _mm_cvtss_f32(max4);
+    }
+#elif defined(__SSE2__)
+    if (count >= 4) {
+        __m128 max4 = _mm_loadu_ps(scores);
+        for (pos = 4; pos + 4 <= count; pos += 4) {
+            max4 = _mm_max_ps(max4, _mm_loadu_ps(scores + pos));
+        }
+
+        max4 = _mm_max_ps(max4, _mm_movehl_ps(max4, max4));
+        max4 = _mm_max_ss(max4, _mm_shuffle_ps(max4, max4, 1));
+        result = _mm_cvtss_f32(max4);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    if (count >= 4) {
+        float32x4_t max4 = vld1q_f32(scores);
+        for (pos = 4; pos + 4 <= count; pos += 4) {
+            max4 = vmaxq_f32(max4, vld1q_f32(scores + pos));
+        }
+
+        result = vmaxvq_f32(max4);
+    }
+#endif
+
+    /* Tail, or everything for scalar build. */
+    for (; pos < count; ++pos) {
+        result = std::max(result, scores[pos]);
+    }
+
+    return result;
+}
+
+int32_t ArgMax(const float* scores, size_t count) {
+    if (count == 0) {
+        return -1;
+    }
+
+    const float max = max_value(scores, count);
+
+    for (size_t pos = 0; pos < count; ++pos) {
+        if (scores[pos] == max) {
+            return static_cast<int32_t>(pos);
+        }
+    }
+
+    return 0; // All scores are NaN
+}
+
+static
+bool higher_score(const ScoredLabel& left, const ScoredLabel& right) {
+    if (left.score != right.score) {
+        return left.score > right.score;
+    }
+    return left.index < right.index;
+}
+
+void TopK(const float* scores, size_t count, size_t k,
+        std::vector<ScoredLabel>& result) {
+    result.clear();
+    k = std::min(k, count);
+
+    if (k == 0) {
+        return;
+    }
+
+    if (k == 1) {
+        const int32_t index = ArgMax(scores, count);
+        result.push_back({index, scores[index]});
+        return;
+    }
+
+    /* Min-heap of the k best scores seen so far,
+     * front is the worst of them and the first to be replaced.
+     * */
+    result.reserve(k);
+    for (size_t pos = 0; pos < k; ++pos) {
+        result.push_back({static_cast<int32_t>(pos), scores[pos]});
+    }
+    std::make_heap(result.begin(), result.end(), higher_score);
+
+    for (size_t pos = k; pos < count; ++pos) {
+        const ScoredLabel candidate = {static_cast<int32_t>(pos), scores[pos]};
+
+        if (higher_score(candidate, result.front())) {
+            std::pop_heap(result.begin(), result.end(), higher_score);
+            result.back() = candidate;
+            std::push_heap(result.begin(), result.end(), higher_score);
+        }
+    }
+
+    std::sort_heap(result.begin(), result.end(), higher_score);
+}
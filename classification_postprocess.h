@@ -0,0 +1,45 @@
+#ifndef __CLASSIFICATION_POSTPROCESS_H__
+#define __CLASSIFICATION_POSTPROCESS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* All labels in one contiguous buffer.
+ * Every label is stored null terminated, offsets point to its first char.
+ * */
+class LabelArena {
+private:
+    std::string _data;
+    std::vector<uint32_t> _offsets;
+
+public:
+    /* One label per line. Returns false if file can't be opened. */
+    bool Load(const std::string& file_name);
+
+    size_t size() const { return _offsets.size(); }
+    bool empty() const { return _offsets.empty(); }
+
+    const char* operator[](size_t index) const {
+        return _data.data() + _offsets[index];
+    }
+};
+
+struct ScoredLabel {
+    int32_t index;
+    float score;
+};
+
+/* Index of the highest score, first one on ties.
+ * Vectorized with AVX/SSE2/NEON when available.
+ * */
+int32_t ArgMax(const float* scores, size_t count);
+
+/* k highest scores sorted by descending score.
+ * Partial selection, O(count * log k), k == 1 uses ArgMax.
+ * */
+void TopK(const float* scores, size_t count, size_t k,
+        std::vector<ScoredLabel>& result);
+
+#endif /* __CLASSIFICATION_POSTPROCESS_H__ */
@@ -0,0 +1,251 @@
+/*
+ * Runs the detection model in fp32 and in a reduced precision over the
+ * same images and reports how far the reduced one drifts: share of fp32
+ * boxes it finds again, IoU of matched boxes, score differences and the
+ * speedup. Exits with 1 when a gate is not met, so it can guard turning
+ * precision=bf16 or int8 on.
+ * */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/util/command_line_flags.h"
+
+#include "detection_model.h"
+#include "stream_inputs.h"
+
+using tensorflow::Flag;
+
+struct ImageDrift {
+    size_t reference = 0;   // Detections of fp32
+    size_t candidate = 0;   // Detections of reduced precision
+    size_t matched = 0;
+    double iou_sum = 0;
+    float iou_min = 1.f;
+    double drift_sum = 0;   // Sum of |score difference| of matched
+    float drift_max = 0.f;
+};
+
+/* Greedy one-to-one matching: every reference detection, from the best
+ * score down, takes the unmatched candidate of the same class with the
+ * highest IoU at or above iou_threshold.
+ * */
+static
+ImageDrift compare(const std::vector<Detection>& reference,
+        const std::vector<Detection>& candidate, float iou_threshold) {
+    ImageDrift drift;
+    std::vector<size_t> order(reference.size());
+    std::vector<bool> taken(candidate.size(), false);
+
+    drift.reference = reference.size();
+    drift.candidate = candidate.size();
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return reference[a].score > reference[b].score;
+    });
+
+    for (size_t index : order) {
+        const Detection& expected = reference[index];
+        float best_iou = iou_threshold;
+        size_t best = candidate.size();
+
+        for (size_t j = 0; j < candidate.size(); ++j) {
+            if (taken[j] || candidate[j].class_id != expected.class_id) {
+                continue;
+            }
+
+            float iou = IoU(expected.box, candidate[j].box);
+            if (iou >= best_iou) {
+                best_iou = iou;
+                best = j;
+            }
+        }
+
+        if (best == candidate.size()) {
+            continue;
+        }
+
+        const float score_drift =
+            std::abs(candidate[best].score - expected.score);
+
+        taken[best] = true;
+        ++drift.matched;
+        drift.iou_sum += best_iou;
+        drift.iou_min = std::min(drift.iou_min, best_iou);
+        drift.drift_sum += score_drift;
+        drift.drift_max = std::max(drift.drift_max, score_drift);
+    }
+
+    return drift;
+}
+
+static
+double ratio(double value, double total) {
+    return total > 0 ? value / total : 1.;
+}
+
+int main(int argc, char** argv) {
+    std::string path_to_model;
+    std::string images = "images/*.jpg";
+    std::string model_config;
+    std::string precision = "bf16";
+    std::string int8_model;
+    std::string output;
+    float score_threshold = 0.3f;
+    float iou_threshold = 0.5f;
+    float min_match_rate = 0.95f;
+    float min_mean_iou = 0.9f;
+    float max_mean_score_drift = 0.02f;
+
+    std::vector<Flag> flag_list = {
+        Flag("model", &path_to_model, "fp32 SavedModel"),
+        Flag("images", &images, "comma separated images or glob patterns"),
+        Flag("model_config", &model_config,
+                "load settings of both models, key=value,..."),
+        Flag("precision", &precision, "precision to check: bf16 or int8"),
+        Flag("int8_model", &int8_model, "quantized SavedModel for int8"),
+        Flag("score_threshold", &score_threshold,
+                "min score of compared detections"),
+        Flag("iou_threshold", &iou_threshold,
+                "min IoU of a detection and its match"),
+        Flag("min_match_rate", &min_match_rate,
+                "gate: share of fp32 detections found again"),
+        Flag("min_mean_iou", &min_mean_iou, "gate: mean IoU of matched"),
+        Flag("max_mean_score_drift", &max_mean_score_drift,
+                "gate: mean |score difference| of matched"),
+        Flag("output", &output, "CSV with drift of every image"),
+    };
+
+    std::string usage = tensorflow::Flags::Usage(argv[0], flag_list);
+    bool parse_result = tensorflow::Flags::Parse(&argc, argv, flag_list);
+    if (!parse_result || path_to_model.empty()) {
+        LOG(ERROR) << usage;
+        return -1;
+    }
+
+    std::vector<StreamInput> inputs;
+    ExpandInputs(images, inputs);
+    if (inputs.empty()) {
+        LOG(ERROR) << "No images in " << images;
+        return -1;
+    }
+
+    ModelConfig reference_config = DetectionModelConfig();
+    Status status = ParseModelConfig(model_config, reference_config);
+    ModelConfig candidate_config = reference_config;
+    if (status.ok()) {
+        status = SetModelConfig("precision", precision, candidate_config);
+    }
+    if (status.ok() && !int8_model.empty()) {
+        status = SetModelConfig("int8_model", int8_model, candidate_config);
+    }
+    if (!status.ok() || candidate_config.precision == Precision::FP32) {
+        LOG(ERROR) << (status.ok() ? "precision must be bf16 or int8" :
+                status.ToString());
+        return -1;
+    }
+
+    /* Both run with oneDNN, so the difference is precision alone:
+     * the candidate loads first and turns it on for the process.
+     * */
+    if (reference_config.onednn == Toggle::DEFAULT) {
+        reference_config.onednn = Toggle::ON;
+    }
+
+    PostprocessOptions postprocess_options;
+    postprocess_options.score_threshold = score_threshold;
+
+    std::ofstream csv;
+    if (!output.empty()) {
+        csv.open(output);
+        csv << "image,reference,candidate,matched,mean_iou,"
+               "mean_score_drift,max_score_drift\n";
+    }
+
+    ImageDrift total;
+    double reference_seconds = 0;
+    double candidate_seconds = 0;
+
+    try {
+        DetectionModel candidate(path_to_model, candidate_config);
+        DetectionModel reference(path_to_model, reference_config);
+
+        candidate.SetPostprocessOptions(postprocess_options);
+        reference.SetPostprocessOptions(postprocess_options);
+
+        /* First runs pay lazy initialization, keep them out of timing. */
+        reference.Testing(inputs[0].path);
+        candidate.Testing(inputs[0].path);
+
+        for (const StreamInput& input : inputs) {
+            auto begin = std::chrono::steady_clock::now();
+            std::vector<Detection> expected = reference.Testing(input.path);
+            auto middle = std::chrono::steady_clock::now();
+            std::vector<Detection> actual = candidate.Testing(input.path);
+            auto end = std::chrono::steady_clock::now();
+
+            reference_seconds +=
+                std::chrono::duration<double>(middle - begin).count();
+            candidate_seconds +=
+                std::chrono::duration<double>(end - middle).count();
+
+            ImageDrift drift = compare(expected, actual, iou_threshold);
+
+            total.reference += drift.reference;
+            total.candidate += drift.candidate;
+            total.matched += drift.matched;
+            total.iou_sum += drift.iou_sum;
+            total.iou_min = std::min(total.iou_min, drift.iou_min);
+            total.drift_sum += drift.drift_sum;
+            total.drift_max = std::max(total.drift_max, drift.drift_max);
+
+            if (csv.is_open()) {
+                csv << input.path << "," << drift.reference << ","
+                    << drift.candidate << "," << drift.matched << ","
+                    << ratio(drift.iou_sum, drift.matched) << ","
+                    << (drift.matched > 0 ?
+                        drift.drift_sum / drift.matched : 0.) << ","
+                    << drift.drift_max << "\n";
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG(ERROR) << e.what();
+        return -1;
+    }
+
+    const double match_rate = ratio(total.matched, total.reference);
+    const double mean_iou = ratio(total.iou_sum, total.matched);
+    const double mean_drift = total.matched > 0 ?
+        total.drift_sum / total.matched : 0.;
+    const bool passed = match_rate >= min_match_rate &&
+        mean_iou >= min_mean_iou && mean_drift <= max_mean_score_drift;
+
+    std::cout << "Images: " << inputs.size() << "\n"
+              << "Detections: fp32 " << total.reference << ", " << precision
+              << " " << total.candidate << ", matched " << total.matched
+              << "\n"
+              << "Match rate: " << match_rate << " (of fp32), "
+              << ratio(total.matched, total.candidate) << " (of "
+              << precision << ")\n"
+              << "Box IoU: mean " << mean_iou << ", min "
+              << (total.matched > 0 ? total.iou_min : 1.f) << "\n"
+              << "Score drift: mean " << mean_drift << ", max "
+              << total.drift_max << "\n"
+              << "Time per image: fp32 "
+              << reference_seconds * 1000. / inputs.size() << " ms, "
+              << precision << " " << candidate_seconds * 1000. / inputs.size()
+              << " ms, speedup "
+              << ratio(reference_seconds, candidate_seconds) << "x\n"
+              << (passed ? "PASSED" : "FAILED") << std::endl;
+
+    return passed ? 0 : 1;
+}
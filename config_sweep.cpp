@@ -0,0 +1,422 @@
+/*
+ * Loads a SavedModel with every combination of load settings and times
+ * it on random inputs of its serving signature, to pick --model_config
+ * for a model and a machine.
+ *
+ * oneDNN and XLA CPU clustering are read once per process, so every
+ * combination runs in its own forked process; the parent never runs TF.
+ * */
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/util/command_line_flags.h"
+
+#include "model_config.h"
+#include "model_startup.h"
+
+using tensorflow::Flag;
+using tensorflow::Status;
+using tensorflow::Tensor;
+
+struct SweepOptions {
+    std::string model;
+    std::string signature = "serving_default";
+    std::vector<int64_t> input_shape; // Replaces unknown dims, empty - 1
+    int warmup = 3;
+    int runs = 20;
+};
+
+struct SweepResult {
+    std::string config;
+    std::string error;
+    double load_seconds = 0;
+    double first_run_seconds = 0; // Grappler, XLA compilation included
+    double mean_ms = 0;
+    double p50_ms = 0;
+    double p95_ms = 0;
+};
+
+static
+double seconds_since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - begin).count();
+}
+
+/* "key=a|b;key=c|d" -> every combination as a ParseModelConfig list. */
+static
+bool expand_grid(const std::string& grid, std::vector<std::string>& configs) {
+    std::istringstream axes(grid);
+    std::string axis;
+
+    configs.assign(1, "");
+    while (std::getline(axes, axis, ';')) {
+        size_t equal = axis.find('=');
+        std::vector<std::string> combined;
+        std::string value;
+
+        if (axis.empty()) {
+            continue;
+        }
+        if (equal == std::string::npos) {
+            return false;
+        }
+
+        std::istringstream values(axis.substr(equal + 1));
+        while (std::getline(values, value, '|')) {
+            for (const std::string& config : configs) {
+                combined.push_back(config + (config.empty() ? "" : ",") +
+                        axis.substr(0, equal) + "=" + value);
+            }
+        }
+        configs.swap(combined);
+    }
+
+    return true;
+}
+
+static
+Status random_input(const tensorflow::TensorInfo& info,
+        const std::vector<int64_t>& input_shape, std::mt19937& generator,
+        Tensor& tensor) {
+    using namespace tensorflow;
+
+    TensorShape shape;
+    const TensorShapeProto& proto = info.tensor_shape();
+
+    if (proto.unknown_rank()) {
+        return errors::InvalidArgument("Input ", info.name(),
+                " has unknown rank");
+    }
+
+    for (int i = 0; i < proto.dim_size(); ++i) {
+        int64 dim = proto.dim(i).size();
+
+        if (dim < 0) {
+            dim = static_cast<size_t>(proto.dim_size()) == input_shape.size() ?
+                input_shape[i] : 1;
+        }
+        shape.AddDim(dim);
+    }
+
+    tensor = Tensor(info.dtype(), shape);
+    switch (info.dtype()) {
+    case DT_FLOAT: {
+        std::uniform_real_distribution<float> distribution(0.f, 1.f);
+        auto flat = tensor.flat<float>();
+        for (int64 i = 0; i < flat.size(); ++i) {
+            flat(i) = distribution(generator);
+        }
+        break;
+    }
+    case DT_UINT8: {
+        auto flat = tensor.flat<uint8>();
+        for (int64 i = 0; i < flat.size(); ++i) {
+            flat(i) = static_cast<uint8>(generator());
+        }
+        break;
+    }
+    case DT_INT32:
+        tensor.flat<int32>().setZero();
+        break;
+    case DT_INT64:
+        tensor.flat<int64>().setZero();
+        break;
+    default:
+        return errors::Unimplemented("Input ", info.name(), " has dtype ",
+                DataTypeString(info.dtype()));
+    }
+
+    return Status::OK();
+}
+
+static
+std::string csv_quoted(const std::string& value) {
+    std::string result = "\"";
+
+    for (char c : value) {
+        result += c == '"' ? "\"\"" : std::string(1, c);
+    }
+
+    return result + "\"";
+}
+
+/* Runs in the child process. */
+static
+Status run_config(const SweepOptions& options, const ModelConfig& config,
+        SweepResult& result) {
+    using namespace tensorflow;
+
+    SessionOptions session_options;
+    RunOptions run_options;
+    SavedModelBundle bundle;
+    CallableOptions callable_options;
+    Session::CallableHandle callable;
+    std::vector<Tensor> inputs;
+    std::vector<Tensor> outputs;
+    std::vector<double> latencies;
+    std::mt19937 generator(42);
+    std::string export_dir;
+
+    TF_RETURN_IF_ERROR(ResolveModelPath(options.model, config, export_dir));
+    TF_RETURN_IF_ERROR(ApplyModelConfig(config, session_options));
+
+    auto begin = std::chrono::steady_clock::now();
+    TF_RETURN_IF_ERROR(LoadSavedModelCached(session_options, run_options,
+            export_dir, config, &bundle));
+    result.load_seconds = seconds_since(begin);
+
+    auto signature = bundle.GetSignatures().find(options.signature);
+    if (signature == bundle.GetSignatures().end()) {
+        return errors::NotFound("Signature ", options.signature, " not found");
+    }
+
+    for (const auto& input : signature->second.inputs()) {
+        Tensor tensor;
+
+        TF_RETURN_IF_ERROR(random_input(input.second, options.input_shape,
+                generator, tensor));
+        callable_options.add_feed(input.second.name());
+        inputs.push_back(tensor);
+    }
+    for (const auto& output : signature->second.outputs()) {
+        callable_options.add_fetch(output.second.name());
+    }
+
+    Session* session = bundle.GetSession();
+
+    begin = std::chrono::steady_clock::now();
+    TF_RETURN_IF_ERROR(session->MakeCallable(callable_options, &callable));
+    TF_RETURN_IF_ERROR(session->RunCallable(callable, inputs, &outputs,
+            nullptr));
+    result.first_run_seconds = seconds_since(begin);
+
+    for (int i = 0; i < options.warmup + options.runs; ++i) {
+        begin = std::chrono::steady_clock::now();
+        TF_RETURN_IF_ERROR(session->RunCallable(callable, inputs, &outputs,
+                nullptr));
+        if (i >= options.warmup) {
+            latencies.push_back(seconds_since(begin) * 1000.);
+        }
+    }
+    session->ReleaseCallable(callable);
+
+    std::sort(latencies.begin(), latencies.end());
+    for (double latency : latencies) {
+        result.mean_ms += latency / latencies.size();
+    }
+    result.p50_ms = latencies[latencies.size() / 2];
+    result.p95_ms = latencies[std::min(latencies.size() - 1,
+            latencies.size() * 95 / 100)];
+
+    return Status::OK();
+}
+
+/* Fork, run one config and read its result line back through a pipe. */
+static
+SweepResult run_isolated(const SweepOptions& options, const std::string& list) {
+    SweepResult result;
+    ModelConfig config;
+    int fds[2];
+
+    result.config = list;
+
+    Status status = ParseModelConfig(list, config);
+    if (!status.ok()) {
+        result.error = status.ToString();
+        return result;
+    }
+
+    if (pipe(fds) != 0) {
+        result.error = "pipe failed";
+        return result;
+    }
+
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        result.error = "fork failed";
+        return result;
+    }
+
+    if (pid == 0) {
+        std::ostringstream line;
+
+        close(fds[0]);
+        status = run_config(options, config, result);
+        if (status.ok()) {
+            line << "ok " << result.load_seconds << " "
+                 << result.first_run_seconds << " " << result.mean_ms << " "
+                 << result.p50_ms << " " << result.p95_ms;
+        } else {
+            line << "error " << status.ToString();
+        }
+
+        std::string text = line.str();
+        ssize_t written = write(fds[1], text.data(), text.size());
+        (void)written;
+        _exit(0);
+    }
+
+    std::string text;
+    char buffer[512];
+    ssize_t count;
+    int wait_status = 0;
+
+    close(fds[1]);
+    while ((count = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, count);
+    }
+    close(fds[0]);
+    waitpid(pid, &wait_status, 0);
+
+    std::istringstream fields(text);
+    std::string kind;
+
+    fields >> kind;
+    if (kind == "ok") {
+        fields >> result.load_seconds >> result.first_run_seconds
+               >> result.mean_ms >> result.p50_ms >> result.p95_ms;
+    } else if (kind == "error") {
+        std::getline(fields >> std::ws, result.error);
+    } else if (WIFSIGNALED(wait_status)) {
+        result.error = "crashed with signal " +
+            std::to_string(WTERMSIG(wait_status));
+    } else {
+        result.error = "no result";
+    }
+
+    return result;
+}
+
+int main(int argc, char** argv) {
+    SweepOptions options;
+    std::string base;
+    std::string base_file;
+    std::string grid =
+        "xla=off|on;onednn=off|on;grappler=on|off";
+    std::string input_shape;
+    std::string output;
+    std::vector<std::string> configs;
+    std::vector<SweepResult> results;
+
+    std::vector<Flag> flag_list = {
+        Flag("model", &options.model, "SavedModel directory"),
+        Flag("signature", &options.signature, "signature to feed and fetch"),
+        Flag("input_shape", &input_shape,
+                "comma separated dims for unknown input dims, empty - 1"),
+        Flag("model_config", &base,
+                "settings shared by all combinations, key=value,..."),
+        Flag("model_config_file", &base_file,
+                "file with shared settings, one key=value per line"),
+        Flag("grid", &grid,
+                "settings to combine: key=value|value;key=value|value..."),
+        Flag("warmup", &options.warmup, "untimed runs after the first one"),
+        Flag("runs", &options.runs, "timed runs of every combination"),
+        Flag("output", &output, "CSV file for results, empty - none"),
+    };
+
+    std::string usage = tensorflow::Flags::Usage(argv[0], flag_list);
+    bool parse_result = tensorflow::Flags::Parse(&argc, argv, flag_list);
+    if (!parse_result || options.model.empty() || options.runs <= 0 ||
+        options.warmup < 0 || !expand_grid(grid, configs)) {
+        LOG(ERROR) << usage;
+        return -1;
+    }
+
+    std::istringstream dims(input_shape);
+    std::string dim;
+    while (std::getline(dims, dim, ',')) {
+        char* end = nullptr;
+        long long size = std::strtoll(dim.c_str(), &end, 10);
+
+        if (dim.empty() || *end != '\0' || size <= 0) {
+            LOG(ERROR) << "Bad input_shape " << input_shape;
+            return -1;
+        }
+        options.input_shape.push_back(size);
+    }
+
+    /* Shared settings go first, so grid values override them. */
+    ModelConfig shared;
+    Status status = Status::OK();
+    if (!base_file.empty()) {
+        status = LoadModelConfig(base_file, shared);
+    }
+    if (status.ok()) {
+        status = ParseModelConfig(base, shared);
+    }
+    if (!status.ok()) {
+        LOG(ERROR) << status.ToString();
+        return -1;
+    }
+    base = ModelConfigString(shared);
+
+    for (const std::string& config : configs) {
+        std::string list = base + (base.empty() || config.empty() ? "" : ",") +
+            config;
+
+        LOG(INFO) << "Running " << (list.empty() ? "defaults" : list);
+        results.push_back(run_isolated(options, list));
+        if (!results.back().error.empty()) {
+            LOG(WARNING) << results.back().error;
+        }
+    }
+
+    std::stable_sort(results.begin(), results.end(),
+            [](const SweepResult& a, const SweepResult& b) {
+                if (a.error.empty() != b.error.empty()) {
+                    return a.error.empty();
+                }
+                return a.mean_ms < b.mean_ms;
+            });
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "mean_ms  p50_ms  p95_ms  load_s  first_run_s  config\n";
+    for (const SweepResult& result : results) {
+        if (result.error.empty()) {
+            std::cout << result.mean_ms << "  " << result.p50_ms << "  "
+                      << result.p95_ms << "  " << result.load_seconds << "  "
+                      << result.first_run_seconds << "  ";
+        } else {
+            std::cout << "failed: " << result.error << "  ";
+        }
+        std::cout << (result.config.empty() ? "defaults" : result.config)
+                  << "\n";
+    }
+
+    if (!output.empty()) {
+        std::ofstream file(output);
+
+        file << "config,mean_ms,p50_ms,p95_ms,load_s,first_run_s,error\n";
+        for (const SweepResult& result : results) {
+            file << csv_quoted(result.config) << "," << result.mean_ms << ","
+                 << result.p50_ms << "," << result.p95_ms << ","
+                 << result.load_seconds << "," << result.first_run_seconds
+                 << "," << csv_quoted(result.error) << "\n";
+        }
+    }
+
+    if (!results.empty() && results.front().error.empty()) {
+        std::cout << "Best: --model_config=" << results.front().config
+                  << std::endl;
+    }
+
+    return 0;
+}
@@ -1,11 +1,61 @@
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <sstream>
+
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/hash.h"
+
+#include "chrome_trace.h"
 #include "detection_model.h"
+#include "metrics.h"
+#include "tensor_buffer.h"
+
+/* View of a [1, H, W, 3] uint8 tensor as an image. */
+static
+cv::Mat tensor_image(const Tensor& tensor) {
+    return cv::Mat(tensor.dim_size(1), tensor.dim_size(2), CV_8UC3,
+            const_cast<tensorflow::uint8*>(
+                tensor.flat<tensorflow::uint8>().data()));
+}
+
+/* Views of every image of a [N, H, W, 3] uint8 tensor. */
+static
+void append_tensor_images(const Tensor& tensor, std::vector<cv::Mat>& images) {
+    const int rows = static_cast<int>(tensor.dim_size(1));
+    const int cols = static_cast<int>(tensor.dim_size(2));
+    const size_t image_size = static_cast<size_t>(rows) * cols * 3;
+    tensorflow::uint8* data = const_cast<tensorflow::uint8*>(
+            tensor.flat<tensorflow::uint8>().data());
+
+    for (int64_t i = 0; i < tensor.dim_size(0); ++i) {
+        images.emplace_back(rows, cols, CV_8UC3, data + i * image_size);
+    }
+}
+
+ModelConfig DetectionModelConfig() {
+    ModelConfig config;
+    config.tags.clear();
+    return config;
+}
 
-DetectionModel::DetectionModel(const std::string& path_to_model) :
-    _root(Scope::NewRootScope()), _path_to_model(path_to_model) {
-	auto status = tensorflow::LoadSavedModel(session_options, run_options,
-        path_to_model, {}, &_model);
-        /* path_to_model, {"serve"}, &_model); */
+DetectionModel::DetectionModel(const std::string& path_to_model,
+    const ModelConfig& config) :
+    _root(Scope::NewRootScope()), _path_to_model(path_to_model),
+    _config(config) {
+    auto status = ResolveModelPath(path_to_model, config, _path_to_model);
+    if (status.ok()) {
+        status = ApplyModelConfig(config, session_options);
+    }
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+	status = LoadSavedModelCached(session_options, run_options,
+        _path_to_model, config, &_model);
 	if (status.ok()) {
+        LogModelConfig(config, session_options);
 		LOG(INFO) << "Model was loaded successfully...";
 	} else {
 		LOG(ERROR) << "Error in loading model";
@@ -17,15 +67,170 @@ DetectionModel::DetectionModel(const std::string& path_to_model) :
 		LOG(ERROR) << "Failed to create graph";
         throw std::runtime_error(status.ToString());
     }
+
+    status = CreateCallables();
+    if (!status.ok()) {
+		LOG(ERROR) << "Failed to create callables";
+        throw std::runtime_error(status.ToString());
+    }
+}
+
+DetectionModel::~DetectionModel() {
+    if (_cache) {
+        auto status = _cache->Save();
+        if (!status.ok()) {
+            LOG(ERROR) << status.ToString();
+        }
+    }
+    if (_image_session) {
+        _image_session->ReleaseCallable(_image_callable);
+        _image_session->Close();
+    }
+    _model.GetSession()->ReleaseCallable(_predict_callable);
+    if (_trace_every > 0) {
+        _model.GetSession()->ReleaseCallable(_trace_callable);
+    }
+}
+
+void DetectionModel::SetShapeBuckets(const BucketOptions& options) {
+    if (options.shapes.empty()) {
+        _buckets.reset();
+        return;
+    }
+
+    _buckets.reset(new ShapeBuckets(options));
+}
+
+void DetectionModel::SetTiling(const TileOptions& options) {
+    _tiling = TileOptions();
+    _tile_pool.reset();
+
+    if (options.rows == 0 && options.cols == 0) {
+        return;
+    }
+
+    auto status = ValidateTileOptions(options);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    _tiling = options;
+    if (options.parallel_runs > 1) {
+        _tile_pool.reset(new tensorflow::thread::ThreadPool(
+                tensorflow::Env::Default(), "tile_runs",
+                options.parallel_runs));
+    }
+}
+
+void DetectionModel::SetResultCache(const CacheOptions& options) {
+    using namespace tensorflow;
+
+    std::ostringstream settings;
+    uint64_t key = 0;
+
+    if (options.capacity == 0) {
+        _cache.reset();
+        return;
+    }
+
+    auto status = ModelCacheKey(_path_to_model, _config, key);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    settings << _postprocess_options.score_threshold << ","
+             << _postprocess_options.nms << ","
+             << _postprocess_options.nms_iou_threshold;
+    if (_buckets) {
+        const BucketOptions& buckets = _buckets->Options();
+
+        settings << ";" << static_cast<int>(buckets.fit) << ","
+                 << static_cast<int>(buckets.pad_value);
+        for (const auto& shape : buckets.shapes) {
+            settings << "," << shape.first << "x" << shape.second;
+        }
+    }
+    if (_tiling.rows > 0) {
+        settings << ";" << _tiling.rows << "x" << _tiling.cols << ","
+                 << _tiling.overlap << "," << _tiling.full_frame << ","
+                 << _tiling.merge_threshold;
+    }
+    key = Hash64Combine(key, Hash64(settings.str()));
+
+    _cache.reset(new ResultCache(options, key));
+
+    /* A broken file only costs the results it held. */
+    status = _cache->Load();
+    if (!status.ok()) {
+        LOG(WARNING) << "Result cache file not fully loaded: "
+                     << status.ToString();
+    }
+}
+
+void DetectionModel::EnableTrace(const std::string& trace_dir,
+    int every_n_runs) {
+
+    using namespace tensorflow;
+
+    CallableOptions trace_options;
+
+    if (every_n_runs <= 0) {
+        return;
+    }
+
+    auto status = Env::Default()->RecursivelyCreateDir(trace_dir);
+    if (!status.ok()) {
+		LOG(ERROR) << status.ToString();
+        throw std::runtime_error(status.ToString());
+    }
+
+    run_options.set_trace_level(RunOptions::FULL_TRACE);
+
+    trace_options.add_feed(input_nodes);
+    for (const auto& node : output_nodes) {
+        trace_options.add_fetch(node);
+    }
+    *trace_options.mutable_run_options() = run_options;
+
+    status = _model.GetSession()->MakeCallable(trace_options, &_trace_callable);
+    if (!status.ok()) {
+		LOG(ERROR) << "Failed to create trace callable";
+        throw std::runtime_error(status.ToString());
+    }
+
+    _trace_dir = trace_dir;
+    _trace_every = every_n_runs;
+
+    LOG(INFO) << "Tracing every " << every_n_runs << " run to " << trace_dir;
+}
+
+void DetectionModel::WriteTrace(uint64_t run,
+    const tensorflow::RunMetadata& run_metadata) {
+
+    using namespace tensorflow;
+
+    const std::string path = io::JoinPath(_trace_dir,
+            "trace_" + std::to_string(run) + ".json");
+
+    auto status = WriteStringToFile(Env::Default(), path,
+            StepStatsToChromeTrace(run_metadata.step_stats()));
+    if (!status.ok()) {
+		LOG(ERROR) << "Failed to write trace: " << status.ToString();
+        return;
+    }
+
+    LOG(INFO) << "Trace of run " << run << " is written to " << path;
 }
 
 Status DetectionModel::CreateGraphForImage() {
     using namespace tensorflow::ops;
 
+    /* Input is encoded bytes, not a path: files are mapped by the caller,
+     * so an image costs no ReadFile op nor a copy into a string.
+     * */
     _input_of_graph = Placeholder(_root.WithOpName("input"), DT_STRING);
-    auto file_reader = ReadFile(_root.WithOpName("file_reader"), _input_of_graph);
     auto image_reader = DecodeJpeg(_root.WithOpName("image_decoder"),
-            file_reader, DecodeJpeg::Channels(_image_channels));
+            _input_of_graph, DecodeJpeg::Channels(_image_channels));
     /* auto cast_image = Cast(_root.WithOpName("cast"), image_reader, DT_FLOAT); */
     auto cast_image = Cast(_root.WithOpName("cast"), image_reader, DT_UINT8);
     _output_of_graph = ExpandDims(_root.WithOpName("dims"), cast_image,
@@ -34,112 +239,775 @@ Status DetectionModel::CreateGraphForImage() {
     return _root.status();
 }
 
-Status DetectionModel::ImageToTensor(const std::string& path_to_image,
+Status DetectionModel::CreateCallables() {
+    using namespace tensorflow;
+
+    GraphDef graph;
+    CallableOptions image_options;
+    CallableOptions predict_options;
+
+    /* Image graph gets its own session, created once. */
+    TF_RETURN_IF_ERROR(_root.ToGraphDef(&graph));
+    _image_session.reset(NewSession(session_options));
+    TF_RETURN_IF_ERROR(_image_session->Create(graph));
+
+    image_options.add_feed(_input_of_graph.name());
+    image_options.add_fetch(_output_of_graph.name());
+    TF_RETURN_IF_ERROR(_image_session->MakeCallable(image_options,
+            &_image_callable));
+
+    /* Feeds and fetches of model are resolved once, not on every Run. */
+    predict_options.add_feed(input_nodes);
+    for (const auto& node : output_nodes) {
+        predict_options.add_fetch(node);
+    }
+
+    return _model.GetSession()->MakeCallable(predict_options,
+            &_predict_callable);
+}
+
+Status DetectionModel::ImageToTensor(tensorflow::StringPiece jpeg,
     Tensor& imageTensor) {
 
     using namespace tensorflow;
 
     std::vector<Tensor> vecTensors;
+    Tensor contents;
 
-    if (!str_util::EndsWith(path_to_image, ".jpg") &&
-        !str_util::EndsWith(path_to_image, ".jpeg")) {
-		LOG(ERROR) << "Image must be jpeg/jpg encoded";
-        return errors::InvalidArgument("Image must be jpeg/jpg encoded");
+    StageTimer timer(Stage::TENSOR_BUILD);
+    TF_RETURN_IF_ERROR(EncodedToTensor(jpeg, contents));
+    TF_RETURN_IF_ERROR(_image_session->RunCallable(_image_callable, {contents},
+            &vecTensors, nullptr));
+
+    imageTensor = std::move(vecTensors[0]);
+
+    return Status::OK();
+}
+
+std::vector<Detection> DetectionModel::Testing(const std::string& path_to_image) {
+    std::vector<Detection> detections;
+    std::unique_ptr<MappedFile> file;
+
+    auto status = MappedFile::Open(path_to_image, MapAccess::SEQUENTIAL, file);
+    if (!status.ok()) {
+		LOG(ERROR) << status.ToString();
+        throw std::runtime_error(status.ToString());
     }
 
-    ClientSession session(_root);
+    PredictJpeg(file->Data(), detections);
+
+    return detections;
+}
 
-    TF_RETURN_IF_ERROR(session.Run({{_input_of_graph, path_to_image}},
-            {_output_of_graph}, &vecTensors));
+std::vector<Detection> DetectionModel::PredictEncoded(
+        tensorflow::StringPiece jpeg) {
+    std::vector<Detection> detections;
 
-    imageTensor = std::move(vecTensors[0]);
+    PredictJpeg(jpeg, detections);
+
+    return detections;
+}
+
+void DetectionModel::PredictJpeg(tensorflow::StringPiece jpeg,
+    std::vector<Detection>& detections) {
+
+    Tensor imageTensor;
+    CacheKey key;
+    std::string cached;
+
+    /* Same bytes are answered before decoding. */
+    if (_cache) {
+        key = EncodedCacheKey(jpeg);
+        if (_cache->Find(key, cached) && UnpackValues(cached, detections)) {
+            return;
+        }
+    }
+
+    auto status = ImageToTensor(jpeg, imageTensor);
+    if (!status.ok()) {
+		LOG(ERROR) << status.ToString();
+        throw std::runtime_error(status.ToString());
+    }
+
+    if (_cache) {
+        if (_cache->NearEnabled()) {
+            key.dhash = DHash(tensor_image(imageTensor));
+            key.has_dhash = true;
+        }
+        if (_cache->Lookup(key, cached) && UnpackValues(cached, detections)) {
+            return;
+        }
+    }
+
+    if (_tiling.rows > 0) {
+        std::vector<std::vector<Detection>> batch;
+
+        PredictTiled({tensor_image(imageTensor)}, batch,
+                tensorflow::thread::ThreadPoolOptions());
+        detections = std::move(batch[0]);
+    } else if (_buckets) {
+        PredictFitted(tensor_image(imageTensor), detections);
+    } else {
+        Predict(imageTensor, detections);
+    }
+
+    if (_cache) {
+        _cache->Insert(key, PackValues(detections));
+    }
+}
+
+std::vector<Detection> DetectionModel::Testing(cv::Mat& image) {
+    std::vector<Detection> detections;
+    Tensor imageTensor;
+    CacheKey key;
+
+    if (_cache) {
+        std::string cached;
+
+        key = PixelCacheKey(image, _cache->NearEnabled());
+        if (_cache->Lookup(key, cached) && UnpackValues(cached, detections)) {
+            return detections;
+        }
+    }
+
+    if (_tiling.rows > 0) {
+        std::vector<std::vector<Detection>> batch;
+
+        PredictTiled({image}, batch, tensorflow::thread::ThreadPoolOptions());
+        detections = std::move(batch[0]);
+        if (_cache) {
+            _cache->Insert(key, PackValues(detections));
+        }
+        return detections;
+    }
+
+    if (_buckets) {
+        PredictFitted(image, detections);
+        if (_cache) {
+            _cache->Insert(key, PackValues(detections));
+        }
+        return detections;
+    }
+
+    /* Tensor borrows pixels of image, shaped [1, H, W, 3] directly. */
+    Status status;
+    {
+        StageTimer timer(Stage::TENSOR_BUILD);
+        status = MatToTensor(image, imageTensor);
+    }
+    if (!status.ok()) {
+		LOG(ERROR) << status.ToString();
+        throw std::runtime_error(status.ToString());
+    }
+
+    Predict(imageTensor, detections);
+
+    if (_cache) {
+        _cache->Insert(key, PackValues(detections));
+    }
+
+    return detections;
+}
+
+Status DetectionModel::ImagesToTensor(const std::vector<cv::Mat>& images,
+    Tensor& batchTensor, std::vector<Box>& contents) {
+    using namespace tensorflow;
+
+    if (images.empty()) {
+        return errors::InvalidArgument("Batch of images is empty");
+    }
+
+    int rows = images[0].rows;
+    int cols = images[0].cols;
+
+    contents.clear();
+    if (_buckets) {
+        for (const auto& image : images) {
+            rows = std::max(rows, image.rows);
+            cols = std::max(cols, image.cols);
+        }
 
-    LOG(INFO) << imageTensor.DebugString();
+        const int bucket = _buckets->Select(rows, cols);
+        rows = _buckets->Shape(bucket).first;
+        cols = _buckets->Shape(bucket).second;
+
+        batchTensor = Tensor(DT_UINT8, TensorShape({
+                static_cast<int64>(images.size()), rows, cols,
+                _image_channels}));
+
+        /* Every image scaled straight into its slot of batch tensor. */
+        uint8_t *p = batchTensor.flat<tensorflow::uint8>().data();
+        const size_t image_size =
+            static_cast<size_t>(rows) * cols * _image_channels;
+
+        for (const auto& image : images) {
+            const BucketPlacement placement =
+                _buckets->Place(bucket, image.rows, image.cols);
+            cv::Mat slot(rows, cols, CV_8UC3, p);
+
+            TF_RETURN_IF_ERROR(_buckets->FitInto(image, placement, slot));
+            contents.push_back(placement.content);
+            p += image_size;
+        }
+
+        return Status::OK();
+    }
+
+    for (const auto& image : images) {
+        if (image.type() != CV_8UC3) {
+            return errors::InvalidArgument("Image must be CV_8UC3");
+        }
+        if (image.rows != rows || image.cols != cols) {
+            return errors::InvalidArgument("All images of batch must have "
+                    "the same resolution ", rows, "x", cols, ", got ",
+                    image.rows, "x", image.cols);
+        }
+    }
+
+    batchTensor = Tensor(DT_UINT8, TensorShape({
+            static_cast<int64>(images.size()), rows, cols, _image_channels}));
+
+    /* Copy every image directly into its slot of batch tensor. */
+    uint8_t *p = batchTensor.flat<tensorflow::uint8>().data();
+    const size_t image_size = static_cast<size_t>(rows) * cols * _image_channels;
+
+    for (const auto& image : images) {
+        cv::Mat tensorMatImage(rows, cols, CV_8UC3, p);
+        image.copyTo(tensorMatImage);
+        p += image_size;
+    }
 
     return Status::OK();
 }
 
-Status DetectionModel::ImageToTensor(Tensor& imageTensor) {
-    using namespace tensorflow::ops;
+Status DetectionModel::WarmupInputs(const WarmupOptions& options,
+    std::vector<Tensor>& inputs) {
 
-    GraphDef graph;
-    std::vector<Tensor> vecTensors;
+    using namespace tensorflow;
 
-    auto output_of_graph = ExpandDims(_root.WithOpName("dim"), imageTensor,
-            _expand_dims_axis);
+    /* Requests name inputs by signature key, find the one of input_nodes. */
+    std::string input_key = "input_tensor";
+    auto signature = _model.GetSignatures().find("serving_default");
+    if (signature != _model.GetSignatures().end()) {
+        for (const auto& input : signature->second.inputs()) {
+            if (input.second.name() == input_nodes) {
+                input_key = input.first;
+            }
+        }
+    }
+
+    inputs.clear();
+    Status status = ReadWarmupRequests(_path_to_model, input_key,
+            options.max_requests, inputs);
+    if (status.ok()) {
+        LOG(INFO) << "Warmup with " << inputs.size()
+                  << " recorded requests";
+        return Status::OK();
+    }
+    if (!errors::IsNotFound(status)) {
+        return status;
+    }
 
-	TF_RETURN_IF_ERROR(_root.ToGraphDef(&graph));
-	ClientSession session(_root);
+    for (const auto& shape : options.shapes) {
+        for (int batch_size : options.batch_sizes) {
+            Tensor input(DT_UINT8, TensorShape({batch_size, shape.first,
+                    shape.second, 3}));
+            input.flat<uint8>().setZero();
+            inputs.push_back(input);
+        }
+    }
 
-	auto run_status = session.Run({output_of_graph}, &vecTensors);
-	if (!run_status.ok()){
-		printf("Error in running session \n");
-	}
+    return Status::OK();
+}
 
-    LOG(INFO) << imageTensor.DebugString();
-    imageTensor = std::move(vecTensors[0]);
-    LOG(INFO) << imageTensor.DebugString();
+Status DetectionModel::Warmup(const std::vector<Tensor>& inputs, int runs,
+    const tensorflow::thread::ThreadPoolOptions& pools) {
+
+    std::vector<Tensor> outputs;
+
+    for (const Tensor& input : inputs) {
+        for (int i = 0; i < runs; ++i) {
+            TF_RETURN_IF_ERROR(_model.GetSession()->RunCallable(
+                    _predict_callable, {input}, &outputs, nullptr, pools));
+        }
+    }
 
     return Status::OK();
 }
 
-void DetectionModel::Testing(const std::string& path_to_image) {
-    std::vector<Tensor> predictions;
-    Tensor imageTensor;
+void DetectionModel::PredictBatch(const std::vector<cv::Mat>& images,
+    std::vector<std::vector<Detection>>& detections) {
+
+    std::vector<CacheKey> keys;
+    std::vector<size_t> misses;
+    std::vector<cv::Mat> missed;
+    std::vector<std::vector<Detection>> results;
+
+    if (!_cache) {
+        PredictImages(images, detections);
+        return;
+    }
+
+    /* Only images without cached results are run, as one smaller batch. */
+    LookupBatch(images, keys, detections, misses);
+    if (misses.empty()) {
+        return;
+    }
+    for (size_t index : misses) {
+        missed.push_back(images[index]);
+    }
+
+    PredictImages(missed, results);
+    StoreBatch(keys, misses, results, detections);
+}
 
-    auto status = ImageToTensor(path_to_image, imageTensor);
+void DetectionModel::PredictImages(const std::vector<cv::Mat>& images,
+    std::vector<std::vector<Detection>>& detections) {
+
+    Tensor batchTensor;
+    std::vector<Box> contents;
+    Status status;
+
+    if (_tiling.rows > 0) {
+        PredictTiled(images, detections,
+                tensorflow::thread::ThreadPoolOptions());
+        return;
+    }
+
+    {
+        StageTimer timer(Stage::TENSOR_BUILD);
+        status = ImagesToTensor(images, batchTensor, contents);
+    }
     if (!status.ok()) {
 		LOG(ERROR) << status.ToString();
         throw std::runtime_error(status.ToString());
     }
 
-    LOG(INFO) << "Image was loaded";
+    RunBatch(batchTensor, detections, tensorflow::thread::ThreadPoolOptions());
 
-    Predict(imageTensor, predictions);
+    for (size_t i = 0; i < contents.size(); ++i) {
+        RestoreBoxes(contents[i], detections[i]);
+    }
 }
 
-void DetectionModel::Testing(cv::Mat& image) {
-    const clock_t begin_time = clock();
+void DetectionModel::PredictBatch(const std::vector<Tensor>& images,
+    std::vector<std::vector<Detection>>& detections) {
+
+    PredictBatch(images, detections, tensorflow::thread::ThreadPoolOptions());
+}
+
+void DetectionModel::PredictBatch(const std::vector<Tensor>& images,
+    std::vector<std::vector<Detection>>& detections,
+    const tensorflow::thread::ThreadPoolOptions& pools) {
+
+    std::vector<cv::Mat> views;
+    std::vector<CacheKey> keys;
+    std::vector<size_t> misses;
+    std::vector<Tensor> missed;
+    std::vector<std::vector<Detection>> results;
+
+    if (!_cache) {
+        PredictTensors(images, detections, pools);
+        return;
+    }
+
+    /* Keys need single frames, anything else is run uncached. */
+    for (const Tensor& image : images) {
+        if (image.dtype() != DT_UINT8 || image.dims() != 4 ||
+            image.dim_size(0) != 1) {
+            PredictTensors(images, detections, pools);
+            return;
+        }
+        views.push_back(tensor_image(image));
+    }
+
+    LookupBatch(views, keys, detections, misses);
+    if (misses.empty()) {
+        return;
+    }
+    for (size_t index : misses) {
+        missed.push_back(images[index]);
+    }
+
+    PredictTensors(missed, results, pools);
+    StoreBatch(keys, misses, results, detections);
+}
 
-    Tensor imageTensor(DT_UINT8, TensorShape({1, image.rows, image.cols, 3});
-    std::cout << "imageTensor is empty: " << std::endl << imageTensor.DebugString() << std::endl;
-    uint8_t *p = inputImg.flat<tensorflow:uint8_t>().data();
-    cv::Mat tensorMatImage(image.rows, image.cols, CV_8UC3, p);
+void DetectionModel::LookupBatch(const std::vector<cv::Mat>& images,
+    std::vector<CacheKey>& keys,
+    std::vector<std::vector<Detection>>& detections,
+    std::vector<size_t>& misses) {
 
-    image.convertTo(tensorMatImage, CV_8UC3);
+    std::string cached;
+
+    keys.clear();
+    misses.clear();
+    detections.assign(images.size(), std::vector<Detection>());
+
+    for (size_t i = 0; i < images.size(); ++i) {
+        keys.push_back(PixelCacheKey(images[i], _cache->NearEnabled()));
+        if (!_cache->Lookup(keys[i], cached) ||
+            !UnpackValues(cached, detections[i])) {
+            misses.push_back(i);
+        }
+    }
+}
+
+void DetectionModel::StoreBatch(const std::vector<CacheKey>& keys,
+    const std::vector<size_t>& misses,
+    std::vector<std::vector<Detection>>& results,
+    std::vector<std::vector<Detection>>& detections) {
+
+    for (size_t i = 0; i < misses.size(); ++i) {
+        _cache->Insert(keys[misses[i]], PackValues(results[i]));
+        detections[misses[i]] = std::move(results[i]);
+    }
+}
+
+void DetectionModel::PredictTensors(const std::vector<Tensor>& images,
+    std::vector<std::vector<Detection>>& detections,
+    const tensorflow::thread::ThreadPoolOptions& pools) {
+
+    Tensor batchTensor;
+
+    if (_tiling.rows > 0) {
+        std::vector<cv::Mat> views;
+
+        for (const Tensor& image : images) {
+            if (image.dtype() != DT_UINT8 || image.dims() != 4 ||
+                image.dim_size(3) != 3) {
+                LOG(ERROR) << "Tiled frames must be [N, H, W, 3] uint8";
+                throw std::runtime_error("Tiled frames must be "
+                        "[N, H, W, 3] uint8, got " +
+                        image.shape().DebugString());
+            }
+            append_tensor_images(image, views);
+        }
+
+        PredictTiled(views, detections, pools);
+        return;
+    }
+
+    if (images.size() == 1) {
+        /* Already [1, H, W, 3], feed as is. */
+        batchTensor = images[0];
+    } else {
+        StageTimer timer(Stage::TENSOR_BUILD);
+        auto status = tensorflow::tensor::Concat(images, &batchTensor);
+        if (!status.ok()) {
+            LOG(ERROR) << status.ToString();
+            throw std::runtime_error(status.ToString());
+        }
+    }
+
+    RunBatch(batchTensor, detections, pools);
+}
 
-    auto status = ImageToTensor(imageTensor);
+void DetectionModel::RunBatch(const Tensor& batchTensor,
+    std::vector<std::vector<Detection>>& detections,
+    const tensorflow::thread::ThreadPoolOptions& pools, bool tiles) {
+
+    const int64_t batch_size = batchTensor.dim_size(0);
+    const uint64_t run = _runs.fetch_add(1, std::memory_order_relaxed);
+    const bool trace = _trace_every > 0 && run % _trace_every == 0;
+    std::vector<Tensor> outputs;
+    tensorflow::RunMetadata run_metadata;
+    Status status;
+
+    {
+        StageTimer timer(Stage::SESSION_RUN);
+        status = _model.GetSession()->RunCallable(
+                trace ? _trace_callable : _predict_callable, {batchTensor},
+                &outputs, trace ? &run_metadata : nullptr, pools);
+    }
+    if (!status.ok()) {
+		LOG(ERROR) << status.ToString();
+        throw std::runtime_error(status.ToString());
+    }
+
+    if (trace) {
+        WriteTrace(run, run_metadata);
+    }
+
+    {
+        StageTimer timer(Stage::POSTPROCESS);
+        status = Postprocess(outputs, detections);
+    }
+    if (!status.ok()) {
+		LOG(ERROR) << status.ToString();
+        throw std::runtime_error(status.ToString());
+    }
+
+    size_t count = 0;
+    for (const auto& image_detections : detections) {
+        count += image_detections.size();
+    }
+
+    Metrics& metrics = Metrics::Global();
+    metrics.Add(Counter::BATCHES);
+    metrics.Add(tiles ? Counter::TILES_INFERRED : Counter::FRAMES_INFERRED,
+            batch_size);
+    metrics.Add(Counter::DETECTIONS, count);
+}
+
+Status DetectionModel::Postprocess(const std::vector<Tensor>& outputs,
+    std::vector<std::vector<Detection>>& detections) {
+
+    using namespace tensorflow;
+
+    if (outputs.size() != output_nodes.size()) {
+        return errors::Internal("Expected ", output_nodes.size(),
+                " outputs, got ", outputs.size());
+    }
+
+    const Tensor& boxes = outputs[DETECTION_BOXES];
+    const Tensor& classes = outputs[DETECTION_CLASSES];
+    const Tensor& scores = outputs[DETECTION_SCORES];
+    const Tensor& num_detections = outputs[NUM_DETECTIONS];
+
+    for (const Tensor* tensor : {&boxes, &classes, &scores, &num_detections}) {
+        if (tensor->dtype() != DT_FLOAT) {
+            return errors::InvalidArgument("Detection output must be float, "
+                    "got ", DataTypeString(tensor->dtype()));
+        }
+    }
+
+    if (scores.dims() != 2 || classes.shape() != scores.shape() ||
+        boxes.dims() != 3 || boxes.dim_size(2) != 4 ||
+        boxes.dim_size(1) != scores.dim_size(1)) {
+        return errors::InvalidArgument("Unexpected shapes of detection outputs: ",
+                boxes.shape().DebugString(), ", ", scores.shape().DebugString());
+    }
+
+    const int64 batch_size = scores.dim_size(0);
+    const int64 max_detections = scores.dim_size(1);
+
+    /* resize keeps capacity of vectors reused by caller */
+    detections.resize(batch_size);
+
+    for (int64 i = 0; i < batch_size; ++i) {
+        const int64 count = std::min(max_detections,
+                static_cast<int64>(num_detections.flat<float>()(i)));
+
+        BuildDetections(boxes.flat<float>().data() + i * max_detections * 4,
+                classes.flat<float>().data() + i * max_detections,
+                scores.flat<float>().data() + i * max_detections,
+                count, _postprocess_options, detections[i]);
+    }
+
+    return Status::OK();
+}
+
+void DetectionModel::PredictFitted(const cv::Mat& image,
+    std::vector<Detection>& detections) {
+
+    std::shared_ptr<FrameBuffer> buffer;
+    Status status;
+
+    {
+        StageTimer timer(Stage::TENSOR_BUILD);
+        status = _buckets->Fit(image, buffer);
+    }
     if (!status.ok()) {
 		LOG(ERROR) << status.ToString();
         throw std::runtime_error(status.ToString());
     }
 
-    LOG(INFO) << "Time of Convert Mat to tensor: "
-              << float(clock() - begin_time) / CLOCKS_PER_SEC;
+    Predict(buffer->tensor, detections);
 
-    Predict(imageTensor, predictions);
+    RestoreBoxes(buffer->content, detections);
 }
 
 void DetectionModel::Predict(const Tensor& imageTensor,
-    std::vector<Tensor>& predictions) {
+    std::vector<Detection>& detections) {
+
+    std::vector<std::vector<Detection>> batch;
+
+    RunBatch(imageTensor, batch, tensorflow::thread::ThreadPoolOptions());
+
+    detections = std::move(batch[0]);
 
-    const clock_t begin_time = clock();
-    /* status = _model.GetSession()->Run({{_input_layer, imageTensor}}, */
-    /*         _output_layers, {}, &predictions); */
+    VLOG(1) << "Run is successfully. Detections: " << detections.size();
+}
+
+void DetectionModel::PredictTiled(const std::vector<cv::Mat>& images,
+    std::vector<std::vector<Detection>>& detections,
+    const tensorflow::thread::ThreadPoolOptions& pools) {
+
+    std::vector<FrameTile> tiles;
+    std::vector<Tile> frame_tiles;
+    std::vector<TileRun> runs;
+    std::vector<std::vector<Detection>> results;
+
+    for (size_t i = 0; i < images.size(); ++i) {
+        if (images[i].type() != CV_8UC3) {
+            LOG(ERROR) << "Image must be CV_8UC3";
+            throw std::runtime_error("Image must be CV_8UC3");
+        }
+
+        TileFrame(images[i].rows, images[i].cols, _tiling, frame_tiles);
+        for (const Tile& tile : frame_tiles) {
+            FrameTile frame_tile;
+
+            frame_tile.image = i;
+            frame_tile.tile = tile;
+            tiles.push_back(frame_tile);
+        }
+    }
+
+    /* One run holds tiles of one shape: a frame no larger than a tile,
+     * or of another resolution, starts the next run.
+     * */
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        const bool same_shape = t > 0 &&
+            tiles[t].tile.roi.size() == tiles[t - 1].tile.roi.size();
+
+        if (!same_shape || (_tiling.tiles_per_run > 0 &&
+                runs.back().second - runs.back().first ==
+                    _tiling.tiles_per_run)) {
+            runs.emplace_back(t, t + 1);
+        } else {
+            ++runs.back().second;
+        }
+    }
 
-    auto status = _model.GetSession()->Run({{input_nodes, imageTensor}},
-            output_nodes, {}, &predictions);
+    results.resize(tiles.size());
+    if (_tile_pool && runs.size() > 1) {
+        std::vector<std::exception_ptr> errors(runs.size());
+
+        /* Cost per run is huge for the pool's cost model, so every run
+         * becomes its own shard. Session::Run is thread safe.
+         * */
+        _tile_pool->ParallelFor(static_cast<int64_t>(runs.size()),
+                std::numeric_limits<int32_t>::max(),
+                [&](int64_t begin, int64_t end) {
+            for (int64_t r = begin; r < end; ++r) {
+                try {
+                    RunTiles(images, tiles, runs[r], results, pools);
+                } catch (...) {
+                    errors[r] = std::current_exception();
+                }
+            }
+        });
+
+        for (const auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    } else {
+        for (const auto& run : runs) {
+            RunTiles(images, tiles, run, results, pools);
+        }
+    }
+
+    detections.assign(images.size(), std::vector<Detection>());
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        std::vector<Detection>& frame = detections[tiles[t].image];
+
+        RestoreBoxes(tiles[t].tile.content, results[t]);
+        frame.insert(frame.end(), results[t].begin(), results[t].end());
+    }
+
+    for (size_t i = 0; i < images.size(); ++i) {
+        if (images[i].rows <= _tiling.rows && images[i].cols <= _tiling.cols) {
+            continue;
+        }
+
+        if (_tiling.full_frame) {
+            std::vector<Detection> whole;
+
+            PredictWhole(images[i], whole, pools);
+            detections[i].insert(detections[i].end(), whole.begin(),
+                    whole.end());
+        }
+
+        StageTimer timer(Stage::POSTPROCESS);
+        MergeTileDetections(detections[i], _tiling.merge_threshold);
+    }
+
+    Metrics::Global().Add(Counter::FRAMES_INFERRED, images.size());
+}
+
+void DetectionModel::RunTiles(const std::vector<cv::Mat>& images,
+    const std::vector<FrameTile>& tiles, const TileRun& run,
+    std::vector<std::vector<Detection>>& results,
+    const tensorflow::thread::ThreadPoolOptions& pools) {
+
+    using namespace tensorflow;
+
+    const size_t count = run.second - run.first;
+    const cv::Size size = tiles[run.first].tile.roi.size();
+    std::vector<std::vector<Detection>> batch;
+    Tensor batchTensor;
+    Status status;
+
+    {
+        StageTimer timer(Stage::TENSOR_BUILD);
+
+        if (count == 1) {
+            /* Borrowed when the tile is whole rows of a continuous frame,
+             * e.g. a frame no larger than a tile, copied otherwise.
+             * */
+            const FrameTile& tile = tiles[run.first];
+            status = MatToTensor(images[tile.image](tile.tile.roi),
+                    batchTensor);
+        } else {
+            batchTensor = Tensor(DT_UINT8, TensorShape({
+                    static_cast<int64>(count), size.height, size.width,
+                    _image_channels}));
+
+            /* Every tile is copied from its view straight into its slot. */
+            uint8_t *p = batchTensor.flat<tensorflow::uint8>().data();
+            const size_t image_size =
+                static_cast<size_t>(size.height) * size.width * _image_channels;
+
+            for (size_t t = run.first; t < run.second; ++t) {
+                cv::Mat slot(size.height, size.width, CV_8UC3, p);
+
+                images[tiles[t].image](tiles[t].tile.roi).copyTo(slot);
+                p += image_size;
+            }
+        }
+    }
     if (!status.ok()) {
 		LOG(ERROR) << status.ToString();
         throw std::runtime_error(status.ToString());
     }
 
-    LOG(INFO) << "Time of Predict: "
-              << float(clock() - begin_time) / CLOCKS_PER_SEC;
+    RunBatch(batchTensor, batch, pools, true);
+
+    for (size_t k = 0; k < count; ++k) {
+        results[run.first + k] = std::move(batch[k]);
+    }
+}
+
+void DetectionModel::PredictWhole(const cv::Mat& image,
+    std::vector<Detection>& detections,
+    const tensorflow::thread::ThreadPoolOptions& pools) {
+
+    std::vector<std::vector<Detection>> batch;
+    std::shared_ptr<FrameBuffer> buffer;
+    Tensor imageTensor;
+    Status status;
+
+    {
+        StageTimer timer(Stage::TENSOR_BUILD);
+        if (_buckets) {
+            status = _buckets->Fit(image, buffer);
+        } else {
+            status = MatToTensor(image, imageTensor);
+        }
+    }
+    if (!status.ok()) {
+		LOG(ERROR) << status.ToString();
+        throw std::runtime_error(status.ToString());
+    }
 
-    LOG(INFO) << "Run is successfully. Predictions: " << predictions.size();
+    RunBatch(_buckets ? buffer->tensor : imageTensor, batch, pools, true);
+    detections = std::move(batch[0]);
 
-    for (auto tensor : predictions) {
-        std::cout << tensor.DebugString() << std::endl;
+    if (_buckets) {
+        RestoreBoxes(buffer->content, detections);
     }
 }
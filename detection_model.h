@@ -1,12 +1,29 @@
 #ifndef __DETECTION_MODEL_H__
 #define __DETECTION_MODEL_H__
 
+#include <atomic>
+#include <memory>
+
+#include <opencv2/core/mat.hpp>
+
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/cc/framework/scope.h"
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/util/command_line_flags.h"
 #include "tensorflow/cc/client/client_session.h"
 #include "tensorflow/cc/ops/standard_ops.h"
+#include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/platform/threadpool.h"
+#include "tensorflow/core/platform/threadpool_options.h"
+#include "tensorflow/core/public/session.h"
+
+#include "detection_postprocess.h"
+#include "encoded_image.h"
+#include "model_config.h"
+#include "model_startup.h"
+#include "result_cache.h"
+#include "shape_buckets.h"
+#include "tiling.h"
 
 using tensorflow::Flag;
 using tensorflow::Scope;
@@ -22,11 +39,19 @@ using tensorflow::DT_FLOAT;
 using tensorflow::DT_UINT8;
 using tensorflow::DT_STRING;
 using tensorflow::TensorShape;
+using tensorflow::Session;
+
+/* Load settings of DetectionModel: defaults without tags, since the
+ * detection SavedModels it is written for have none. "tags=serve" in
+ * --model_config loads models exported with tags.
+ * */
+ModelConfig DetectionModelConfig();
 
 class DetectionModel {
 private:
     Scope _root;
     std::string _path_to_model;
+    ModelConfig _config;
 
     SavedModelBundle _model;
     SessionOptions session_options;
@@ -38,6 +63,19 @@ private:
     Output _input_of_graph;
     Output _output_of_graph;
 
+    /* Graphs are built once, every call only runs a prepared callable. */
+    std::unique_ptr<Session> _image_session;
+    Session::CallableHandle _image_callable;
+    Session::CallableHandle _predict_callable;
+
+    /* Same feeds and fetches with FULL_TRACE run_options,
+     * used for every _trace_every-th run when tracing is enabled.
+     * */
+    Session::CallableHandle _trace_callable;
+    std::string _trace_dir;
+    int _trace_every = 0;
+    std::atomic<uint64_t> _runs{0};
+
     std::string _input_layer = "hub_input/image_tensor:0";
     std::vector<std::string> _output_layers = {{
         "hub_input/strided_slice:0",
@@ -47,6 +85,31 @@ private:
         "hub_input/strided_slice_1:0"
     }};
 
+    /* Index of tensor in output_nodes */
+    enum Outputs {
+        DETECTION_ANCHOR_INDICES = 0,
+        DETECTION_BOXES,
+        DETECTION_CLASSES,
+        DETECTION_MULTICLASS_SCORES,
+        DETECTION_SCORES,
+        NUM_DETECTIONS,
+    };
+
+    PostprocessOptions _postprocess_options;
+    std::unique_ptr<ShapeBuckets> _buckets;
+    std::unique_ptr<ResultCache> _cache;
+
+    struct FrameTile {
+        size_t image; // Index of the frame in its batch
+        Tile tile;
+    };
+
+    /* Runs [first, last) of tiles of one frame batch. */
+    using TileRun = std::pair<size_t, size_t>;
+
+    TileOptions _tiling;
+    std::unique_ptr<tensorflow::thread::ThreadPool> _tile_pool;
+
     std::string input_nodes = "serving_default_input_tensor:0";
     std::vector<std::string> output_nodes = {{
         "StatefulPartitionedCall:0", //detection_anchor_indices
@@ -58,14 +121,138 @@ private:
     }};
 
     Status CreateGraphForImage();
-    Status ImageToTensor(const std::string& path_to_image, Tensor& imageTensor);
-    Status ImageToTensor(Tensor& imageTensor);
-    void Predict(const Tensor& imageTensor, std::vector<Tensor>& predictions);
+    Status CreateCallables();
+    Status ImageToTensor(tensorflow::StringPiece jpeg, Tensor& imageTensor);
+    Status ImagesToTensor(const std::vector<cv::Mat>& images,
+            Tensor& batchTensor, std::vector<Box>& contents);
+    void RunBatch(const Tensor& batchTensor,
+            std::vector<std::vector<Detection>>& detections,
+            const tensorflow::thread::ThreadPoolOptions& pools,
+            bool tiles = false);
+    Status Postprocess(const std::vector<Tensor>& outputs,
+            std::vector<std::vector<Detection>>& detections);
+    void WriteTrace(uint64_t run, const tensorflow::RunMetadata& run_metadata);
+    void Predict(const Tensor& imageTensor, std::vector<Detection>& detections);
+    void PredictFitted(const cv::Mat& image,
+            std::vector<Detection>& detections);
+    void PredictJpeg(tensorflow::StringPiece jpeg,
+            std::vector<Detection>& detections);
+    void PredictImages(const std::vector<cv::Mat>& images,
+            std::vector<std::vector<Detection>>& detections);
+    void PredictTensors(const std::vector<Tensor>& images,
+            std::vector<std::vector<Detection>>& detections,
+            const tensorflow::thread::ThreadPoolOptions& pools);
+    void PredictTiled(const std::vector<cv::Mat>& images,
+            std::vector<std::vector<Detection>>& detections,
+            const tensorflow::thread::ThreadPoolOptions& pools);
+    void RunTiles(const std::vector<cv::Mat>& images,
+            const std::vector<FrameTile>& tiles, const TileRun& run,
+            std::vector<std::vector<Detection>>& results,
+            const tensorflow::thread::ThreadPoolOptions& pools);
+    void PredictWhole(const cv::Mat& image, std::vector<Detection>& detections,
+            const tensorflow::thread::ThreadPoolOptions& pools);
+    void LookupBatch(const std::vector<cv::Mat>& images,
+            std::vector<CacheKey>& keys,
+            std::vector<std::vector<Detection>>& detections,
+            std::vector<size_t>& misses);
+    void StoreBatch(const std::vector<CacheKey>& keys,
+            const std::vector<size_t>& misses,
+            std::vector<std::vector<Detection>>& results,
+            std::vector<std::vector<Detection>>& detections);
 public:
-    DetectionModel(const std::string& path_to_model);
+    DetectionModel(const std::string& path_to_model,
+            const ModelConfig& config = DetectionModelConfig());
+    ~DetectionModel();
+
+    DetectionModel(const DetectionModel&) = delete;
+    DetectionModel& operator=(const DetectionModel&) = delete;
+
+    /* Options are read by every run, set them before any prediction. */
+    void SetPostprocessOptions(const PostprocessOptions& options) {
+        _postprocess_options = options;
+    }
+
+    /* Fit images of Testing, PredictEncoded and PredictBatch of cv::Mat
+     * into the given input shapes, boxes are still relative to the
+     * original image. Frames passed as tensors are fed as they are.
+     * Call before any prediction.
+     * */
+    void SetShapeBuckets(const BucketOptions& options);
+
+    /* Split frames larger than a tile into overlapping tiles, run them
+     * as batches of tiles_per_run, parallel_runs batches at once, and
+     * merge their boxes in frame coordinates. Small objects keep their
+     * pixels instead of vanishing in the model's own resize. Applies to
+     * every prediction, shape buckets fit only the whole frame pass.
+     * Throws on bad options. Call before any prediction.
+     * */
+    void SetTiling(const TileOptions& options);
+
+    /* Answer repeated images and, with near_distance, near-duplicate
+     * frames from a result cache instead of running the model. Results
+     * depend on postprocess options, shape buckets and tiling, so call
+     * after setting them and before any prediction. Entries of options.file
+     * are loaded now and saved when the model is destroyed.
+     * */
+    void SetResultCache(const CacheOptions& options);
+
+    /* Run every every_n_runs-th Session::Run with RunOptions::FULL_TRACE
+     * and write its step stats to trace_dir/trace_<run>.json as Chrome
+     * trace. Tracing slows down the traced runs, keep every_n_runs large
+     * under load. Call before any prediction.
+     * */
+    void EnableTrace(const std::string& trace_dir, int every_n_runs);
+
+    /* Warmup frames: requests of assets.extra/tf_serving_warmup_requests
+     * when the model has them, otherwise zero [N, H, W, 3] frames of every
+     * shape and batch size of options.
+     * */
+    Status WarmupInputs(const WarmupOptions& options,
+            std::vector<Tensor>& inputs);
+
+    /* Run every input runs times on the given pools, so lazy kernel,
+     * allocator and pool setup is done before the first real frame.
+     * Warmup runs are not counted in metrics.
+     * */
+    Status Warmup(const std::vector<Tensor>& inputs, int runs,
+            const tensorflow::thread::ThreadPoolOptions& pools);
+
+    /* JPEG bytes to a [1, H, W, 3] uint8 tensor. Thread safe, so
+     * callers can decode on their own threads and batch the results.
+     * */
+    Status DecodeImage(tensorflow::StringPiece jpeg, Tensor& image) {
+        return ImageToTensor(jpeg, image);
+    }
+
+    /* JPEG file is mapped and decoded from the mapping. */
+    std::vector<Detection> Testing(const std::string& path_to_image);
+    std::vector<Detection> Testing(cv::Mat& image);
+
+    /* JPEG bytes from memory, a mapping or an ImageArchive entry,
+     * decoded without copying them.
+     * */
+    std::vector<Detection> PredictEncoded(tensorflow::StringPiece jpeg);
+
+    /* Run all images as one [N, H, W, 3] tensor.
+     * Every image must be CV_8UC3 and, without shape buckets, have the
+     * same resolution; with them all go to the bucket of the largest.
+     * detections[i] holds the results for images[i].
+     * */
+    void PredictBatch(const std::vector<cv::Mat>& images,
+            std::vector<std::vector<Detection>>& detections);
+
+    /* Same for frames already stored as [1, H, W, 3] uint8 tensors.
+     * Single frame is fed without any copy.
+     * */
+    void PredictBatch(const std::vector<Tensor>& images,
+            std::vector<std::vector<Detection>>& detections);
 
-    void Testing(const std::string& path_to_image);
-    void Testing(cv::Mat& image);
+    /* Same, but ops run on the given thread pools instead of
+     * the session ones. Safe to call from several threads.
+     * */
+    void PredictBatch(const std::vector<Tensor>& images,
+            std::vector<std::vector<Detection>>& detections,
+            const tensorflow::thread::ThreadPoolOptions& pools);
 };
 
 #endif /* __DETECTION_MODEL_H__ */
@@ -0,0 +1,210 @@
+#include "detection_postprocess.h"
+
+#include <algorithm>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* Push index of every set bit of mask, bit 0 is scores[base]. */
+static inline
+void push_mask(unsigned mask, int32_t base, std::vector<int32_t>& indices) {
+    while (mask != 0) {
+        indices.push_back(base + __builtin_ctz(mask));
+        mask &= mask - 1;
+    }
+}
+
+void SelectScores(const float* scores, size_t count, float threshold,
+        std::vector<int32_t>& indices) {
+    size_t pos = 0;
+
+#if defined(__AVX__)
+    const __m256 threshold8 = _mm256_set1_ps(threshold);
+    for (; pos + 8 <= count; pos += 8) {
+        __m256 ge = _mm256_cmp_ps(_mm256_loadu_ps(scores + pos), threshold8,
+                _CMP_GE_OQ);
+        push_mask(_mm256_movemask_ps(ge), pos, indices);
+    }
+#elif defined(__SSE2__)
+    const __m128 threshold4 = _mm_set1_ps(threshold);
+    for (; pos + 4 <= count; pos += 4) {
+        __m128 ge = _mm_cmpge_ps(_mm_loadu_ps(scores + pos), threshold4);
+        push_mask(_mm_movemask_ps(ge), pos, indices);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t threshold4 = vdupq_n_f32(threshold);
+    const uint32x4_t bits = {1, 2, 4, 8};
+    for (; pos + 4 <= count; pos += 4) {
+        uint32x4_t ge = vcgeq_f32(vld1q_f32(scores + pos), threshold4);
+        push_mask(vaddvq_u32(vandq_u32(ge, bits)), pos, indices);
+    }
+#endif
+
+    for (; pos < count; ++pos) {
+        if (scores[pos] >= threshold) {
+            indices.push_back(pos);
+        }
+    }
+}
+
+float IoU(const Box& a, const Box& b) {
+    const float ymin = std::max(a.ymin, b.ymin);
+    const float xmin = std::max(a.xmin, b.xmin);
+    const float ymax = std::min(a.ymax, b.ymax);
+    const float xmax = std::min(a.xmax, b.xmax);
+
+    const float intersection = std::max(0.f, ymax - ymin) *
+                               std::max(0.f, xmax - xmin);
+    const float area_a = (a.ymax - a.ymin) * (a.xmax - a.xmin);
+    const float area_b = (b.ymax - b.ymin) * (b.xmax - b.xmin);
+    const float uni = area_a + area_b - intersection;
+
+    return uni > 0.f ? intersection / uni : 0.f;
+}
+
+static
+bool higher_score(const Detection& left, const Detection& right) {
+    return left.score > right.score;
+}
+
+void ClassAwareNms(std::vector<Detection>& detections, float iou_threshold) {
+    size_t kept = 0;
+
+    std::stable_sort(detections.begin(), detections.end(), higher_score);
+
+    /* Detections before kept survived, compare candidates only with them. */
+    for (size_t pos = 0; pos < detections.size(); ++pos) {
+        bool suppressed = false;
+
+        for (size_t other = 0; other < kept; ++other) {
+            if (detections[other].class_id == detections[pos].class_id &&
+                IoU(detections[other].box, detections[pos].box) > iou_threshold) {
+                suppressed = true;
+                break;
+            }
+        }
+
+        if (!suppressed) {
+            detections[kept++] = detections[pos];
+        }
+    }
+
+    detections.resize(kept);
+}
+
+/* Intersection over the area of the smaller box. */
+static
+float overlap_of_smaller(const Box& a, const Box& b) {
+    const float ymin = std::max(a.ymin, b.ymin);
+    const float xmin = std::max(a.xmin, b.xmin);
+    const float ymax = std::min(a.ymax, b.ymax);
+    const float xmax = std::min(a.xmax, b.xmax);
+
+    const float intersection = std::max(0.f, ymax - ymin) *
+                               std::max(0.f, xmax - xmin);
+    const float smaller = std::min((a.ymax - a.ymin) * (a.xmax - a.xmin),
+                                   (b.ymax - b.ymin) * (b.xmax - b.xmin));
+
+    return smaller > 0.f ? intersection / smaller : 0.f;
+}
+
+void MergeTileDetections(std::vector<Detection>& detections, float threshold) {
+    size_t kept = 0;
+
+    std::stable_sort(detections.begin(), detections.end(), higher_score);
+
+    /* Compared with the original boxes of kept ones, so a merge can't
+     * snowball a chain of neighbours into one box.
+     * */
+    std::vector<Box> originals;
+    originals.reserve(detections.size());
+
+    for (size_t pos = 0; pos < detections.size(); ++pos) {
+        const Detection candidate = detections[pos];
+        bool merged = false;
+
+        for (size_t other = 0; other < kept; ++other) {
+            if (detections[other].class_id != candidate.class_id ||
+                overlap_of_smaller(originals[other], candidate.box) <
+                    threshold) {
+                continue;
+            }
+
+            Box& box = detections[other].box;
+            box.ymin = std::min(box.ymin, candidate.box.ymin);
+            box.xmin = std::min(box.xmin, candidate.box.xmin);
+            box.ymax = std::max(box.ymax, candidate.box.ymax);
+            box.xmax = std::max(box.xmax, candidate.box.xmax);
+            merged = true;
+            break;
+        }
+
+        if (!merged) {
+            originals.push_back(candidate.box);
+            detections[kept++] = candidate;
+        }
+    }
+
+    detections.resize(kept);
+}
+
+static
+float restore(float value, float begin, float size) {
+    return std::min(1.f, std::max(0.f, (value - begin) / size));
+}
+
+void RestoreBoxes(const Box& content, std::vector<Detection>& detections) {
+    const float height = content.ymax - content.ymin;
+    const float width = content.xmax - content.xmin;
+    size_t kept = 0;
+
+    if (height <= 0.f || width <= 0.f) {
+        detections.clear();
+        return;
+    }
+
+    for (size_t pos = 0; pos < detections.size(); ++pos) {
+        Box& box = detections[pos].box;
+
+        box.ymin = restore(box.ymin, content.ymin, height);
+        box.xmin = restore(box.xmin, content.xmin, width);
+        box.ymax = restore(box.ymax, content.ymin, height);
+        box.xmax = restore(box.xmax, content.xmin, width);
+
+        if (box.ymax > box.ymin && box.xmax > box.xmin) {
+            detections[kept++] = detections[pos];
+        }
+    }
+
+    detections.resize(kept);
+}
+
+void BuildDetections(const float* boxes, const float* classes,
+        const float* scores, size_t count, const PostprocessOptions& options,
+        std::vector<Detection>& detections) {
+    std::vector<int32_t> indices;
+
+    indices.reserve(count);
+    detections.clear();
+    detections.reserve(count);
+
+    SelectScores(scores, count, options.score_threshold, indices);
+
+    for (int32_t index : indices) {
+        const float* box = boxes + static_cast<size_t>(index) * 4;
+        Detection detection;
+
+        detection.box = {box[0], box[1], box[2], box[3]};
+        detection.class_id = static_cast<int32_t>(classes[index]);
+        detection.score = scores[index];
+
+        detections.push_back(detection);
+    }
+
+    if (options.nms) {
+        ClassAwareNms(detections, options.nms_iou_threshold);
+    }
+}
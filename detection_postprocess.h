@@ -0,0 +1,64 @@
+#ifndef __DETECTION_POSTPROCESS_H__
+#define __DETECTION_POSTPROCESS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Normalized coordinates, order of detection_boxes output. */
+struct Box {
+    float ymin;
+    float xmin;
+    float ymax;
+    float xmax;
+};
+
+struct Detection {
+    Box box;
+    int32_t class_id;
+    float score;
+};
+
+struct PostprocessOptions {
+    float score_threshold = 0.5f;
+    bool nms = false;              // Class-aware NMS over model output
+    float nms_iou_threshold = 0.5f;
+};
+
+/* Append indices of scores >= threshold, in ascending order.
+ * Vectorized with AVX/SSE2/NEON when available.
+ * */
+void SelectScores(const float* scores, size_t count, float threshold,
+        std::vector<int32_t>& indices);
+
+float IoU(const Box& a, const Box& b);
+
+/* Greedy NMS among detections of the same class.
+ * Keeps order by descending score.
+ * */
+void ClassAwareNms(std::vector<Detection>& detections, float iou_threshold);
+
+/* Merge of detections from overlapping tiles, same class only.
+ * A box that shares at least threshold of the smaller of the two with
+ * a higher scored one is merged into it: the kept box grows to their
+ * union. So a box cut by a tile edge joins the whole one from the
+ * neighbouring tile instead of surviving IoU NMS. Keeps order by
+ * descending score.
+ * */
+void MergeTileDetections(std::vector<Detection>& detections, float threshold);
+
+/* Map boxes normalized to a padded or resized input back to the source
+ * frame, content is where the frame lies in that input. Boxes are
+ * clipped to the frame, the ones entirely in padding are dropped.
+ * */
+void RestoreBoxes(const Box& content, std::vector<Detection>& detections);
+
+/* Build detections of one image from raw model outputs.
+ * boxes has count * 4 values, classes and scores have count values.
+ * detections is cleared, capacity is kept between calls.
+ * */
+void BuildDetections(const float* boxes, const float* classes,
+        const float* scores, size_t count, const PostprocessOptions& options,
+        std::vector<Detection>& detections);
+
+#endif /* __DETECTION_POSTPROCESS_H__ */
@@ -0,0 +1,402 @@
+/*
+ * Resident detection server: loads the model once and answers requests
+ * over HTTP on a Unix socket and/or a localhost port, so small jobs
+ * don't pay for model load and concurrent clients share batches.
+ *
+ *   POST /v1/detect   JPEG body (Content-Type: image/jpeg), or a packed
+ *                     RGB24 frame (application/octet-stream) with
+ *                     X-Frame-Width and X-Frame-Height headers.
+ *                     X-Deadline-Ms overrides --deadline_ms.
+ *   GET  /healthz     200 when the model is ready, 503 while it loads
+ *   GET  /metrics     Prometheus text
+ * */
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/util/command_line_flags.h"
+
+#include "detection_service.h"
+#include "http_server.h"
+#include "metrics.h"
+
+using tensorflow::Flag;
+
+enum Code {
+    SUCCESS_CODE = 0,
+    ERROR_CODE   = -1,
+};
+
+static HttpServer* running_server = nullptr;
+
+static
+void stop_server(int) {
+    if (running_server != nullptr) {
+        running_server->Stop();
+    }
+}
+
+static
+void write_json_string(std::ostream& output, const std::string& value) {
+    output << '"';
+    for (unsigned char c : value) {
+        switch (c) {
+        case '"':  output << "\\\""; break;
+        case '\\': output << "\\\\"; break;
+        case '\n': output << "\\n"; break;
+        case '\r': output << "\\r"; break;
+        case '\t': output << "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                output << escaped;
+            } else {
+                output << c;
+            }
+        }
+    }
+    output << '"';
+}
+
+static
+HttpResponse error_response(const Status& status) {
+    using namespace tensorflow;
+
+    std::ostringstream body;
+    HttpResponse response;
+
+    switch (status.code()) {
+    case error::INVALID_ARGUMENT:  response.status = 400; break;
+    case error::UNAVAILABLE:       response.status = 503; break;
+    case error::DEADLINE_EXCEEDED: response.status = 504; break;
+    default:                       response.status = 500; break;
+    }
+
+    body << "{\"error\":";
+    write_json_string(body, status.error_message());
+    body << ",\"code\":\"" << error_name(status.code()) << "\"}\n";
+    response.body = body.str();
+
+    return response;
+}
+
+static
+HttpResponse result_response(const ImageResult& result) {
+    std::ostringstream body;
+    HttpResponse response;
+
+    if (!result.status.ok()) {
+        return error_response(result.status);
+    }
+
+    body << "{\"width\":" << result.width << ",\"height\":" << result.height
+         << ",\"detections\":[";
+    for (size_t i = 0; i < result.detections.size(); ++i) {
+        const Detection& detection = result.detections[i];
+
+        body << (i > 0 ? "," : "") << "{\"class_id\":" << detection.class_id
+             << ",\"score\":" << detection.score
+             << ",\"box\":[" << detection.box.ymin << ","
+             << detection.box.xmin << "," << detection.box.ymax << ","
+             << detection.box.xmax << "]}";
+    }
+    body << "],\"batch_size\":" << result.batch_size
+         << ",\"queue_ms\":" << result.queue_seconds * 1000.
+         << ",\"inference_ms\":" << result.inference_seconds * 1000.
+         << "}\n";
+    response.body = body.str();
+
+    return response;
+}
+
+static
+bool parse_int(const std::string& value, long& result) {
+    char* end = nullptr;
+
+    result = std::strtol(value.c_str(), &end, 10);
+
+    return !value.empty() && *end == '\0';
+}
+
+/* Image request of a POST /v1/detect, body is moved out of it. */
+static
+Status detect_request(HttpRequest& http, int default_deadline_ms,
+        ImageRequest& request) {
+    using namespace tensorflow;
+
+    const std::string type = http.Header("content-type");
+    long deadline_ms = default_deadline_ms;
+
+    if (http.headers.count("x-deadline-ms") != 0 &&
+        (!parse_int(http.Header("x-deadline-ms"), deadline_ms) ||
+         deadline_ms < 0)) {
+        return errors::InvalidArgument("Bad X-Deadline-Ms");
+    }
+
+    if (type.compare(0, 24, "application/octet-stream") == 0) {
+        long width;
+        long height;
+
+        if (!parse_int(http.Header("x-frame-width"), width) ||
+            !parse_int(http.Header("x-frame-height"), height) ||
+            width <= 0 || height <= 0 || width > (1 << 16) ||
+            height > (1 << 16)) {
+            return errors::InvalidArgument("RGB24 frame needs X-Frame-Width "
+                    "and X-Frame-Height");
+        }
+        request.width = static_cast<int>(width);
+        request.height = static_cast<int>(height);
+    } else if (!type.empty() && type.compare(0, 10, "image/jpeg") != 0) {
+        return errors::InvalidArgument("Unsupported Content-Type ", type,
+                ", use image/jpeg or application/octet-stream");
+    }
+    if (http.body.empty()) {
+        return errors::InvalidArgument("Empty body");
+    }
+
+    request.data = std::move(http.body);
+    request.arrival = http.arrival;
+    if (deadline_ms > 0) {
+        request.deadline = http.arrival + std::chrono::milliseconds(deadline_ms);
+    }
+
+    return Status::OK();
+}
+
+int main(int argc, char** argv) {
+    std::string path_to_model;
+    std::string model_config;
+    std::string model_config_file;
+    std::string unix_socket;
+    std::string host = "127.0.0.1";
+    int32_t port = 0;
+    int32_t workers = 1;
+    int32_t intra_op_threads = 0;
+    int32_t inter_op_threads = 0;
+    std::string cpu_pinning = "none";
+    int32_t max_batch_size = 8;
+    int32_t max_batch_wait_ms = 5;
+    int32_t max_queue = 256;
+    int32_t decode_threads = 2;
+    int32_t deadline_ms = 1000;
+    int32_t max_body_mb = 64;
+    int32_t max_connections = 1024;
+    std::string shape_buckets;
+    std::string bucket_fit = "letterbox";
+    int32_t bucket_buffers = 0;
+    int32_t warmup_runs = 1;
+    std::string warmup_shapes;
+    float score_threshold = 0.5f;
+    bool nms = false;
+    float nms_iou_threshold = 0.5f;
+    int32_t cache_entries = 0;
+    int32_t cache_near_distance = -1;
+    std::string cache_file;
+
+    std::vector<Flag> flag_list = {
+        Flag("model", &path_to_model, "path of model to be served"),
+        Flag("model_config", &model_config,
+                "load settings as key=value,..."),
+        Flag("model_config_file", &model_config_file,
+                "load settings, one key = value per line"),
+        Flag("unix_socket", &unix_socket, "path of Unix socket to listen on"),
+        Flag("port", &port, "TCP port to listen on, 0 - off"),
+        Flag("host", &host, "IPv4 address of the TCP port"),
+        Flag("workers", &workers, "count of inference workers sharing model"),
+        Flag("intra_op_threads", &intra_op_threads,
+                "intra-op threads of every worker, 0 - TF default pool"),
+        Flag("inter_op_threads", &inter_op_threads,
+                "inter-op threads of every worker, 0 - TF default pool"),
+        Flag("cpu_pinning", &cpu_pinning,
+                "bind worker pools to CPUs: none, core or numa"),
+        Flag("max_batch_size", &max_batch_size,
+                "max requests coalesced into one model run"),
+        Flag("max_batch_wait_ms", &max_batch_wait_ms,
+                "max wait of a request for its batch to fill"),
+        Flag("max_queue", &max_queue,
+                "requests waiting at most, more are answered with 503"),
+        Flag("decode_threads", &decode_threads, "threads decoding JPEG"),
+        Flag("deadline_ms", &deadline_ms,
+                "default deadline of a request, 0 - none"),
+        Flag("max_body_mb", &max_body_mb, "max size of a request body"),
+        Flag("max_connections", &max_connections, "max open connections"),
+        Flag("shape_buckets", &shape_buckets,
+                "model input sizes as HxW,..., requests of any size are "
+                "fitted into one and batched together"),
+        Flag("bucket_fit", &bucket_fit,
+                "fitting into a bucket: letterbox or stretch"),
+        Flag("bucket_buffers", &bucket_buffers,
+                "buffers of every bucket allocated at start"),
+        Flag("warmup_runs", &warmup_runs,
+                "runs of every warmup input before serving, 0 - off"),
+        Flag("warmup_shapes", &warmup_shapes,
+                "image sizes to warm up as HxW,..., default - buckets"),
+        Flag("score_threshold", &score_threshold,
+                "min score of reported detection"),
+        Flag("nms", &nms, "run class-aware NMS over model output"),
+        Flag("nms_iou_threshold", &nms_iou_threshold,
+                "IoU above which NMS suppresses a detection"),
+        Flag("cache_entries", &cache_entries,
+                "results kept for repeated frames, 0 - no result cache"),
+        Flag("cache_near_distance", &cache_near_distance,
+                "max dHash bits a near-duplicate frame differs by, -1 - off"),
+        Flag("cache_file", &cache_file,
+                "result cache kept across restarts, empty - memory only"),
+    };
+
+    std::string usage = tensorflow::Flags::Usage(argv[0], flag_list);
+    bool parse_result = tensorflow::Flags::Parse(&argc, argv, flag_list);
+    if (!parse_result || path_to_model.empty()) {
+        LOG(ERROR) << usage;
+        return ERROR_CODE;
+    }
+
+    try {
+        ModelPoolOptions pool_options;
+        DetectionServiceOptions service_options;
+        HttpServerOptions server_options;
+        PostprocessOptions postprocess_options;
+        CacheOptions cache_options;
+
+        pool_options.workers = workers;
+        pool_options.intra_op_threads = intra_op_threads;
+        pool_options.inter_op_threads = inter_op_threads;
+        if (!ParseCpuPinning(cpu_pinning, pool_options.pinning)) {
+            LOG(ERROR) << "Unknown cpu_pinning " << cpu_pinning;
+            return ERROR_CODE;
+        }
+
+        /* Pairs of --model_config override the file. */
+        Status status = Status::OK();
+        if (!model_config_file.empty()) {
+            status = LoadModelConfig(model_config_file,
+                    pool_options.model_config);
+        }
+        if (status.ok()) {
+            status = ParseModelConfig(model_config, pool_options.model_config);
+        }
+        if (!status.ok()) {
+            LOG(ERROR) << status.ToString();
+            return ERROR_CODE;
+        }
+
+        if (!ParseWarmupShapes(shape_buckets, service_options.buckets.shapes) ||
+            !ParseBucketFit(bucket_fit, service_options.buckets.fit)) {
+            LOG(ERROR) << "Bad shape_buckets or bucket_fit";
+            return ERROR_CODE;
+        }
+        service_options.buckets.preallocate = std::max(0, bucket_buffers);
+        service_options.max_batch_size = std::max(1, max_batch_size);
+        service_options.max_batch_wait =
+            std::chrono::milliseconds(max_batch_wait_ms);
+        service_options.max_queue = std::max(1, max_queue);
+        service_options.decode_threads = decode_threads;
+
+        /* Clients connect while the model loads, /healthz tells them
+         * when it is ready.
+         * */
+        pool_options.background_load = true;
+        pool_options.warmup.runs = warmup_runs;
+        pool_options.warmup.batch_sizes = {1};
+        if (max_batch_size > 1) {
+            pool_options.warmup.batch_sizes.push_back(max_batch_size);
+        }
+        if (warmup_shapes.empty()) {
+            pool_options.warmup.shapes = service_options.buckets.shapes;
+        }
+        if (!ParseWarmupShapes(warmup_shapes, pool_options.warmup.shapes)) {
+            LOG(ERROR) << "Bad warmup_shapes";
+            return ERROR_CODE;
+        }
+
+        postprocess_options.score_threshold = score_threshold;
+        postprocess_options.nms = nms;
+        postprocess_options.nms_iou_threshold = nms_iou_threshold;
+        cache_options.capacity = std::max(0, cache_entries);
+        cache_options.near_distance = cache_near_distance;
+        cache_options.file = cache_file;
+        pool_options.prepare = [&](DetectionModel& model) {
+            model.SetPostprocessOptions(postprocess_options);
+            model.SetResultCache(cache_options);
+        };
+
+        server_options.unix_socket = unix_socket;
+        server_options.port = port;
+        server_options.host = host;
+        server_options.max_body_bytes =
+            static_cast<size_t>(std::max(1, max_body_mb)) << 20;
+        server_options.max_connections = std::max(1, max_connections);
+
+        ModelPool model(path_to_model, pool_options);
+        DetectionService service(model, service_options);
+
+        HttpServer server(server_options,
+                [&](HttpRequest& request, HttpServer::Reply reply) {
+            if (request.path == "/v1/detect") {
+                ImageRequest image;
+
+                if (request.method != "POST") {
+                    reply({405, "text/plain", "Use POST\n"});
+                    return;
+                }
+
+                Status status = detect_request(request, deadline_ms, image);
+                if (!status.ok()) {
+                    reply(error_response(status));
+                    return;
+                }
+
+                service.Submit(std::move(image), [reply](ImageResult& result) {
+                    reply(result_response(result));
+                });
+            } else if (request.path == "/healthz") {
+                std::ostringstream body;
+                const bool ready = model.Ready();
+
+                body << "{\"ready\":" << (ready ? "true" : "false")
+                     << ",\"queued\":" << service.Queued() << "}\n";
+                reply({ready ? 200 : 503, "application/json", body.str()});
+            } else if (request.path == "/metrics") {
+                reply({200, "text/plain; version=0.0.4",
+                        Metrics::Global().ExportPrometheus()});
+            } else {
+                reply({404, "text/plain", "Not found\n"});
+            }
+        });
+
+        status = server.Listen();
+        if (!status.ok()) {
+            LOG(ERROR) << status.ToString();
+            return ERROR_CODE;
+        }
+
+        running_server = &server;
+        std::signal(SIGINT, stop_server);
+        std::signal(SIGTERM, stop_server);
+
+        server.Run();
+
+        /* Threads stop before the server and the model go away,
+         * requests still waiting are dropped with their connections.
+         * */
+        LOG(INFO) << "Stopping, " << service.Queued() << " requests waiting";
+        service.Stop();
+        running_server = nullptr;
+
+        /* Throws if the model failed to load in background. */
+        model.WaitReady();
+    } catch (const std::exception& e) {
+        LOG(ERROR) << e.what();
+        return ERROR_CODE;
+    }
+
+    return SUCCESS_CODE;
+}
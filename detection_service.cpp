@@ -0,0 +1,346 @@
+#include "detection_service.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "tensorflow/core/platform/errors.h"
+
+#include "metrics.h"
+
+using Clock = std::chrono::steady_clock;
+
+static
+double seconds_between(Clock::time_point begin, Clock::time_point end) {
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+DetectionService::DetectionService(ModelPool& pool,
+        const DetectionServiceOptions& options) :
+    _pool(pool), _options(options) {
+    if (!_options.buckets.shapes.empty()) {
+        _buckets.reset(new ShapeBuckets(_options.buckets));
+    }
+    _options.max_batch_size = std::max<size_t>(1, _options.max_batch_size);
+
+    for (int i = 0; i < std::max(1, _options.decode_threads); ++i) {
+        _decoders.emplace_back(&DetectionService::Decoder, this);
+    }
+    for (size_t i = 0; i < _pool.Workers(); ++i) {
+        _dispatchers.emplace_back(&DetectionService::Dispatcher, this);
+    }
+}
+
+DetectionService::~DetectionService() {
+    Stop();
+}
+
+void DetectionService::Submit(ImageRequest&& request, Callback done) {
+    std::unique_ptr<Pending> pending(new Pending());
+
+    pending->request = std::move(request);
+    pending->done = std::move(done);
+    if (pending->request.arrival == Clock::time_point()) {
+        pending->request.arrival = Clock::now();
+    }
+    if (pending->request.deadline == Clock::time_point()) {
+        pending->request.deadline = Clock::time_point::max();
+    }
+    Metrics::Global().Add(Counter::REQUESTS);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_stop && _queued < _options.max_queue) {
+            ++_queued;
+            _undecoded.push_back(std::move(pending));
+            _decode_cv.notify_one();
+            return;
+        }
+    }
+
+    ImageResult result;
+    result.status = tensorflow::errors::Unavailable(
+            "Server is busy or shutting down");
+    Metrics::Global().Add(Counter::REQUESTS_REJECTED);
+    Finish(*pending, result);
+}
+
+size_t DetectionService::Queued() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _queued;
+}
+
+void DetectionService::Stop() {
+    std::deque<std::unique_ptr<Pending>> left;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stop) {
+            return;
+        }
+        _stop = true;
+    }
+    _decode_cv.notify_all();
+    _batch_cv.notify_all();
+
+    for (auto& thread : _decoders) {
+        thread.join();
+    }
+    for (auto& thread : _dispatchers) {
+        thread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        left.swap(_undecoded);
+        for (auto& pending : _ready) {
+            left.push_back(std::move(pending));
+        }
+        _ready.clear();
+        _queued = 0;
+    }
+
+    for (auto& pending : left) {
+        ImageResult result;
+        result.status = tensorflow::errors::Unavailable("Server is stopping");
+        Finish(*pending, result);
+    }
+}
+
+void DetectionService::Finish(Pending& pending, ImageResult& result) {
+    if (tensorflow::errors::IsDeadlineExceeded(result.status)) {
+        Metrics::Global().Add(Counter::DEADLINES_EXCEEDED);
+    }
+    if (result.width == 0) {
+        result.width = pending.width;
+        result.height = pending.height;
+    }
+
+    pending.done(result);
+
+    Metrics::Global().Record(Stage::REQUEST, static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - pending.request.arrival).count()));
+}
+
+Status DetectionService::Decode(Pending& pending) {
+    using namespace tensorflow;
+
+    const ImageRequest& request = pending.request;
+    Tensor decoded;
+    cv::Mat image;
+
+    StageTimer timer(Stage::TENSOR_BUILD);
+
+    if (request.width == 0) {
+        TF_RETURN_IF_ERROR(_pool.Model().DecodeImage(request.data, decoded));
+        pending.height = decoded.dim_size(1);
+        pending.width = decoded.dim_size(2);
+
+        if (!_buckets) {
+            pending.image = std::move(decoded);
+            return Status::OK();
+        }
+        image = cv::Mat(pending.height, pending.width, CV_8UC3,
+                decoded.flat<uint8>().data());
+    } else {
+        const size_t size = static_cast<size_t>(request.width) *
+            request.height * 3;
+
+        if (request.width <= 0 || request.height <= 0 ||
+            request.data.size() != size) {
+            return errors::InvalidArgument("RGB24 frame ", request.width, "x",
+                    request.height, " needs ", size, " bytes, got ",
+                    request.data.size());
+        }
+        pending.width = request.width;
+        pending.height = request.height;
+
+        image = cv::Mat(request.height, request.width, CV_8UC3,
+                const_cast<char*>(request.data.data()));
+        if (!_buckets) {
+            pending.image = Tensor(DT_UINT8, TensorShape({1, request.height,
+                    request.width, 3}));
+            memcpy(pending.image.flat<uint8>().data(), request.data.data(),
+                    size);
+            return Status::OK();
+        }
+    }
+
+    TF_RETURN_IF_ERROR(_buckets->Fit(image, pending.buffer));
+    pending.image = pending.buffer->tensor;
+
+    return Status::OK();
+}
+
+void DetectionService::Decoder() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _decode_cv.wait(lock, [this] { return _stop || !_undecoded.empty(); });
+        if (_stop) {
+            return;
+        }
+
+        std::unique_ptr<Pending> pending = std::move(_undecoded.front());
+        _undecoded.pop_front();
+        lock.unlock();
+
+        ImageResult result;
+        if (Clock::now() >= pending->request.deadline) {
+            result.status = tensorflow::errors::DeadlineExceeded(
+                    "Deadline passed before decoding");
+        } else {
+            try {
+                result.status = Decode(*pending);
+            } catch (const std::exception& e) {
+                /* Model failed to load. */
+                result.status = tensorflow::errors::Unavailable(e.what());
+            }
+        }
+
+        lock.lock();
+        if (result.status.ok()) {
+            pending->ready = Clock::now();
+            _ready.push_back(std::move(pending));
+            _batch_cv.notify_one();
+            continue;
+        }
+
+        --_queued;
+        lock.unlock();
+        Finish(*pending, result);
+        lock.lock();
+    }
+}
+
+void DetectionService::Dispatcher() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _batch_cv.wait(lock, [this] { return _stop || !_ready.empty(); });
+        if (_stop) {
+            return;
+        }
+
+        const Clock::time_point now = Clock::now();
+        std::vector<std::unique_ptr<Pending>> expired;
+
+        for (auto pending = _ready.begin(); pending != _ready.end();) {
+            if (now >= (*pending)->request.deadline) {
+                expired.push_back(std::move(*pending));
+                pending = _ready.erase(pending);
+            } else {
+                ++pending;
+            }
+        }
+        if (!expired.empty()) {
+            _queued -= expired.size();
+            lock.unlock();
+            for (auto& pending : expired) {
+                ImageResult result;
+                result.status = tensorflow::errors::DeadlineExceeded(
+                        "Deadline passed in queue");
+                Finish(*pending, result);
+            }
+            lock.lock();
+            continue;
+        }
+
+        /* Oldest request decides the shape of the batch. */
+        const TensorShape shape = _ready.front()->image.shape();
+        const auto batch_duration = std::chrono::duration_cast<
+            Clock::duration>(std::chrono::duration<double>(_batch_seconds));
+        Clock::time_point dispatch_at =
+            _ready.front()->ready + _options.max_batch_wait;
+        size_t count = 0;
+
+        for (const auto& pending : _ready) {
+            if (count == _options.max_batch_size) {
+                break;
+            }
+            if (pending->image.shape() == shape) {
+                ++count;
+                dispatch_at = std::min(dispatch_at,
+                        pending->request.deadline - batch_duration);
+            }
+        }
+
+        if (count < _options.max_batch_size && now < dispatch_at) {
+            _batch_cv.wait_until(lock, dispatch_at);
+            continue;
+        }
+
+        std::vector<std::unique_ptr<Pending>> batch;
+        for (auto pending = _ready.begin();
+             pending != _ready.end() && batch.size() < count;) {
+            if ((*pending)->image.shape() == shape) {
+                batch.push_back(std::move(*pending));
+                pending = _ready.erase(pending);
+            } else {
+                ++pending;
+            }
+        }
+        _queued -= batch.size();
+
+        /* Requests of other shapes may be waiting for a dispatcher. */
+        if (!_ready.empty()) {
+            _batch_cv.notify_one();
+        }
+
+        lock.unlock();
+        RunBatch(batch);
+        lock.lock();
+    }
+}
+
+void DetectionService::RunBatch(std::vector<std::unique_ptr<Pending>>& batch) {
+    const Clock::time_point begin = Clock::now();
+    std::vector<Tensor> images;
+    std::vector<std::vector<Detection>> detections;
+    Status status;
+
+    for (const auto& pending : batch) {
+        images.push_back(pending->image);
+        Metrics::Global().Record(Stage::BATCH_WAIT, static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        begin - pending->ready).count()));
+    }
+
+    try {
+        _pool.PredictBatch(images, detections);
+    } catch (const std::exception& e) {
+        status = tensorflow::errors::Internal(e.what());
+    }
+
+    const Clock::time_point end = Clock::now();
+    const double seconds = seconds_between(begin, end);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _batch_seconds = _batch_seconds == 0 ? seconds :
+            0.8 * _batch_seconds + 0.2 * seconds;
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        Pending& pending = *batch[i];
+        ImageResult result;
+
+        result.status = status;
+        result.batch_size = batch.size();
+        result.queue_seconds = seconds_between(pending.request.arrival, begin);
+        result.inference_seconds = seconds;
+
+        if (status.ok() && end > pending.request.deadline) {
+            result.status = tensorflow::errors::DeadlineExceeded(
+                    "Inference finished after the deadline");
+        } else if (status.ok()) {
+            result.detections = std::move(detections[i]);
+            if (pending.buffer) {
+                RestoreBoxes(pending.buffer->content, result.detections);
+            }
+        }
+
+        Finish(pending, result);
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef __DETECTION_SERVICE_H__
+#define __DETECTION_SERVICE_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "model_pool.h"
+#include "shape_buckets.h"
+
+struct DetectionServiceOptions {
+    size_t max_batch_size = 8;
+    std::chrono::microseconds max_batch_wait = std::chrono::milliseconds(5);
+    size_t max_queue = 256;  // Requests waiting, more are rejected
+    int decode_threads = 2;
+    BucketOptions buckets;   // Requests of other sizes batch together
+};
+
+struct ImageRequest {
+    std::string data;   // JPEG bytes, or packed RGB24 of width x height
+    int width = 0;      // 0 - data is JPEG
+    int height = 0;
+    std::chrono::steady_clock::time_point arrival;
+    std::chrono::steady_clock::time_point deadline; // Unset - none
+};
+
+struct ImageResult {
+    Status status;
+    std::vector<Detection> detections; // Normalized to the image
+    int width = 0;
+    int height = 0;
+    size_t batch_size = 0;
+    double queue_seconds = 0;     // Arrival to the start of its batch
+    double inference_seconds = 0; // Run of its batch
+};
+
+/* Request side of a resident detection server.
+ *
+ *   Submit -> decode threads -> ready queue -> dispatchers -> ModelPool
+ *
+ * Requests of concurrent clients are coalesced: a dispatcher takes up to
+ * max_batch_size decoded images of one shape and runs them as one batch,
+ * waiting at most max_batch_wait for the batch to fill. Every request
+ * has a deadline; one that expires while queued is answered with
+ * DeadlineExceeded without being run, and a batch is dispatched early
+ * when waiting longer would make a request in it miss its deadline.
+ * There is one dispatcher per ModelPool worker.
+ * */
+class DetectionService {
+public:
+    /* Called once per request, on a service thread or, for a rejected
+     * request, inside Submit.
+     * */
+    using Callback = std::function<void(ImageResult& result)>;
+
+private:
+    struct Pending {
+        ImageRequest request;
+        Callback done;
+        Tensor image;                        // [1, H, W, 3] model input
+        std::shared_ptr<FrameBuffer> buffer; // Bucket buffer of image
+        std::chrono::steady_clock::time_point ready;
+        int width = 0;
+        int height = 0;
+    };
+
+    ModelPool& _pool;
+    DetectionServiceOptions _options;
+    std::unique_ptr<ShapeBuckets> _buckets;
+
+    std::mutex _mutex;
+    std::condition_variable _decode_cv;
+    std::condition_variable _batch_cv;
+    std::deque<std::unique_ptr<Pending>> _undecoded;
+    std::deque<std::unique_ptr<Pending>> _ready;
+    size_t _queued = 0;
+    double _batch_seconds = 0; // Moving average of a batch run
+    bool _stop = false;
+
+    std::vector<std::thread> _decoders;
+    std::vector<std::thread> _dispatchers;
+
+    void Decoder();
+    void Dispatcher();
+    Status Decode(Pending& pending);
+    void RunBatch(std::vector<std::unique_ptr<Pending>>& batch);
+    void Finish(Pending& pending, ImageResult& result);
+
+public:
+    DetectionService(ModelPool& pool, const DetectionServiceOptions& options);
+    ~DetectionService();
+
+    DetectionService(const DetectionService&) = delete;
+    DetectionService& operator=(const DetectionService&) = delete;
+
+    /* Never blocks. Unavailable at once when max_queue requests wait. */
+    void Submit(ImageRequest&& request, Callback done);
+
+    /* Stop threads, waiting requests are answered with Unavailable. */
+    void Stop();
+
+    size_t Queued();
+};
+
+#endif /* __DETECTION_SERVICE_H__ */
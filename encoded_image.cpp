@@ -0,0 +1,222 @@
+#include "encoded_image.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/tstring.h"
+
+using tensorflow::Status;
+using tensorflow::StringPiece;
+
+const char ImageArchive::kMagic[8] = {'I', 'M', 'G', 'P', 'A', 'C', 'K', '1'};
+
+static const size_t kHeaderSize = sizeof(ImageArchive::kMagic) + 2 * 8;
+
+static
+void put_u64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+static
+void put_u32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+static
+uint64_t get_uint(const char* data, int bytes) {
+    uint64_t value = 0;
+
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | static_cast<uint8_t>(data[i]);
+    }
+
+    return value;
+}
+
+MappedFile::~MappedFile() {
+    if (_data != nullptr) {
+        munmap(const_cast<char*>(_data), _size);
+    }
+}
+
+Status MappedFile::Open(const std::string& path, MapAccess access,
+        std::unique_ptr<MappedFile>& file) {
+    using namespace tensorflow;
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return errors::NotFound("Can't open ", path, ": ", strerror(errno));
+    }
+
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return errors::InvalidArgument("File ", path, " is empty");
+    }
+
+    /* Mapping keeps its own reference of the file. */
+    data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return errors::Internal("Can't map ", path, ": ", strerror(errno));
+    }
+
+    madvise(data, info.st_size, access == MapAccess::SEQUENTIAL ?
+            MADV_SEQUENTIAL : MADV_RANDOM);
+
+    file.reset(new MappedFile(static_cast<const char*>(data), info.st_size));
+
+    return Status::OK();
+}
+
+Status EncodedToTensor(StringPiece jpeg, tensorflow::Tensor& tensor) {
+    using namespace tensorflow;
+
+    /* SOI marker, DecodeJpeg would fail later with a vaguer message. */
+    if (jpeg.size() < 3 || static_cast<uint8_t>(jpeg[0]) != 0xff ||
+        static_cast<uint8_t>(jpeg[1]) != 0xd8) {
+        return errors::InvalidArgument("Image must be jpeg/jpg encoded");
+    }
+
+    tensor = Tensor(DT_STRING, TensorShape());
+    tensor.scalar<tstring>()().assign_as_view(jpeg.data(), jpeg.size());
+
+    return Status::OK();
+}
+
+Status ImageArchive::Open(const std::string& path,
+        std::unique_ptr<ImageArchive>& archive) {
+    using namespace tensorflow;
+
+    std::unique_ptr<ImageArchive> result(new ImageArchive());
+
+    TF_RETURN_IF_ERROR(MappedFile::Open(path, MapAccess::SEQUENTIAL,
+            result->_file));
+
+    const StringPiece data = result->_file->Data();
+
+    if (data.size() < kHeaderSize ||
+        std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+        return errors::InvalidArgument(path, " is not an image archive");
+    }
+
+    const uint64_t count = get_uint(data.data() + sizeof(kMagic), 8);
+    uint64_t position = get_uint(data.data() + sizeof(kMagic) + 8, 8);
+
+    /* Every index entry takes at least 20 bytes. */
+    if (position < kHeaderSize || position > data.size() ||
+        count > (data.size() - position) / 20) {
+        return errors::DataLoss(path, ": broken index");
+    }
+
+    result->_entries.resize(count);
+    for (auto& entry : result->_entries) {
+        if (data.size() - position < 20) {
+            return errors::DataLoss(path, ": broken index");
+        }
+
+        entry.offset = get_uint(data.data() + position, 8);
+        entry.size = get_uint(data.data() + position + 8, 8);
+        const uint64_t name_size = get_uint(data.data() + position + 16, 4);
+        position += 20;
+
+        if (name_size > data.size() - position ||
+            entry.offset < kHeaderSize || entry.offset > data.size() ||
+            entry.size > data.size() - entry.offset) {
+            return errors::DataLoss(path, ": broken index");
+        }
+
+        entry.name.assign(data.data() + position, name_size);
+        position += name_size;
+    }
+
+    archive = std::move(result);
+
+    return Status::OK();
+}
+
+Status ImageArchiveWriter::Open(const std::string& path) {
+    using namespace tensorflow;
+
+    /* Header is rewritten with the real count and index by Finish. */
+    std::string header(kHeaderSize, '\0');
+
+    _path = path;
+    _entries.clear();
+    _file.open(path, std::ios::binary | std::ios::trunc);
+    if (!_file) {
+        return errors::NotFound("Can't create ", path);
+    }
+
+    _file.write(header.data(), header.size());
+    _offset = header.size();
+
+    return _file ? Status::OK() : errors::DataLoss("Can't write ", path);
+}
+
+Status ImageArchiveWriter::Add(const std::string& name, StringPiece jpeg) {
+    using namespace tensorflow;
+
+    ArchiveEntry entry;
+
+    if (!_file.is_open()) {
+        return errors::FailedPrecondition("Archive is not open");
+    }
+
+    entry.offset = _offset;
+    entry.size = jpeg.size();
+    entry.name = name;
+
+    _file.write(jpeg.data(), jpeg.size());
+    if (!_file) {
+        return errors::DataLoss("Can't write ", _path);
+    }
+
+    _offset += jpeg.size();
+    _entries.push_back(std::move(entry));
+
+    return Status::OK();
+}
+
+Status ImageArchiveWriter::Finish() {
+    using namespace tensorflow;
+
+    std::string index;
+    std::string header(ImageArchive::kMagic, sizeof(ImageArchive::kMagic));
+
+    if (!_file.is_open()) {
+        return errors::FailedPrecondition("Archive is not open");
+    }
+
+    for (const auto& entry : _entries) {
+        put_u64(index, entry.offset);
+        put_u64(index, entry.size);
+        put_u32(index, static_cast<uint32_t>(entry.name.size()));
+        index += entry.name;
+    }
+
+    put_u64(header, _entries.size());
+    put_u64(header, _offset);
+
+    _file.write(index.data(), index.size());
+    _file.seekp(0);
+    _file.write(header.data(), header.size());
+    _file.close();
+    if (!_file) {
+        return errors::DataLoss("Can't write ", _path);
+    }
+
+    return Status::OK();
+}
@@ -0,0 +1,111 @@
+#ifndef __ENCODED_IMAGE_H__
+#define __ENCODED_IMAGE_H__
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/stringpiece.h"
+
+enum class MapAccess {
+    SEQUENTIAL, // Read once front to back, kernel reads ahead
+    RANDOM,     // Entries picked by index
+};
+
+/* Read-only memory map of a whole file, unmapped on destruction. */
+class MappedFile {
+private:
+    const char* _data = nullptr;
+    size_t _size = 0;
+
+    MappedFile(const char* data, size_t size) : _data(data), _size(size) {}
+
+public:
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    static tensorflow::Status Open(const std::string& path, MapAccess access,
+            std::unique_ptr<MappedFile>& file);
+
+    tensorflow::StringPiece Data() const {
+        return tensorflow::StringPiece(_data, _size);
+    }
+};
+
+/* Scalar DT_STRING tensor viewing the encoded bytes, no copy is made:
+ * bytes must stay valid until the tensor is fed and the run is over.
+ * Returns InvalidArgument for data without JPEG signature.
+ * */
+tensorflow::Status EncodedToTensor(tensorflow::StringPiece jpeg,
+        tensorflow::Tensor& tensor);
+
+/* Image of an archive: bytes at offset of the archive file. */
+struct ArchiveEntry {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    std::string name;
+};
+
+/* Many JPEG files packed in one file, so reading millions of small
+ * images costs one open and one mmap instead of one per image.
+ *
+ * Layout, integers are little endian:
+ *   header: "IMGPACK1", uint64 count, uint64 index_offset
+ *   images: encoded bytes back to back
+ *   index:  count x {uint64 offset, uint64 size, uint32 name_size, name}
+ * */
+class ImageArchive {
+private:
+    std::unique_ptr<MappedFile> _file;
+    std::vector<ArchiveEntry> _entries;
+
+    ImageArchive() = default;
+
+public:
+    static const char kMagic[8];
+
+    ImageArchive(const ImageArchive&) = delete;
+    ImageArchive& operator=(const ImageArchive&) = delete;
+
+    /* Index is read and checked against the file size once. */
+    static tensorflow::Status Open(const std::string& path,
+            std::unique_ptr<ImageArchive>& archive);
+
+    size_t Size() const { return _entries.size(); }
+    const std::string& Name(size_t index) const { return _entries[index].name; }
+
+    /* View into the mapping, valid while the archive lives. */
+    tensorflow::StringPiece Image(size_t index) const {
+        const ArchiveEntry& entry = _entries[index];
+        return tensorflow::StringPiece(_file->Data().data() + entry.offset,
+                entry.size);
+    }
+};
+
+/* Appends images to a new archive, Finish writes the index. */
+class ImageArchiveWriter {
+private:
+    std::ofstream _file;
+    std::string _path;
+    std::vector<ArchiveEntry> _entries;
+    uint64_t _offset = 0;
+
+public:
+    ImageArchiveWriter() = default;
+
+    ImageArchiveWriter(const ImageArchiveWriter&) = delete;
+    ImageArchiveWriter& operator=(const ImageArchiveWriter&) = delete;
+
+    tensorflow::Status Open(const std::string& path);
+    tensorflow::Status Add(const std::string& name,
+            tensorflow::StringPiece jpeg);
+    tensorflow::Status Finish();
+};
+
+#endif /* __ENCODED_IMAGE_H__ */
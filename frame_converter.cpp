@@ -0,0 +1,160 @@
+#include "frame_converter.h"
+
+#include "tensorflow/core/platform/logging.h"
+
+#include "metrics.h"
+#include "shape_buckets.h"
+#include "tensor_buffer.h"
+
+static
+std::unique_ptr<FrameBuffer> new_buffer(int rows, int cols) {
+    using namespace tensorflow;
+
+    std::unique_ptr<FrameBuffer> buffer(new FrameBuffer());
+
+    buffer->tensor = Tensor(DT_UINT8, TensorShape({1, rows, cols, 3}));
+    buffer->image = cv::Mat(rows, cols, CV_8UC3,
+            buffer->tensor.flat<uint8>().data());
+
+    return buffer;
+}
+
+std::shared_ptr<FrameBuffer> FrameBufferPool::Acquire(int rows, int cols) {
+    std::unique_ptr<FrameBuffer> buffer;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        /* Buffers of previous resolution are useless now. */
+        if (rows != _rows || cols != _cols) {
+            _free.clear();
+            _rows = rows;
+            _cols = cols;
+        }
+
+        if (!_free.empty()) {
+            buffer = std::move(_free.back());
+            _free.pop_back();
+            ++_reused;
+        } else {
+            ++_allocated;
+        }
+    }
+
+    if (!buffer) {
+        buffer = new_buffer(rows, cols);
+    }
+
+    return std::shared_ptr<FrameBuffer>(buffer.release(),
+            [this](FrameBuffer* released) { Release(released); });
+}
+
+void FrameBufferPool::Reserve(int rows, int cols, size_t count) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (rows != _rows || cols != _cols) {
+        _free.clear();
+        _rows = rows;
+        _cols = cols;
+    }
+
+    while (_free.size() < count) {
+        _free.push_back(new_buffer(rows, cols));
+        ++_allocated;
+    }
+}
+
+void FrameBufferPool::Release(FrameBuffer* buffer) {
+    std::unique_ptr<FrameBuffer> owner(buffer);
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (buffer->image.rows == _rows && buffer->image.cols == _cols) {
+        _free.push_back(std::move(owner));
+    }
+}
+
+std::shared_ptr<FrameBuffer> FrameConverter::Convert(const AVFrame* frame) {
+    const AVPixelFormat src_pix_fmt = static_cast<AVPixelFormat>(frame->format);
+
+    /* Decoder already produced RGB24, borrow its memory instead of scaling. */
+    if (src_pix_fmt == _dst_pix_fmt) {
+        std::shared_ptr<FrameBuffer> buffer(new FrameBuffer());
+
+        auto status = AVFrameToTensor(frame, buffer->tensor);
+        if (!status.ok()) {
+            LOG(ERROR) << status.ToString();
+            return nullptr;
+        }
+        buffer->image = cv::Mat(frame->height, frame->width, CV_8UC3,
+                buffer->tensor.flat<tensorflow::uint8>().data());
+
+        /* Padded or unaligned frames were copied, the rest is shared
+         * with reference frames the decoder still predicts from.
+         * */
+        buffer->borrowed =
+            buffer->tensor.flat<tensorflow::uint8>().data() == frame->data[0];
+
+        return buffer;
+    }
+
+    /* Returns the same context while parameters are unchanged,
+     * otherwise frees it and creates a new one.
+     * */
+    _sws_ctx.reset(sws_getCachedContext(_sws_ctx.release(),
+            frame->width, frame->height, src_pix_fmt,
+            frame->width, frame->height, _dst_pix_fmt,
+            SWS_BILINEAR, nullptr, nullptr, nullptr));
+    if (!_sws_ctx) {
+        LOG(ERROR) << "Failed to create scaling context for "
+                   << frame->width << " x " << frame->height
+                   << " format " << frame->format;
+        return nullptr;
+    }
+
+    std::shared_ptr<FrameBuffer> buffer = _pool.Acquire(frame->height,
+            frame->width);
+
+    uint8_t* dst_data[1] = {buffer->image.data};
+    int dst_linesize[1] = {static_cast<int>(buffer->image.step)};
+
+    /* convert to destination format straight into tensor memory */
+    StageTimer timer(Stage::SWS_SCALE);
+    sws_scale(_sws_ctx.get(), frame->data, frame->linesize, 0, frame->height,
+              dst_data, dst_linesize);
+
+    return buffer;
+}
+
+std::shared_ptr<FrameBuffer> FrameConverter::ConvertToBucket(
+        const AVFrame* frame, ShapeBuckets& buckets) {
+    const AVPixelFormat src_pix_fmt = static_cast<AVPixelFormat>(frame->format);
+    const BucketPlacement placement = buckets.Place(frame->height,
+            frame->width);
+
+    _sws_ctx.reset(sws_getCachedContext(_sws_ctx.release(),
+            frame->width, frame->height, src_pix_fmt,
+            placement.roi.width, placement.roi.height, _dst_pix_fmt,
+            SWS_BILINEAR, nullptr, nullptr, nullptr));
+    if (!_sws_ctx) {
+        LOG(ERROR) << "Failed to create scaling context for "
+                   << frame->width << " x " << frame->height
+                   << " format " << frame->format << " to "
+                   << placement.roi.width << " x " << placement.roi.height;
+        return nullptr;
+    }
+
+    std::shared_ptr<FrameBuffer> buffer = buckets.Acquire(placement);
+
+    /* Rows keep the stride of the whole bucket, so the scaled frame
+     * lands inside the padding.
+     * */
+    uint8_t* dst_data[1] = {buffer->image.ptr(placement.roi.y) +
+            placement.roi.x * 3};
+    int dst_linesize[1] = {static_cast<int>(buffer->image.step)};
+
+    StageTimer timer(Stage::SWS_SCALE);
+    sws_scale(_sws_ctx.get(), frame->data, frame->linesize, 0, frame->height,
+              dst_data, dst_linesize);
+
+    return buffer;
+}
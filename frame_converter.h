@@ -0,0 +1,105 @@
+#ifndef __FRAME_CONVERTER_H__
+#define __FRAME_CONVERTER_H__
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "tensorflow/core/framework/tensor.h"
+
+#include "detection_postprocess.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libswscale/swscale.h>
+#ifdef __cplusplus
+}
+#endif
+
+struct SwsContext_Deleter {
+    void operator() (SwsContext* ptr) {
+        if (ptr != nullptr) {
+            sws_freeContext(ptr);
+        }
+    }
+};
+
+/* RGB frame stored directly in the backing store of a
+ * [1, H, W, 3] uint8 tensor, image is a view of the same memory.
+ * content is the part holding the frame, less than all of it when
+ * the frame was letterboxed into a shape bucket.
+ * */
+struct FrameBuffer {
+    tensorflow::Tensor tensor;
+    cv::Mat image;
+    Box content = {0.f, 0.f, 1.f, 1.f};
+    bool borrowed = false; // Pixels belong to the decoder, read only
+};
+
+/* Recycles frame buffers of one resolution.
+ * Buffer returns to the pool when the last shared_ptr is released,
+ * so it stays valid until inference and output are done with it.
+ * */
+class FrameBufferPool {
+private:
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<FrameBuffer>> _free;
+    int _rows = 0;
+    int _cols = 0;
+    size_t _allocated = 0;
+    size_t _reused = 0;
+
+    void Release(FrameBuffer* buffer);
+
+public:
+    FrameBufferPool() = default;
+    FrameBufferPool(const FrameBufferPool&) = delete;
+    FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+    std::shared_ptr<FrameBuffer> Acquire(int rows, int cols);
+
+    /* Allocate count free buffers up front, so the first frames of this
+     * resolution reuse memory too.
+     * */
+    void Reserve(int rows, int cols, size_t count);
+
+    size_t Allocated() const { return _allocated; }
+    size_t Reused() const { return _reused; }
+};
+
+class ShapeBuckets;
+
+/* Converts decoded frames to RGB24 for one stream.
+ * Conversion context is kept across frames and recreated only when
+ * source width, height or pixel format changes.
+ * */
+class FrameConverter {
+private:
+    std::unique_ptr<SwsContext, SwsContext_Deleter> _sws_ctx;
+    AVPixelFormat _dst_pix_fmt = AV_PIX_FMT_RGB24;
+    FrameBufferPool _pool;
+
+public:
+    FrameConverter() = default;
+    FrameConverter(const FrameConverter&) = delete;
+    FrameConverter& operator=(const FrameConverter&) = delete;
+
+    /* Returns nullptr if the conversion context can't be created. */
+    std::shared_ptr<FrameBuffer> Convert(const AVFrame* frame);
+
+    /* Color conversion and resize in one sws_scale pass, written into
+     * the place of the frame in a pooled buffer of its shape bucket.
+     * Full resolution RGB is never produced.
+     * */
+    std::shared_ptr<FrameBuffer> ConvertToBucket(const AVFrame* frame,
+            ShapeBuckets& buckets);
+
+    const FrameBufferPool& Pool() const { return _pool; }
+};
+
+#endif /* __FRAME_CONVERTER_H__ */
@@ -0,0 +1,189 @@
+#include "frame_sampler.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/avutil.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/pixdesc.h>
+#ifdef __cplusplus
+}
+#endif
+
+bool ParseSamplingMode(const std::string& value, SamplingMode& mode) {
+    if (value == "stride") {
+        mode = SamplingMode::STRIDE;
+    } else if (value == "fps") {
+        mode = SamplingMode::FPS;
+    } else if (value == "keyframe") {
+        mode = SamplingMode::KEYFRAME;
+    } else if (value == "scene") {
+        mode = SamplingMode::SCENE_CHANGE;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool LumaHistogram(const AVFrame* frame, int bins, int step,
+        std::vector<uint32_t>& histogram) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(
+            static_cast<AVPixelFormat>(frame->format));
+
+    if (desc == nullptr || desc->nb_components == 0 ||
+        (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL |
+                        AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BE))) {
+        return false;
+    }
+
+    /* Component 0 of YUV and gray formats is luma. */
+    const AVComponentDescriptor& luma = desc->comp[0];
+    const int depth = luma.depth;
+    const int bin_shift = depth - __builtin_ctz(bins);
+
+    if (depth > 16 || bin_shift < 0) {
+        return false;
+    }
+
+    histogram.assign(bins, 0);
+
+    for (int y = 0; y < frame->height; y += step) {
+        const uint8_t* row = frame->data[luma.plane] +
+                static_cast<std::ptrdiff_t>(y) * frame->linesize[luma.plane] +
+                luma.offset;
+
+        if (depth <= 8) {
+            for (int x = 0; x < frame->width; x += step) {
+                ++histogram[(row[x * luma.step] >> luma.shift) >> bin_shift];
+            }
+        } else {
+            for (int x = 0; x < frame->width; x += step) {
+                const uint8_t* pixel = row + x * luma.step;
+                const int value = (pixel[0] | (pixel[1] << 8)) >> luma.shift;
+                ++histogram[(value & ((1 << depth) - 1)) >> bin_shift];
+            }
+        }
+    }
+
+    return true;
+}
+
+FrameSampler::FrameSampler(const SamplingOptions& options,
+        AVRational time_base) :
+    _options(options), _time_base(time_base) {
+    if (_options.stride <= 0) {
+        _options.stride = 1;
+    }
+    if (_options.target_fps <= 0.) {
+        _options.target_fps = 1.;
+    }
+}
+
+bool FrameSampler::ByStride(int frame_number) const {
+    return frame_number % _options.stride == 0;
+}
+
+bool FrameSampler::ByTime(const AVFrame* frame, int frame_number) {
+    const int64_t pts = frame->best_effort_timestamp;
+
+    /* No timestamps, nothing to measure time by. */
+    if (pts == AV_NOPTS_VALUE || _time_base.num <= 0 || _time_base.den <= 0) {
+        return ByStride(frame_number);
+    }
+
+    if (_next_pts != INT64_MIN && pts < _next_pts) {
+        return false;
+    }
+
+    /* Interval of 1 / target_fps seconds in stream time base,
+     * av_get_time_base_q as AV_TIME_BASE_Q is a C compound literal.
+     * */
+    const int64_t interval = std::max<int64_t>(1, av_rescale_q(
+            static_cast<int64_t>(AV_TIME_BASE / _options.target_fps),
+            av_get_time_base_q(), _time_base));
+
+    /* Next slot counts from the previous one while the stream is dense,
+     * so the average rate stays target_fps; after a gap from this frame.
+     * */
+    if (_next_pts == INT64_MIN || pts - _next_pts >= interval) {
+        _next_pts = pts + interval;
+    } else {
+        _next_pts += interval;
+    }
+
+    return true;
+}
+
+bool FrameSampler::BySceneChange(const AVFrame* frame) {
+    if (!LumaHistogram(frame, kHistogramBins, kHistogramStep, _histogram)) {
+        return true;
+    }
+
+    bool changed = _last_histogram.empty();
+
+    if (!changed) {
+        uint64_t total = 0;
+        uint64_t distance = 0;
+
+        for (int i = 0; i < kHistogramBins; ++i) {
+            total += _histogram[i];
+            distance += std::abs(static_cast<int64_t>(_histogram[i]) -
+                                 static_cast<int64_t>(_last_histogram[i]));
+        }
+
+        /* Half of L1 distance is the share of pixels that moved to
+         * other bins, 0 - same histogram, 1 - disjoint.
+         * */
+        changed = total > 0 &&
+                distance > 2. * _options.scene_threshold * total;
+    }
+
+    if (!changed && _options.scene_max_gap > 0 &&
+        _skipped_in_row >= _options.scene_max_gap) {
+        changed = true;
+    }
+
+    /* Compare with the last inferred frame, so slow drift adds up. */
+    if (changed) {
+        _last_histogram.swap(_histogram);
+    }
+
+    return changed;
+}
+
+bool FrameSampler::ShouldInfer(const AVFrame* frame, int frame_number) {
+    bool infer = true;
+
+    switch (_options.mode) {
+    case SamplingMode::STRIDE:
+        infer = ByStride(frame_number);
+        break;
+    case SamplingMode::FPS:
+        infer = ByTime(frame, frame_number);
+        break;
+    case SamplingMode::KEYFRAME:
+        /* Decoder already dropped others, keep a check for
+         * decoders that ignore skip_frame.
+         * */
+        infer = frame->key_frame != 0;
+        break;
+    case SamplingMode::SCENE_CHANGE:
+        infer = BySceneChange(frame);
+        break;
+    }
+
+    if (infer) {
+        ++_sampled;
+        _skipped_in_row = 0;
+    } else {
+        ++_skipped;
+        ++_skipped_in_row;
+    }
+
+    return infer;
+}
@@ -0,0 +1,76 @@
+#ifndef __FRAME_SAMPLER_H__
+#define __FRAME_SAMPLER_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+#ifdef __cplusplus
+}
+#endif
+
+enum class SamplingMode {
+    STRIDE,       // Every N-th decoded frame
+    FPS,          // At most target_fps frames per second of stream time
+    KEYFRAME,     // Only key frames, others are not even decoded
+    SCENE_CHANGE, // Frames whose luma histogram moved away from the last one
+};
+
+struct SamplingOptions {
+    SamplingMode mode = SamplingMode::STRIDE;
+    int stride = 3;
+    double target_fps = 1.;
+    float scene_threshold = 0.3f; // Half L1 distance of histograms, 0..1
+    int scene_max_gap = 0;        // Force a frame after N skipped, 0 - never
+};
+
+/* "--sampling" value: stride, fps, keyframe or scene. */
+bool ParseSamplingMode(const std::string& value, SamplingMode& mode);
+
+/* Decides which decoded frames of one stream go to inference.
+ *
+ * Runs on decoded frames before color conversion, so skipped frames
+ * cost only decoding. KEYFRAME mode expects the decoder to be opened
+ * with skip_frame = AVDISCARD_NONKEY.
+ * */
+class FrameSampler {
+private:
+    static const int kHistogramBins = 32;
+    static const int kHistogramStep = 4; // Every 4th pixel of every 4th row
+
+    SamplingOptions _options;
+    AVRational _time_base;
+
+    int64_t _next_pts = INT64_MIN;         // FPS mode, in time_base units
+    std::vector<uint32_t> _last_histogram; // SCENE_CHANGE mode
+    std::vector<uint32_t> _histogram;
+    int _skipped_in_row = 0;
+
+    uint64_t _sampled = 0;
+    uint64_t _skipped = 0;
+
+    bool ByStride(int frame_number) const;
+    bool ByTime(const AVFrame* frame, int frame_number);
+    bool BySceneChange(const AVFrame* frame);
+
+public:
+    FrameSampler(const SamplingOptions& options, AVRational time_base);
+
+    bool ShouldInfer(const AVFrame* frame, int frame_number);
+
+    uint64_t Sampled() const { return _sampled; }
+    uint64_t Skipped() const { return _skipped; }
+};
+
+/* Luma histogram of a YUV or gray frame from a sparse grid of pixels.
+ * Returns false for formats without a luma plane.
+ * */
+bool LumaHistogram(const AVFrame* frame, int bins, int step,
+        std::vector<uint32_t>& histogram);
+
+#endif /* __FRAME_SAMPLER_H__ */
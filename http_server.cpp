@@ -0,0 +1,579 @@
+#include "http_server.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/logging.h"
+
+using tensorflow::Status;
+
+/* epoll keys besides connection ids, which start from 1. */
+static const uint64_t kWakeupKey = 0;
+static const uint64_t kListenerBit = 1ull << 63;
+
+static const size_t kMaxHeaderBytes = 64 << 10;
+static const size_t kReadChunk = 64 << 10;
+
+std::string HttpRequest::Header(const std::string& name,
+        const std::string& fallback) const {
+    auto header = headers.find(name);
+
+    return header != headers.end() ? header->second : fallback;
+}
+
+const char* HttpReason(int status) {
+    switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default:  return "Unknown";
+    }
+}
+
+static
+std::string lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(),
+            [](unsigned char c) { return std::tolower(c); });
+    return value;
+}
+
+static
+std::string trim(const std::string& value) {
+    const size_t begin = value.find_first_not_of(" \t");
+    const size_t end = value.find_last_not_of(" \t");
+
+    return begin == std::string::npos ? std::string() :
+        value.substr(begin, end - begin + 1);
+}
+
+/* Request line and headers of head, without the final empty line.
+ * False if they are malformed.
+ * */
+static
+bool parse_head(const std::string& head, HttpRequest& request,
+        std::string& version) {
+    std::istringstream lines(head);
+    std::string line;
+    std::string target;
+
+    if (!std::getline(lines, line)) {
+        return false;
+    }
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+
+    std::istringstream request_line(line);
+    if (!(request_line >> request.method >> target >> version) ||
+        version.compare(0, 5, "HTTP/") != 0) {
+        return false;
+    }
+
+    const size_t question = target.find('?');
+    request.path = target.substr(0, question);
+    request.query = question == std::string::npos ? std::string() :
+        target.substr(question + 1);
+
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos || colon == 0) {
+            return false;
+        }
+        request.headers[lower(line.substr(0, colon))] =
+            trim(line.substr(colon + 1));
+    }
+
+    return true;
+}
+
+HttpServer::HttpServer(const HttpServerOptions& options, Handler handler) :
+    _options(options), _handler(std::move(handler)) {}
+
+HttpServer::~HttpServer() {
+    for (auto& connection : _connections) {
+        close(connection.second->fd);
+    }
+    for (int listener : _listeners) {
+        close(listener);
+    }
+    if (_unix_bound) {
+        unlink(_options.unix_socket.c_str());
+    }
+    if (_wakeup >= 0) {
+        close(_wakeup);
+    }
+    if (_epoll >= 0) {
+        close(_epoll);
+    }
+}
+
+Status HttpServer::AddListener(int fd) {
+    using namespace tensorflow;
+
+    epoll_event event = {};
+
+    if (listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return errors::Internal("listen: ", strerror(errno));
+    }
+
+    event.events = EPOLLIN;
+    event.data.u64 = kListenerBit | _listeners.size();
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+        close(fd);
+        return errors::Internal("epoll_ctl: ", strerror(errno));
+    }
+    _listeners.push_back(fd);
+
+    return Status::OK();
+}
+
+Status HttpServer::Listen() {
+    using namespace tensorflow;
+
+    epoll_event event = {};
+
+    if (_options.unix_socket.empty() && _options.port <= 0) {
+        return errors::InvalidArgument("Neither Unix socket nor TCP port set");
+    }
+
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    _wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_epoll < 0 || _wakeup < 0) {
+        return errors::Internal("epoll: ", strerror(errno));
+    }
+
+    event.events = EPOLLIN;
+    event.data.u64 = kWakeupKey;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup, &event) != 0) {
+        return errors::Internal("epoll_ctl: ", strerror(errno));
+    }
+
+    if (!_options.unix_socket.empty()) {
+        sockaddr_un address = {};
+
+        if (_options.unix_socket.size() >= sizeof(address.sun_path)) {
+            return errors::InvalidArgument("Socket path is too long: ",
+                    _options.unix_socket);
+        }
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, _options.unix_socket.c_str(),
+                sizeof(address.sun_path) - 1);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return errors::Internal("socket: ", strerror(errno));
+        }
+
+        /* Left over by a previous run that didn't exit cleanly. */
+        unlink(_options.unix_socket.c_str());
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address),
+                sizeof(address)) != 0) {
+            const int error = errno;
+            close(fd);
+            return errors::Internal("Can't bind ", _options.unix_socket, ": ",
+                    strerror(error));
+        }
+        _unix_bound = true;
+
+        TF_RETURN_IF_ERROR(AddListener(fd));
+        LOG(INFO) << "Listening on unix:" << _options.unix_socket;
+    }
+
+    if (_options.port > 0) {
+        sockaddr_in address = {};
+        int reuse = 1;
+
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(_options.port));
+        if (inet_pton(AF_INET, _options.host.c_str(), &address.sin_addr) != 1) {
+            return errors::InvalidArgument("Bad IPv4 host ", _options.host);
+        }
+
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return errors::Internal("socket: ", strerror(errno));
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address),
+                sizeof(address)) != 0) {
+            const int error = errno;
+            close(fd);
+            return errors::Internal("Can't bind ", _options.host, ":",
+                    _options.port, ": ", strerror(error));
+        }
+
+        TF_RETURN_IF_ERROR(AddListener(fd));
+        LOG(INFO) << "Listening on http://" << _options.host << ":"
+                  << _options.port;
+    }
+
+    return Status::OK();
+}
+
+void HttpServer::Run() {
+    epoll_event events[64];
+
+    while (!_stop.load()) {
+        const int count = epoll_wait(_epoll, events, 64, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG(ERROR) << "epoll_wait: " << strerror(errno);
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            const uint64_t key = events[i].data.u64;
+
+            if (key == kWakeupKey) {
+                uint64_t value;
+                while (read(_wakeup, &value, sizeof(value)) > 0) {}
+                DrainCompletions();
+                continue;
+            }
+            if (key & kListenerBit) {
+                Accept(_listeners[key & ~kListenerBit]);
+                continue;
+            }
+
+            auto connection = _connections.find(key);
+            if (connection == _connections.end()) {
+                continue;
+            }
+            /* Peer is gone both ways, no reply can reach it. HUP is
+             * reported even with no events polled, so keeping the fd
+             * would spin the loop until a busy request completes, its
+             * late reply is dropped by the id lookup.
+             * */
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                Close(key);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                Read(key, *connection->second);
+            }
+
+            /* Read may have closed it. */
+            connection = _connections.find(key);
+            if (connection != _connections.end() &&
+                (events[i].events & EPOLLOUT)) {
+                Write(key, *connection->second);
+            }
+        }
+    }
+}
+
+void HttpServer::Stop() {
+    const uint64_t one = 1;
+
+    _stop.store(true);
+    if (_wakeup >= 0) {
+        ssize_t written = write(_wakeup, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void HttpServer::Accept(int listener) {
+    for (;;) {
+        int fd = accept4(listener, nullptr, nullptr,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG(WARNING) << "accept: " << strerror(errno);
+            }
+            return;
+        }
+
+        if (_connections.size() >= _options.max_connections) {
+            LOG(WARNING) << "Connection limit " << _options.max_connections
+                         << " reached, refusing a client";
+            close(fd);
+            continue;
+        }
+
+        /* Replies are small and written at once, don't hold them back.
+         * Fails harmlessly on Unix sockets.
+         * */
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        const uint64_t id = _next_id++;
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+            LOG(WARNING) << "epoll_ctl: " << strerror(errno);
+            close(fd);
+            continue;
+        }
+
+        std::unique_ptr<Connection> connection(new Connection());
+        connection->fd = fd;
+        _connections[id] = std::move(connection);
+    }
+}
+
+void HttpServer::Read(uint64_t id, Connection& connection) {
+    /* Head and body of one request, the rest waits in the socket. */
+    const size_t limit = kMaxHeaderBytes + 4 + std::min(
+            _options.max_body_bytes, SIZE_MAX - kMaxHeaderBytes - 4);
+    char buffer[kReadChunk];
+
+    while (connection.input.size() < limit) {
+        const ssize_t size = read(connection.fd, buffer, sizeof(buffer));
+
+        if (size > 0) {
+            connection.input.append(buffer, size);
+            continue;
+        }
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (size < 0) {
+            Close(id);
+            return;
+        }
+
+        /* Peer is done sending, it may still wait for the replies. */
+        connection.eof = true;
+        break;
+    }
+
+    Parse(id, connection);
+
+    auto current = _connections.find(id);
+    if (current != _connections.end() && connection.eof &&
+        !connection.busy && connection.output.empty()) {
+        Close(id);
+    }
+}
+
+void HttpServer::Parse(uint64_t id, Connection& connection) {
+    while (!connection.busy && !connection.closing) {
+        HttpRequest request;
+        std::string version;
+
+        const size_t head_end = connection.input.find("\r\n\r\n");
+        if (head_end == std::string::npos || head_end > kMaxHeaderBytes) {
+            if (connection.input.size() > kMaxHeaderBytes) {
+                Respond(connection, {431, "text/plain", "Headers too large\n"},
+                        false);
+            }
+            break;
+        }
+
+        if (!parse_head(connection.input.substr(0, head_end), request,
+                version)) {
+            Respond(connection, {400, "text/plain", "Malformed request\n"},
+                    false);
+            break;
+        }
+
+        const std::string connection_header =
+            lower(request.Header("connection"));
+        const bool keep_alive = version == "HTTP/1.0" ?
+            connection_header == "keep-alive" : connection_header != "close";
+
+        if (request.headers.count("transfer-encoding") != 0) {
+            Respond(connection, {501, "text/plain",
+                    "Chunked bodies are not supported, send Content-Length\n"},
+                    false);
+            break;
+        }
+
+        const std::string length_header = request.Header("content-length",
+                "0");
+        char* length_end = nullptr;
+        const unsigned long long length =
+            std::strtoull(length_header.c_str(), &length_end, 10);
+        if (length_header.empty() || *length_end != '\0') {
+            Respond(connection, {400, "text/plain", "Bad Content-Length\n"},
+                    false);
+            break;
+        }
+        if (length > _options.max_body_bytes) {
+            Respond(connection, {413, "text/plain", "Body too large\n"},
+                    false);
+            break;
+        }
+
+        const size_t body_begin = head_end + 4;
+        if (connection.input.size() < body_begin + length) {
+            if (!connection.continued &&
+                lower(request.Header("expect")) == "100-continue") {
+                connection.output += "HTTP/1.1 100 Continue\r\n\r\n";
+                connection.continued = true;
+                Write(id, connection);
+                return;
+            }
+            break;
+        }
+
+        request.body.assign(connection.input, body_begin, length);
+        connection.input.erase(0, body_begin + length);
+        connection.continued = false;
+        connection.busy = true;
+        request.arrival = std::chrono::steady_clock::now();
+
+        _handler(request, [this, id, keep_alive](const HttpResponse& response) {
+            Complete(id, response, keep_alive);
+        });
+    }
+
+    UpdateEvents(id, connection);
+}
+
+void HttpServer::Respond(Connection& connection, const HttpResponse& response,
+        bool keep_alive) {
+    std::ostringstream head;
+
+    head << "HTTP/1.1 " << response.status << " " << HttpReason(response.status)
+         << "\r\nContent-Type: " << response.content_type
+         << "\r\nContent-Length: " << response.body.size()
+         << "\r\nConnection: " << (keep_alive ? "keep-alive" : "close")
+         << "\r\n\r\n";
+
+    connection.output += head.str();
+    connection.output += response.body;
+    if (!keep_alive) {
+        connection.closing = true;
+    }
+}
+
+void HttpServer::Write(uint64_t id, Connection& connection) {
+    while (connection.written < connection.output.size()) {
+        const ssize_t size = send(connection.fd,
+                connection.output.data() + connection.written,
+                connection.output.size() - connection.written, MSG_NOSIGNAL);
+
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            UpdateEvents(id, connection);
+            return;
+        }
+        if (size < 0) {
+            Close(id);
+            return;
+        }
+        connection.written += size;
+    }
+
+    connection.output.clear();
+    connection.written = 0;
+    if ((connection.closing || connection.eof) && !connection.busy) {
+        Close(id);
+        return;
+    }
+
+    UpdateEvents(id, connection);
+}
+
+void HttpServer::UpdateEvents(uint64_t id, Connection& connection) {
+    epoll_event event = {};
+
+    /* EOF stays readable, stop polling it or the loop spins. Nothing
+     * is read while a request runs or the connection is closing, so a
+     * pipelining client can't grow input beyond one request.
+     * */
+    const bool readable = !connection.eof && !connection.busy &&
+        !connection.closing;
+    event.events = readable ? static_cast<uint32_t>(EPOLLIN) : 0u;
+    if (connection.written < connection.output.size()) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.u64 = id;
+    epoll_ctl(_epoll, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void HttpServer::Close(uint64_t id) {
+    auto connection = _connections.find(id);
+    if (connection == _connections.end()) {
+        return;
+    }
+
+    epoll_ctl(_epoll, EPOLL_CTL_DEL, connection->second->fd, nullptr);
+    close(connection->second->fd);
+    _connections.erase(connection);
+}
+
+void HttpServer::Complete(uint64_t id, const HttpResponse& response,
+        bool keep_alive) {
+    const uint64_t one = 1;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _completions.push_back({id, response, keep_alive});
+    }
+
+    ssize_t written = write(_wakeup, &one, sizeof(one));
+    (void)written;
+}
+
+void HttpServer::DrainCompletions() {
+    std::vector<Completion> completions;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        completions.swap(_completions);
+    }
+
+    for (Completion& completion : completions) {
+        auto connection = _connections.find(completion.connection);
+        if (connection == _connections.end()) {
+            continue;
+        }
+
+        Connection& current = *connection->second;
+        current.busy = false;
+        Respond(current, completion.response, completion.keep_alive);
+
+        /* Hand over the next pipelined request before writing, Write
+         * closes a connection the peer shut down once nothing is busy.
+         * */
+        Parse(completion.connection, current);
+
+        /* Parse may have written a 100 Continue and closed it. */
+        if (_connections.find(completion.connection) != _connections.end()) {
+            Write(completion.connection, current);
+        }
+    }
+}
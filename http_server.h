@@ -0,0 +1,133 @@
+#ifndef __HTTP_SERVER_H__
+#define __HTTP_SERVER_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+
+struct HttpRequest {
+    std::string method;
+    std::string path;    // Without query
+    std::string query;   // After '?', not decoded
+    std::map<std::string, std::string> headers; // Names in lower case
+    std::string body;
+    std::chrono::steady_clock::time_point arrival; // Headers complete
+
+    /* Value of a header, fallback if it is missing. */
+    std::string Header(const std::string& name,
+            const std::string& fallback = std::string()) const;
+};
+
+struct HttpResponse {
+    int status = 200;
+    std::string content_type = "application/json";
+    std::string body;
+
+    HttpResponse() = default;
+    HttpResponse(int status, const std::string& content_type,
+            const std::string& body) :
+        status(status), content_type(content_type), body(body) {}
+};
+
+struct HttpServerOptions {
+    std::string unix_socket;   // Path of a Unix domain socket, empty - off
+    int port = 0;              // TCP port on host, 0 - off
+    std::string host = "127.0.0.1";
+    size_t max_body_bytes = 64 << 20;
+    size_t max_connections = 1024;
+};
+
+/* Minimal HTTP/1.1 server on one epoll event loop.
+ *
+ * The loop only accepts, reads, parses and writes, never blocks on a
+ * request: the handler is called on the loop thread and gets a Reply it
+ * may call later from any thread, e.g. after inference. Replies are
+ * queued and handed back to the loop by an eventfd. Every connection
+ * has one request in flight at a time, keep-alive is supported, bodies
+ * need Content-Length ("Expect: 100-continue" is answered).
+ * */
+class HttpServer {
+public:
+    /* Completes one request, call it exactly once, from any thread. */
+    using Reply = std::function<void(const HttpResponse& response)>;
+    using Handler = std::function<void(HttpRequest& request, Reply reply)>;
+
+private:
+    struct Connection {
+        int fd = -1;
+        std::string input;
+        std::string output;
+        size_t written = 0;
+        bool busy = false;        // Request given to the handler
+        bool keep_alive = true;
+        bool closing = false;     // Close when output is written
+        bool eof = false;         // Peer shut down its sending side
+        bool continued = false;   // 100 Continue sent for this request
+    };
+
+    struct Completion {
+        uint64_t connection;
+        HttpResponse response;
+        bool keep_alive;
+    };
+
+    HttpServerOptions _options;
+    Handler _handler;
+
+    int _epoll = -1;
+    int _wakeup = -1;
+    std::vector<int> _listeners;
+    bool _unix_bound = false;
+
+    /* Ids instead of fds, so a late reply never reaches a new
+     * connection that got the fd of a closed one.
+     * */
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> _connections;
+    uint64_t _next_id = 1;
+
+    std::mutex _mutex;
+    std::vector<Completion> _completions;
+    std::atomic<bool> _stop{false};
+
+    tensorflow::Status AddListener(int fd);
+    void Accept(int listener);
+    void Read(uint64_t id, Connection& connection);
+    void Write(uint64_t id, Connection& connection);
+    void Parse(uint64_t id, Connection& connection);
+    void Respond(Connection& connection, const HttpResponse& response,
+            bool keep_alive);
+    void UpdateEvents(uint64_t id, Connection& connection);
+    void Close(uint64_t id);
+    void DrainCompletions();
+    void Complete(uint64_t id, const HttpResponse& response, bool keep_alive);
+
+public:
+    HttpServer(const HttpServerOptions& options, Handler handler);
+    ~HttpServer();
+
+    HttpServer(const HttpServer&) = delete;
+    HttpServer& operator=(const HttpServer&) = delete;
+
+    /* Bind the Unix socket and/or TCP port, before Run. */
+    tensorflow::Status Listen();
+
+    /* Event loop, returns after Stop. */
+    void Run();
+
+    /* Safe from any thread and from a signal handler. */
+    void Stop();
+};
+
+/* Standard reason phrase of a status code. */
+const char* HttpReason(int status);
+
+#endif /* __HTTP_SERVER_H__ */
@@ -1,270 +1,182 @@
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <tuple>
-#include <fstream>
-#include "tensorflow/cc/framework/scope.h"
-#include "tensorflow/cc/saved_model/loader.h"
-#include "tensorflow/core/public/session.h"
-#include "tensorflow/cc/client/client_session.h"
-#include "tensorflow/cc/ops/standard_ops.h"
-
-using tensorflow::Status;
-using tensorflow::Tensor;
-using tensorflow::Scope;
-using tensorflow::GraphDef;
-using tensorflow::Output;
-using tensorflow::SessionOptions;
-using tensorflow::ClientSession;
-using tensorflow::Session;
-using tensorflow::RunOptions;
-using tensorflow::SavedModelBundle;
-
-class Model {
-private: /* Variables */
-    /* scope for graph */
-    Scope _root;
-
-    /* Layers in model */
-    std::string _input_layer;
-    std::string _output_layer;
-
-    /* Labels */
-    std::vector<std::string> _labels;
-
-    /* Read SavedModel type */
-    SessionOptions _session_options;
-    RunOptions _run_options;
-    SavedModelBundle _bundle;
-
-    /* Variables for graph */
-    Output _input_of_graph;
-    Output _output_of_graph;
-
-    int _image_channels = 3; // RGB - 3, Gray - 2
-    int _expand_dims_axis = 0; // Index for inserting
-    int _input_height = 96;
-    int _input_width = 96;
-    float _convert_data_value = 255.f;
-
-private: /* Functions */
-    Status ReadLabelsFile(const std::string& file_name);
-    Status CreateGraphForImage();
-    Status ReadImageToTensor(const std::string& file_name, Tensor& out_tensors);
-    Status GetTopLabels(const std::vector<Tensor>& outputs, Tensor* indices,
-            Tensor* scores);
-    void PrintTopLabels(Tensor& indexes, Tensor& scores);
-
-public:
-    /* Read only SavedModel type.
-     * Have 2 folders, "assets" and "variables", and one file "save_model.pb".
-     * */
-    Model(const std::string& model_path, const std::string& file_labels,
-            const std::string& input_layer, const std::string& output_layer);
-
-    std::tuple<int32_t, float> Testing(const std::string& file_path);
-};
-
-Model::Model(const std::string& model_path, const std::string& file_labels,
-        const std::string& input_layer, const std::string& output_layer)
-        : _root(Scope::NewRootScope()),  _input_layer(input_layer),
-        _output_layer(output_layer) {
-    /* SessionOption - configuration information for a Session.
-     * export_dir - the path of directory.
-     * tags("serve") - used at SavedModel build time.
-     * Bundle - model bundle.
-     * */
-    auto status = tensorflow::LoadSavedModel(_session_options, _run_options,
-            model_path, {"serve"}, &_bundle);
-    if (!status.ok()) {
-        throw std::runtime_error(status.ToString());
-    }
-
-    status = ReadLabelsFile(file_labels);
-    if (!status.ok()) {
-        throw std::runtime_error(status.ToString());
-    }
-
-    status = CreateGraphForImage();
-    if (!status.ok()) {
-        throw std::runtime_error(status.ToString());
-    }
-}
-
-Status Model::ReadLabelsFile(const std::string& file_name) {
-    using namespace tensorflow;
-
-    std::string line;
-
-    std::ifstream file(file_name);
-    if (!file) {
-        return errors::NotFound("Labels file ", file_name, " not found.");
-    }
-
-    while (std::getline(file, line)) {
-        _labels.push_back(line);
-    }
-
-    return Status::OK();
-}
-
-Status Model::CreateGraphForImage() {
-    using namespace tensorflow;
-
-    /* Add receiving directory
-     * Return tensorflow::Output
-     * */
-    _input_of_graph = ops::Placeholder(_root.WithOpName("input"), DT_STRING);
-
-    /* Read file
-     * Return tensorflow::Output
-     * */
-    auto file_reader = ops::ReadFile(_root.WithOpName("file_reader"),
-            _input_of_graph);
-
-    /* Receive Jpeg file
-     * Return tensorflow::Output
-     * */
-    auto image_reader = ops::DecodeJpeg(_root.WithOpName("image_decoder"),
-            file_reader, ops::DecodeJpeg::Channels(_image_channels));
-
-    /* Casting data to float type
-     * Return tensorflow::Output
-     * */
-    auto cast_image = ops::Cast(_root.WithOpName("cast"), image_reader,
-            DT_FLOAT);
-
-    /* Add number of banch
-     * (height, width, channels) -> (banch, height, width, channels)
-     * Return tensorflow::Output
-     * */
-    auto dims = ops::ExpandDims(_root.WithOpName("dims"),
-            cast_image, _expand_dims_axis);
-
-    /* Resize images
-     * Return tensorflow::Output
-     * */
-    _output_of_graph = ops::ResizeBilinear(_root.WithOpName("resize"), dims,
-            ops::Const(_root.WithOpName("size"), {_input_height, _input_width}));
-
-    /* Delete datas on convert_data_value
-     * Return tensorflow::Output
-     * Normalized isn't used because rescaling is used in graph of model.
-     * */
-    /* _output_of_graph = Div(_root.WithOpName("div"), resize, */
-    /*         {_convert_data_value}); */
-
-    return _root.status();
-}
-
-Status Model::ReadImageToTensor(const std::string& file_name,
-        Tensor& out_tensor) {
-    using namespace tensorflow;
-
-    std::vector<Tensor> out_tensors;
+#include <memory>
+#include "tensorflow/core/util/command_line_flags.h"
 
-    if (!str_util::EndsWith(file_name, ".jpg") &&
-        !str_util::EndsWith(file_name, ".jpeg")) {
-        return errors::InvalidArgument("Image must be jpeg/jpg encoded");
-    }
-
-    ClientSession session(_root);
-
-    TF_RETURN_IF_ERROR(session.Run({{_input_of_graph, file_name}},
-            {_output_of_graph}, &out_tensors));
-
-    out_tensor = out_tensors[0]; // shallow copy
-
-    return Status::OK();
-}
-
-
-std::tuple<int32_t, float> Model::Testing(const std::string& file_path) {
-        Tensor out_tensor;
-    std::vector<Tensor> outputs;
-    Tensor indexes, scores;
-
-    auto status = ReadImageToTensor(file_path, out_tensor);
-    if (!status.ok()) {
-        throw std::runtime_error(status.ToString());
-    }
+#include "batch_classifier.h"
+#include "classification_model.h"
+#include "metrics.h"
+#include "stream_inputs.h"
 
-    status = _bundle.GetSession()->Run({{_input_layer, out_tensor}},
-            {_output_layer}, {}, &outputs);
-    if (!status.ok()) {
-        throw std::runtime_error(status.ToString());
-    }
-
-    status = GetTopLabels(outputs, &indexes, &scores);
-    if (!status.ok()) {
-        throw std::runtime_error(status.ToString());
-    }
-
-    tensorflow::TTypes<float>::Flat scores_flat = scores.flat<float>();
-    tensorflow::TTypes<int32_t>::Flat indexes_flat = indexes.flat<int32_t>();
-
-    PrintTopLabels(indexes, scores);
+using tensorflow::Flag;
 
-    return std::make_tuple(indexes_flat(0), scores_flat(0));
-}
-
-Status Model::GetTopLabels(const std::vector<Tensor>& inputs,
-        Tensor* indexes, Tensor* scores) {
-    using namespace tensorflow;
-
-    GraphDef graph;
-    std::vector<Tensor> outputs;
-    std::unique_ptr<Session> session(NewSession(SessionOptions()));
-    auto tmp_root = Scope::NewRootScope();
-
-    if (inputs.size() == 0) {
-        return errors::NotFound("No found output from model");
-    }
-
-    ops::TopK(tmp_root.WithOpName("top_k"), inputs[0], (int32_t)_labels.size());
-
-    TF_RETURN_IF_ERROR(tmp_root.ToGraphDef(&graph));
-    TF_RETURN_IF_ERROR(session->Create(graph));
-    TF_RETURN_IF_ERROR(session->Run({}, {"top_k:0", "top_k:1"}, {}, &outputs));
-
-    if (outputs.size() == 0) {
-        return errors::NotFound("No found result from top_k");
-    }
-
-    *scores = outputs[0];
-    *indexes = outputs[1];
-
-    return Status::OK();
-}
-
-void Model::PrintTopLabels(Tensor& indexes, Tensor& scores) {
-    tensorflow::TTypes<float>::Flat scores_flat = scores.flat<float>();
-    tensorflow::TTypes<int32_t>::Flat indexes_flat = indexes.flat<int32_t>();
-
-    for (size_t pos = 0; pos < _labels.size(); ++pos) {
-        const int label_index = indexes_flat(pos);
-        const float score = scores_flat(pos);
-        LOG(INFO) << _labels[label_index] << " (" << label_index << "): " << score;
-    }
-}
-
-int main() {
+int main(int argc, char** argv) {
     int32_t index;
     float score;
+    int32_t top_k = 5;
+    int32_t batch_size = 32;
+    int32_t prefetch_threads = 0;
+    int32_t prefetch = 64;
+    int32_t cache_entries = 0;
+    int32_t cache_near_distance = -1;
+    std::string cache_file;
     std::string path_to_model = "<path_to_model>";
     std::string testing_file = "<path_to_image>";
+    std::string images;
+    std::string image_dir;
+    std::string image_list;
+    std::string archive;
+    std::string output;
+    std::string output_format = "csv";
+    std::string preprocess = "graph";
+    std::string model_config;
+    std::string model_config_file;
     std::string file_labels = "<path_to_file_of_labels";
     std::string input_model_layer = "serving_default_rescaling_input:0";
     std::string output_model_layer = "StatefulPartitionedCall:0";
+    BatchOptions batch_options;
+
+    std::vector<Flag> flag_list = {
+        Flag("model", &path_to_model, "path of model to be processed"),
+        Flag("image", &testing_file, "path of image to be classified"),
+        Flag("images", &images,
+                "comma separated images or glob patterns, classified in batches"),
+        Flag("image_dir", &image_dir,
+                "directory, all its .jpg and .jpeg files are classified"),
+        Flag("image_list", &image_list,
+                "file with one image path per line, - reads stdin"),
+        Flag("archive", &archive, "image archive made by pack_images"),
+        Flag("labels", &file_labels, "path of file with labels"),
+        Flag("top_k", &top_k, "count of best labels to print"),
+        Flag("preprocess", &preprocess,
+                "image preprocessing: graph (TF ops) or native (libjpeg)"),
+        Flag("model_config", &model_config,
+                "load settings as key=value,...: tags, xla, onednn, grappler..."),
+        Flag("model_config_file", &model_config_file,
+                "file with one load setting key=value per line"),
+        Flag("batch_size", &batch_size, "images per Session::Run"),
+        Flag("prefetch_threads", &prefetch_threads,
+                "threads reading and decoding images, 0 - one per core"),
+        Flag("prefetch", &prefetch,
+                "decoded images waiting for a batch at most"),
+        Flag("output", &output, "results file, stdout if empty"),
+        Flag("output_format", &output_format, "results format: csv or jsonl"),
+        Flag("cache_entries", &cache_entries,
+                "results kept for repeated images, 0 - no result cache"),
+        Flag("cache_near_distance", &cache_near_distance,
+                "max dHash bits a near-duplicate image differs by, -1 - off"),
+        Flag("cache_file", &cache_file,
+                "result cache kept across runs, empty - memory only"),
+    };
+
+    std::string usage = tensorflow::Flags::Usage(argv[0], flag_list);
+    bool parse_result = tensorflow::Flags::Parse(&argc, argv, flag_list);
+    if (!parse_result || top_k <= 0 || batch_size <= 0 || prefetch <= 0 ||
+        (preprocess != "graph" && preprocess != "native") ||
+        !ParseResultFormat(output_format, batch_options.format)) {
+        LOG(ERROR) << usage;
+        return -1;
+    }
 
-    try {
-        Model model(path_to_model, file_labels, input_model_layer,
-                output_model_layer);
+    /* Pairs of --model_config override the file. */
+    ModelConfig config;
+    Status config_status = Status::OK();
+    if (!model_config_file.empty()) {
+        config_status = LoadModelConfig(model_config_file, config);
+    }
+    if (config_status.ok()) {
+        config_status = ParseModelConfig(model_config, config);
+    }
+    if (!config_status.ok()) {
+        LOG(ERROR) << config_status.ToString();
+        return -1;
+    }
 
-        std::tie(index, score) = model.Testing(testing_file);
+    batch_options.batch_size = batch_size;
+    batch_options.prefetch_threads = prefetch_threads;
+    batch_options.prefetch = prefetch;
 
-        std::cout << "Result: index: " << index
-            << " score: " << score << std::endl;
+    bool batch_mode = !images.empty() || !image_dir.empty() ||
+        !image_list.empty() || !archive.empty();
+
+    try {
+        ClassificationModel model(path_to_model, file_labels, input_model_layer,
+                output_model_layer, top_k, preprocess == "native", config);
+
+        if (cache_entries > 0) {
+            CacheOptions cache_options;
+
+            cache_options.capacity = cache_entries;
+            cache_options.near_distance = cache_near_distance;
+            cache_options.file = cache_file;
+            model.SetResultCache(cache_options);
+        }
+
+        if (!batch_mode) {
+            std::tie(index, score) = model.Testing(testing_file);
+
+            std::cout << "Result: index: " << index
+                << " score: " << score << std::endl;
+            return 0;
+        }
+
+        std::vector<std::string> paths;
+        std::unique_ptr<ImageArchive> packed;
+        std::unique_ptr<std::istream> list_file;
+        std::unique_ptr<ImageSource> source;
+        std::ofstream output_file;
+
+        if (!archive.empty()) {
+            /* One mapping for all images, no open or read per image. */
+            auto status = ImageArchive::Open(archive, packed);
+            if (!status.ok()) {
+                throw std::runtime_error(status.ToString());
+            }
+            source.reset(new ImageSource(*packed));
+        } else if (image_list == "-") {
+            source.reset(new ImageSource(std::cin));
+        } else if (!image_list.empty()) {
+            list_file.reset(new std::ifstream(image_list));
+            if (!*list_file) {
+                throw std::runtime_error("Failed to read list " + image_list);
+            }
+            source.reset(new ImageSource(*list_file));
+        } else {
+            std::vector<StreamInput> inputs;
+
+            ExpandInputs(images, inputs);
+            for (const StreamInput& input : inputs) {
+                paths.push_back(input.path);
+            }
+            if (!image_dir.empty() && !ListImages(image_dir, paths)) {
+                throw std::runtime_error("Failed to list " + image_dir);
+            }
+            source.reset(new ImageSource(paths));
+        }
+
+        if (!output.empty()) {
+            output_file.open(output);
+            if (!output_file) {
+                throw std::runtime_error("Failed to create " + output);
+            }
+        }
+
+        BatchClassifier classifier(model, batch_options);
+        classifier.Run(*source,
+                output.empty() ? std::cout : output_file);
+
+        if (cache_entries > 0) {
+            const Metrics& metrics = Metrics::Global();
+
+            LOG(INFO) << "Result cache: "
+                      << metrics.Value(Counter::CACHE_HITS) << " hits, "
+                      << metrics.Value(Counter::CACHE_NEAR_HITS)
+                      << " near hits, "
+                      << metrics.Value(Counter::CACHE_MISSES) << " misses";
+        }
     } catch (const std::exception& e) {
         std::cout << e.what() << std::endl;
     }
@@ -0,0 +1,352 @@
+#include "jpeg_preprocess.h"
+
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESIZE_AVX2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESIZE_NEON 1
+#endif
+
+#include "tensorflow/core/platform/errors.h"
+
+using tensorflow::Status;
+using tensorflow::StringPiece;
+
+/* Bytes readable past the last pixel, 32-bit gathers of the
+ * AVX2 kernel load up to 3 bytes after the byte they need.
+ * */
+static const size_t kPixelsPadding = 4;
+
+namespace {
+
+struct JpegErrorManager {
+    jpeg_error_mgr manager;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+/* Source pixels of one output row or column, as TF LegacyScaler. */
+struct Interpolation {
+    int32_t lower;
+    int32_t upper;
+    float lerp;
+};
+
+/* Per output element of a row: x * channels + c. */
+struct RowTables {
+    std::vector<int32_t> left;
+    std::vector<int32_t> right;
+    std::vector<float> lerp;
+};
+
+} // namespace
+
+static
+void jpeg_error_exit(j_common_ptr cinfo) {
+    JpegErrorManager* error = reinterpret_cast<JpegErrorManager*>(cinfo->err);
+
+    (*cinfo->err->format_message)(cinfo, error->message);
+    std::longjmp(error->jump, 1);
+}
+
+/* Warnings of corrupt but decodable data are not printed. */
+static
+void jpeg_output_message(j_common_ptr cinfo) {}
+
+/* in_size / out_size as float and floor / ceil of the scaled index,
+ * exactly as compute_interpolation_weights of TF resize_bilinear_op.
+ * */
+static
+void compute_interpolation(int in_size, int out_size,
+        std::vector<Interpolation>& weights) {
+    const float scale = in_size / static_cast<float>(out_size);
+
+    weights.resize(out_size);
+    for (int i = 0; i < out_size; ++i) {
+        const float in = static_cast<float>(i) * scale;
+        const float in_floor = std::floor(in);
+
+        weights[i].lower = std::max(static_cast<int32_t>(in_floor), 0);
+        weights[i].upper = std::min(static_cast<int32_t>(std::ceil(in)),
+                in_size - 1);
+        weights[i].lerp = in - in_floor;
+    }
+}
+
+/* Multiply and add are kept separate everywhere (and the file is built
+ * with -ffp-contract=off), an FMA would round differently from TF.
+ * */
+static
+int resize_row_scalar(const uint8_t* top, const uint8_t* bottom,
+        const RowTables& tables, float y_lerp, int begin, int count,
+        const JpegPreprocessOptions& options, float* out) {
+    for (int i = begin; i < count; ++i) {
+        const float top_left = top[tables.left[i]];
+        const float top_right = top[tables.right[i]];
+        const float bottom_left = bottom[tables.left[i]];
+        const float bottom_right = bottom[tables.right[i]];
+        const float x_lerp = tables.lerp[i];
+
+        const float top_value = top_left + (top_right - top_left) * x_lerp;
+        const float bottom_value = bottom_left +
+                (bottom_right - bottom_left) * x_lerp;
+        float value = top_value + (bottom_value - top_value) * y_lerp;
+
+        if (options.normalize) {
+            value = value * options.scale + options.offset;
+        }
+
+        out[i] = value;
+    }
+
+    return count;
+}
+
+#if RESIZE_AVX2
+__attribute__((target("avx2")))
+static
+__m256 gather_u8(const uint8_t* base, __m256i indices) {
+    const __m256i words = _mm256_i32gather_epi32(
+            reinterpret_cast<const int*>(base), indices, 1);
+    return _mm256_cvtepi32_ps(_mm256_and_si256(words, _mm256_set1_epi32(0xff)));
+}
+
+/* 8 output elements per step, returns the count done. */
+__attribute__((target("avx2")))
+static
+int resize_row_simd(const uint8_t* top, const uint8_t* bottom,
+        const RowTables& tables, float y_lerp, int count,
+        const JpegPreprocessOptions& options, float* out) {
+    const __m256 y_lerps = _mm256_set1_ps(y_lerp);
+    const __m256 scale = _mm256_set1_ps(options.scale);
+    const __m256 offset = _mm256_set1_ps(options.offset);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        const __m256i left = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&tables.left[i]));
+        const __m256i right = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&tables.right[i]));
+        const __m256 x_lerp = _mm256_loadu_ps(&tables.lerp[i]);
+
+        const __m256 top_left = gather_u8(top, left);
+        const __m256 top_right = gather_u8(top, right);
+        const __m256 bottom_left = gather_u8(bottom, left);
+        const __m256 bottom_right = gather_u8(bottom, right);
+
+        const __m256 top_value = _mm256_add_ps(top_left,
+                _mm256_mul_ps(_mm256_sub_ps(top_right, top_left), x_lerp));
+        const __m256 bottom_value = _mm256_add_ps(bottom_left,
+                _mm256_mul_ps(_mm256_sub_ps(bottom_right, bottom_left), x_lerp));
+        __m256 value = _mm256_add_ps(top_value, _mm256_mul_ps(
+                _mm256_sub_ps(bottom_value, top_value), y_lerps));
+
+        if (options.normalize) {
+            value = _mm256_add_ps(_mm256_mul_ps(value, scale), offset);
+        }
+
+        _mm256_storeu_ps(out + i, value);
+    }
+
+    return i;
+}
+#elif RESIZE_NEON
+static
+float32x4_t load_u8(const uint8_t* base, const int32_t* indices) {
+    const float values[4] = {
+        static_cast<float>(base[indices[0]]),
+        static_cast<float>(base[indices[1]]),
+        static_cast<float>(base[indices[2]]),
+        static_cast<float>(base[indices[3]]),
+    };
+
+    return vld1q_f32(values);
+}
+
+/* No gather in NEON, loads are scalar and arithmetic is 4 wide. */
+static
+int resize_row_simd(const uint8_t* top, const uint8_t* bottom,
+        const RowTables& tables, float y_lerp, int count,
+        const JpegPreprocessOptions& options, float* out) {
+    const float32x4_t y_lerps = vdupq_n_f32(y_lerp);
+    const float32x4_t scale = vdupq_n_f32(options.scale);
+    const float32x4_t offset = vdupq_n_f32(options.offset);
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        const float32x4_t x_lerp = vld1q_f32(&tables.lerp[i]);
+        const float32x4_t top_left = load_u8(top, &tables.left[i]);
+        const float32x4_t top_right = load_u8(top, &tables.right[i]);
+        const float32x4_t bottom_left = load_u8(bottom, &tables.left[i]);
+        const float32x4_t bottom_right = load_u8(bottom, &tables.right[i]);
+
+        const float32x4_t top_value = vaddq_f32(top_left,
+                vmulq_f32(vsubq_f32(top_right, top_left), x_lerp));
+        const float32x4_t bottom_value = vaddq_f32(bottom_left,
+                vmulq_f32(vsubq_f32(bottom_right, bottom_left), x_lerp));
+        float32x4_t value = vaddq_f32(top_value, vmulq_f32(
+                vsubq_f32(bottom_value, top_value), y_lerps));
+
+        if (options.normalize) {
+            value = vaddq_f32(vmulq_f32(value, scale), offset);
+        }
+
+        vst1q_f32(out + i, value);
+    }
+
+    return i;
+}
+#endif
+
+bool ResizeSimdAvailable() {
+#if RESIZE_AVX2
+    static const bool available = __builtin_cpu_supports("avx2");
+    return available;
+#elif RESIZE_NEON
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ResizeBilinearFused(const uint8_t* src, int src_height, int src_width,
+        int channels, float* dst, int dst_height, int dst_width,
+        const JpegPreprocessOptions& options, ResizeKernel kernel) {
+    const int count = dst_width * channels;
+    const size_t src_stride = static_cast<size_t>(src_width) * channels;
+    const bool simd = kernel != ResizeKernel::SCALAR && ResizeSimdAvailable();
+    std::vector<Interpolation> ys;
+    std::vector<Interpolation> xs;
+    RowTables tables;
+
+    compute_interpolation(src_height, dst_height, ys);
+    compute_interpolation(src_width, dst_width, xs);
+
+    tables.left.resize(count);
+    tables.right.resize(count);
+    tables.lerp.resize(count);
+    for (int x = 0; x < dst_width; ++x) {
+        for (int c = 0; c < channels; ++c) {
+            tables.left[x * channels + c] = xs[x].lower * channels + c;
+            tables.right[x * channels + c] = xs[x].upper * channels + c;
+            tables.lerp[x * channels + c] = xs[x].lerp;
+        }
+    }
+
+    for (int y = 0; y < dst_height; ++y) {
+        const uint8_t* top = src + ys[y].lower * src_stride;
+        const uint8_t* bottom = src + ys[y].upper * src_stride;
+        float* out = dst + static_cast<size_t>(y) * count;
+        int done = 0;
+
+#if RESIZE_AVX2 || RESIZE_NEON
+        if (simd) {
+            done = resize_row_simd(top, bottom, tables, ys[y].lerp, count,
+                    options, out);
+        }
+#endif
+        resize_row_scalar(top, bottom, tables, ys[y].lerp, done, count,
+                options, out);
+    }
+}
+
+Status DecodeJpegScaled(StringPiece jpeg, int channels, int min_height,
+        int min_width, std::vector<uint8_t>& pixels, int& height, int& width) {
+    using namespace tensorflow;
+
+    jpeg_decompress_struct cinfo;
+    JpegErrorManager error;
+
+    if (channels != 1 && channels != 3) {
+        return errors::InvalidArgument("Unsupported count of channels ",
+                channels);
+    }
+
+    cinfo.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = jpeg_error_exit;
+    error.manager.output_message = jpeg_output_message;
+
+    /* Only POD locals live between setjmp and longjmp. */
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return errors::InvalidArgument("Invalid JPEG data: ", error.message);
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(
+            reinterpret_cast<const unsigned char*>(jpeg.data())),
+            static_cast<unsigned long>(jpeg.size()));
+    jpeg_read_header(&cinfo, TRUE);
+
+    cinfo.out_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.do_fancy_upsampling = TRUE;
+    cinfo.scale_num = 8;
+    cinfo.scale_denom = 8;
+
+    /* libjpeg-turbo has SIMD IDCT for 1/8, 2/8, 4/8 and 8/8, the
+     * smallest of them that still covers the target is used.
+     * */
+    if (min_height > 0 && min_width > 0) {
+        for (unsigned int num = 1; num < 8; num *= 2) {
+            const unsigned int scaled_width =
+                    (cinfo.image_width * num + 7) / 8;
+            const unsigned int scaled_height =
+                    (cinfo.image_height * num + 7) / 8;
+
+            if (scaled_width >= static_cast<unsigned int>(min_width) &&
+                scaled_height >= static_cast<unsigned int>(min_height)) {
+                cinfo.scale_num = num;
+                break;
+            }
+        }
+    }
+
+    jpeg_start_decompress(&cinfo);
+
+    width = cinfo.output_width;
+    height = cinfo.output_height;
+
+    const size_t stride = static_cast<size_t>(width) * channels;
+
+    pixels.resize(stride * height + kPixelsPadding);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = &pixels[cinfo.output_scanline * stride];
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return Status::OK();
+}
+
+Status JpegPreprocessor::Run(StringPiece jpeg, tensorflow::Tensor& tensor,
+        ResizeKernel kernel) {
+    using namespace tensorflow;
+
+    int height = 0;
+    int width = 0;
+
+    TF_RETURN_IF_ERROR(DecodeJpegScaled(jpeg, _options.channels,
+            _options.dct_scaling ? _options.height : 0,
+            _options.dct_scaling ? _options.width : 0,
+            _pixels, height, width));
+
+    tensor = Tensor(DT_FLOAT, TensorShape({1, _options.height, _options.width,
+            _options.channels}));
+
+    ResizeBilinearFused(_pixels.data(), height, width, _options.channels,
+            tensor.flat<float>().data(), _options.height, _options.width,
+            _options, kernel);
+
+    return Status::OK();
+}
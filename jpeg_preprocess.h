@@ -0,0 +1,70 @@
+#ifndef __JPEG_PREPROCESS_H__
+#define __JPEG_PREPROCESS_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/stringpiece.h"
+
+struct JpegPreprocessOptions {
+    int height = 96;
+    int width = 96;
+    int channels = 3;          // RGB - 3, Gray - 1
+    bool dct_scaling = true;   // Let libjpeg decode at 1/2, 1/4 or 1/8 size
+    bool normalize = false;    // value * scale + offset after resize
+    float scale = 1.f / 255.f;
+    float offset = 0.f;
+};
+
+enum class ResizeKernel {
+    AUTO,   // SIMD if the CPU has it
+    SCALAR,
+    SIMD,   // AVX2 or NEON, scalar if neither is available
+};
+
+/* True if the resize has an AVX2 or NEON version on this CPU. */
+bool ResizeSimdAvailable();
+
+/* Decode JPEG with libjpeg-turbo, settings match TF DecodeJpeg defaults
+ * (INTEGER_FAST DCT, fancy upsampling). With min_height / min_width > 0
+ * the largest DCT scale 1/8..8/8 giving at least that size is used, so
+ * big photos are never decoded at full resolution.
+ * pixels gets height * width * channels bytes and some padding.
+ * */
+tensorflow::Status DecodeJpegScaled(tensorflow::StringPiece jpeg, int channels,
+        int min_height, int min_width, std::vector<uint8_t>& pixels,
+        int& height, int& width);
+
+/* Bilinear resize, uint8 -> float cast and optional normalize in one
+ * pass. Same arithmetic as TF ResizeBilinear with align_corners and
+ * half_pixel_centers off, so the output equals Cast + ResizeBilinear
+ * bit for bit; SIMD and scalar kernels give identical results.
+ * src rows must be readable 4 bytes past the end of the image.
+ * */
+void ResizeBilinearFused(const uint8_t* src, int src_height, int src_width,
+        int channels, float* dst, int dst_height, int dst_width,
+        const JpegPreprocessOptions& options,
+        ResizeKernel kernel = ResizeKernel::AUTO);
+
+/* JPEG bytes -> [1, height, width, channels] float tensor, replacing
+ * the DecodeJpeg -> Cast -> ExpandDims -> ResizeBilinear graph without
+ * full resolution float intermediates. Keeps its buffers between
+ * images, use one per thread.
+ * */
+class JpegPreprocessor {
+private:
+    JpegPreprocessOptions _options;
+    std::vector<uint8_t> _pixels;
+
+public:
+    explicit JpegPreprocessor(const JpegPreprocessOptions& options) :
+        _options(options) {}
+
+    tensorflow::Status Run(tensorflow::StringPiece jpeg,
+            tensorflow::Tensor& tensor,
+            ResizeKernel kernel = ResizeKernel::AUTO);
+};
+
+#endif /* __JPEG_PREPROCESS_H__ */
@@ -0,0 +1,264 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "tensorflow/core/platform/logging.h"
+
+const char* StageName(Stage stage) {
+    switch (stage) {
+    case Stage::DEMUX: return "demux";
+    case Stage::DECODE: return "decode";
+    case Stage::SWS_SCALE: return "sws_scale";
+    case Stage::TENSOR_BUILD: return "tensor_build";
+    case Stage::BATCH_WAIT: return "batch_wait";
+    case Stage::SESSION_RUN: return "session_run";
+    case Stage::POSTPROCESS: return "postprocess";
+    case Stage::OUTPUT_ENCODE: return "output_encode";
+    case Stage::OUTPUT_WRITE: return "output_write";
+    case Stage::REQUEST: return "request";
+    case Stage::TRACK: return "track";
+    default: return "unknown";
+    }
+}
+
+const char* CounterName(Counter counter) {
+    switch (counter) {
+    case Counter::PACKETS: return "packets";
+    case Counter::FRAMES_DECODED: return "frames_decoded";
+    case Counter::FRAMES_SKIPPED: return "frames_skipped";
+    case Counter::FRAMES_INFERRED: return "frames_inferred";
+    case Counter::TILES_INFERRED: return "tiles_inferred";
+    case Counter::BATCHES: return "batches";
+    case Counter::DETECTIONS: return "detections";
+    case Counter::FRAMES_WRITTEN: return "frames_written";
+    case Counter::FRAMES_DROPPED: return "frames_dropped";
+    case Counter::REQUESTS: return "requests";
+    case Counter::REQUESTS_REJECTED: return "requests_rejected";
+    case Counter::DEADLINES_EXCEEDED: return "deadlines_exceeded";
+    case Counter::CACHE_HITS: return "cache_hits";
+    case Counter::CACHE_NEAR_HITS: return "cache_near_hits";
+    case Counter::CACHE_MISSES: return "cache_misses";
+    case Counter::FRAMES_TRACKED: return "frames_tracked";
+    default: return "unknown";
+    }
+}
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto& bucket : _buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+/* Values below kSubBuckets are exact, above them every power of two
+ * 2^e gets kSubBuckets buckets of width 2^(e - kSubBucketBits).
+ * */
+int LatencyHistogram::BucketIndex(uint64_t value) {
+    if (value < kSubBuckets) {
+        return static_cast<int>(value);
+    }
+
+    const int exponent = 63 - __builtin_clzll(value);
+    const int shift = exponent - kSubBucketBits;
+    const int sub_bucket = static_cast<int>(value >> shift) - kSubBuckets;
+
+    return (shift + 1) * kSubBuckets + sub_bucket;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int index) {
+    if (index < kSubBuckets) {
+        return index;
+    }
+
+    const int shift = index / kSubBuckets - 1;
+    const uint64_t sub_bucket = index % kSubBuckets;
+    const uint64_t lower = (kSubBuckets + sub_bucket) << shift;
+
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds) {
+    _buckets[BucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t max = _max.load(std::memory_order_relaxed);
+    while (nanoseconds > max &&
+           !_max.compare_exchange_weak(max, nanoseconds,
+                   std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::Quantile(double q) const {
+    const uint64_t count = Count();
+
+    if (count == 0) {
+        return 0;
+    }
+
+    /* Rank of the wanted value, 1-based. */
+    uint64_t rank = static_cast<uint64_t>(q * count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += _buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(BucketUpperBound(i), Max());
+        }
+    }
+
+    return Max();
+}
+
+Metrics::Metrics() {
+    for (auto& counter : _counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+}
+
+Metrics& Metrics::Global() {
+    static Metrics metrics;
+    return metrics;
+}
+
+static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+std::string Metrics::ExportPrometheus() const {
+    std::ostringstream os;
+
+    os << "# HELP detection_stage_seconds Latency of pipeline stages.\n"
+       << "# TYPE detection_stage_seconds summary\n";
+    for (int i = 0; i < static_cast<int>(Stage::COUNT); ++i) {
+        const LatencyHistogram& histogram = _stages[i];
+        const char* name = StageName(static_cast<Stage>(i));
+
+        for (double q : kQuantiles) {
+            os << "detection_stage_seconds{stage=\"" << name
+               << "\",quantile=\"" << q << "\"} "
+               << histogram.Quantile(q) * 1e-9 << "\n";
+        }
+        os << "detection_stage_seconds_sum{stage=\"" << name << "\"} "
+           << histogram.Sum() * 1e-9 << "\n"
+           << "detection_stage_seconds_count{stage=\"" << name << "\"} "
+           << histogram.Count() << "\n";
+    }
+
+    for (int i = 0; i < static_cast<int>(Counter::COUNT); ++i) {
+        const char* name = CounterName(static_cast<Counter>(i));
+
+        os << "# TYPE detection_" << name << "_total counter\n"
+           << "detection_" << name << "_total "
+           << Value(static_cast<Counter>(i)) << "\n";
+    }
+
+    return os.str();
+}
+
+std::string Metrics::ExportJson() const {
+    std::ostringstream os;
+
+    os << "{\"stages\":{";
+    for (int i = 0; i < static_cast<int>(Stage::COUNT); ++i) {
+        const LatencyHistogram& histogram = _stages[i];
+
+        os << (i ? "," : "") << "\"" << StageName(static_cast<Stage>(i))
+           << "\":{\"count\":" << histogram.Count()
+           << ",\"sum_us\":" << histogram.Sum() / 1000
+           << ",\"max_us\":" << histogram.Max() / 1000
+           << ",\"p50_us\":" << histogram.Quantile(0.5) / 1000
+           << ",\"p90_us\":" << histogram.Quantile(0.9) / 1000
+           << ",\"p99_us\":" << histogram.Quantile(0.99) / 1000
+           << ",\"p999_us\":" << histogram.Quantile(0.999) / 1000 << "}";
+    }
+
+    os << "},\"counters\":{";
+    for (int i = 0; i < static_cast<int>(Counter::COUNT); ++i) {
+        os << (i ? "," : "") << "\"" << CounterName(static_cast<Counter>(i))
+           << "\":" << Value(static_cast<Counter>(i));
+    }
+    os << "}}\n";
+
+    return os.str();
+}
+
+bool ParseMetricsFormat(const std::string& value, MetricsFormat& format) {
+    if (value == "prometheus") {
+        format = MetricsFormat::PROMETHEUS;
+    } else if (value == "json") {
+        format = MetricsFormat::JSON;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+MetricsExporter::MetricsExporter(const std::string& path,
+        MetricsFormat format, std::chrono::milliseconds interval) :
+    _path(path), _format(format), _interval(interval) {
+    _thread = std::thread(&MetricsExporter::Run, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+    Stop();
+}
+
+bool MetricsExporter::WriteNow() {
+    const Metrics& metrics = Metrics::Global();
+    const std::string tmp_path = _path + ".tmp";
+
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+
+        file << (_format == MetricsFormat::JSON ? metrics.ExportJson()
+                                                : metrics.ExportPrometheus());
+        if (!file) {
+            LOG(ERROR) << "Failed to write metrics to " << tmp_path;
+            return false;
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), _path.c_str()) != 0) {
+        LOG(ERROR) << "Failed to rename " << tmp_path << " to " << _path;
+        return false;
+    }
+
+    return true;
+}
+
+void MetricsExporter::Run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!_stop) {
+        if (_stop_cv.wait_for(lock, _interval, [this]() { return _stop; })) {
+            break;
+        }
+
+        lock.unlock();
+        WriteNow();
+        lock.lock();
+    }
+}
+
+void MetricsExporter::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stop) {
+            return;
+        }
+        _stop = true;
+    }
+
+    _stop_cv.notify_all();
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+
+    /* Final numbers of the run. */
+    WriteNow();
+}
@@ -0,0 +1,181 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* Timed stages of the hot path. */
+enum class Stage {
+    DEMUX,         // av_read_frame
+    DECODE,        // one avcodec_send_packet or avcodec_receive_frame
+    SWS_SCALE,     // color conversion into tensor memory
+    TENSOR_BUILD,  // JPEG decode graph, Mat -> Tensor, batch concat
+    BATCH_WAIT,    // frame arrival at MicroBatcher -> batch dispatch
+    SESSION_RUN,   // RunCallable of the model
+    POSTPROCESS,   // model outputs -> Detection
+    OUTPUT_ENCODE, // annotation and compression on an output sink worker
+    OUTPUT_WRITE,  // ordered append of one frame to a file or encoder
+    REQUEST,       // server request from arrival to reply
+    TRACK,         // tracker update or prediction of one frame
+    COUNT,
+};
+
+enum class Counter {
+    PACKETS,
+    FRAMES_DECODED,
+    FRAMES_SKIPPED, // Not inferred by sampling
+    FRAMES_INFERRED,
+    TILES_INFERRED, // Tiles and full frame passes of tiled frames
+    BATCHES,
+    DETECTIONS,
+    FRAMES_WRITTEN,
+    FRAMES_DROPPED, // Output sink was full with the drop policy
+    REQUESTS,
+    REQUESTS_REJECTED,  // Server queue was full or shutting down
+    DEADLINES_EXCEEDED, // Server request expired before its reply
+    CACHE_HITS,         // Result cache, same bytes or pixels
+    CACHE_NEAR_HITS,    // Result cache, dHash within near_distance
+    CACHE_MISSES,
+    FRAMES_TRACKED,     // Boxes predicted by the tracker, no inference
+    COUNT,
+};
+
+const char* StageName(Stage stage);
+const char* CounterName(Counter counter);
+
+/* Latency histogram with HDR-style log-linear buckets.
+ *
+ * Every power of two is split into 16 linear sub-buckets, so any value
+ * is stored with relative error below 1/16 from 1 ns to the full
+ * uint64_t range. Record is wait-free: a few relaxed atomic adds.
+ * Readers see a snapshot that may be slightly torn between buckets,
+ * which is fine for monitoring.
+ * */
+class LatencyHistogram {
+public:
+    static const int kSubBucketBits = 4;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    static const int kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+private:
+    std::atomic<uint64_t> _buckets[kBuckets];
+    std::atomic<uint64_t> _count{0};
+    std::atomic<uint64_t> _sum{0};
+    std::atomic<uint64_t> _max{0};
+
+    static int BucketIndex(uint64_t value);
+    static uint64_t BucketUpperBound(int index);
+
+public:
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void Record(uint64_t nanoseconds);
+
+    uint64_t Count() const { return _count.load(std::memory_order_relaxed); }
+    uint64_t Sum() const { return _sum.load(std::memory_order_relaxed); }
+    uint64_t Max() const { return _max.load(std::memory_order_relaxed); }
+
+    /* Upper bound of the bucket holding the q-th quantile, 0 <= q <= 1. */
+    uint64_t Quantile(double q) const;
+};
+
+/* Process-wide histograms and counters, cheap enough to be always on. */
+class Metrics {
+private:
+    LatencyHistogram _stages[static_cast<int>(Stage::COUNT)];
+    std::atomic<uint64_t> _counters[static_cast<int>(Counter::COUNT)];
+
+    Metrics();
+
+public:
+    static Metrics& Global();
+
+    void Record(Stage stage, uint64_t nanoseconds) {
+        _stages[static_cast<int>(stage)].Record(nanoseconds);
+    }
+
+    void Add(Counter counter, uint64_t value = 1) {
+        _counters[static_cast<int>(counter)].fetch_add(value,
+                std::memory_order_relaxed);
+    }
+
+    const LatencyHistogram& Histogram(Stage stage) const {
+        return _stages[static_cast<int>(stage)];
+    }
+
+    uint64_t Value(Counter counter) const {
+        return _counters[static_cast<int>(counter)].load(
+                std::memory_order_relaxed);
+    }
+
+    /* Prometheus text exposition format, latencies are summaries in seconds. */
+    std::string ExportPrometheus() const;
+    std::string ExportJson() const;
+};
+
+/* Records time from construction to destruction into a stage. */
+class StageTimer {
+private:
+    Stage _stage;
+    std::chrono::steady_clock::time_point _begin;
+
+public:
+    explicit StageTimer(Stage stage) :
+        _stage(stage), _begin(std::chrono::steady_clock::now()) {}
+
+    ~StageTimer() {
+        Metrics::Global().Record(_stage, static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - _begin).count()));
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+};
+
+enum class MetricsFormat {
+    PROMETHEUS,
+    JSON,
+};
+
+/* "--metrics_format" value: prometheus or json. */
+bool ParseMetricsFormat(const std::string& value, MetricsFormat& format);
+
+/* Writes Metrics::Global() to a file every interval and once on Stop.
+ * File is replaced by rename, so a reader like the node_exporter
+ * textfile collector never sees a partial file.
+ * */
+class MetricsExporter {
+private:
+    std::string _path;
+    MetricsFormat _format;
+    std::chrono::milliseconds _interval;
+
+    std::mutex _mutex;
+    std::condition_variable _stop_cv;
+    bool _stop = false;
+    std::thread _thread;
+
+    void Run();
+
+public:
+    MetricsExporter(const std::string& path, MetricsFormat format,
+            std::chrono::milliseconds interval);
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    bool WriteNow();
+    void Stop();
+};
+
+#endif /* __METRICS_H__ */
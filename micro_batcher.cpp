@@ -0,0 +1,127 @@
+#include "micro_batcher.h"
+
+#include "metrics.h"
+
+MicroBatcher::MicroBatcher(StreamScheduler& scheduler, int stream_id,
+        size_t max_batch_size, std::chrono::microseconds max_wait,
+        size_t queue_capacity) :
+    _scheduler(scheduler), _stream_id(stream_id),
+    _max_batch_size(max_batch_size ? max_batch_size : 1),
+    _max_wait(max_wait), _queue(queue_capacity) {
+    _worker = std::thread(&MicroBatcher::Worker, this);
+}
+
+MicroBatcher::~MicroBatcher() {
+    Stop();
+}
+
+void MicroBatcher::Submit(const Tensor& image, bool infer, Callback done) {
+    Request request;
+
+    request.image = image;
+    request.infer = infer;
+    request.done = std::move(done);
+    request.arrival = std::chrono::steady_clock::now();
+
+    if (!_queue.Push(std::move(request))) {
+        LOG(ERROR) << "MicroBatcher is stopped, frame is dropped";
+    }
+}
+
+void MicroBatcher::Stop() {
+    _queue.Close();
+
+    if (_worker.joinable()) {
+        _worker.join();
+    }
+}
+
+void MicroBatcher::RunBatch(std::vector<Request>& pending) {
+    std::vector<Tensor> images;
+    std::vector<std::vector<Detection>> detections;
+    std::vector<Detection> empty;
+    bool inferred = false;
+    size_t next = 0;
+
+    const auto dispatch = std::chrono::steady_clock::now();
+
+    for (const auto& request : pending) {
+        if (request.infer) {
+            images.push_back(request.image);
+            Metrics::Global().Record(Stage::BATCH_WAIT, static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            dispatch - request.arrival).count()));
+        }
+    }
+
+    if (!images.empty()) {
+        try {
+            _scheduler.PredictBatch(_stream_id, images, detections);
+            inferred = true;
+        } catch (const std::exception& e) {
+            LOG(ERROR) << "Stream " << _stream_id << ": failed to run batch of "
+                       << images.size() << " frames: " << e.what();
+            detections.assign(images.size(), std::vector<Detection>());
+        }
+    }
+
+    for (auto& request : pending) {
+        if (!request.done) {
+            continue;
+        }
+
+        if (request.infer) {
+            request.done(inferred, detections[next++]);
+        } else {
+            empty.clear();
+            request.done(false, empty);
+        }
+    }
+}
+
+void MicroBatcher::Worker() {
+    std::vector<Request> pending;
+    Request request;
+    bool has_request = false;
+
+    while (has_request || _queue.Pop(request)) {
+        has_request = false;
+
+        if (!request.infer) {
+            pending.push_back(std::move(request));
+            RunBatch(pending);
+            pending.clear();
+            continue;
+        }
+
+        /* Wait for a full batch, but not longer than max_wait
+         * counting from arrival of the oldest inferred frame.
+         * */
+        const auto deadline = request.arrival + _max_wait;
+        const int64_t rows = request.image.dim_size(1);
+        const int64_t cols = request.image.dim_size(2);
+        size_t inferred = 1;
+
+        pending.push_back(std::move(request));
+
+        while (inferred < _max_batch_size &&
+               _queue.PopUntil(request, deadline)) {
+            /* One tensor can hold only frames of the same resolution,
+             * frame of other size starts the next batch.
+             * */
+            if (request.infer && (request.image.dim_size(1) != rows ||
+                                  request.image.dim_size(2) != cols)) {
+                has_request = true;
+                break;
+            }
+
+            if (request.infer) {
+                ++inferred;
+            }
+            pending.push_back(std::move(request));
+        }
+
+        RunBatch(pending);
+        pending.clear();
+    }
+}
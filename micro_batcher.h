@@ -0,0 +1,70 @@
+#ifndef __MICRO_BATCHER_H__
+#define __MICRO_BATCHER_H__
+
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "spsc_queue.h"
+#include "stream_scheduler.h"
+
+/* Collects frames of one stream and runs them through
+ * StreamScheduler::PredictBatch as one [N, H, W, 3] tensor.
+ *
+ * Batch is dispatched when it reaches max_batch_size, when the oldest
+ * frame has waited max_wait, or when resolution of the next frame differs.
+ * Frames submitted without inference are passed through in order,
+ * so callbacks are always called in submission order.
+ * */
+class MicroBatcher {
+public:
+    /* Called on the batcher thread with results of one frame,
+     * inferred is false for frames submitted without inference
+     * or when inference failed.
+     * */
+    using Callback = std::function<void(bool inferred,
+            std::vector<Detection>& detections)>;
+
+private:
+    struct Request {
+        Tensor image;
+        bool infer = false;
+        Callback done;
+        std::chrono::steady_clock::time_point arrival;
+    };
+
+    StreamScheduler& _scheduler;
+    int _stream_id;
+    size_t _max_batch_size;
+    std::chrono::microseconds _max_wait;
+
+    SpscQueue<Request> _queue;
+    std::thread _worker;
+
+    void Worker();
+    void RunBatch(std::vector<Request>& pending);
+
+public:
+    MicroBatcher(StreamScheduler& scheduler, int stream_id,
+            size_t max_batch_size,
+            std::chrono::microseconds max_wait, size_t queue_capacity = 64);
+    ~MicroBatcher();
+
+    MicroBatcher(const MicroBatcher&) = delete;
+    MicroBatcher& operator=(const MicroBatcher&) = delete;
+
+    /* Single producer only. Blocks while the queue is full.
+     * Image is a [1, H, W, 3] uint8 tensor shared with the batcher,
+     * caller must not modify it until done is called.
+     * */
+    void Submit(const Tensor& image, bool infer, Callback done);
+
+    /* Dispatch all queued frames and wait until the worker is stopped. */
+    void Stop();
+
+    QueueStats Stats() const { return _queue.Stats(); }
+    size_t QueueCapacity() const { return _queue.Capacity(); }
+};
+
+#endif /* __MICRO_BATCHER_H__ */
@@ -0,0 +1,484 @@
+#include "model_config.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow/core/protobuf/rewriter_config.pb.h"
+
+using tensorflow::RewriterConfig;
+using tensorflow::RewriterConfig_Toggle;
+using tensorflow::Status;
+
+/* Grappler passes with an on/off switch in RewriterConfig. */
+struct OptimizerSwitch {
+    const char* name;
+    void (RewriterConfig::*set)(RewriterConfig_Toggle);
+};
+
+static const OptimizerSwitch kOptimizers[] = {
+    {"constant_folding", &RewriterConfig::set_constant_folding},
+    {"layout_optimizer", &RewriterConfig::set_layout_optimizer},
+    {"remapping", &RewriterConfig::set_remapping},
+    {"arithmetic_optimization", &RewriterConfig::set_arithmetic_optimization},
+    {"dependency_optimization", &RewriterConfig::set_dependency_optimization},
+    {"loop_optimization", &RewriterConfig::set_loop_optimization},
+    {"function_optimization", &RewriterConfig::set_function_optimization},
+    {"shape_optimization", &RewriterConfig::set_shape_optimization},
+    {"debug_stripper", &RewriterConfig::set_debug_stripper},
+    {"pin_to_host_optimization", &RewriterConfig::set_pin_to_host_optimization},
+    {"implementation_selector", &RewriterConfig::set_implementation_selector},
+};
+
+static
+const OptimizerSwitch* find_optimizer(const std::string& name) {
+    for (const OptimizerSwitch& optimizer : kOptimizers) {
+        if (name == optimizer.name) {
+            return &optimizer;
+        }
+    }
+
+    return nullptr;
+}
+
+static
+std::string trim(const std::string& value) {
+    const char* spaces = " \t\r\n";
+    size_t begin = value.find_first_not_of(spaces);
+
+    if (begin == std::string::npos) {
+        return "";
+    }
+
+    return value.substr(begin, value.find_last_not_of(spaces) - begin + 1);
+}
+
+static
+bool parse_toggle(const std::string& value, Toggle& toggle) {
+    if (value == "on" || value == "true" || value == "1") {
+        toggle = Toggle::ON;
+    } else if (value == "off" || value == "false" || value == "0") {
+        toggle = Toggle::OFF;
+    } else if (value == "default") {
+        toggle = Toggle::DEFAULT;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static
+bool parse_bool(const std::string& value, bool& result) {
+    Toggle toggle;
+
+    if (!parse_toggle(value, toggle) || toggle == Toggle::DEFAULT) {
+        return false;
+    }
+    result = toggle == Toggle::ON;
+
+    return true;
+}
+
+static
+bool parse_count(const std::string& value, int& result) {
+    char* end = nullptr;
+    long count = std::strtol(value.c_str(), &end, 10);
+
+    if (value.empty() || *end != '\0' || count < 0 || count > 4096) {
+        return false;
+    }
+    result = static_cast<int>(count);
+
+    return true;
+}
+
+static
+const char* toggle_name(Toggle toggle) {
+    switch (toggle) {
+    case Toggle::ON:  return "on";
+    case Toggle::OFF: return "off";
+    default:          return "default";
+    }
+}
+
+static
+RewriterConfig_Toggle rewriter_toggle(Toggle toggle) {
+    switch (toggle) {
+    case Toggle::ON:  return RewriterConfig::ON;
+    case Toggle::OFF: return RewriterConfig::OFF;
+    default:          return RewriterConfig::DEFAULT;
+    }
+}
+
+static
+bool parse_precision(const std::string& value, Precision& precision) {
+    if (value == "fp32") {
+        precision = Precision::FP32;
+    } else if (value == "bf16") {
+        precision = Precision::BF16;
+    } else if (value == "int8") {
+        precision = Precision::INT8;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static
+const char* precision_name(Precision precision) {
+    switch (precision) {
+    case Precision::BF16: return "bf16";
+    case Precision::INT8: return "int8";
+    default:              return "fp32";
+    }
+}
+
+Status SetModelConfig(const std::string& key, const std::string& value,
+        ModelConfig& config) {
+    using namespace tensorflow;
+
+    bool ok = true;
+
+    if (key == "tags") {
+        std::istringstream tags(value);
+        std::string tag;
+
+        config.tags.clear();
+        while (std::getline(tags, tag, '+')) {
+            if (!tag.empty()) {
+                config.tags.push_back(tag);
+            }
+        }
+    } else if (key == "intra_op_threads") {
+        ok = parse_count(value, config.intra_op_threads);
+    } else if (key == "inter_op_threads") {
+        ok = parse_count(value, config.inter_op_threads);
+    } else if (key == "per_session_threads") {
+        ok = parse_bool(value, config.per_session_threads);
+    } else if (key == "xla") {
+        ok = parse_toggle(value, config.xla);
+    } else if (key == "onednn") {
+        ok = parse_toggle(value, config.onednn);
+    } else if (key == "grappler") {
+        ok = parse_bool(value, config.grappler);
+    } else if (key == "grappler_iterations") {
+        ok = parse_count(value, config.grappler_iterations) &&
+            config.grappler_iterations <= 2;
+    } else if (key == "graph_cache") {
+        config.graph_cache = value;
+    } else if (key == "precision") {
+        ok = parse_precision(value, config.precision);
+    } else if (key == "int8_model") {
+        config.int8_model = value;
+    } else if (find_optimizer(key) != nullptr) {
+        ok = parse_toggle(value, config.optimizers[key]);
+    } else {
+        return errors::InvalidArgument("Unknown model config key ", key);
+    }
+
+    if (!ok) {
+        return errors::InvalidArgument("Bad value \"", value,
+                "\" of model config key ", key);
+    }
+
+    return Status::OK();
+}
+
+static
+Status set_pair(const std::string& pair, ModelConfig& config) {
+    using namespace tensorflow;
+
+    size_t equal = pair.find('=');
+
+    if (equal == std::string::npos) {
+        return errors::InvalidArgument("Model config entry \"", pair,
+                "\" is not key=value");
+    }
+
+    return SetModelConfig(trim(pair.substr(0, equal)),
+            trim(pair.substr(equal + 1)), config);
+}
+
+Status ParseModelConfig(const std::string& list, ModelConfig& config) {
+    std::istringstream pairs(list);
+    std::string pair;
+
+    while (std::getline(pairs, pair, ',')) {
+        if (!trim(pair).empty()) {
+            TF_RETURN_IF_ERROR(set_pair(pair, config));
+        }
+    }
+
+    return Status::OK();
+}
+
+Status LoadModelConfig(const std::string& file_name, ModelConfig& config) {
+    using namespace tensorflow;
+
+    std::ifstream file(file_name);
+    std::string line;
+
+    if (!file) {
+        return errors::NotFound("Model config ", file_name, " not found");
+    }
+
+    while (std::getline(file, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (!line.empty()) {
+            TF_RETURN_IF_ERROR(set_pair(line, config));
+        }
+    }
+
+    return Status::OK();
+}
+
+std::string ModelConfigString(const ModelConfig& config) {
+    const ModelConfig defaults;
+    std::ostringstream result;
+    const char* separator = "";
+
+    if (config.tags != defaults.tags) {
+        result << separator << "tags=";
+        for (size_t i = 0; i < config.tags.size(); ++i) {
+            result << (i > 0 ? "+" : "") << config.tags[i];
+        }
+        separator = ",";
+    }
+    if (config.intra_op_threads != defaults.intra_op_threads) {
+        result << separator << "intra_op_threads=" << config.intra_op_threads;
+        separator = ",";
+    }
+    if (config.inter_op_threads != defaults.inter_op_threads) {
+        result << separator << "inter_op_threads=" << config.inter_op_threads;
+        separator = ",";
+    }
+    if (config.per_session_threads != defaults.per_session_threads) {
+        result << separator << "per_session_threads="
+               << (config.per_session_threads ? "on" : "off");
+        separator = ",";
+    }
+    if (config.xla != defaults.xla) {
+        result << separator << "xla=" << toggle_name(config.xla);
+        separator = ",";
+    }
+    if (config.onednn != defaults.onednn) {
+        result << separator << "onednn=" << toggle_name(config.onednn);
+        separator = ",";
+    }
+    if (config.grappler != defaults.grappler) {
+        result << separator << "grappler="
+               << (config.grappler ? "on" : "off");
+        separator = ",";
+    }
+    if (config.grappler_iterations != defaults.grappler_iterations) {
+        result << separator << "grappler_iterations="
+               << config.grappler_iterations;
+        separator = ",";
+    }
+    for (const auto& optimizer : config.optimizers) {
+        if (optimizer.second != Toggle::DEFAULT) {
+            result << separator << optimizer.first << "="
+                   << toggle_name(optimizer.second);
+            separator = ",";
+        }
+    }
+    if (config.graph_cache != defaults.graph_cache) {
+        result << separator << "graph_cache=" << config.graph_cache;
+        separator = ",";
+    }
+    if (config.precision != defaults.precision) {
+        result << separator << "precision=" << precision_name(config.precision);
+        separator = ",";
+    }
+    if (config.int8_model != defaults.int8_model) {
+        result << separator << "int8_model=" << config.int8_model;
+    }
+
+    return result.str();
+}
+
+/* Values exported to the environment by the first ApplyModelConfig. */
+static std::mutex process_mutex;
+static bool process_applied = false;
+static Toggle process_onednn = Toggle::DEFAULT;
+static bool process_xla_cpu = false;
+
+static
+void apply_process_settings(const ModelConfig& config) {
+    std::lock_guard<std::mutex> lock(process_mutex);
+
+    /* bf16 rewrite and int8 kernels exist only with oneDNN. */
+    Toggle onednn = config.onednn;
+    if (onednn == Toggle::DEFAULT && config.precision != Precision::FP32) {
+        onednn = Toggle::ON;
+    }
+
+    if (!process_applied) {
+        process_applied = true;
+        process_onednn = onednn;
+        process_xla_cpu = config.xla == Toggle::ON;
+
+        if (onednn != Toggle::DEFAULT) {
+            setenv("TF_ENABLE_ONEDNN_OPTS",
+                    onednn == Toggle::ON ? "1" : "0", 1);
+        }
+
+        /* global_jit_level alone clusters only GPU ops. */
+        if (process_xla_cpu) {
+            const char* flags = std::getenv("TF_XLA_FLAGS");
+            std::string value = flags != nullptr ? flags : "";
+
+            if (value.find("--tf_xla_cpu_global_jit") == std::string::npos) {
+                value += (value.empty() ? "" : " ");
+                value += "--tf_xla_cpu_global_jit";
+                setenv("TF_XLA_FLAGS", value.c_str(), 1);
+            }
+        }
+        return;
+    }
+
+    if (onednn != Toggle::DEFAULT && onednn != process_onednn) {
+        LOG(WARNING) << "onednn=" << toggle_name(onednn)
+                     << " ignored, oneDNN is set once per process";
+    }
+    if (config.xla == Toggle::ON && !process_xla_cpu) {
+        LOG(WARNING) << "xla=on clusters only GPU ops, CPU auto-clustering "
+                     << "is set once per process by the first model";
+    }
+}
+
+bool Bf16Supported() {
+    static const bool supported = [] {
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+
+        while (std::getline(cpuinfo, line)) {
+            if (line.compare(0, 5, "flags") != 0 &&
+                line.compare(0, 8, "Features") != 0) {
+                continue;
+            }
+
+            std::istringstream flags(line.substr(line.find(':') + 1));
+            std::string flag;
+            while (flags >> flag) {
+                if (flag == "avx512_bf16" || flag == "amx_bf16" ||
+                    flag == "bf16") {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return false;
+    }();
+
+    return supported;
+}
+
+Status ResolveModelPath(const std::string& path, const ModelConfig& config,
+        std::string& export_dir) {
+    using namespace tensorflow;
+
+    if (config.precision != Precision::INT8) {
+        export_dir = path;
+        return Status::OK();
+    }
+    if (config.int8_model.empty()) {
+        return errors::InvalidArgument("precision=int8 needs int8_model, "
+                "the quantized SavedModel directory");
+    }
+
+    export_dir = config.int8_model;
+
+    return Status::OK();
+}
+
+Status ApplyModelConfig(const ModelConfig& config,
+        tensorflow::SessionOptions& options) {
+    using namespace tensorflow;
+
+    ConfigProto& proto = options.config;
+    OptimizerOptions* optimizer_options =
+        proto.mutable_graph_options()->mutable_optimizer_options();
+    RewriterConfig* rewriter =
+        proto.mutable_graph_options()->mutable_rewrite_options();
+
+    apply_process_settings(config);
+
+    if (config.intra_op_threads > 0) {
+        proto.set_intra_op_parallelism_threads(config.intra_op_threads);
+    }
+    if (config.inter_op_threads > 0) {
+        proto.set_inter_op_parallelism_threads(config.inter_op_threads);
+    }
+    proto.set_use_per_session_threads(config.per_session_threads);
+
+    if (config.xla == Toggle::ON) {
+        optimizer_options->set_global_jit_level(OptimizerOptions::ON_1);
+    } else if (config.xla == Toggle::OFF) {
+        optimizer_options->set_global_jit_level(OptimizerOptions::OFF);
+    }
+
+    rewriter->set_disable_meta_optimizer(!config.grappler);
+    if (config.grappler_iterations == 1) {
+        rewriter->set_meta_optimizer_iterations(RewriterConfig::ONE);
+    } else if (config.grappler_iterations == 2) {
+        rewriter->set_meta_optimizer_iterations(RewriterConfig::TWO);
+    }
+
+    if (config.precision == Precision::BF16) {
+        rewriter->set_auto_mixed_precision_mkl(RewriterConfig::ON);
+        if (!Bf16Supported()) {
+            LOG(WARNING) << "CPU has no native bfloat16, precision=bf16 "
+                         << "is emulated and likely slower than fp32";
+        }
+    }
+
+    for (const auto& optimizer : config.optimizers) {
+        const OptimizerSwitch* optimizer_switch =
+            find_optimizer(optimizer.first);
+
+        if (optimizer_switch == nullptr) {
+            return errors::InvalidArgument("Unknown Grappler optimizer ",
+                    optimizer.first);
+        }
+        (rewriter->*optimizer_switch->set)(rewriter_toggle(optimizer.second));
+    }
+
+    return Status::OK();
+}
+
+void LogModelConfig(const ModelConfig& config,
+        const tensorflow::SessionOptions& options) {
+    const tensorflow::ConfigProto& proto = options.config;
+    const char* onednn = std::getenv("TF_ENABLE_ONEDNN_OPTS");
+    const char* xla_flags = std::getenv("TF_XLA_FLAGS");
+    std::string changed = ModelConfigString(config);
+
+    /* Zero means TF sizes the pool by the count of usable cores. */
+    int intra_op_threads = proto.intra_op_parallelism_threads();
+    int inter_op_threads = proto.inter_op_parallelism_threads();
+    if (intra_op_threads == 0) {
+        intra_op_threads = tensorflow::port::MaxParallelism();
+    }
+    if (inter_op_threads == 0) {
+        inter_op_threads = tensorflow::port::MaxParallelism();
+    }
+
+    LOG(INFO) << "Model config: " << (changed.empty() ? "defaults" : changed);
+    LOG(INFO) << "Session: intra_op_threads " << intra_op_threads
+              << ", inter_op_threads " << inter_op_threads
+              << ", per_session_threads "
+              << (proto.use_per_session_threads() ? "on" : "off")
+              << ", TF_ENABLE_ONEDNN_OPTS="
+              << (onednn != nullptr ? onednn : "<unset>")
+              << ", TF_XLA_FLAGS=" << (xla_flags != nullptr ? xla_flags : "")
+              << ", graph_options { " << proto.graph_options().ShortDebugString()
+              << " }";
+}
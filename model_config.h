@@ -0,0 +1,87 @@
+#ifndef __MODEL_CONFIG_H__
+#define __MODEL_CONFIG_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/public/session_options.h"
+
+enum class Toggle {
+    DEFAULT, // Whatever TF does when nothing is set
+    ON,
+    OFF,
+};
+
+enum class Precision {
+    FP32,
+    BF16, // Grappler auto mixed precision to bfloat16 on oneDNN
+    INT8, // Post-training quantized variant of the model, int8_model
+};
+
+/* Session and graph settings used when a SavedModel is loaded.
+ *
+ * Written as "key=value" pairs, by --model_config as a comma separated
+ * list or by a config file with one pair per line. Keys are the field
+ * names below; Grappler passes use their RewriterConfig names
+ * (constant_folding, layout_optimizer, remapping, ...) with on, off or
+ * default. Several tags are joined with '+', "tags=" loads the meta
+ * graph without tags.
+ * */
+struct ModelConfig {
+    std::vector<std::string> tags = {"serve"};
+    int intra_op_threads = 0;          // 0 - one per core
+    int inter_op_threads = 0;          // 0 - one per core
+    bool per_session_threads = false;  // Own pools instead of process ones
+    Toggle xla = Toggle::DEFAULT;      // XLA auto-clustering, CPU included
+    Toggle onednn = Toggle::DEFAULT;   // oneDNN kernels and graph rewrites
+    bool grappler = true;              // false - no graph optimization at all
+    int grappler_iterations = 0;       // 0 - TF default, 1 or 2
+    std::map<std::string, Toggle> optimizers; // Single Grappler passes
+    std::string graph_cache;           // Directory of optimized graphs
+    Precision precision = Precision::FP32; // Not FP32 - oneDNN on by default
+    std::string int8_model;            // SavedModel loaded for INT8
+};
+
+/* Set one key, error on unknown key or bad value. */
+tensorflow::Status SetModelConfig(const std::string& key,
+        const std::string& value, ModelConfig& config);
+
+/* "key=value,key=value", empty list changes nothing. */
+tensorflow::Status ParseModelConfig(const std::string& list,
+        ModelConfig& config);
+
+/* One "key = value" per line, empty lines and '#' comments skipped. */
+tensorflow::Status LoadModelConfig(const std::string& file_name,
+        ModelConfig& config);
+
+/* Keys that differ from defaults, accepted back by ParseModelConfig. */
+std::string ModelConfigString(const ModelConfig& config);
+
+/* True if the CPU computes bfloat16 natively (AVX512_BF16, AMX or
+ * Arm BF16), elsewhere bf16 is emulated and usually slower than fp32.
+ * */
+bool Bf16Supported();
+
+/* SavedModel to load for the precision: int8_model for INT8, path
+ * otherwise.
+ * */
+tensorflow::Status ResolveModelPath(const std::string& path,
+        const ModelConfig& config, std::string& export_dir);
+
+/* Fill session options for LoadSavedModel.
+ *
+ * oneDNN and the CPU XLA switch are environment settings TF reads once
+ * per process, they are exported by the first call and only warned
+ * about by later calls with other values. Apply the config before
+ * anything else runs TF ops.
+ * */
+tensorflow::Status ApplyModelConfig(const ModelConfig& config,
+        tensorflow::SessionOptions& options);
+
+/* Log the settings the model was really loaded with. */
+void LogModelConfig(const ModelConfig& config,
+        const tensorflow::SessionOptions& options);
+
+#endif /* __MODEL_CONFIG_H__ */
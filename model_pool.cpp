@@ -0,0 +1,338 @@
+#include "model_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* Eigen environment that binds every thread it creates to a CPU set. */
+struct PinnedEnvironment {
+    struct Task {
+        std::function<void()> f;
+    };
+
+    class EnvThread {
+    private:
+        std::thread _thread;
+
+    public:
+        EnvThread(std::function<void()> f) : _thread(std::move(f)) {}
+        ~EnvThread() { _thread.join(); }
+        void OnCancel() {}
+    };
+
+    std::vector<int> cpus;
+
+    EnvThread* CreateThread(std::function<void()> f) {
+        std::vector<int> thread_cpus = cpus;
+
+        return new EnvThread([thread_cpus, f]() {
+#ifdef __linux__
+            if (!thread_cpus.empty()) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                for (int cpu : thread_cpus) {
+                    CPU_SET(cpu, &set);
+                }
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            }
+#endif
+            f();
+        });
+    }
+
+    Task CreateTask(std::function<void()> f) { return Task{std::move(f)}; }
+    void ExecuteTask(const Task& task) { task.f(); }
+};
+
+class PinnedThreadPool : public tensorflow::thread::ThreadPoolInterface {
+private:
+    Eigen::ThreadPoolTempl<PinnedEnvironment> _pool;
+
+    static PinnedEnvironment MakeEnvironment(const std::vector<int>& cpus) {
+        PinnedEnvironment environment;
+        environment.cpus = cpus;
+        return environment;
+    }
+
+public:
+    PinnedThreadPool(int num_threads, const std::vector<int>& cpus) :
+        _pool(num_threads, true, MakeEnvironment(cpus)) {}
+
+    void Schedule(std::function<void()> fn) override {
+        _pool.Schedule(std::move(fn));
+    }
+
+    void ScheduleWithHint(std::function<void()> fn, int start,
+            int limit) override {
+        _pool.ScheduleWithHint(std::move(fn), start, limit);
+    }
+
+    void Cancel() override { _pool.Cancel(); }
+    int NumThreads() const override { return _pool.NumThreads(); }
+    int CurrentThreadId() const override { return _pool.CurrentThreadId(); }
+};
+
+/* "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11} */
+static
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream stream(list);
+    std::string range;
+
+    while (std::getline(stream, range, ',')) {
+        int first = 0;
+        int last = 0;
+        char dash = 0;
+        std::istringstream range_stream(range);
+
+        if (!(range_stream >> first)) {
+            continue;
+        }
+        last = first;
+        if (range_stream >> dash >> last && dash != '-') {
+            last = first;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+/* CPUs this process may run on, grouped by NUMA node if asked. */
+static
+std::vector<int> available_cpus(CpuPinning pinning) {
+    std::vector<int> cpus;
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return cpus;
+    }
+
+    if (pinning == CpuPinning::NUMA) {
+        for (int node = 0; ; ++node) {
+            std::ifstream file("/sys/devices/system/node/node" +
+                    std::to_string(node) + "/cpulist");
+            std::string list;
+
+            if (!file || !std::getline(file, list)) {
+                break;
+            }
+            for (int cpu : parse_cpu_list(list)) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+    }
+
+    /* No NUMA information, or plain core pinning */
+    if (cpus.empty()) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+
+    return cpus;
+}
+
+ModelPool::ModelPool(const std::string& path_to_model,
+        const ModelPoolOptions& options) {
+    const int workers = std::max(options.workers, 1);
+    std::vector<int> cpus;
+
+    if (options.pinning != CpuPinning::NONE) {
+        cpus = available_cpus(options.pinning);
+        if (cpus.size() < static_cast<size_t>(workers)) {
+            LOG(WARNING) << "Only " << cpus.size() << " CPUs for " << workers
+                         << " workers, pinning is disabled";
+            cpus.clear();
+        }
+    }
+
+    const size_t cpus_per_worker = cpus.size() / workers;
+
+    for (int i = 0; i < workers; ++i) {
+        std::unique_ptr<Worker> worker(new Worker());
+
+        /* Contiguous range, with NUMA order it stays inside one node
+         * when workers divide nodes evenly.
+         * */
+        if (cpus_per_worker != 0) {
+            worker->cpus.assign(cpus.begin() + i * cpus_per_worker,
+                    cpus.begin() + (i + 1) * cpus_per_worker);
+        }
+
+        int intra_op_threads = options.intra_op_threads;
+        int inter_op_threads = options.inter_op_threads;
+
+        /* Pinned worker needs own pools even if sizes are not given. */
+        if (!worker->cpus.empty()) {
+            if (intra_op_threads <= 0) {
+                intra_op_threads = worker->cpus.size();
+            }
+            if (inter_op_threads <= 0) {
+                inter_op_threads = 1;
+            }
+        }
+
+        if (intra_op_threads > 0) {
+            worker->intra_op_pool.reset(new PinnedThreadPool(intra_op_threads,
+                    worker->cpus));
+            worker->pools.intra_op_threadpool = worker->intra_op_pool.get();
+        }
+        if (inter_op_threads > 0) {
+            worker->inter_op_pool.reset(new PinnedThreadPool(inter_op_threads,
+                    worker->cpus));
+            worker->pools.inter_op_threadpool = worker->inter_op_pool.get();
+        }
+
+        std::ostringstream cpu_list;
+        for (int cpu : worker->cpus) {
+            cpu_list << cpu << " ";
+        }
+
+        LOG(INFO) << "Worker " << i << ": intra_op threads "
+                  << intra_op_threads << ", inter_op threads "
+                  << inter_op_threads << ", cpus [ " << cpu_list.str() << "]";
+
+        _workers.push_back(std::move(worker));
+    }
+
+    if (options.background_load) {
+        _loader = std::thread(&ModelPool::Load, this, path_to_model, options);
+    } else {
+        Load(path_to_model, options);
+        WaitReady();
+    }
+}
+
+ModelPool::~ModelPool() {
+    if (_loader.joinable()) {
+        _loader.join();
+    }
+}
+
+void ModelPool::Load(const std::string& path_to_model,
+        const ModelPoolOptions& options) {
+    const auto begin = std::chrono::steady_clock::now();
+    std::exception_ptr error;
+
+    try {
+        std::unique_ptr<DetectionModel> model(
+                new DetectionModel(path_to_model, options.model_config));
+        const float load_seconds = std::chrono::duration<float>(
+                std::chrono::steady_clock::now() - begin).count();
+
+        if (options.prepare) {
+            options.prepare(*model);
+        }
+
+        /* Every worker has own pools, each of them is warmed up. */
+        std::vector<Tensor> inputs;
+        Status status = Status::OK();
+        if (options.warmup.runs > 0) {
+            status = model->WarmupInputs(options.warmup, inputs);
+        }
+        for (size_t i = 0; status.ok() && i < _workers.size(); ++i) {
+            status = model->Warmup(inputs, options.warmup.runs,
+                    _workers[i]->pools);
+        }
+        if (!status.ok()) {
+            throw std::runtime_error("Warmup failed: " + status.ToString());
+        }
+
+        const float ready_seconds = std::chrono::duration<float>(
+                std::chrono::steady_clock::now() - begin).count();
+        LOG(INFO) << "Model ready in " << ready_seconds << " s: load "
+                  << load_seconds << " s, warmup of " << inputs.size()
+                  << " inputs " << ready_seconds - load_seconds << " s";
+
+        _model = std::move(model);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_load_mutex);
+        _load_error = error;
+        _load_done = true;
+    }
+    _ready.store(!error, std::memory_order_release);
+    _loaded.notify_all();
+}
+
+void ModelPool::WaitReady() {
+    if (_ready.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_load_mutex);
+    _loaded.wait(lock, [this] { return _load_done; });
+    if (_load_error) {
+        std::rethrow_exception(_load_error);
+    }
+}
+
+ModelPool::Worker& ModelPool::LeastLoaded() {
+    /* Start from a rotating index, so idle workers are used evenly. */
+    const size_t start = _next.fetch_add(1, std::memory_order_relaxed);
+    Worker* best = nullptr;
+
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        Worker* worker = _workers[(start + i) % _workers.size()].get();
+
+        if (best == nullptr || worker->in_flight.load(std::memory_order_relaxed) <
+                best->in_flight.load(std::memory_order_relaxed)) {
+            best = worker;
+        }
+    }
+
+    return *best;
+}
+
+void ModelPool::PredictBatch(const std::vector<Tensor>& images,
+        std::vector<std::vector<Detection>>& detections) {
+    WaitReady();
+
+    Worker& worker = LeastLoaded();
+
+    worker.in_flight.fetch_add(1, std::memory_order_relaxed);
+
+    try {
+        _model->PredictBatch(images, detections, worker.pools);
+    } catch (...) {
+        worker.in_flight.fetch_sub(1, std::memory_order_relaxed);
+        throw;
+    }
+
+    worker.in_flight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool ParseCpuPinning(const std::string& value, CpuPinning& pinning) {
+    if (value == "none") {
+        pinning = CpuPinning::NONE;
+    } else if (value == "core") {
+        pinning = CpuPinning::CORE;
+    } else if (value == "numa") {
+        pinning = CpuPinning::NUMA;
+    } else {
+        return false;
+    }
+
+    return true;
+}
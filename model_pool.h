@@ -0,0 +1,105 @@
+#ifndef __MODEL_POOL_H__
+#define __MODEL_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tensorflow/core/platform/threadpool_interface.h"
+#include "tensorflow/core/platform/threadpool_options.h"
+
+#include "detection_model.h"
+
+enum class CpuPinning {
+    NONE, // Threads float over all CPUs
+    CORE, // Every worker gets a contiguous range of CPUs
+    NUMA, // Same, but CPUs are ordered by NUMA node
+};
+
+struct ModelPoolOptions {
+    int workers = 1;
+    int intra_op_threads = 0; // 0 - TF default pool of the session
+    int inter_op_threads = 0; // 0 - TF default pool of the session
+    CpuPinning pinning = CpuPinning::NONE;
+    ModelConfig model_config = DetectionModelConfig(); // Of the shared model
+    WarmupOptions warmup;          // Run on every worker before it serves
+    bool background_load = false;  // Constructor returns before the load
+
+    /* Called with the loaded model before warmup, e.g. to set postprocess
+     * options or tracing.
+     * */
+    std::function<void(DetectionModel&)> prepare;
+};
+
+/* Eigen thread pool whose threads are bound to a set of CPUs. */
+class PinnedThreadPool;
+
+/* Loads SavedModel once and serves it by several workers.
+ *
+ * All workers run the same session, so weights exist only once.
+ * Every worker has its own intra-op and inter-op thread pools, passed to
+ * Session::RunCallable via ThreadPoolOptions, optionally pinned to its
+ * own CPUs. Requests go to the worker with the fewest runs in flight.
+ *
+ * With background_load the model is loaded and warmed up on a separate
+ * thread, so streams can open and decode while it loads; the first
+ * PredictBatch waits until the model is ready.
+ * */
+class ModelPool {
+private:
+    struct Worker {
+        std::vector<int> cpus;
+        std::unique_ptr<PinnedThreadPool> intra_op_pool;
+        std::unique_ptr<PinnedThreadPool> inter_op_pool;
+        tensorflow::thread::ThreadPoolOptions pools;
+        std::atomic<int> in_flight{0};
+    };
+
+    std::unique_ptr<DetectionModel> _model;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::atomic<size_t> _next{0};
+
+    std::mutex _load_mutex;
+    std::condition_variable _loaded;
+    std::atomic<bool> _ready{false};
+    bool _load_done = false;
+    std::exception_ptr _load_error;
+    std::thread _loader;
+
+    Worker& LeastLoaded();
+    void Load(const std::string& path_to_model,
+            const ModelPoolOptions& options);
+
+public:
+    ModelPool(const std::string& path_to_model, const ModelPoolOptions& options);
+    ~ModelPool();
+
+    ModelPool(const ModelPool&) = delete;
+    ModelPool& operator=(const ModelPool&) = delete;
+
+    /* Thread safe, concurrent calls run on different workers. */
+    void PredictBatch(const std::vector<Tensor>& images,
+            std::vector<std::vector<Detection>>& detections);
+
+    /* Blocks until the model is loaded and warmed up,
+     * throws if loading failed.
+     * */
+    void WaitReady();
+
+    /* Loaded and warmed up, doesn't block. */
+    bool Ready() const { return _ready.load(); }
+
+    DetectionModel& Model() { WaitReady(); return *_model; }
+    size_t Workers() const { return _workers.size(); }
+};
+
+/* Parse "--cpu_pinning" value: none, core or numa. */
+bool ParseCpuPinning(const std::string& value, CpuPinning& pinning);
+
+#endif /* __MODEL_POOL_H__ */
@@ -0,0 +1,375 @@
+#include "model_startup.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include "tensorflow/cc/saved_model/constants.h"
+#include "tensorflow/cc/saved_model/reader.h"
+#include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/grappler/clusters/utils.h"
+#include "tensorflow/core/grappler/clusters/virtual_cluster.h"
+#include "tensorflow/core/grappler/grappler_item_builder.h"
+#include "tensorflow/core/grappler/optimizers/meta_optimizer.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/hash.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/public/session.h"
+#include "tensorflow/core/public/version.h"
+
+using tensorflow::Status;
+using tensorflow::StringPiece;
+
+/* Field numbers of tensorflow_serving/apis, whose generated code is not
+ * part of TF: PredictionLog.predict_log, PredictLog.request,
+ * PredictRequest.inputs and the key / value of a map entry.
+ * */
+enum WarmupField {
+    PREDICTION_LOG_PREDICT_LOG = 6,
+    PREDICT_LOG_REQUEST = 1,
+    PREDICT_REQUEST_INPUTS = 2,
+    MAP_ENTRY_KEY = 1,
+    MAP_ENTRY_VALUE = 2,
+};
+
+static
+bool parse_positive(const std::string& value, int& result) {
+    char* end = nullptr;
+    long number = std::strtol(value.c_str(), &end, 10);
+
+    if (value.empty() || *end != '\0' || number <= 0 || number > (1 << 16)) {
+        return false;
+    }
+    result = static_cast<int>(number);
+
+    return true;
+}
+
+bool ParseWarmupShapes(const std::string& value,
+        std::vector<std::pair<int, int>>& shapes) {
+    std::istringstream list(value);
+    std::string shape;
+
+    while (std::getline(list, shape, ',')) {
+        size_t x = shape.find('x');
+        int height;
+        int width;
+
+        if (x == std::string::npos ||
+            !parse_positive(shape.substr(0, x), height) ||
+            !parse_positive(shape.substr(x + 1), width)) {
+            return false;
+        }
+        shapes.emplace_back(height, width);
+    }
+
+    return true;
+}
+
+bool ParseBatchSizes(const std::string& value, std::vector<int>& sizes) {
+    std::istringstream list(value);
+    std::string size;
+
+    sizes.clear();
+    while (std::getline(list, size, ',')) {
+        int batch_size;
+
+        if (!parse_positive(size, batch_size)) {
+            return false;
+        }
+        sizes.push_back(batch_size);
+    }
+
+    return !sizes.empty();
+}
+
+/* Length-delimited fields with the given number of a serialized message.
+ * False if the message is malformed.
+ * */
+static
+bool message_fields(StringPiece message, int number,
+        std::vector<StringPiece>& fields) {
+    using google::protobuf::internal::WireFormatLite;
+
+    google::protobuf::io::CodedInputStream input(
+            reinterpret_cast<const uint8_t*>(message.data()), message.size());
+
+    fields.clear();
+    for (;;) {
+        const uint32_t tag = input.ReadTag();
+        uint32_t size;
+
+        if (tag == 0) {
+            return input.ConsumedEntireMessage();
+        }
+        if (WireFormatLite::GetTagWireType(tag) !=
+                WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+            if (!WireFormatLite::SkipField(&input, tag)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (!input.ReadVarint32(&size)) {
+            return false;
+        }
+        const int offset = input.CurrentPosition();
+        if (!input.Skip(size)) {
+            return false;
+        }
+        if (WireFormatLite::GetTagFieldNumber(tag) == number) {
+            fields.push_back(message.substr(offset, size));
+        }
+    }
+}
+
+/* Tensor of input_key in one PredictionLog, found is false if the
+ * record has no predict request or no such input.
+ * */
+static
+Status request_input(StringPiece record, const std::string& input_key,
+        tensorflow::Tensor& input, bool& found) {
+    using namespace tensorflow;
+
+    std::vector<StringPiece> logs;
+    std::vector<StringPiece> requests;
+    std::vector<StringPiece> entries;
+    std::vector<StringPiece> keys;
+    std::vector<StringPiece> values;
+
+    found = false;
+    if (!message_fields(record, PREDICTION_LOG_PREDICT_LOG, logs) ||
+        (!logs.empty() &&
+         !message_fields(logs.back(), PREDICT_LOG_REQUEST, requests)) ||
+        (!requests.empty() &&
+         !message_fields(requests.back(), PREDICT_REQUEST_INPUTS, entries))) {
+        return errors::DataLoss("Malformed warmup request");
+    }
+
+    for (StringPiece entry : entries) {
+        TensorProto proto;
+
+        if (!message_fields(entry, MAP_ENTRY_KEY, keys) ||
+            !message_fields(entry, MAP_ENTRY_VALUE, values)) {
+            return errors::DataLoss("Malformed warmup request input");
+        }
+        if (keys.empty() || keys.back() != input_key || values.empty()) {
+            continue;
+        }
+
+        if (!proto.ParseFromArray(values.back().data(), values.back().size()) ||
+            !input.FromProto(proto)) {
+            return errors::DataLoss("Bad tensor of warmup input ", input_key);
+        }
+        found = true;
+        break;
+    }
+
+    return Status::OK();
+}
+
+Status ReadWarmupRequests(const std::string& export_dir,
+        const std::string& input_key, int max_requests,
+        std::vector<tensorflow::Tensor>& inputs) {
+    using namespace tensorflow;
+
+    const std::string path = io::JoinPath(export_dir,
+            kSavedModelAssetsExtraDirectory, "tf_serving_warmup_requests");
+    std::unique_ptr<RandomAccessFile> file;
+    uint64 offset = 0;
+    tstring record;
+
+    if (!Env::Default()->FileExists(path).ok()) {
+        return errors::NotFound("No warmup requests in ", export_dir);
+    }
+    TF_RETURN_IF_ERROR(Env::Default()->NewRandomAccessFile(path, &file));
+
+    io::RecordReader reader(file.get());
+    while (inputs.size() < static_cast<size_t>(max_requests)) {
+        Tensor input;
+        bool found;
+
+        Status status = reader.ReadRecord(&offset, &record);
+        if (errors::IsOutOfRange(status)) {
+            break;
+        }
+        TF_RETURN_IF_ERROR(status);
+
+        TF_RETURN_IF_ERROR(request_input(record, input_key, input, found));
+        if (found) {
+            inputs.push_back(input);
+        }
+    }
+
+    if (inputs.empty()) {
+        return errors::NotFound("No predict requests with input ", input_key,
+                " in ", path);
+    }
+
+    return Status::OK();
+}
+
+Status ModelCacheKey(const std::string& export_dir, const ModelConfig& config,
+        uint64_t& key) {
+    using namespace tensorflow;
+
+    Env* env = Env::Default();
+    ModelConfig hashed = config;
+    std::string data;
+
+    const std::string variables_index = io::JoinPath(export_dir,
+            kSavedModelVariablesDirectory,
+            std::string(kSavedModelVariablesFilename) + ".index");
+
+    TF_RETURN_IF_ERROR(ReadFileToString(env,
+            io::JoinPath(export_dir, kSavedModelFilenamePb), &data));
+    key = Hash64Combine(Hash64(TF_VERSION_STRING), Hash64(data));
+
+    if (env->FileExists(variables_index).ok()) {
+        TF_RETURN_IF_ERROR(ReadFileToString(env, variables_index, &data));
+        key = Hash64Combine(key, Hash64(data));
+    }
+
+    /* Where the cache is has no effect on the graph. */
+    hashed.graph_cache.clear();
+    key = Hash64Combine(key, Hash64(ModelConfigString(hashed)));
+
+    return Status::OK();
+}
+
+/* Grappler over the whole meta graph, as a session would run it on the
+ * first Session::Run. Signature, init and restore nodes are preserved.
+ * */
+static
+Status optimize_meta_graph(const tensorflow::SessionOptions& session_options,
+        tensorflow::MetaGraphDef& meta_graph) {
+    using namespace tensorflow;
+
+    grappler::ItemConfig item_config;
+    std::unordered_map<std::string, DeviceProperties> devices;
+    GraphDef optimized;
+
+    std::unique_ptr<grappler::GrapplerItem> item =
+        grappler::GrapplerItemFromMetaGraphDef("saved_model", meta_graph,
+                item_config);
+    if (!item) {
+        return errors::Internal("Can't build Grappler item of the model");
+    }
+
+    devices["/job:localhost/replica:0/task:0/device:CPU:0"] =
+        grappler::GetLocalCPUInfo();
+    grappler::VirtualCluster cluster(devices);
+    TF_RETURN_IF_ERROR(cluster.Provision());
+
+    TF_RETURN_IF_ERROR(grappler::RunMetaOptimizer(std::move(*item),
+            session_options.config, nullptr, &cluster, &optimized));
+    meta_graph.mutable_graph_def()->Swap(&optimized);
+
+    return Status::OK();
+}
+
+/* Session over an already optimized meta graph, variables restored and
+ * init op run the same way LoadSavedModel does.
+ * */
+static
+Status load_optimized(const tensorflow::SessionOptions& session_options,
+        const tensorflow::RunOptions& run_options,
+        const std::string& export_dir,
+        const tensorflow::MetaGraphDef& meta_graph,
+        tensorflow::SavedModelBundle* bundle) {
+    using namespace tensorflow;
+
+    SessionOptions options = session_options;
+    options.config.mutable_graph_options()->mutable_rewrite_options()
+        ->set_disable_meta_optimizer(true);
+
+    std::unique_ptr<Session> session(NewSession(options));
+    if (!session) {
+        return errors::Internal("Failed to create session");
+    }
+
+    TF_RETURN_IF_ERROR(session->Create(meta_graph.graph_def()));
+    TF_RETURN_IF_ERROR(RestoreSession(run_options, meta_graph, export_dir,
+            &session));
+
+    bundle->meta_graph_def = meta_graph;
+    bundle->session = std::move(session);
+
+    return Status::OK();
+}
+
+Status LoadSavedModelCached(const tensorflow::SessionOptions& session_options,
+        const tensorflow::RunOptions& run_options,
+        const std::string& export_dir, const ModelConfig& config,
+        tensorflow::SavedModelBundle* bundle) {
+    using namespace tensorflow;
+
+    const std::unordered_set<std::string> tags(config.tags.begin(),
+            config.tags.end());
+    Env* env = Env::Default();
+    MetaGraphDef meta_graph;
+    uint64_t key;
+    char name[32];
+
+    if (config.graph_cache.empty() || !config.grappler) {
+        return LoadSavedModel(session_options, run_options, export_dir, tags,
+                bundle);
+    }
+
+    TF_RETURN_IF_ERROR(ModelCacheKey(export_dir, config, key));
+    snprintf(name, sizeof(name), "%016llx.pb",
+            static_cast<unsigned long long>(key));
+    const std::string path = io::JoinPath(config.graph_cache, name);
+
+    if (env->FileExists(path).ok()) {
+        Status status = ReadBinaryProto(env, path, &meta_graph);
+        if (status.ok()) {
+            status = load_optimized(session_options, run_options, export_dir,
+                    meta_graph, bundle);
+        }
+        if (status.ok()) {
+            LOG(INFO) << "Optimized graph from cache " << path;
+            return Status::OK();
+        }
+
+        LOG(WARNING) << "Rebuilding graph cache " << path << ": "
+                     << status.ToString();
+        meta_graph.Clear();
+    }
+
+    TF_RETURN_IF_ERROR(ReadMetaGraphDefFromSavedModel(export_dir, tags,
+            &meta_graph));
+
+    auto begin = std::chrono::steady_clock::now();
+    TF_RETURN_IF_ERROR(optimize_meta_graph(session_options, meta_graph));
+    LOG(INFO) << "Grappler optimized the model in "
+              << std::chrono::duration<float>(
+                      std::chrono::steady_clock::now() - begin).count()
+              << " s";
+
+    /* Written under a temporary name, so concurrent starts never read
+     * a partial file.
+     * */
+    const std::string temp = path + ".tmp." + std::to_string(env->NowMicros());
+    Status status = env->RecursivelyCreateDir(config.graph_cache);
+    if (status.ok()) {
+        status = WriteBinaryProto(env, temp, meta_graph);
+    }
+    if (status.ok()) {
+        status = env->RenameFile(temp, path);
+    }
+    if (!status.ok()) {
+        LOG(WARNING) << "Can't write graph cache " << path << ": "
+                     << status.ToString();
+    }
+
+    return load_optimized(session_options, run_options, export_dir, meta_graph,
+            bundle);
+}
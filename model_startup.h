@@ -0,0 +1,59 @@
+#ifndef __MODEL_STARTUP_H__
+#define __MODEL_STARTUP_H__
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/status.h"
+
+#include "model_config.h"
+
+struct WarmupOptions {
+    int runs = 1;                   // Runs of every input, 0 - no warmup
+    int max_requests = 1000;        // Records read from warmup requests
+    std::vector<std::pair<int, int>> shapes; // height, width
+    std::vector<int> batch_sizes = {1};
+};
+
+/* "480x640,720x1280" -> {height, width} pairs. */
+bool ParseWarmupShapes(const std::string& value,
+        std::vector<std::pair<int, int>>& shapes);
+
+/* "1,4" -> batch sizes. */
+bool ParseBatchSizes(const std::string& value, std::vector<int>& sizes);
+
+/* Inputs of assets.extra/tf_serving_warmup_requests, the TFRecord file of
+ * PredictionLog protos TF Serving replays at load. Only predict requests
+ * are used, input_key is the signature input to take from each of them.
+ * NotFound if the model has no such file.
+ * */
+tensorflow::Status ReadWarmupRequests(const std::string& export_dir,
+        const std::string& input_key, int max_requests,
+        std::vector<tensorflow::Tensor>& inputs);
+
+/* Hash of saved_model.pb, variables.index, config (tags included) and
+ * TF version. Any change of model or settings gives another key.
+ * */
+tensorflow::Status ModelCacheKey(const std::string& export_dir,
+        const ModelConfig& config, uint64_t& key);
+
+/* LoadSavedModel with the Grappler pass done once per model.
+ *
+ * Without config.graph_cache it is a plain LoadSavedModel. Otherwise the
+ * meta graph with its graph already optimized by Grappler is read from
+ * <graph_cache>/<key>.pb, or optimized and written there on the first
+ * start. The session is created from the optimized graph with the meta
+ * optimizer off and variables are restored from export_dir, so later
+ * starts skip graph optimization. Broken cache entries are rebuilt.
+ * */
+tensorflow::Status LoadSavedModelCached(
+        const tensorflow::SessionOptions& session_options,
+        const tensorflow::RunOptions& run_options,
+        const std::string& export_dir, const ModelConfig& config,
+        tensorflow::SavedModelBundle* bundle);
+
+#endif /* __MODEL_STARTUP_H__ */
@@ -6,14 +6,20 @@
  * So, this class can work only with that model.
  * */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include <opencv2/core/mat.hpp>
-#include <opencv2/imgcodecs.hpp>
-
-#include "detection_model.h"
+#include "metrics.h"
+#include "model_pool.h"
+#include "output_backends.h"
+#include "stream_inputs.h"
+#include "stream_scheduler.h"
+#include "video_pipeline.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -32,80 +38,120 @@ enum Code {
     ERROR_CODE   = -1,
 };
 
-struct SwsContext_Deleter {
-    void operator() (SwsContext* ptr) {
-        if (ptr != nullptr) {
-            sws_freeContext(ptr);
-        }
-    }
+/* Decoder settings of every input. */
+struct DecodeOptions {
+    int max_packets = 0; // Video packets to read, 0 - whole input
+    int threads = 0;     // Decoder threads, 0 - one per core
 };
 
+/* Send one packet to the decoder and pass every frame it has ready.
+ * nullptr packet flushes the decoder at EOF.
+ *
+ * Packet may give several frames or none: B-frames and frame threading
+ * keep frames inside the decoder, so frames are received until EAGAIN.
+ * Decoder refuses a packet with EAGAIN only while it has output,
+ * then output is drained and the packet is sent again.
+ * */
 static
-int decode_packet(DetectionModel& model, AVPacket* pPacket,
-        AVCodecContext *pCodecContext, AVFrame* pFrame) {
+int decode_packet(int stream_id, VideoPipeline& pipeline, AVPacket* pPacket,
+        AVCodecContext *pCodecContext, AVFrame* pFrame, int64_t& frames) {
     int res = -1;
-    int cvLinesizes[1] = {0};
-    std::ostringstream os("frame");
-    cv::Mat image;
-    AVPixelFormat src_pix_fmt = AV_PIX_FMT_YUV420P;
-    AVPixelFormat dst_pix_fmt = AV_PIX_FMT_RGB24;
-    std::unique_ptr<SwsContext, SwsContext_Deleter> sws_ctx(nullptr, SwsContext_Deleter());
-
-    /* Supply raw packet data as input to a decoder. */
-    res = avcodec_send_packet(pCodecContext, pPacket);
-    if (res != SUCCESS) {
-        LOG(ERROR) << "Failed to send packet to decoder";
-
-        return res;
+    bool sent = false;
+
+    if (pPacket != nullptr) {
+        Metrics::Global().Add(Counter::PACKETS);
     }
 
-    /* Return decoded output data from a decoder. */
-    res = avcodec_receive_frame(pCodecContext, pFrame);
-    if (res == AVERROR(EAGAIN) || res == AVERROR_EOF) {
-        return SUCCESS_CODE;
-    } else if (res != Code::SUCCESS) {
-        LOG(ERROR) << "Failed to receive frame from decoder";
+    while (!sent) {
+        int received = 0;
 
-        return res;
-    }
+        /* Supply raw packet data as input to a decoder. */
+        {
+            StageTimer timer(Stage::DECODE);
+            res = avcodec_send_packet(pCodecContext, pPacket);
+        }
+
+        if (res == SUCCESS_CODE || res == AVERROR_EOF) {
+            /* AVERROR_EOF: decoder is flushed already */
+            sent = true;
+        } else if (res == AVERROR_INVALIDDATA && pPacket != nullptr) {
+            LOG(WARNING) << "Stream " << stream_id << ": corrupt packet "
+                         << "is skipped";
 
-    LOG(INFO) << "Frame " << pCodecContext->frame_number <<
-                " (type=" << av_get_picture_type_char(pFrame->pict_type) <<
-                ", size=" << pFrame->pkt_size <<
-                " bytes, format=" << pFrame->format <<
-                ") pts " << pFrame->pts << " " << pFrame->width <<
-                " x " << pFrame->height <<
-                " key_frame " << pFrame->key_frame <<
-                " [DTS " << pFrame->coded_picture_number << "]";
+            return SUCCESS_CODE;
+        } else if (res != AVERROR(EAGAIN)) {
+            LOG(ERROR) << "Failed to send packet to decoder";
 
-    /* create scaling context */
-    sws_ctx.reset(sws_getContext(pFrame->width, pFrame->height, src_pix_fmt,
-                                 pFrame->width, pFrame->height, dst_pix_fmt,
-                                 SWS_BILINEAR, nullptr, nullptr, nullptr));
-    image = cv::Mat(pFrame->height, pFrame->width, CV_8UC3);
+            return res;
+        }
 
-    cvLinesizes[0] = image.step1();
+        /* Return decoded output data from a decoder. */
+        for (;;) {
+            {
+                StageTimer timer(Stage::DECODE);
+                res = avcodec_receive_frame(pCodecContext, pFrame);
+            }
 
-    /* convert to destination format */
-    sws_scale(sws_ctx.get(), pFrame->data, pFrame->linesize, 0, pFrame->height,
-              &image.data, cvLinesizes);
+            if (res == AVERROR(EAGAIN) || res == AVERROR_EOF) {
+                break;
+            } else if (res != SUCCESS_CODE) {
+                LOG(ERROR) << "Failed to receive frame from decoder";
 
+                return res;
+            }
 
-    if (pCodecContext->frame_number % 3 == 0) {
-        model.Testing(image);
+            ++received;
+            ++frames;
+            Metrics::Global().Add(Counter::FRAMES_DECODED);
+
+            LOG(INFO) << "Stream " << stream_id <<
+                        " frame " << pCodecContext->frame_number <<
+                        " (type=" <<
+                        av_get_picture_type_char(pFrame->pict_type) <<
+                        ", size=" << pFrame->pkt_size <<
+                        " bytes, format=" << pFrame->format <<
+                        ") pts " << pFrame->pts << " " << pFrame->width <<
+                        " x " << pFrame->height <<
+                        " key_frame " << pFrame->key_frame <<
+                        " [DTS " << pFrame->coded_picture_number << "]";
+
+            /* Conversion, inference and output run on the next stages. */
+            const bool pushed = pipeline.PushDecoded(pFrame,
+                    pCodecContext->frame_number);
+            av_frame_unref(pFrame);
+
+            if (!pushed) {
+                LOG(ERROR) << "Pipeline is closed";
+
+                return ERROR_CODE;
+            }
+        }
+
+        if (!sent && received == 0) {
+            LOG(ERROR) << "Decoder neither takes packet nor gives frames";
+
+            return ERROR_CODE;
+        }
     }
 
-    os << pCodecContext->frame_number << ".jpg";
-    cv::imwrite(os.str(), image);
+    return SUCCESS_CODE;
+}
 
-    return res;
+static
+int read_packet(AVFormatContext* pFormatContext, AVPacket* pPacket) {
+    StageTimer timer(Stage::DEMUX);
+
+    return av_read_frame(pFormatContext, pPacket);
 }
 
-int ffmpeg_proceed(DetectionModel& mode, const std::string& filename) {
+/* Demux and decode one input, its frames go through own pipeline. */
+int ffmpeg_proceed(StreamScheduler& scheduler, int stream_id,
+        const PipelineOptions& options, const DecodeOptions& decode_options,
+        const std::string& filename) {
     int res = SUCCESS_CODE;
     int video_stream_index = -1;
     int response = 0;
-    int count_of_packets = 8;
+    int count_of_packets = decode_options.max_packets;
 
     AVPacket* pPacket = nullptr;
     AVFrame* pFrame = nullptr;
@@ -138,7 +184,7 @@ int ffmpeg_proceed(DetectionModel& mode, const std::string& filename) {
 
     /* Read packets of a media file to get stream information. */
     res = avformat_find_stream_info(pFormatContext, nullptr);
-    if (res != SUCCESS) {
+    if (res < SUCCESS_CODE) {
         std::cout << "Failed with find stream in file" << std::endl;
 
         goto close_input;
@@ -158,12 +204,6 @@ int ffmpeg_proceed(DetectionModel& mode, const std::string& filename) {
         }
 
         if (pLocalCodecParameters->codec_type == AVMEDIA_TYPE_VIDEO) {
-            if (video_stream_index == -1) {
-                video_stream_index = i;
-                pCodec = pLocalCodec;
-                pCodecParameters = pLocalCodecParameters;
-            }
-
             LOG(INFO) << "Video Codec: resolution "
                       << pLocalCodecParameters->width << " x "
                       << pLocalCodecParameters->height;
@@ -179,12 +219,18 @@ int ffmpeg_proceed(DetectionModel& mode, const std::string& filename) {
                   << " bit_rate " << pLocalCodecParameters->bit_rate;
     }
 
-    if (video_stream_index == -1) {
+    /* Camera recordings may carry several video streams,
+     * take the one FFmpeg ranks best instead of the first.
+     * */
+    video_stream_index = av_find_best_stream(pFormatContext,
+            AVMEDIA_TYPE_VIDEO, -1, -1, &pCodec, 0);
+    if (video_stream_index < 0 || pCodec == nullptr) {
         LOG(ERROR) << "File " << filename << " does not contain a video stream!";
         res = ERROR_CODE;
 
         goto close_input;
     }
+    pCodecParameters = pFormatContext->streams[video_stream_index]->codecpar;
 
     /* Allocate an AVCodecContext and set its fields to default values. */
     pCodecContext = avcodec_alloc_context3(pCodec);
@@ -204,6 +250,19 @@ int ffmpeg_proceed(DetectionModel& mode, const std::string& filename) {
         goto free_codec_context;
     }
 
+    /* Frame threading decodes several frames at once, slice threading
+     * splits one frame, decoder uses what the codec supports.
+     * */
+    pCodecContext->thread_count = decode_options.threads;
+    pCodecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    /* Keyframe sampling: decoder drops other frames without decoding,
+     * unless the tracker needs them.
+     * */
+    if (options.sampling.mode == SamplingMode::KEYFRAME && !options.track) {
+        pCodecContext->skip_frame = AVDISCARD_NONKEY;
+    }
+
     /* Initialize the AVCodecContext to use the given AVCodec. */
     res = avcodec_open2(pCodecContext, pCodec, nullptr);
     if (res != SUCCESS_CODE) {
@@ -230,19 +289,47 @@ int ffmpeg_proceed(DetectionModel& mode, const std::string& filename) {
         goto free_packet;
     }
 
-    while(av_read_frame(pFormatContext, pPacket) >= 0) {
-        if (pPacket->stream_index == video_stream_index) {
-
-            res = decode_packet(model, pPacket, pCodecContext, pFrame);
-            if (res != SUCCESS_CODE) {
-                av_packet_unref(pPacket);
-                break;
+    {
+        VideoPipeline pipeline(scheduler, stream_id, options,
+                pFormatContext->streams[video_stream_index]->time_base);
+        const auto begin_time = std::chrono::steady_clock::now();
+        int64_t frames = 0;
+
+        while(read_packet(pFormatContext, pPacket) >= 0) {
+            if (pPacket->stream_index == video_stream_index) {
+
+                res = decode_packet(stream_id, pipeline, pPacket,
+                        pCodecContext, pFrame, frames);
+                if (res != SUCCESS_CODE) {
+                    av_packet_unref(pPacket);
+                    break;
+                }
+
+                if (decode_options.max_packets > 0 &&
+                    --count_of_packets <= 0) {
+                    av_packet_unref(pPacket);
+                    break;
+                }
             }
 
-            if (--count_of_packets <= 0) break;
+            av_packet_unref(pPacket);
+        }
+
+        /* EOF or packet limit: flush frames still held by the decoder. */
+        if (res == SUCCESS_CODE) {
+            res = decode_packet(stream_id, pipeline, nullptr, pCodecContext,
+                    pFrame, frames);
         }
 
-        av_packet_unref(pPacket);
+        const double seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - begin_time).count();
+
+        LOG(INFO) << "Stream " << stream_id << ": decoded " << frames
+                  << " frames in " << seconds << " s, "
+                  << (seconds > 0. ? frames / seconds : 0.) << " fps on "
+                  << pCodecContext->thread_count << " threads";
+
+        pipeline.Finish();
     }
 
 free_frame:
@@ -263,16 +350,237 @@ free_context:
     return res;
 }
 
-int main(int argv, char** argc) {
+/* Run every input on its own pipeline, at most max_streams at once,
+ * all of them share the model through the scheduler.
+ * */
+static
+int run_streams(StreamScheduler& scheduler,
+        const std::vector<StreamInput>& inputs,
+        const PipelineOptions& options, const DecodeOptions& decode_options,
+        int max_streams) {
+    std::atomic<size_t> next{0};
+    std::atomic<int> failed{0};
+    std::vector<std::thread> runners;
+
+    auto runner = [&]() {
+        for (;;) {
+            const size_t stream_id = next.fetch_add(1);
+            if (stream_id >= inputs.size()) {
+                return;
+            }
+
+            PipelineOptions stream_options = options;
+            if (inputs[stream_id].infer_stride > 0) {
+                stream_options.sampling.stride = inputs[stream_id].infer_stride;
+            }
+
+            LOG(INFO) << "Stream " << stream_id << ": "
+                      << inputs[stream_id].path;
+
+            if (ffmpeg_proceed(scheduler, stream_id, stream_options,
+                    decode_options, inputs[stream_id].path) != SUCCESS_CODE) {
+                LOG(ERROR) << "Stream " << stream_id << ": failed with "
+                           << inputs[stream_id].path;
+                ++failed;
+            }
+        }
+    };
+
+    size_t count = inputs.size();
+    if (max_streams > 0) {
+        count = std::min(count, static_cast<size_t>(max_streams));
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        runners.emplace_back(runner);
+    }
+    for (auto& thread : runners) {
+        thread.join();
+    }
+
+    return failed == 0 ? SUCCESS_CODE : ERROR_CODE;
+}
+
+int main(int argc, char** argv) {
     int res = SUCCESS_CODE;
     /* std::string path_to_image; */
     std::string path_to_model;
     std::string path_to_video;
+    std::string manifest;
+    int32_t max_streams = 0;
+    int32_t max_packets = 0;
+    int32_t decode_threads = 0;
+    std::string sampling = "stride";
+    int32_t infer_stride = 3;
+    float target_fps = 1.f;
+    float scene_threshold = 0.3f;
+    int32_t scene_max_gap = 0;
+    bool track = false;
+    std::string track_assignment = "greedy";
+    float track_iou = 0.3f;
+    int32_t track_min_hits = 2;
+    int32_t track_max_misses = 2;
+    int32_t max_batch_size = 4;
+    int32_t max_batch_wait_ms = 50;
+    int32_t queue_capacity = 16;
+    std::string shape_buckets;
+    std::string bucket_fit = "letterbox";
+    int32_t bucket_buffers = 0;
+    std::string tile_size;
+    int32_t tile_overlap = 64;
+    int32_t tiles_per_run = 0;
+    int32_t tile_parallel_runs = 1;
+    bool tile_full_frame = false;
+    float tile_merge_threshold = 0.5f;
+    int32_t workers = 1;
+    int32_t intra_op_threads = 0;
+    int32_t inter_op_threads = 0;
+    std::string cpu_pinning = "none";
+    std::string model_config;
+    std::string model_config_file;
+    bool background_load = true;
+    int32_t warmup_runs = 1;
+    std::string warmup_shapes;
+    std::string warmup_batch_sizes;
+    float score_threshold = 0.5f;
+    bool nms = false;
+    float nms_iou_threshold = 0.5f;
+    int32_t cache_entries = 0;
+    int32_t cache_near_distance = -1;
+    std::string cache_file;
+    std::string metrics_file;
+    std::string metrics_format = "prometheus";
+    int32_t metrics_interval_ms = 5000;
+    std::string trace_dir;
+    int32_t trace_every = 0;
+    std::string output = "jpeg";
+    std::string output_dir = ".";
+    int32_t jpeg_quality = 90;
+    bool annotate = false;
+    int32_t output_workers = 2;
+    int32_t output_queue = 64;
+    std::string output_policy = "block";
+    int32_t output_fps = 25;
+    std::string output_codec;
+    std::string output_extension = "mp4";
 
     std::vector<Flag> flag_list = {
         /* Flag("image", &path_to_image, "path of image to be processed"), */
         Flag("model", &path_to_model, "path of model to be processed"),
-        Flag("video_file", &path_to_video, "path of video to be processed"),
+        Flag("video_file", &path_to_video,
+                "comma separated videos or glob patterns to be processed"),
+        Flag("manifest", &manifest,
+                "file with one \"<video> [infer_stride]\" per line"),
+        Flag("max_streams", &max_streams,
+                "max count of videos processed at once, 0 - all"),
+        Flag("max_packets", &max_packets,
+                "video packets to read from every input, 0 - all"),
+        Flag("decode_threads", &decode_threads,
+                "decoder threads of every input, 0 - one per core"),
+        Flag("sampling", &sampling,
+                "frames to infer: stride, fps, keyframe or scene"),
+        Flag("infer_stride", &infer_stride,
+                "stride sampling: infer every N-th frame of a stream"),
+        Flag("target_fps", &target_fps,
+                "fps sampling: frames per second of stream time to infer"),
+        Flag("scene_threshold", &scene_threshold,
+                "scene sampling: luma histogram change to infer, 0..1"),
+        Flag("scene_max_gap", &scene_max_gap,
+                "scene sampling: infer after N skipped frames, 0 - never"),
+        Flag("track", &track,
+                "track objects, boxes with track ids on every frame"),
+        Flag("track_assignment", &track_assignment,
+                "matching of detections to tracks: greedy or hungarian"),
+        Flag("track_iou", &track_iou,
+                "min IoU of a detection and the track it continues"),
+        Flag("track_min_hits", &track_min_hits,
+                "detections of a track before it is reported"),
+        Flag("track_max_misses", &track_max_misses,
+                "inferred frames without detection before a track ends"),
+        Flag("max_batch_size", &max_batch_size,
+                "max count of frames in one Session::Run"),
+        Flag("max_batch_wait_ms", &max_batch_wait_ms,
+                "max time a frame waits for a full batch"),
+        Flag("queue_capacity", &queue_capacity,
+                "slots of every queue between pipeline stages"),
+        Flag("shape_buckets", &shape_buckets,
+                "model input sizes as HxW,..., every frame is fitted into "
+                "the nearest one, empty - frames go as they are"),
+        Flag("bucket_fit", &bucket_fit,
+                "fitting into a bucket: letterbox or stretch"),
+        Flag("bucket_buffers", &bucket_buffers,
+                "buffers of every bucket allocated per stream at start"),
+        Flag("tile_size", &tile_size,
+                "HxW, larger frames run as overlapping tiles of this size, "
+                "empty - whole frames"),
+        Flag("tile_overlap", &tile_overlap,
+                "min pixels shared by neighbouring tiles"),
+        Flag("tiles_per_run", &tiles_per_run,
+                "max tiles in one Session::Run, 0 - all tiles of a batch"),
+        Flag("tile_parallel_runs", &tile_parallel_runs,
+                "runs of tiles of one batch at once"),
+        Flag("tile_full_frame", &tile_full_frame,
+                "also run the whole frame, for objects larger than a tile"),
+        Flag("tile_merge_threshold", &tile_merge_threshold,
+                "share of the smaller box to merge detections of tiles"),
+        Flag("workers", &workers, "count of inference workers sharing model"),
+        Flag("intra_op_threads", &intra_op_threads,
+                "intra-op threads per worker, 0 - TF default"),
+        Flag("inter_op_threads", &inter_op_threads,
+                "inter-op threads per worker, 0 - TF default"),
+        Flag("cpu_pinning", &cpu_pinning,
+                "pin worker threads to CPUs: none, core or numa"),
+        Flag("model_config", &model_config,
+                "load settings as key=value,...: tags, xla, onednn, grappler..."),
+        Flag("model_config_file", &model_config_file,
+                "file with one load setting key=value per line"),
+        Flag("background_load", &background_load,
+                "open streams while the model loads and warms up"),
+        Flag("warmup_runs", &warmup_runs,
+                "runs of every warmup input before serving, 0 - off"),
+        Flag("warmup_shapes", &warmup_shapes,
+                "frame sizes to warm up as HxW,... when the model has no "
+                "tf_serving_warmup_requests"),
+        Flag("warmup_batch_sizes", &warmup_batch_sizes,
+                "batch sizes to warm up, empty - 1 and max_batch_size"),
+        Flag("score_threshold", &score_threshold,
+                "min score of reported detection"),
+        Flag("nms", &nms, "run class-aware NMS over model output"),
+        Flag("nms_iou_threshold", &nms_iou_threshold,
+                "IoU above which NMS drops the lower score box"),
+        Flag("cache_entries", &cache_entries,
+                "results kept for repeated frames, 0 - no result cache"),
+        Flag("cache_near_distance", &cache_near_distance,
+                "max dHash bits a near-duplicate frame differs by, -1 - off"),
+        Flag("cache_file", &cache_file,
+                "result cache kept across restarts, empty - memory only"),
+        Flag("metrics_file", &metrics_file,
+                "file to export stage latencies and counters to, empty - off"),
+        Flag("metrics_format", &metrics_format,
+                "format of metrics_file: prometheus or json"),
+        Flag("metrics_interval_ms", &metrics_interval_ms,
+                "period of rewriting metrics_file"),
+        Flag("trace_dir", &trace_dir,
+                "directory for Chrome traces of Session::Run"),
+        Flag("trace_every", &trace_every,
+                "trace every N-th Session::Run with FULL_TRACE, 0 - off"),
+        Flag("output", &output,
+                "frame writer: none, jpeg, mjpeg, raw or video"),
+        Flag("output_dir", &output_dir, "directory of written frames"),
+        Flag("jpeg_quality", &jpeg_quality,
+                "quality of jpeg and mjpeg output, 0..100"),
+        Flag("annotate", &annotate, "draw detections over written frames"),
+        Flag("output_workers", &output_workers,
+                "threads encoding and writing frames"),
+        Flag("output_queue", &output_queue,
+                "frames waiting for output workers"),
+        Flag("output_policy", &output_policy,
+                "when output_queue is full: block or drop"),
+        Flag("output_fps", &output_fps, "frame rate of video output"),
+        Flag("output_codec", &output_codec,
+                "encoder of video output, empty - container default"),
+        Flag("output_extension", &output_extension,
+                "container of video output: mp4, mkv, avi..."),
     };
 
     std::string usage = tensorflow::Flags::Usage(argv[0], flag_list);
@@ -294,15 +602,196 @@ int main(int argv, char** argc) {
     }
     LOG(INFO) << "Path of model: " << path_to_model;
 
-    if (path_to_video.empty()) {
+    std::vector<StreamInput> inputs;
+
+    ExpandInputs(path_to_video, inputs);
+    if (!manifest.empty() && !LoadManifest(manifest, inputs)) {
+        LOG(ERROR) << "Failed to read manifest " << manifest;
+        return ERROR_CODE;
+    }
+
+    if (inputs.empty()) {
         LOG(ERROR) << "Path of video file is empty!!!";
         return ERROR_CODE;
     }
-    LOG(INFO) << "Path of video file: " << path_to_video;
+    LOG(INFO) << "Count of video streams: " << inputs.size();
 
     try {
-        DetectionModel model(path_to_model);
-        res = ffmpeg_proceed(model, path_to_video);
+        PipelineOptions options;
+        DecodeOptions decode_options;
+        ModelPoolOptions pool_options;
+        PostprocessOptions postprocess_options;
+        CacheOptions cache_options;
+        TileOptions tile_options;
+        OutputOptions output_options;
+        MetricsFormat format;
+        std::unique_ptr<MetricsExporter> exporter;
+        std::unique_ptr<OutputSink> sink;
+
+        if (!ParseMetricsFormat(metrics_format, format)) {
+            LOG(ERROR) << "Unknown metrics_format " << metrics_format;
+            return ERROR_CODE;
+        }
+        /* Created first, so the last write happens after everything is done. */
+        if (!metrics_file.empty()) {
+            exporter.reset(new MetricsExporter(metrics_file, format,
+                    std::chrono::milliseconds(metrics_interval_ms)));
+        }
+
+        pool_options.workers = workers;
+        pool_options.intra_op_threads = intra_op_threads;
+        pool_options.inter_op_threads = inter_op_threads;
+        if (!ParseCpuPinning(cpu_pinning, pool_options.pinning)) {
+            LOG(ERROR) << "Unknown cpu_pinning " << cpu_pinning;
+            return ERROR_CODE;
+        }
+
+        /* Pairs of --model_config override the file. */
+        Status config_status = Status::OK();
+        if (!model_config_file.empty()) {
+            config_status = LoadModelConfig(model_config_file,
+                    pool_options.model_config);
+        }
+        if (config_status.ok()) {
+            config_status = ParseModelConfig(model_config,
+                    pool_options.model_config);
+        }
+        if (!config_status.ok()) {
+            LOG(ERROR) << config_status.ToString();
+            return ERROR_CODE;
+        }
+
+        pool_options.background_load = background_load;
+        pool_options.warmup.runs = warmup_runs;
+        pool_options.warmup.batch_sizes = {1};
+        if (max_batch_size > 1) {
+            pool_options.warmup.batch_sizes.push_back(max_batch_size);
+        }
+        if (!ParseWarmupShapes(shape_buckets, options.buckets.shapes) ||
+            !ParseBucketFit(bucket_fit, options.buckets.fit)) {
+            LOG(ERROR) << "Bad shape_buckets or bucket_fit";
+            return ERROR_CODE;
+        }
+        options.buckets.preallocate = std::max(0, bucket_buffers);
+
+        if (!tile_size.empty()) {
+            if (!ParseTileSize(tile_size, tile_options)) {
+                LOG(ERROR) << "Bad tile_size " << tile_size;
+                return ERROR_CODE;
+            }
+            tile_options.overlap = tile_overlap;
+            tile_options.tiles_per_run = std::max(0, tiles_per_run);
+            tile_options.parallel_runs = tile_parallel_runs;
+            tile_options.full_frame = tile_full_frame;
+            tile_options.merge_threshold = tile_merge_threshold;
+
+            Status tile_status = ValidateTileOptions(tile_options);
+            if (!tile_status.ok()) {
+                LOG(ERROR) << tile_status.ToString();
+                return ERROR_CODE;
+            }
+            /* Buckets would scale frames down before they are tiled. */
+            if (!options.buckets.shapes.empty()) {
+                LOG(ERROR) << "tile_size and shape_buckets exclude each other";
+                return ERROR_CODE;
+            }
+        }
+
+        /* Buckets or tiles are the only shapes the model sees,
+         * warm them up.
+         * */
+        if (warmup_shapes.empty()) {
+            pool_options.warmup.shapes = options.buckets.shapes;
+            if (tile_options.rows > 0) {
+                pool_options.warmup.shapes.emplace_back(tile_options.rows,
+                        tile_options.cols);
+                if (tiles_per_run > 1) {
+                    pool_options.warmup.batch_sizes.push_back(tiles_per_run);
+                }
+            }
+        }
+        if (!ParseWarmupShapes(warmup_shapes, pool_options.warmup.shapes) ||
+            (!warmup_batch_sizes.empty() && !ParseBatchSizes(
+                    warmup_batch_sizes, pool_options.warmup.batch_sizes))) {
+            LOG(ERROR) << "Bad warmup_shapes or warmup_batch_sizes";
+            return ERROR_CODE;
+        }
+
+        decode_options.max_packets = max_packets;
+        decode_options.threads = decode_threads;
+
+        options.queue_capacity = std::max(1, queue_capacity);
+        if (!ParseSamplingMode(sampling, options.sampling.mode)) {
+            LOG(ERROR) << "Unknown sampling " << sampling;
+            return ERROR_CODE;
+        }
+        options.sampling.stride = infer_stride;
+        options.sampling.target_fps = target_fps;
+        options.sampling.scene_threshold = scene_threshold;
+        options.sampling.scene_max_gap = scene_max_gap;
+        options.max_batch_size = std::max(1, max_batch_size);
+        options.max_batch_wait = std::chrono::milliseconds(
+                std::max(0, max_batch_wait_ms));
+        options.track = track;
+        if (!ParseAssignment(track_assignment, options.tracker.assignment)) {
+            LOG(ERROR) << "Unknown track_assignment " << track_assignment;
+            return ERROR_CODE;
+        }
+        options.tracker.iou_threshold = track_iou;
+        options.tracker.min_hits = track_min_hits;
+        options.tracker.max_misses = track_max_misses;
+
+        output_options.backend = output;
+        output_options.dir = output_dir;
+        output_options.jpeg_quality = jpeg_quality;
+        output_options.annotate = annotate;
+        output_options.workers = output_workers;
+        output_options.queue_capacity = std::max(1, output_queue);
+        output_options.video_fps = output_fps;
+        output_options.video_codec = output_codec;
+        output_options.video_extension = output_extension;
+        if (!ParseOverflowPolicy(output_policy, output_options.policy)) {
+            LOG(ERROR) << "Unknown output_policy " << output_policy;
+            return ERROR_CODE;
+        }
+        if (output != "none") {
+            std::unique_ptr<OutputBackend> backend =
+                    CreateOutputBackend(output_options);
+
+            if (!backend) {
+                LOG(ERROR) << "Unknown output " << output;
+                return ERROR_CODE;
+            }
+            sink.reset(new OutputSink(std::move(backend), output_options));
+            options.sink = sink.get();
+        }
+
+        postprocess_options.score_threshold = score_threshold;
+        postprocess_options.nms = nms;
+        postprocess_options.nms_iou_threshold = nms_iou_threshold;
+        cache_options.capacity = std::max(0, cache_entries);
+        cache_options.near_distance = cache_near_distance;
+        cache_options.file = cache_file;
+
+        /* Runs on the loading thread, before warmup and any frame. */
+        pool_options.prepare = [&](DetectionModel& model) {
+            model.SetPostprocessOptions(postprocess_options);
+            model.SetTiling(tile_options);
+            model.SetResultCache(cache_options);
+            if (trace_every > 0) {
+                model.EnableTrace(trace_dir.empty() ? "." : trace_dir,
+                        trace_every);
+            }
+        };
+
+        ModelPool model(path_to_model, pool_options);
+        StreamScheduler scheduler(model, inputs.size());
+
+        res = run_streams(scheduler, inputs, options, decode_options,
+                max_streams);
+
+        /* Throws if the model failed to load in background. */
+        model.WaitReady();
         if (res != SUCCESS_CODE) {
             LOG(ERROR) << "Failed with FFmpeg proceed";
             return ERROR_CODE;
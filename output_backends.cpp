@@ -0,0 +1,465 @@
+#include "output_backends.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "tensorflow/core/platform/logging.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+#ifdef __cplusplus
+}
+#endif
+
+static
+std::string stream_path(const std::string& dir, int stream_id,
+        const std::string& suffix) {
+    std::ostringstream os;
+
+    if (!dir.empty()) {
+        os << dir << '/';
+    }
+    os << "stream" << stream_id << suffix;
+
+    return os.str();
+}
+
+/* Annotations are drawn in place into pooled buffers, nobody reads
+ * them after inference. A buffer borrowed from the decoder may be its
+ * reference frame, so its image is detached into a copy first, the
+ * tensor keeps the decoder's pixels.
+ * */
+static
+void annotate(const OutputOptions& options, const OutputFrame& frame) {
+    if (options.annotate) {
+        if (frame.buffer->borrowed) {
+            frame.buffer->image = frame.buffer->image.clone();
+            frame.buffer->borrowed = false;
+        }
+        DrawDetections(frame.buffer->image, frame.detections,
+                frame.track_ids);
+    }
+}
+
+static
+bool encode_jpeg(const OutputOptions& options, const OutputFrame& frame,
+        std::vector<uint8_t>& data) {
+    const std::vector<int> params = {cv::IMWRITE_JPEG_QUALITY,
+            options.jpeg_quality};
+    cv::Mat bgr;
+
+    annotate(options, frame);
+
+    /* Buffers are RGB, OpenCV encoders expect BGR. */
+    cv::cvtColor(frame.buffer->image, bgr, cv::COLOR_RGB2BGR);
+
+    return cv::imencode(".jpg", bgr, data, params);
+}
+
+static
+bool write_all(FILE* file, const void* data, size_t size) {
+    return std::fwrite(data, 1, size, file) == size;
+}
+
+void DrawDetections(cv::Mat& image, const std::vector<Detection>& detections,
+        const std::vector<uint32_t>& track_ids) {
+    static const cv::Scalar palette[] = {
+        cv::Scalar(230, 25, 75), cv::Scalar(60, 180, 75),
+        cv::Scalar(255, 225, 25), cv::Scalar(0, 130, 200),
+        cv::Scalar(245, 130, 48), cv::Scalar(145, 30, 180),
+        cv::Scalar(70, 240, 240), cv::Scalar(240, 50, 230),
+    };
+    const int colors = sizeof(palette) / sizeof(palette[0]);
+
+    for (size_t i = 0; i < detections.size(); ++i) {
+        const Detection& detection = detections[i];
+        const cv::Scalar& color = palette[
+                static_cast<uint32_t>(detection.class_id) % colors];
+        const cv::Point top_left(
+                static_cast<int>(detection.box.xmin * image.cols),
+                static_cast<int>(detection.box.ymin * image.rows));
+        const cv::Point bottom_right(
+                static_cast<int>(detection.box.xmax * image.cols),
+                static_cast<int>(detection.box.ymax * image.rows));
+        std::ostringstream label;
+
+        label << detection.class_id << ':'
+              << static_cast<int>(detection.score * 100 + 0.5f);
+        if (i < track_ids.size()) {
+            label << " #" << track_ids[i];
+        }
+
+        cv::rectangle(image, top_left, bottom_right, color, 2);
+        cv::putText(image, label.str(),
+                cv::Point(top_left.x + 2, std::max(top_left.y - 4, 12)),
+                cv::FONT_HERSHEY_SIMPLEX, 0.5, color, 1);
+    }
+}
+
+JpegFileBackend::JpegFileBackend(const OutputOptions& options) :
+    _options(options) {}
+
+bool JpegFileBackend::Encode(const OutputFrame& frame,
+        std::vector<uint8_t>& data) {
+    std::ostringstream suffix;
+    FILE* file = nullptr;
+    bool ok = false;
+
+    if (!encode_jpeg(_options, frame, data)) {
+        return false;
+    }
+
+    suffix << "_frame" << frame.frame_number << ".jpg";
+    file = std::fopen(stream_path(_options.dir, frame.stream_id,
+            suffix.str()).c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    ok = write_all(file, data.data(), data.size());
+
+    return std::fclose(file) == 0 && ok;
+}
+
+bool JpegFileBackend::Append(const OutputFrame& frame,
+        const std::vector<uint8_t>& data) {
+    return true;
+}
+
+MjpegBackend::MjpegBackend(const OutputOptions& options) :
+    _options(options) {}
+
+MjpegBackend::~MjpegBackend() {
+    for (auto& file : _files) {
+        std::fclose(file.second);
+    }
+}
+
+bool MjpegBackend::Encode(const OutputFrame& frame,
+        std::vector<uint8_t>& data) {
+    return encode_jpeg(_options, frame, data);
+}
+
+bool MjpegBackend::Append(const OutputFrame& frame,
+        const std::vector<uint8_t>& data) {
+    FILE*& file = _files[frame.stream_id];
+
+    if (file == nullptr) {
+        const std::string path = stream_path(_options.dir, frame.stream_id,
+                ".mjpeg");
+
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            LOG(ERROR) << "Can't open " << path;
+            _files.erase(frame.stream_id);
+            return false;
+        }
+    }
+
+    return write_all(file, data.data(), data.size());
+}
+
+void MjpegBackend::CloseStream(int stream_id) {
+    auto it = _files.find(stream_id);
+
+    if (it != _files.end()) {
+        std::fclose(it->second);
+        _files.erase(it);
+    }
+}
+
+RawBackend::RawBackend(const OutputOptions& options) :
+    _options(options) {}
+
+RawBackend::~RawBackend() {
+    for (auto& file : _files) {
+        std::fclose(file.second.file);
+    }
+}
+
+bool RawBackend::Encode(const OutputFrame& frame, std::vector<uint8_t>& data) {
+    annotate(_options, frame);
+    return true;
+}
+
+bool RawBackend::Append(const OutputFrame& frame,
+        const std::vector<uint8_t>& data) {
+    const cv::Mat& image = frame.buffer->image;
+    File& file = _files[frame.stream_id];
+
+    if (file.file == nullptr) {
+        std::ostringstream suffix;
+
+        suffix << '_' << image.cols << 'x' << image.rows << ".rgb";
+        file.file = std::fopen(stream_path(_options.dir, frame.stream_id,
+                suffix.str()).c_str(), "wb");
+        file.rows = image.rows;
+        file.cols = image.cols;
+        if (file.file == nullptr) {
+            _files.erase(frame.stream_id);
+            return false;
+        }
+    }
+
+    if (image.rows != file.rows || image.cols != file.cols) {
+        return false;
+    }
+
+    /* View of a dense [1, H, W, 3] tensor, rows are contiguous. */
+    return write_all(file.file, image.data, image.total() * image.elemSize());
+}
+
+void RawBackend::CloseStream(int stream_id) {
+    auto it = _files.find(stream_id);
+
+    if (it != _files.end()) {
+        std::fclose(it->second.file);
+        _files.erase(it);
+    }
+}
+
+/* libavformat muxer and libavcodec encoder of one output stream. */
+struct VideoEncoder {
+    AVFormatContext* format = nullptr;
+    AVCodecContext* codec = nullptr;
+    AVStream* stream = nullptr;
+    SwsContext* sws = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+    int rows = 0;
+    int cols = 0;
+    int64_t next_pts = 0;
+    bool header_written = false;
+
+    ~VideoEncoder();
+
+    bool Open(const std::string& path, const OutputOptions& options,
+            int rows, int cols);
+    bool Write(const cv::Mat& image);
+    bool Close();
+    bool Send(AVFrame* input); // nullptr flushes
+};
+
+VideoEncoder::~VideoEncoder() {
+    sws_freeContext(sws);
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&codec);
+    if (format != nullptr) {
+        if (format->pb != nullptr && !(format->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&format->pb);
+        }
+        avformat_free_context(format);
+    }
+}
+
+bool VideoEncoder::Open(const std::string& path, const OutputOptions& options,
+        int rows, int cols) {
+    const AVCodec* encoder = nullptr;
+    const int fps = options.video_fps > 0 ? options.video_fps : 25;
+
+    this->rows = rows;
+    this->cols = cols;
+
+    if (avformat_alloc_output_context2(&format, nullptr, nullptr,
+            path.c_str()) < 0 || format == nullptr) {
+        LOG(ERROR) << "No muxer for " << path;
+        return false;
+    }
+
+    encoder = options.video_codec.empty() ?
+            avcodec_find_encoder(format->oformat->video_codec) :
+            avcodec_find_encoder_by_name(options.video_codec.c_str());
+    if (encoder == nullptr) {
+        LOG(ERROR) << "No video encoder for " << path;
+        return false;
+    }
+
+    codec = avcodec_alloc_context3(encoder);
+    if (codec == nullptr) {
+        return false;
+    }
+
+    /* Chroma subsampled formats need even dimensions. */
+    codec->width = cols & ~1;
+    codec->height = rows & ~1;
+    codec->pix_fmt = encoder->pix_fmts != nullptr ?
+            encoder->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+    codec->time_base = AVRational{1, fps};
+    codec->framerate = AVRational{fps, 1};
+    if (format->oformat->flags & AVFMT_GLOBALHEADER) {
+        codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if (avcodec_open2(codec, encoder, nullptr) < 0) {
+        LOG(ERROR) << "Could not open encoder " << encoder->name;
+        return false;
+    }
+
+    stream = avformat_new_stream(format, nullptr);
+    if (stream == nullptr ||
+        avcodec_parameters_from_context(stream->codecpar, codec) < 0) {
+        return false;
+    }
+    stream->time_base = codec->time_base;
+
+    if (!(format->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&format->pb, path.c_str(), AVIO_FLAG_WRITE) < 0) {
+        LOG(ERROR) << "Can't open " << path;
+        return false;
+    }
+
+    if (avformat_write_header(format, nullptr) < 0) {
+        return false;
+    }
+    header_written = true;
+
+    frame = av_frame_alloc();
+    packet = av_packet_alloc();
+    if (frame == nullptr || packet == nullptr) {
+        return false;
+    }
+
+    frame->format = codec->pix_fmt;
+    frame->width = codec->width;
+    frame->height = codec->height;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        return false;
+    }
+
+    sws = sws_getContext(cols, rows, AV_PIX_FMT_RGB24,
+            codec->width, codec->height, codec->pix_fmt,
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+
+    return sws != nullptr;
+}
+
+bool VideoEncoder::Send(AVFrame* input) {
+    int res = avcodec_send_frame(codec, input);
+
+    if (res < 0) {
+        return false;
+    }
+
+    while ((res = avcodec_receive_packet(codec, packet)) >= 0) {
+        av_packet_rescale_ts(packet, codec->time_base, stream->time_base);
+        packet->stream_index = stream->index;
+
+        /* Muxer takes the packet reference. */
+        if (av_interleaved_write_frame(format, packet) < 0) {
+            return false;
+        }
+    }
+
+    return res == AVERROR(EAGAIN) || res == AVERROR_EOF;
+}
+
+bool VideoEncoder::Write(const cv::Mat& image) {
+    const uint8_t* src[1] = {image.data};
+    const int src_stride[1] = {static_cast<int>(image.step)};
+
+    if (image.rows != rows || image.cols != cols) {
+        return false;
+    }
+
+    /* Encoder may still hold the previous frame data. */
+    if (av_frame_make_writable(frame) < 0) {
+        return false;
+    }
+
+    sws_scale(sws, src, src_stride, 0, rows, frame->data, frame->linesize);
+    frame->pts = next_pts++;
+
+    return Send(frame);
+}
+
+bool VideoEncoder::Close() {
+    bool ok = true;
+
+    if (!header_written) {
+        return false;
+    }
+
+    ok = Send(nullptr);
+    ok = av_write_trailer(format) == 0 && ok;
+    header_written = false;
+
+    return ok;
+}
+
+VideoBackend::VideoBackend(const OutputOptions& options) :
+    _options(options) {}
+
+VideoBackend::~VideoBackend() {
+    for (auto& encoder : _encoders) {
+        if (encoder.second) {
+            encoder.second->Close();
+        }
+    }
+}
+
+bool VideoBackend::Encode(const OutputFrame& frame,
+        std::vector<uint8_t>& data) {
+    annotate(_options, frame);
+    return true;
+}
+
+bool VideoBackend::Append(const OutputFrame& frame,
+        const std::vector<uint8_t>& data) {
+    const cv::Mat& image = frame.buffer->image;
+    auto it = _encoders.find(frame.stream_id);
+
+    if (it == _encoders.end()) {
+        const std::string path = stream_path(_options.dir, frame.stream_id,
+                "." + _options.video_extension);
+        std::unique_ptr<VideoEncoder> encoder(new VideoEncoder());
+
+        /* Failed stream keeps a null entry, so it is not retried per frame. */
+        if (!encoder->Open(path, _options, image.rows, image.cols)) {
+            LOG(ERROR) << "Stream " << frame.stream_id
+                       << ": can't encode video to " << path;
+            encoder.reset();
+        }
+
+        it = _encoders.emplace(frame.stream_id, std::move(encoder)).first;
+    }
+
+    return it->second && it->second->Write(image);
+}
+
+void VideoBackend::CloseStream(int stream_id) {
+    auto it = _encoders.find(stream_id);
+
+    if (it == _encoders.end()) {
+        return;
+    }
+
+    if (it->second && !it->second->Close()) {
+        LOG(WARNING) << "Stream " << stream_id << ": video is not finalized";
+    }
+    _encoders.erase(it);
+}
+
+std::unique_ptr<OutputBackend> CreateOutputBackend(const OutputOptions& options) {
+    std::unique_ptr<OutputBackend> backend;
+
+    if (options.backend == "jpeg") {
+        backend.reset(new JpegFileBackend(options));
+    } else if (options.backend == "mjpeg") {
+        backend.reset(new MjpegBackend(options));
+    } else if (options.backend == "raw") {
+        backend.reset(new RawBackend(options));
+    } else if (options.backend == "video") {
+        backend.reset(new VideoBackend(options));
+    }
+
+    return backend;
+}
@@ -0,0 +1,106 @@
+#ifndef __OUTPUT_BACKENDS_H__
+#define __OUTPUT_BACKENDS_H__
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "output_sink.h"
+
+/* Draw boxes and "class:score" labels over an RGB image,
+ * "class:score #id" with track ids.
+ * */
+void DrawDetections(cv::Mat& image, const std::vector<Detection>& detections,
+        const std::vector<uint32_t>& track_ids = std::vector<uint32_t>());
+
+/* stream<ID>_frame<N>.jpg per frame. Files are independent,
+ * so they are written right in Encode, by all workers at once.
+ * */
+class JpegFileBackend : public OutputBackend {
+private:
+    OutputOptions _options;
+
+public:
+    explicit JpegFileBackend(const OutputOptions& options);
+
+    bool Encode(const OutputFrame& frame, std::vector<uint8_t>& data) override;
+    bool Append(const OutputFrame& frame,
+            const std::vector<uint8_t>& data) override;
+};
+
+/* One stream<ID>.mjpeg per stream: JPEG frames back to back,
+ * readable by "ffplay -f mjpeg". Compression runs in parallel,
+ * appends keep frame order.
+ * */
+class MjpegBackend : public OutputBackend {
+private:
+    OutputOptions _options;
+    std::map<int, FILE*> _files;
+
+public:
+    explicit MjpegBackend(const OutputOptions& options);
+    ~MjpegBackend();
+
+    bool Encode(const OutputFrame& frame, std::vector<uint8_t>& data) override;
+    bool Append(const OutputFrame& frame,
+            const std::vector<uint8_t>& data) override;
+    void CloseStream(int stream_id) override;
+};
+
+/* One stream<ID>_<W>x<H>.rgb per stream: packed RGB24 frames without
+ * headers, for "ffplay -f rawvideo -pixel_format rgb24 -video_size WxH".
+ * Frames of other resolution are not written.
+ * */
+class RawBackend : public OutputBackend {
+private:
+    struct File {
+        FILE* file = nullptr;
+        int rows = 0;
+        int cols = 0;
+    };
+
+    OutputOptions _options;
+    std::map<int, File> _files;
+
+public:
+    explicit RawBackend(const OutputOptions& options);
+    ~RawBackend();
+
+    bool Encode(const OutputFrame& frame, std::vector<uint8_t>& data) override;
+    bool Append(const OutputFrame& frame,
+            const std::vector<uint8_t>& data) override;
+    void CloseStream(int stream_id) override;
+};
+
+struct VideoEncoder;
+
+/* One stream<ID>.<extension> per stream re-encoded by libavcodec at
+ * video_fps, from every frame the sink gets: only inferred frames
+ * without tracking, all decoded frames with it. Encoder is opened on
+ * the first frame of a stream with its resolution.
+ * */
+class VideoBackend : public OutputBackend {
+private:
+    OutputOptions _options;
+    std::map<int, std::unique_ptr<VideoEncoder>> _encoders;
+
+public:
+    explicit VideoBackend(const OutputOptions& options);
+    ~VideoBackend();
+
+    bool Encode(const OutputFrame& frame, std::vector<uint8_t>& data) override;
+    bool Append(const OutputFrame& frame,
+            const std::vector<uint8_t>& data) override;
+    void CloseStream(int stream_id) override;
+};
+
+/* Backend by options.backend: jpeg, mjpeg, raw or video.
+ * nullptr for an unknown name.
+ * */
+std::unique_ptr<OutputBackend> CreateOutputBackend(const OutputOptions& options);
+
+#endif /* __OUTPUT_BACKENDS_H__ */
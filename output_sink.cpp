@@ -0,0 +1,188 @@
+#include "output_sink.h"
+
+#include "tensorflow/core/platform/logging.h"
+
+#include "metrics.h"
+
+bool ParseOverflowPolicy(const std::string& value, OverflowPolicy& policy) {
+    if (value == "block") {
+        policy = OverflowPolicy::BLOCK;
+    } else if (value == "drop") {
+        policy = OverflowPolicy::DROP;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+OutputSink::OutputSink(std::unique_ptr<OutputBackend> backend,
+        const OutputOptions& options) :
+    _backend(std::move(backend)), _policy(options.policy),
+    _capacity(options.queue_capacity > 0 ? options.queue_capacity : 1) {
+    const int workers = options.workers > 0 ? options.workers : 1;
+
+    for (int i = 0; i < workers; ++i) {
+        _workers.emplace_back(&OutputSink::Worker, this);
+    }
+}
+
+OutputSink::~OutputSink() {
+    Stop();
+}
+
+bool OutputSink::Submit(OutputFrame frame) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    Item item;
+
+    if (_policy == OverflowPolicy::BLOCK) {
+        _not_full.wait(lock, [this] {
+            return _stopped || _queue.size() < _capacity;
+        });
+    }
+
+    if (_stopped || _queue.size() >= _capacity) {
+        ++_dropped;
+        Metrics::Global().Add(Counter::FRAMES_DROPPED);
+        return false;
+    }
+
+    /* Sequence is taken under the queue lock, so commit order
+     * is the order frames entered the queue.
+     * */
+    item.sequence = _next_sequence++;
+    item.frame = std::move(frame);
+    ++_pending[item.frame.stream_id];
+    _queue.push_back(std::move(item));
+
+    lock.unlock();
+    _not_empty.notify_one();
+
+    return true;
+}
+
+void OutputSink::Worker() {
+    Item item;
+    std::vector<uint8_t> data;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            _not_empty.wait(lock, [this] {
+                return _stopped || !_queue.empty();
+            });
+
+            /* Stopped workers still drain what is queued. */
+            if (_queue.empty()) {
+                return;
+            }
+
+            item = std::move(_queue.front());
+            _queue.pop_front();
+        }
+        _not_full.notify_one();
+
+        bool encoded = false;
+
+        data.clear();
+        {
+            StageTimer timer(Stage::OUTPUT_ENCODE);
+            encoded = _backend->Encode(item.frame, data);
+        }
+
+        Commit(item, data, encoded);
+    }
+}
+
+void OutputSink::Commit(Item& item, std::vector<uint8_t>& data, bool encoded) {
+    std::lock_guard<std::mutex> lock(_commit_mutex);
+    Encoded& slot = _encoded[item.sequence];
+
+    slot.item = std::move(item);
+    slot.data.swap(data);
+    slot.ok = encoded;
+
+    /* Whoever completes the next sequence appends it and every
+     * already encoded one after it, holding the commit lock keeps
+     * Append calls serial and ordered.
+     * */
+    while (!_encoded.empty() && _encoded.begin()->first == _next_commit) {
+        Encoded& next = _encoded.begin()->second;
+        const int stream_id = next.item.frame.stream_id;
+        bool written = next.ok;
+
+        if (written) {
+            StageTimer timer(Stage::OUTPUT_WRITE);
+            written = _backend->Append(next.item.frame, next.data);
+        }
+
+        if (written) {
+            ++_written;
+            Metrics::Global().Add(Counter::FRAMES_WRITTEN);
+        } else {
+            ++_failed;
+            LOG(WARNING) << "Stream " << stream_id << ": failed to write frame "
+                         << next.item.frame.frame_number;
+        }
+
+        /* Releases the frame buffer back to the pool of its stream. */
+        _encoded.erase(_encoded.begin());
+        ++_next_commit;
+
+        {
+            std::lock_guard<std::mutex> pending_lock(_mutex);
+            --_pending[stream_id];
+        }
+        _stream_done.notify_all();
+    }
+}
+
+void OutputSink::FinishStream(int stream_id) {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _stream_done.wait(lock, [this, stream_id] {
+            auto it = _pending.find(stream_id);
+            return it == _pending.end() || it->second == 0;
+        });
+        _pending.erase(stream_id);
+    }
+
+    std::lock_guard<std::mutex> lock(_commit_mutex);
+    _backend->CloseStream(stream_id);
+}
+
+void OutputSink::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stopped) {
+            return;
+        }
+        _stopped = true;
+    }
+    _not_empty.notify_all();
+    _not_full.notify_all();
+
+    for (auto& worker : _workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    LogStats();
+}
+
+void OutputSink::LogStats() {
+    uint64_t dropped = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        dropped = _dropped;
+    }
+
+    std::lock_guard<std::mutex> lock(_commit_mutex);
+    LOG(INFO) << "Output sink: written " << _written
+              << ", dropped " << dropped
+              << ", failed " << _failed;
+}
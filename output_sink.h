@@ -0,0 +1,137 @@
+#ifndef __OUTPUT_SINK_H__
+#define __OUTPUT_SINK_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "detection_postprocess.h"
+#include "frame_converter.h"
+
+/* One processed frame on its way to disk. */
+struct OutputFrame {
+    int stream_id = 0;
+    int frame_number = 0;
+    std::shared_ptr<FrameBuffer> buffer; // RGB24
+    std::vector<Detection> detections;
+    std::vector<uint32_t> track_ids; // Per detection, empty - not tracked
+};
+
+/* Where frames go.
+ *
+ * Encode runs on several sink workers at once and must not touch
+ * shared state, it does the heavy part: drawing, JPEG compression.
+ * Append is called by one thread at a time in submission order,
+ * it writes what Encode produced to a shared file or encoder.
+ * */
+class OutputBackend {
+public:
+    virtual ~OutputBackend() = default;
+
+    virtual bool Encode(const OutputFrame& frame,
+            std::vector<uint8_t>& data) = 0;
+    virtual bool Append(const OutputFrame& frame,
+            const std::vector<uint8_t>& data) = 0;
+
+    /* Frames of the stream are over, called after its last Append. */
+    virtual void CloseStream(int stream_id) {}
+};
+
+enum class OverflowPolicy {
+    BLOCK, // Producer waits for a free slot, inference slows down
+    DROP,  // New frame is dropped, inference keeps its pace
+};
+
+struct OutputOptions {
+    std::string backend = "jpeg";  // none, jpeg, mjpeg, raw or video
+    std::string dir = ".";
+    int jpeg_quality = 90;
+    bool annotate = false;         // Draw detection boxes
+    int workers = 2;
+    size_t queue_capacity = 64;
+    OverflowPolicy policy = OverflowPolicy::BLOCK;
+    int video_fps = 25;
+    std::string video_codec;       // Empty - default of the container
+    std::string video_extension = "mp4";
+};
+
+/* "--output_policy" value: block or drop. */
+bool ParseOverflowPolicy(const std::string& value, OverflowPolicy& policy);
+
+/* Asynchronous frame writer shared by all streams.
+ *
+ * Submit puts a frame into a bounded queue and returns, workers encode
+ * frames in parallel and commit them to the backend in submission
+ * order. When the queue is full the policy decides between waiting
+ * and dropping the frame.
+ * */
+class OutputSink {
+private:
+    struct Item {
+        uint64_t sequence = 0;
+        OutputFrame frame;
+    };
+
+    struct Encoded {
+        Item item;
+        std::vector<uint8_t> data;
+        bool ok = false;
+    };
+
+    std::unique_ptr<OutputBackend> _backend;
+    OverflowPolicy _policy;
+    size_t _capacity;
+
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+    std::condition_variable _stream_done;
+    std::deque<Item> _queue;
+    bool _stopped = false;
+    uint64_t _next_sequence = 0;
+    std::unordered_map<int, size_t> _pending; // per stream, queued + in work
+
+    /* Encoded frames waiting for their turn to be appended. */
+    std::mutex _commit_mutex;
+    std::map<uint64_t, Encoded> _encoded;
+    uint64_t _next_commit = 0;
+
+    uint64_t _written = 0;
+    uint64_t _dropped = 0;
+    uint64_t _failed = 0;
+
+    std::vector<std::thread> _workers;
+
+    void Worker();
+    void Commit(Item& item, std::vector<uint8_t>& data, bool encoded);
+
+public:
+    OutputSink(std::unique_ptr<OutputBackend> backend,
+            const OutputOptions& options);
+    ~OutputSink();
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    /* Thread safe. Returns false if the frame was dropped. */
+    bool Submit(OutputFrame frame);
+
+    /* Wait until all frames of the stream are written, then close it.
+     * Must be called before the stream frees its frame buffers.
+     * */
+    void FinishStream(int stream_id);
+
+    /* Write everything queued and join the workers. */
+    void Stop();
+
+    void LogStats();
+};
+
+#endif /* __OUTPUT_SINK_H__ */
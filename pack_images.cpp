@@ -0,0 +1,73 @@
+/*
+ * Packs many JPEG files into one ImageArchive, so consumers map one
+ * file instead of opening millions of small ones.
+ * */
+
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/util/command_line_flags.h"
+
+#include "encoded_image.h"
+#include "stream_inputs.h"
+
+using tensorflow::Flag;
+using tensorflow::Status;
+
+int main(int argc, char** argv) {
+    std::string images;
+    std::string list;
+    std::string output;
+    std::vector<StreamInput> inputs;
+    ImageArchiveWriter writer;
+    size_t skipped = 0;
+
+    std::vector<Flag> flag_list = {
+        Flag("images", &images, "comma separated images or glob patterns"),
+        Flag("list", &list, "file with one image path or pattern per line"),
+        Flag("output", &output, "archive to create"),
+    };
+
+    std::string usage = tensorflow::Flags::Usage(argv[0], flag_list);
+    bool parse_result = tensorflow::Flags::Parse(&argc, argv, flag_list);
+    if (!parse_result || output.empty()) {
+        LOG(ERROR) << usage;
+        return -1;
+    }
+
+    ExpandInputs(images, inputs);
+    if (!list.empty() && !LoadManifest(list, inputs)) {
+        LOG(ERROR) << "Failed to read list " << list;
+        return -1;
+    }
+
+    Status status = writer.Open(output);
+
+    for (size_t i = 0; status.ok() && i < inputs.size(); ++i) {
+        std::unique_ptr<MappedFile> file;
+        Status read = MappedFile::Open(inputs[i].path, MapAccess::SEQUENTIAL,
+                file);
+
+        if (!read.ok()) {
+            LOG(WARNING) << read.ToString();
+            ++skipped;
+            continue;
+        }
+
+        status = writer.Add(inputs[i].path, file->Data());
+    }
+
+    if (status.ok()) {
+        status = writer.Finish();
+    }
+    if (!status.ok()) {
+        LOG(ERROR) << status.ToString();
+        return -1;
+    }
+
+    LOG(INFO) << "Packed " << inputs.size() - skipped << " images to "
+              << output << ", skipped " << skipped;
+
+    return 0;
+}
@@ -0,0 +1,442 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/hash.h"
+#include "tensorflow/core/platform/logging.h"
+
+#include "encoded_image.h"
+#include "metrics.h"
+
+using tensorflow::Status;
+using tensorflow::StringPiece;
+
+static const char kMagic[8] = {'R', 'E', 'S', 'C', 'A', 'C', 'H', '1'};
+static const size_t kHeaderSize = sizeof(kMagic) + 2 * 8;
+static const size_t kRecordHeaderSize = 3 * 8 + 2 * 4;
+
+/* Keeps keys of bytes and pixels apart even if their hashes are equal. */
+static const uint64_t kEncodedSeed = 0x656e636f646564ULL;
+static const uint64_t kPixelSeed = 0x706978656c73ULL;
+
+static const int kGridRows = 8;
+static const int kGridCols = 9;
+static const int kCellSamples = 16; // Per cell side
+
+static
+void put_u64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+static
+void put_u32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+static
+uint64_t get_uint(const char* data, int bytes) {
+    uint64_t value = 0;
+
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | static_cast<uint8_t>(data[i]);
+    }
+
+    return value;
+}
+
+CacheKey EncodedCacheKey(StringPiece bytes) {
+    CacheKey key;
+
+    key.exact[0] = tensorflow::Hash64(bytes.data(), bytes.size(),
+            kEncodedSeed);
+    key.exact[1] = tensorflow::Hash64Combine(kEncodedSeed, bytes.size());
+    key.dhash = 0;
+    key.has_dhash = false;
+
+    return key;
+}
+
+CacheKey PixelCacheKey(const cv::Mat& image, bool with_dhash) {
+    using tensorflow::Hash64Combine;
+
+    const size_t row_bytes = image.cols * image.elemSize();
+    CacheKey key;
+
+    if (image.isContinuous()) {
+        key.exact[0] = tensorflow::Hash64(
+                reinterpret_cast<const char*>(image.data),
+                row_bytes * image.rows, kPixelSeed);
+    } else {
+        key.exact[0] = kPixelSeed;
+        for (int y = 0; y < image.rows; ++y) {
+            key.exact[0] = Hash64Combine(key.exact[0], tensorflow::Hash64(
+                    image.ptr<char>(y), row_bytes, kPixelSeed));
+        }
+    }
+    key.exact[1] = Hash64Combine(Hash64Combine(Hash64Combine(kPixelSeed,
+            image.rows), image.cols), image.type());
+    key.dhash = with_dhash ? DHash(image) : 0;
+    key.has_dhash = with_dhash;
+
+    return key;
+}
+
+/* Mean luma of every grid cell, at most kCellSamples^2 pixels each. */
+template <typename Pixel>
+static
+void grid_luma(const cv::Mat& image, float luma[kGridRows][kGridCols]) {
+    for (int r = 0; r < kGridRows; ++r) {
+        const int y0 = r * image.rows / kGridRows;
+        const int y1 = std::max(y0 + 1, (r + 1) * image.rows / kGridRows);
+        const int y_step = std::max(1, (y1 - y0) / kCellSamples);
+
+        for (int c = 0; c < kGridCols; ++c) {
+            const int x0 = c * image.cols / kGridCols;
+            const int x1 = std::max(x0 + 1, (c + 1) * image.cols / kGridCols);
+            const int x_step = std::max(1, (x1 - x0) / kCellSamples);
+            float sum = 0;
+            int count = 0;
+
+            for (int y = y0; y < y1; y += y_step) {
+                const Pixel* row = image.ptr<Pixel>(y);
+
+                for (int x = x0; x < x1; x += x_step) {
+                    const Pixel* p = row + 3 * x;
+                    sum += 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+                    ++count;
+                }
+            }
+
+            luma[r][c] = sum / count;
+        }
+    }
+}
+
+uint64_t DHash(const cv::Mat& image) {
+    float luma[kGridRows][kGridCols];
+    uint64_t hash = 0;
+
+    if (image.empty() || image.channels() != 3) {
+        return 0;
+    }
+
+    if (image.depth() == CV_32F) {
+        grid_luma<float>(image, luma);
+    } else {
+        grid_luma<uint8_t>(image, luma);
+    }
+
+    for (int r = 0; r < kGridRows; ++r) {
+        for (int c = 0; c + 1 < kGridCols; ++c) {
+            if (luma[r][c] > luma[r][c + 1]) {
+                hash |= uint64_t(1) << (r * (kGridCols - 1) + c);
+            }
+        }
+    }
+
+    return hash;
+}
+
+ResultCache::ResultCache(const CacheOptions& options, uint64_t model_key) :
+    _options(options), _model_key(model_key) {
+    if (_options.capacity == 0) {
+        throw std::runtime_error("Result cache needs a capacity");
+    }
+    /* Bands must stay 4 bits or wider, narrower ones match everything. */
+    if (_options.near_distance < -1 || _options.near_distance > 15) {
+        throw std::runtime_error("Near duplicate distance must be -1..15");
+    }
+
+    const size_t shards = std::max<size_t>(1,
+            std::min(_options.shards, _options.capacity));
+
+    for (size_t i = 0; i < shards; ++i) {
+        _shards.emplace_back(new Shard());
+        _shards.back()->capacity = _options.capacity / shards +
+            (i < _options.capacity % shards ? 1 : 0);
+        if (NearEnabled()) {
+            _shards.back()->bands.resize(_options.near_distance + 1);
+        }
+    }
+}
+
+uint64_t ResultCache::Band(uint64_t dhash, size_t band) const {
+    const size_t bands = _options.near_distance + 1;
+    const size_t begin = band * 64 / bands;
+    const size_t width = (band + 1) * 64 / bands - begin;
+    const uint64_t mask = width == 64 ? ~uint64_t(0) :
+        (uint64_t(1) << width) - 1;
+
+    return (dhash >> begin) & mask;
+}
+
+void ResultCache::Index(Shard& shard, Entry& entry) {
+    if (!entry.key.has_dhash) {
+        return;
+    }
+
+    for (size_t i = 0; i < shard.bands.size(); ++i) {
+        shard.bands[i].emplace(Band(entry.key.dhash, i), &entry);
+    }
+}
+
+void ResultCache::Unindex(Shard& shard, Entry& entry) {
+    if (!entry.key.has_dhash) {
+        return;
+    }
+
+    for (size_t i = 0; i < shard.bands.size(); ++i) {
+        auto range = shard.bands[i].equal_range(Band(entry.key.dhash, i));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == &entry) {
+                shard.bands[i].erase(it);
+                break;
+            }
+        }
+    }
+}
+
+void ResultCache::InsertLocked(Shard& shard, const CacheKey& key,
+        const std::string& value) {
+    const ExactKey exact(key.exact[0], key.exact[1]);
+    auto found = shard.exact.find(exact);
+
+    if (found != shard.exact.end()) {
+        Entry& entry = *found->second;
+
+        Unindex(shard, entry);
+        entry.key = key;
+        entry.value = value;
+        Index(shard, entry);
+        shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+        return;
+    }
+
+    shard.lru.emplace_front();
+    shard.lru.front().key = key;
+    shard.lru.front().value = value;
+    shard.exact[exact] = shard.lru.begin();
+    Index(shard, shard.lru.front());
+
+    while (shard.lru.size() > shard.capacity) {
+        Entry& oldest = shard.lru.back();
+
+        Unindex(shard, oldest);
+        shard.exact.erase(ExactKey(oldest.key.exact[0], oldest.key.exact[1]));
+        shard.lru.pop_back();
+    }
+}
+
+void ResultCache::Insert(const CacheKey& key, const std::string& value) {
+    Shard& shard = ShardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    InsertLocked(shard, key, value);
+}
+
+bool ResultCache::FindExact(const CacheKey& key, std::string& value) {
+    Shard& shard = ShardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto found = shard.exact.find(ExactKey(key.exact[0], key.exact[1]));
+    if (found == shard.exact.end()) {
+        return false;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+    value = found->second->value;
+
+    return true;
+}
+
+bool ResultCache::FindNear(const CacheKey& key, std::string& value) {
+    int best = _options.near_distance + 1;
+
+    /* Near duplicates have other exact hashes, so any shard may hold one. */
+    for (auto& shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        Entry* nearest = nullptr;
+
+        for (size_t i = 0; i < shard->bands.size() && best > 0; ++i) {
+            auto range = shard->bands[i].equal_range(Band(key.dhash, i));
+
+            for (auto it = range.first; it != range.second; ++it) {
+                const int distance =
+                    __builtin_popcountll(it->second->key.dhash ^ key.dhash);
+                if (distance < best) {
+                    best = distance;
+                    nearest = it->second;
+                }
+            }
+        }
+
+        if (nearest != nullptr) {
+            shard->lru.splice(shard->lru.begin(), shard->lru,
+                    shard->exact[ExactKey(nearest->key.exact[0],
+                            nearest->key.exact[1])]);
+            value = nearest->value;
+        }
+        if (best == 0) {
+            break;
+        }
+    }
+
+    return best <= _options.near_distance;
+}
+
+bool ResultCache::Find(const CacheKey& key, std::string& value) {
+    if (!FindExact(key, value)) {
+        return false;
+    }
+
+    Metrics::Global().Add(Counter::CACHE_HITS);
+    return true;
+}
+
+bool ResultCache::Lookup(const CacheKey& key, std::string& value) {
+    Metrics& metrics = Metrics::Global();
+
+    if (FindExact(key, value)) {
+        metrics.Add(Counter::CACHE_HITS);
+        return true;
+    }
+    if (key.has_dhash && NearEnabled() && FindNear(key, value)) {
+        metrics.Add(Counter::CACHE_NEAR_HITS);
+        return true;
+    }
+
+    metrics.Add(Counter::CACHE_MISSES);
+    return false;
+}
+
+size_t ResultCache::Size() {
+    size_t size = 0;
+
+    for (auto& shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        size += shard->lru.size();
+    }
+
+    return size;
+}
+
+Status ResultCache::Load() {
+    using namespace tensorflow;
+
+    std::unique_ptr<MappedFile> file;
+
+    if (_options.file.empty()) {
+        return Status::OK();
+    }
+
+    Status status = MappedFile::Open(_options.file, MapAccess::SEQUENTIAL,
+            file);
+    if (errors::IsNotFound(status)) {
+        LOG(INFO) << "Result cache " << _options.file << " starts empty";
+        return Status::OK();
+    }
+    TF_RETURN_IF_ERROR(status);
+
+    const StringPiece data = file->Data();
+    if (data.size() < kHeaderSize ||
+        memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+        return errors::DataLoss(_options.file, " is not a result cache");
+    }
+
+    if (get_uint(data.data() + sizeof(kMagic), 8) != _model_key) {
+        LOG(WARNING) << "Result cache " << _options.file
+                     << " belongs to another model or settings, ignored";
+        return Status::OK();
+    }
+
+    const uint64_t count = get_uint(data.data() + sizeof(kMagic) + 8, 8);
+    size_t offset = kHeaderSize;
+
+    for (uint64_t i = 0; i < count; ++i) {
+        if (data.size() - offset < kRecordHeaderSize) {
+            return errors::DataLoss(_options.file, " is truncated");
+        }
+
+        const char* record = data.data() + offset;
+        const uint64_t size = get_uint(record + 28, 4);
+        CacheKey key;
+
+        key.exact[0] = get_uint(record, 8);
+        key.exact[1] = get_uint(record + 8, 8);
+        key.dhash = get_uint(record + 16, 8);
+        key.has_dhash = get_uint(record + 24, 4) != 0;
+        offset += kRecordHeaderSize;
+
+        if (data.size() - offset < size) {
+            return errors::DataLoss(_options.file, " is truncated");
+        }
+
+        Insert(key, std::string(data.data() + offset, size));
+        offset += size;
+    }
+
+    LOG(INFO) << "Result cache: " << Size() << " entries loaded from "
+              << _options.file;
+
+    return Status::OK();
+}
+
+Status ResultCache::Save() {
+    using namespace tensorflow;
+
+    const std::string tmp_path = _options.file + ".tmp";
+    std::string records;
+    uint64_t count = 0;
+
+    if (_options.file.empty()) {
+        return Status::OK();
+    }
+
+    /* Oldest first, so Load leaves every shard in the same order. */
+    for (auto& shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+
+        for (auto entry = shard->lru.rbegin(); entry != shard->lru.rend();
+             ++entry) {
+            put_u64(records, entry->key.exact[0]);
+            put_u64(records, entry->key.exact[1]);
+            put_u64(records, entry->key.dhash);
+            put_u32(records, entry->key.has_dhash ? 1 : 0);
+            put_u32(records, static_cast<uint32_t>(entry->value.size()));
+            records += entry->value;
+            ++count;
+        }
+    }
+
+    std::string header(kMagic, sizeof(kMagic));
+    put_u64(header, _model_key);
+    put_u64(header, count);
+
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+
+        file.write(header.data(), header.size());
+        file.write(records.data(), records.size());
+        if (!file) {
+            return errors::Internal("Failed to write ", tmp_path);
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), _options.file.c_str()) != 0) {
+        return errors::Internal("Failed to rename ", tmp_path, " to ",
+                _options.file);
+    }
+
+    LOG(INFO) << "Result cache: " << count << " entries saved to "
+              << _options.file;
+
+    return Status::OK();
+}
@@ -0,0 +1,162 @@
+#ifndef __RESULT_CACHE_H__
+#define __RESULT_CACHE_H__
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/stringpiece.h"
+
+struct CacheOptions {
+    size_t capacity = 0;    // Entries kept, 0 - no cache
+    size_t shards = 16;     // Independently locked parts
+    int near_distance = -1; // Max dHash Hamming distance, -1 - exact only
+    std::string file;       // Read by Load, written by Save, empty - none
+};
+
+/* Exact key: 64-bit hash of encoded bytes or pixels and a hash of their
+ * size and shape. With a million entries two different inputs share a
+ * key with a chance below 1e-7. dHash of the pixels when they are known.
+ * */
+struct CacheKey {
+    uint64_t exact[2];
+    uint64_t dhash;
+    bool has_dhash;
+};
+
+/* Key of encoded bytes, no dHash until the image is decoded. */
+CacheKey EncodedCacheKey(tensorflow::StringPiece bytes);
+
+/* Key of the pixels of a CV_8UC3 or CV_32FC3 image, dHash included if
+ * with_dhash.
+ * */
+CacheKey PixelCacheKey(const cv::Mat& image, bool with_dhash);
+
+/* Difference hash: luma of a 9x8 grid of cell means, bit i set if a cell
+ * is brighter than its right neighbour. Frames that differ by noise,
+ * compression or small changes are a few bits apart. Cells are sampled
+ * at most 16x16 times, so it costs the same for any resolution.
+ * */
+uint64_t DHash(const cv::Mat& image);
+
+/* Bounded LRU of inference results in front of a model.
+ *
+ * Values are opaque bytes, see PackValues. Entries are split over
+ * shards by exact hash, each with its own lock and LRU list, so
+ * concurrent workers rarely wait for each other. With near_distance a
+ * miss of the exact hash looks for an entry whose dHash is at most that
+ * many bits away, e.g. the previous frame of a static camera. Those are
+ * found through near_distance + 1 band indices: two hashes that close
+ * have at least one band equal.
+ *
+ * model_key identifies the model and settings the results belong to,
+ * a file written for another key is ignored.
+ * */
+class ResultCache {
+private:
+    struct Entry {
+        CacheKey key;
+        std::string value;
+    };
+
+    using ExactKey = std::pair<uint64_t, uint64_t>;
+
+    struct ExactKeyHash {
+        size_t operator()(const ExactKey& key) const {
+            return static_cast<size_t>(key.first ^ key.second);
+        }
+    };
+
+    using BandIndex = std::unordered_multimap<uint64_t, Entry*>;
+
+    struct Shard {
+        size_t capacity = 0;
+        std::mutex mutex;
+        std::list<Entry> lru; // Most recent first
+        std::unordered_map<ExactKey, std::list<Entry>::iterator,
+            ExactKeyHash> exact;
+        std::vector<BandIndex> bands;
+    };
+
+    CacheOptions _options;
+    uint64_t _model_key;
+    std::vector<std::unique_ptr<Shard>> _shards;
+
+    Shard& ShardOf(const CacheKey& key) {
+        return *_shards[key.exact[0] % _shards.size()];
+    }
+    uint64_t Band(uint64_t dhash, size_t band) const;
+    void Index(Shard& shard, Entry& entry);
+    void Unindex(Shard& shard, Entry& entry);
+    void InsertLocked(Shard& shard, const CacheKey& key,
+            const std::string& value);
+    bool FindExact(const CacheKey& key, std::string& value);
+    bool FindNear(const CacheKey& key, std::string& value);
+
+public:
+    /* Throws on bad options. */
+    ResultCache(const CacheOptions& options, uint64_t model_key);
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    bool NearEnabled() const { return _options.near_distance >= 0; }
+
+    /* Exact hash only, a hit is counted, a miss is not: the caller
+     * decodes the image and asks Lookup with its dHash.
+     * */
+    bool Find(const CacheKey& key, std::string& value);
+
+    /* Exact hash, then the nearest dHash if the key has one. Counts a
+     * hit, near hit or miss.
+     * */
+    bool Lookup(const CacheKey& key, std::string& value);
+
+    void Insert(const CacheKey& key, const std::string& value);
+
+    size_t Size();
+
+    /* Entries of options.file, most recent last. Missing file is empty,
+     * a file of another model_key is ignored with a warning.
+     * */
+    tensorflow::Status Load();
+
+    /* Write all entries to options.file, replaced by rename. */
+    tensorflow::Status Save();
+};
+
+/* Trivially copyable results as cache values. */
+template <typename T>
+std::string PackValues(const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+            "Only plain structs can be packed");
+
+    return std::string(reinterpret_cast<const char*>(values.data()),
+            values.size() * sizeof(T));
+}
+
+template <typename T>
+bool UnpackValues(const std::string& data, std::vector<T>& values) {
+    if (data.size() % sizeof(T) != 0) {
+        return false;
+    }
+
+    values.resize(data.size() / sizeof(T));
+    if (!data.empty()) {
+        memcpy(values.data(), data.data(), data.size());
+    }
+
+    return true;
+}
+
+#endif /* __RESULT_CACHE_H__ */
@@ -0,0 +1,171 @@
+#include "shape_buckets.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <opencv2/imgproc.hpp>
+
+#include "tensorflow/core/platform/errors.h"
+
+using tensorflow::Status;
+
+bool ParseBucketFit(const std::string& value, BucketFit& fit) {
+    if (value == "letterbox") {
+        fit = BucketFit::LETTERBOX;
+    } else if (value == "stretch") {
+        fit = BucketFit::STRETCH;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static
+bool same_box(const Box& a, const Box& b) {
+    return a.ymin == b.ymin && a.xmin == b.xmin &&
+           a.ymax == b.ymax && a.xmax == b.xmax;
+}
+
+/* Bilinear like the swscale path, a plain copy when sizes match. */
+static
+void resize_into(const cv::Mat& image, cv::Mat& roi) {
+    if (image.rows == roi.rows && image.cols == roi.cols) {
+        image.copyTo(roi);
+    } else {
+        cv::resize(image, roi, roi.size(), 0, 0, cv::INTER_LINEAR);
+    }
+}
+
+ShapeBuckets::ShapeBuckets(const BucketOptions& options) :
+    _options(options) {
+    for (const auto& shape : _options.shapes) {
+        _pools.emplace_back(new FrameBufferPool());
+        if (_options.preallocate > 0) {
+            _pools.back()->Reserve(shape.first, shape.second,
+                    _options.preallocate);
+        }
+    }
+}
+
+int ShapeBuckets::Select(int rows, int cols) const {
+    int best = -1;
+    double best_scale = 0;
+    int64_t best_area = 0;
+
+    for (size_t i = 0; i < _options.shapes.size(); ++i) {
+        const int64_t area =
+            static_cast<int64_t>(_options.shapes[i].first) *
+            _options.shapes[i].second;
+        /* Scale up to 1 counts as no loss, then the smaller bucket wins. */
+        const double scale = std::min(1., std::min(
+                static_cast<double>(_options.shapes[i].first) / rows,
+                static_cast<double>(_options.shapes[i].second) / cols));
+
+        if (best < 0 || scale > best_scale ||
+            (scale == best_scale && area < best_area)) {
+            best = static_cast<int>(i);
+            best_scale = scale;
+            best_area = area;
+        }
+    }
+
+    return best;
+}
+
+BucketPlacement ShapeBuckets::Place(int bucket, int rows, int cols) const {
+    const int bucket_rows = _options.shapes[bucket].first;
+    const int bucket_cols = _options.shapes[bucket].second;
+    BucketPlacement placement;
+
+    placement.bucket = bucket;
+    placement.roi = cv::Rect(0, 0, bucket_cols, bucket_rows);
+
+    if (_options.fit == BucketFit::LETTERBOX) {
+        const double scale = std::min(
+                static_cast<double>(bucket_rows) / rows,
+                static_cast<double>(bucket_cols) / cols);
+        const int height = std::max(1, std::min(bucket_rows,
+                static_cast<int>(std::lround(rows * scale))));
+        const int width = std::max(1, std::min(bucket_cols,
+                static_cast<int>(std::lround(cols * scale))));
+
+        placement.roi = cv::Rect((bucket_cols - width) / 2,
+                (bucket_rows - height) / 2, width, height);
+    }
+
+    placement.content = {
+        static_cast<float>(placement.roi.y) / bucket_rows,
+        static_cast<float>(placement.roi.x) / bucket_cols,
+        static_cast<float>(placement.roi.y + placement.roi.height) /
+            bucket_rows,
+        static_cast<float>(placement.roi.x + placement.roi.width) /
+            bucket_cols,
+    };
+
+    return placement;
+}
+
+void ShapeBuckets::FillPadding(const cv::Rect& roi,
+        cv::Mat& bucket_image) const {
+    const cv::Scalar pad = cv::Scalar::all(_options.pad_value);
+    const int bottom = roi.y + roi.height;
+    const int right = roi.x + roi.width;
+
+    /* Only the bands around roi, it is overwritten anyway. */
+    bucket_image.rowRange(0, roi.y).setTo(pad);
+    bucket_image.rowRange(bottom, bucket_image.rows).setTo(pad);
+    bucket_image(cv::Rect(0, roi.y, roi.x, roi.height)).setTo(pad);
+    bucket_image(cv::Rect(right, roi.y, bucket_image.cols - right,
+            roi.height)).setTo(pad);
+}
+
+std::shared_ptr<FrameBuffer> ShapeBuckets::Acquire(
+        const BucketPlacement& placement) {
+    const auto& shape = _options.shapes[placement.bucket];
+    std::shared_ptr<FrameBuffer> buffer =
+        _pools[placement.bucket]->Acquire(shape.first, shape.second);
+
+    /* Pixels outside the frame are never written by a conversion, a
+     * recycled buffer with the same placement still has its padding.
+     * */
+    if (!same_box(buffer->content, placement.content)) {
+        FillPadding(placement.roi, buffer->image);
+        buffer->content = placement.content;
+    }
+
+    return buffer;
+}
+
+Status ShapeBuckets::FitInto(const cv::Mat& image,
+        const BucketPlacement& placement, cv::Mat& bucket_image) const {
+    using namespace tensorflow;
+
+    if (image.type() != CV_8UC3) {
+        return errors::InvalidArgument("Image must be CV_8UC3");
+    }
+
+    cv::Mat roi = bucket_image(placement.roi);
+
+    FillPadding(placement.roi, bucket_image);
+    resize_into(image, roi);
+
+    return Status::OK();
+}
+
+Status ShapeBuckets::Fit(const cv::Mat& image,
+        std::shared_ptr<FrameBuffer>& buffer) {
+    using namespace tensorflow;
+
+    if (image.type() != CV_8UC3) {
+        return errors::InvalidArgument("Image must be CV_8UC3");
+    }
+
+    const BucketPlacement placement = Place(image.rows, image.cols);
+    buffer = Acquire(placement);
+
+    cv::Mat roi = buffer->image(placement.roi);
+    resize_into(image, roi);
+
+    return Status::OK();
+}
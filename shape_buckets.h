@@ -0,0 +1,95 @@
+#ifndef __SHAPE_BUCKETS_H__
+#define __SHAPE_BUCKETS_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "tensorflow/core/lib/core/status.h"
+
+#include "detection_postprocess.h"
+#include "frame_converter.h"
+
+enum class BucketFit {
+    LETTERBOX, // Scaled keeping aspect ratio, the rest padded
+    STRETCH,   // Scaled to the whole bucket
+};
+
+struct BucketOptions {
+    std::vector<std::pair<int, int>> shapes; // height, width; empty - off
+    BucketFit fit = BucketFit::LETTERBOX;
+    uint8_t pad_value = 0;
+    size_t preallocate = 0; // Buffers of every bucket allocated up front
+};
+
+/* "letterbox" or "stretch". */
+bool ParseBucketFit(const std::string& value, BucketFit& fit);
+
+/* Where a frame lands in its bucket. */
+struct BucketPlacement {
+    int bucket = -1;
+    cv::Rect roi;     // Pixels of the scaled frame
+    Box content;      // Same, normalized to the bucket
+};
+
+/* Fixed set of input shapes frames are fitted into.
+ *
+ * Frames of any resolution reach the model as one of a few shapes, so
+ * kernels, XLA clusters and allocations specialized for a shape are
+ * reused instead of being rebuilt for every new resolution. Buffers of
+ * every bucket are pooled and recycled across frames. Detections on a
+ * fitted frame are mapped back by RestoreBoxes with its content box.
+ * */
+class ShapeBuckets {
+private:
+    BucketOptions _options;
+    std::vector<std::unique_ptr<FrameBufferPool>> _pools;
+
+    void FillPadding(const cv::Rect& roi, cv::Mat& bucket_image) const;
+
+public:
+    explicit ShapeBuckets(const BucketOptions& options);
+
+    ShapeBuckets(const ShapeBuckets&) = delete;
+    ShapeBuckets& operator=(const ShapeBuckets&) = delete;
+
+    bool Enabled() const { return !_options.shapes.empty(); }
+
+    /* The smallest bucket holding the frame without downscaling, or the
+     * one downscaling it least when the frame is larger than all.
+     * */
+    int Select(int rows, int cols) const;
+
+    BucketPlacement Place(int rows, int cols) const {
+        return Place(Select(rows, cols), rows, cols);
+    }
+    BucketPlacement Place(int bucket, int rows, int cols) const;
+
+    /* Pooled [1, H, W, 3] buffer of the bucket, padding around the
+     * placement already filled and content set.
+     * */
+    std::shared_ptr<FrameBuffer> Acquire(const BucketPlacement& placement);
+
+    /* Resize image straight into its place in bucket_image, padding
+     * filled. bucket_image has the shape of placement.bucket.
+     * */
+    tensorflow::Status FitInto(const cv::Mat& image,
+            const BucketPlacement& placement, cv::Mat& bucket_image) const;
+
+    /* Image of any resolution into a pooled buffer of its bucket. */
+    tensorflow::Status Fit(const cv::Mat& image,
+            std::shared_ptr<FrameBuffer>& buffer);
+
+    size_t Count() const { return _options.shapes.size(); }
+    const std::pair<int, int>& Shape(int bucket) const {
+        return _options.shapes[bucket];
+    }
+    const FrameBufferPool& Pool(int bucket) const { return *_pools[bucket]; }
+    const BucketOptions& Options() const { return _options; }
+};
+
+#endif /* __SHAPE_BUCKETS_H__ */
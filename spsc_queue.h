@@ -0,0 +1,217 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* Spin a little, then yield, then sleep.
+ * Used by blocking operations of lock-free queues.
+ * */
+class Backoff {
+private:
+    unsigned _count = 0;
+
+public:
+    void Pause() {
+        if (_count < 16) {
+            ++_count;
+        } else if (_count < 64) {
+            ++_count;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+};
+
+/* Counters of one queue, collected without locks. */
+struct QueueStats {
+    uint64_t pushes = 0;
+    uint64_t producer_stalls = 0; // Push found queue full (backpressure)
+    uint64_t consumer_stalls = 0; // Pop found queue empty
+    size_t max_occupancy = 0;
+    double avg_occupancy = 0.;    // Sampled on every push
+};
+
+/* Bounded lock-free single-producer/single-consumer ring buffer.
+ *
+ * Exactly one thread may call Push/TryPush and exactly one thread may call
+ * Pop/TryPop/PopUntil/Front. Close can be called from any thread,
+ * consumer drains remaining items before Pop returns false.
+ * */
+template <typename T>
+class SpscQueue {
+private:
+    static constexpr size_t kCacheLine = 64;
+
+    std::vector<T> _slots;
+    size_t _mask;
+
+    alignas(kCacheLine) std::atomic<size_t> _head{0}; // next slot to pop
+    alignas(kCacheLine) std::atomic<size_t> _tail{0}; // next slot to push
+    alignas(kCacheLine) std::atomic<bool> _closed{false};
+
+    /* Written by producer */
+    alignas(kCacheLine) std::atomic<uint64_t> _pushes{0};
+    std::atomic<uint64_t> _producer_stalls{0};
+    std::atomic<uint64_t> _occupancy_sum{0};
+    std::atomic<size_t> _max_occupancy{0};
+
+    /* Written by consumer */
+    alignas(kCacheLine) std::atomic<uint64_t> _consumer_stalls{0};
+
+    /* Stops at the highest power of two instead of shifting to 0. */
+    static size_t RoundUpPowerOfTwo(size_t value) {
+        const size_t highest = ~(~static_cast<size_t>(0) >> 1);
+        size_t result = 1;
+        while (result < value && result < highest) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    void Account(size_t occupancy) {
+        _pushes.store(_pushes.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+        _occupancy_sum.store(_occupancy_sum.load(std::memory_order_relaxed)
+                + occupancy, std::memory_order_relaxed);
+        if (occupancy > _max_occupancy.load(std::memory_order_relaxed)) {
+            _max_occupancy.store(occupancy, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    explicit SpscQueue(size_t capacity) :
+        _slots(RoundUpPowerOfTwo(capacity ? capacity : 1)),
+        _mask(_slots.size() - 1) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    size_t Capacity() const { return _slots.size(); }
+
+    size_t Size() const {
+        return _tail.load(std::memory_order_acquire) -
+               _head.load(std::memory_order_acquire);
+    }
+
+    bool Closed() const { return _closed.load(std::memory_order_acquire); }
+
+    void Close() { _closed.store(true, std::memory_order_release); }
+
+    bool TryPush(T& value) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        const size_t head = _head.load(std::memory_order_acquire);
+
+        if (tail - head == _slots.size()) {
+            return false;
+        }
+
+        _slots[tail & _mask] = std::move(value);
+        _tail.store(tail + 1, std::memory_order_release);
+        Account(tail + 1 - head);
+
+        return true;
+    }
+
+    /* Blocks while queue is full. Returns false if queue was closed. */
+    bool Push(T value) {
+        Backoff backoff;
+        bool stalled = false;
+
+        while (!Closed()) {
+            if (TryPush(value)) {
+                return true;
+            }
+            if (!stalled) {
+                stalled = true;
+                _producer_stalls.fetch_add(1, std::memory_order_relaxed);
+            }
+            backoff.Pause();
+        }
+
+        return false;
+    }
+
+    bool TryPop(T& value) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        T& slot = _slots[head & _mask];
+        value = std::move(slot);
+        slot = T();
+        _head.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /* Peek the oldest item, nullptr when empty. Consumer only. */
+    T* Front() {
+        const size_t head = _head.load(std::memory_order_relaxed);
+
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        return &_slots[head & _mask];
+    }
+
+    /* Blocks until an item is available or the deadline expires.
+     * Returns false on timeout or when queue is closed and drained.
+     * */
+    bool PopUntil(T& value, std::chrono::steady_clock::time_point deadline) {
+        Backoff backoff;
+        bool stalled = false;
+
+        while (true) {
+            if (TryPop(value)) {
+                return true;
+            }
+            /* Check again after seeing closed to not lose the last push. */
+            if (Closed()) {
+                return TryPop(value);
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            if (!stalled) {
+                stalled = true;
+                _consumer_stalls.fetch_add(1, std::memory_order_relaxed);
+            }
+            backoff.Pause();
+        }
+    }
+
+    /* Blocks until an item is available.
+     * Returns false when queue is closed and drained.
+     * */
+    bool Pop(T& value) {
+        return PopUntil(value, std::chrono::steady_clock::time_point::max());
+    }
+
+    QueueStats Stats() const {
+        QueueStats stats;
+
+        stats.pushes = _pushes.load(std::memory_order_relaxed);
+        stats.producer_stalls = _producer_stalls.load(std::memory_order_relaxed);
+        stats.consumer_stalls = _consumer_stalls.load(std::memory_order_relaxed);
+        stats.max_occupancy = _max_occupancy.load(std::memory_order_relaxed);
+        if (stats.pushes != 0) {
+            stats.avg_occupancy = double(_occupancy_sum.load(
+                    std::memory_order_relaxed)) / stats.pushes;
+        }
+
+        return stats;
+    }
+};
+
+#endif /* __SPSC_QUEUE_H__ */
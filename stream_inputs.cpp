@@ -0,0 +1,73 @@
+#include "stream_inputs.h"
+
+#include <glob.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "tensorflow/core/platform/logging.h"
+
+static
+void expand_pattern(const std::string& pattern, int infer_stride,
+        std::vector<StreamInput>& inputs) {
+    StreamInput input;
+    glob_t matches;
+
+    input.infer_stride = infer_stride;
+
+    if (pattern.find_first_of("*?[") == std::string::npos) {
+        input.path = pattern;
+        inputs.push_back(input);
+        return;
+    }
+
+    /* glob sorts matches, so stream IDs are stable between runs. */
+    if (glob(pattern.c_str(), 0, nullptr, &matches) != 0) {
+        LOG(WARNING) << "Pattern " << pattern << " matches no files";
+        globfree(&matches);
+        return;
+    }
+
+    for (size_t i = 0; i < matches.gl_pathc; ++i) {
+        input.path = matches.gl_pathv[i];
+        inputs.push_back(input);
+    }
+
+    globfree(&matches);
+}
+
+void ExpandInputs(const std::string& list, std::vector<StreamInput>& inputs) {
+    std::istringstream stream(list);
+    std::string entry;
+
+    while (std::getline(stream, entry, ',')) {
+        if (!entry.empty()) {
+            expand_pattern(entry, 0, inputs);
+        }
+    }
+}
+
+bool LoadManifest(const std::string& file_name,
+        std::vector<StreamInput>& inputs) {
+    std::ifstream file(file_name);
+    std::string line;
+
+    if (!file) {
+        return false;
+    }
+
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string path;
+        int infer_stride = 0;
+
+        if (!(fields >> path) || path[0] == '#') {
+            continue;
+        }
+        fields >> infer_stride;
+
+        expand_pattern(path, infer_stride, inputs);
+    }
+
+    return true;
+}
@@ -0,0 +1,29 @@
+#ifndef __STREAM_INPUTS_H__
+#define __STREAM_INPUTS_H__
+
+#include <string>
+#include <vector>
+
+/* One video of a multi-stream run, stream ID is its index in the list. */
+struct StreamInput {
+    std::string path;
+    int infer_stride = 0; // 0 - default of the run
+};
+
+/* Comma separated list of paths, URLs or glob patterns.
+ * Pattern is expanded in sorted order, other entries are kept as is,
+ * so "rtsp://..." inputs pass through.
+ * */
+void ExpandInputs(const std::string& list, std::vector<StreamInput>& inputs);
+
+/* Manifest file, one input per line:
+ *
+ *   <path or glob> [infer_stride]
+ *
+ * Empty lines and lines starting with '#' are skipped.
+ * Returns false if the file can't be read.
+ * */
+bool LoadManifest(const std::string& file_name,
+        std::vector<StreamInput>& inputs);
+
+#endif /* __STREAM_INPUTS_H__ */
@@ -0,0 +1,80 @@
+#include "stream_scheduler.h"
+
+#include <stdexcept>
+
+StreamScheduler::StreamScheduler(ModelPool& model, size_t streams,
+        size_t slots) :
+    _model(model), _free_slots(slots ? slots : model.Workers()),
+    _waiting(streams ? streams : 1) {
+}
+
+/* Grant free slots to waiting streams, starting at the cursor.
+ * Called with the mutex held.
+ * */
+void StreamScheduler::Dispatch() {
+    const size_t streams = _waiting.size();
+    bool granted = false;
+
+    while (_free_slots > 0) {
+        size_t stream = 0;
+        bool found = false;
+
+        for (size_t i = 0; i < streams; ++i) {
+            stream = (_next_stream + i) % streams;
+            if (!_waiting[stream].empty()) {
+                found = true;
+                break;
+            }
+        }
+
+        if (!found) {
+            break;
+        }
+
+        _waiting[stream].front()->granted = true;
+        _waiting[stream].pop_front();
+        _next_stream = (stream + 1) % streams;
+        --_free_slots;
+        granted = true;
+    }
+
+    if (granted) {
+        _granted_cv.notify_all();
+    }
+}
+
+void StreamScheduler::Acquire(int stream_id) {
+    Waiter waiter;
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _waiting[stream_id].push_back(&waiter);
+    Dispatch();
+
+    _granted_cv.wait(lock, [&waiter]() { return waiter.granted; });
+}
+
+void StreamScheduler::Release() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    ++_free_slots;
+    Dispatch();
+}
+
+void StreamScheduler::PredictBatch(int stream_id,
+        const std::vector<Tensor>& images,
+        std::vector<std::vector<Detection>>& detections) {
+    if (stream_id < 0 || static_cast<size_t>(stream_id) >= _waiting.size()) {
+        throw std::out_of_range("Unknown stream " + std::to_string(stream_id));
+    }
+
+    Acquire(stream_id);
+
+    try {
+        _model.PredictBatch(images, detections);
+    } catch (...) {
+        Release();
+        throw;
+    }
+
+    Release();
+}
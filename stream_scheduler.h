@@ -0,0 +1,54 @@
+#ifndef __STREAM_SCHEDULER_H__
+#define __STREAM_SCHEDULER_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "model_pool.h"
+
+/* Shares one ModelPool between many streams.
+ *
+ * At most slots batches run at once, by default one per pool worker,
+ * so streams don't oversubscribe the CPU with concurrent Session::Run.
+ * When more batches wait than there are free slots, slots are granted
+ * round-robin by stream, so a stream with a high frame rate can't starve
+ * the others: every waiting stream gets a turn before any stream gets
+ * its second one.
+ * */
+class StreamScheduler {
+private:
+    struct Waiter {
+        bool granted = false;
+    };
+
+    ModelPool& _model;
+
+    std::mutex _mutex;
+    std::condition_variable _granted_cv;
+    size_t _free_slots;
+    std::vector<std::deque<Waiter*>> _waiting; // per stream, FIFO
+    size_t _next_stream = 0;                   // round-robin cursor
+
+    void Acquire(int stream_id);
+    void Release();
+    void Dispatch();
+
+public:
+    /* slots 0 - one per worker of the pool. */
+    StreamScheduler(ModelPool& model, size_t streams, size_t slots = 0);
+
+    StreamScheduler(const StreamScheduler&) = delete;
+    StreamScheduler& operator=(const StreamScheduler&) = delete;
+
+    /* Blocks until the stream gets its turn, then runs the batch.
+     * Thread safe, stream_id is in [0, streams).
+     * */
+    void PredictBatch(int stream_id, const std::vector<Tensor>& images,
+            std::vector<std::vector<Detection>>& detections);
+
+    size_t Streams() const { return _waiting.size(); }
+};
+
+#endif /* __STREAM_SCHEDULER_H__ */
@@ -0,0 +1,87 @@
+#include "tensor_buffer.h"
+
+#include <cstring>
+
+#include "tensorflow/core/lib/core/errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/pixfmt.h>
+#ifdef __cplusplus
+}
+#endif
+
+using tensorflow::Status;
+using tensorflow::Tensor;
+using tensorflow::TensorShape;
+
+/* Tensor takes its own reference of buffer, so drop the initial one. */
+static
+Tensor wrap_buffer(tensorflow::TensorBuffer* buffer, const TensorShape& shape) {
+    Tensor tensor(tensorflow::DT_UINT8, shape, buffer);
+    buffer->Unref();
+
+    return tensor;
+}
+
+Status MatToTensor(const cv::Mat& image, Tensor& tensor) {
+    using namespace tensorflow;
+
+    if (image.type() != CV_8UC3) {
+        return errors::InvalidArgument("Image must be CV_8UC3");
+    }
+
+    const TensorShape shape({1, image.rows, image.cols, 3});
+
+    if (image.isContinuous()) {
+        Tensor wrapped = wrap_buffer(new MatTensorBuffer(image), shape);
+        if (wrapped.IsAligned()) {
+            tensor = std::move(wrapped);
+            return Status::OK();
+        }
+    }
+
+    tensor = Tensor(DT_UINT8, shape);
+    cv::Mat tensorMatImage(image.rows, image.cols, CV_8UC3,
+            tensor.flat<uint8>().data());
+    image.copyTo(tensorMatImage);
+
+    return Status::OK();
+}
+
+Status AVFrameToTensor(const AVFrame* frame, Tensor& tensor) {
+    using namespace tensorflow;
+
+    if (frame->format != AV_PIX_FMT_RGB24) {
+        return errors::InvalidArgument("Frame must be RGB24, got format ",
+                frame->format);
+    }
+
+    const int row_size = frame->width * 3;
+    const TensorShape shape({1, frame->height, frame->width, 3});
+
+    if (frame->linesize[0] == row_size) {
+        AVFrame* reference = av_frame_clone(frame);
+        if (reference == nullptr) {
+            return errors::ResourceExhausted("Failed to reference frame");
+        }
+
+        Tensor wrapped = wrap_buffer(new AVFrameTensorBuffer(reference), shape);
+        if (wrapped.IsAligned()) {
+            tensor = std::move(wrapped);
+            return Status::OK();
+        }
+    }
+
+    tensor = Tensor(DT_UINT8, shape);
+    uint8* dst = tensor.flat<uint8>().data();
+
+    for (int row = 0; row < frame->height; ++row) {
+        std::memcpy(dst + static_cast<size_t>(row) * row_size,
+                frame->data[0] + static_cast<size_t>(row) * frame->linesize[0],
+                row_size);
+    }
+
+    return Status::OK();
+}
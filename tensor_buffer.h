@@ -0,0 +1,77 @@
+#ifndef __TENSOR_BUFFER_H__
+#define __TENSOR_BUFFER_H__
+
+#include <opencv2/core/mat.hpp>
+
+#include "tensorflow/core/framework/allocation_description.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/status.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/frame.h>
+#ifdef __cplusplus
+}
+#endif
+
+/* TensorBuffer that borrows pixels of a cv::Mat.
+ * Holds a reference of the Mat, so memory lives while any tensor uses it.
+ * */
+class MatTensorBuffer : public tensorflow::TensorBuffer {
+private:
+    cv::Mat _image;
+
+public:
+    explicit MatTensorBuffer(const cv::Mat& image) :
+        tensorflow::TensorBuffer(image.data), _image(image) {}
+
+    size_t size() const override { return _image.total() * _image.elemSize(); }
+    TensorBuffer* root_buffer() override { return this; }
+    bool OwnsMemory() const override { return false; }
+
+    void FillAllocationDescription(
+            tensorflow::AllocationDescription* proto) const override {
+        proto->set_requested_bytes(size());
+        proto->set_allocator_name("MatTensorBuffer");
+    }
+};
+
+/* TensorBuffer that borrows plane 0 of a packed RGB24 AVFrame.
+ * Holds its own reference of the frame buffers.
+ * */
+class AVFrameTensorBuffer : public tensorflow::TensorBuffer {
+private:
+    AVFrame* _frame;
+
+public:
+    /* Frame takes ownership of an already referenced AVFrame. */
+    explicit AVFrameTensorBuffer(AVFrame* frame) :
+        tensorflow::TensorBuffer(frame->data[0]), _frame(frame) {}
+    ~AVFrameTensorBuffer() override { av_frame_free(&_frame); }
+
+    size_t size() const override {
+        return static_cast<size_t>(_frame->linesize[0]) * _frame->height;
+    }
+    TensorBuffer* root_buffer() override { return this; }
+    bool OwnsMemory() const override { return false; }
+
+    void FillAllocationDescription(
+            tensorflow::AllocationDescription* proto) const override {
+        proto->set_requested_bytes(size());
+        proto->set_allocator_name("AVFrameTensorBuffer");
+    }
+};
+
+/* Wrap CV_8UC3 image as [1, H, W, 3] uint8 tensor without copy.
+ * Image that is not continuous or not aligned for Eigen is copied.
+ * */
+tensorflow::Status MatToTensor(const cv::Mat& image, tensorflow::Tensor& tensor);
+
+/* Wrap packed RGB24 frame as [1, H, W, 3] uint8 tensor without copy.
+ * Frame with padded rows or unaligned data is copied.
+ * */
+tensorflow::Status AVFrameToTensor(const AVFrame* frame,
+        tensorflow::Tensor& tensor);
+
+#endif /* __TENSOR_BUFFER_H__ */
@@ -0,0 +1,89 @@
+#include "tiling.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#include "tensorflow/core/platform/errors.h"
+
+#include "model_startup.h"
+
+using tensorflow::Status;
+
+bool ParseTileSize(const std::string& value, TileOptions& options) {
+    std::vector<std::pair<int, int>> shapes;
+
+    if (!ParseWarmupShapes(value, shapes) || shapes.size() != 1) {
+        return false;
+    }
+
+    options.rows = shapes[0].first;
+    options.cols = shapes[0].second;
+
+    return true;
+}
+
+Status ValidateTileOptions(const TileOptions& options) {
+    using namespace tensorflow;
+
+    if (options.rows <= 0 || options.cols <= 0) {
+        return errors::InvalidArgument("Tile size must be positive, got ",
+                options.rows, "x", options.cols);
+    }
+    if (options.overlap < 0 ||
+        options.overlap >= std::min(options.rows, options.cols)) {
+        return errors::InvalidArgument("Tile overlap must be in 0..",
+                std::min(options.rows, options.cols) - 1, ", got ",
+                options.overlap);
+    }
+    if (options.parallel_runs < 1) {
+        return errors::InvalidArgument("Parallel tile runs must be positive, "
+                "got ", options.parallel_runs);
+    }
+
+    return Status::OK();
+}
+
+/* Starts of tiles along one axis, first at 0 and last at length - tile. */
+static
+void tile_starts(int length, int tile, int overlap, std::vector<int>& starts) {
+    starts.clear();
+
+    if (length <= tile) {
+        starts.push_back(0);
+        return;
+    }
+
+    const int step = tile - overlap;
+    const int count = (length - tile + step - 1) / step + 1;
+
+    for (int i = 0; i < count; ++i) {
+        starts.push_back(static_cast<int>(
+                static_cast<int64_t>(i) * (length - tile) / (count - 1)));
+    }
+}
+
+void TileFrame(int rows, int cols, const TileOptions& options,
+        std::vector<Tile>& tiles) {
+    const int tile_rows = std::min(rows, options.rows);
+    const int tile_cols = std::min(cols, options.cols);
+    std::vector<int> ys;
+    std::vector<int> xs;
+
+    tiles.clear();
+    tile_starts(rows, tile_rows, options.overlap, ys);
+    tile_starts(cols, tile_cols, options.overlap, xs);
+
+    for (int y : ys) {
+        for (int x : xs) {
+            Tile tile;
+
+            tile.roi = cv::Rect(x, y, tile_cols, tile_rows);
+            tile.content.ymin = -static_cast<float>(y) / tile_rows;
+            tile.content.xmin = -static_cast<float>(x) / tile_cols;
+            tile.content.ymax = static_cast<float>(rows - y) / tile_rows;
+            tile.content.xmax = static_cast<float>(cols - x) / tile_cols;
+            tiles.push_back(tile);
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef __TILING_H__
+#define __TILING_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "tensorflow/core/lib/core/status.h"
+
+#include "detection_postprocess.h"
+
+struct TileOptions {
+    int rows = 0;                 // Tile height, 0 - no tiling
+    int cols = 0;                 // Tile width
+    int overlap = 64;             // Min pixels shared by neighbouring tiles
+    size_t tiles_per_run = 0;     // Batch of one Session::Run, 0 - all tiles
+    int parallel_runs = 1;        // Runs of one frame at once
+    bool full_frame = false;      // Also run the whole frame, large objects
+    float merge_threshold = 0.5f; // Share of the smaller box to merge
+};
+
+/* "--tile_size" value: HxW. */
+bool ParseTileSize(const std::string& value, TileOptions& options);
+
+/* Bad sizes or overlap not smaller than a tile. */
+tensorflow::Status ValidateTileOptions(const TileOptions& options);
+
+/* One tile of a frame. */
+struct Tile {
+    cv::Rect roi; // Pixels of the frame
+    Box content;  // Frame normalized to the tile, for RestoreBoxes
+};
+
+/* Grid of equal tiles covering a rows x cols frame. Along each axis
+ * tiles are spread evenly from edge to edge, neighbours share at least
+ * overlap pixels, so an object smaller than the overlap is whole in
+ * some tile. A frame no larger than a tile is one tile of its own size.
+ * tiles is cleared first.
+ * */
+void TileFrame(int rows, int cols, const TileOptions& options,
+        std::vector<Tile>& tiles);
+
+#endif /* __TILING_H__ */
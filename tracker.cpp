@@ -0,0 +1,436 @@
+#include "tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <tuple>
+
+/* Noise constants of SORT are tuned for pixels, boxes are normalized:
+ * the filter works on a virtual kScale x kScale frame.
+ * */
+static const float kScale = 1000.f;
+
+static const float kInitialVariance[Tracker::kState] = {
+    10.f, 10.f, 10.f, 10.f, 1e4f, 1e4f, 1e4f,
+};
+static const float kProcessNoise[Tracker::kState] = {
+    1.f, 1.f, 1.f, 1.f, 1e-2f, 1e-2f, 1e-4f,
+};
+static const float kMeasureNoise[Tracker::kMeasure] = {
+    1.f, 1.f, 10.f, 10.f,
+};
+
+bool ParseAssignment(const std::string& value, Assignment& assignment) {
+    if (value == "greedy") {
+        assignment = Assignment::GREEDY;
+    } else if (value == "hungarian") {
+        assignment = Assignment::HUNGARIAN;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/* Box -> cx, cy, area, aspect ratio on the virtual frame. */
+static
+void box_to_measure(const Box& box, float z[Tracker::kMeasure]) {
+    const float w = (box.xmax - box.xmin) * kScale;
+    const float h = (box.ymax - box.ymin) * kScale;
+
+    z[0] = (box.xmin + box.xmax) * 0.5f * kScale;
+    z[1] = (box.ymin + box.ymax) * 0.5f * kScale;
+    z[2] = w * h;
+    z[3] = w / std::max(h, 1e-3f);
+}
+
+/* In place inverse of a symmetric positive definite 4x4 matrix,
+ * Gauss-Jordan with partial pivoting.
+ * */
+static
+bool invert4(double m[4][4]) {
+    double inverse[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0},
+                            {0, 0, 0, 1}};
+
+    for (int c = 0; c < 4; ++c) {
+        int pivot = c;
+        for (int r = c + 1; r < 4; ++r) {
+            if (std::fabs(m[r][c]) > std::fabs(m[pivot][c])) {
+                pivot = r;
+            }
+        }
+        if (std::fabs(m[pivot][c]) < 1e-12) {
+            return false;
+        }
+        std::swap(m[c], m[pivot]);
+        std::swap(inverse[c], inverse[pivot]);
+
+        const double scale = 1. / m[c][c];
+        for (int k = 0; k < 4; ++k) {
+            m[c][k] *= scale;
+            inverse[c][k] *= scale;
+        }
+        for (int r = 0; r < 4; ++r) {
+            if (r == c || m[r][c] == 0) {
+                continue;
+            }
+            const double factor = m[r][c];
+            for (int k = 0; k < 4; ++k) {
+                m[r][k] -= factor * m[c][k];
+                inverse[r][k] -= factor * inverse[c][k];
+            }
+        }
+    }
+
+    std::copy(&inverse[0][0], &inverse[0][0] + 16, &m[0][0]);
+    return true;
+}
+
+Tracker::Tracker(const TrackerOptions& options) : _options(options) {}
+
+Box Tracker::TrackBox(size_t track) const {
+    const float* x = &_x[track * kState];
+    Box box = {0, 0, 0, 0};
+
+    if (x[2] <= 0 || x[3] <= 0) {
+        return box;
+    }
+
+    const float w = std::sqrt(x[2] * x[3]);
+    const float h = x[2] / w;
+
+    box.ymin = std::min(std::max((x[1] - h * 0.5f) / kScale, 0.f), 1.f);
+    box.xmin = std::min(std::max((x[0] - w * 0.5f) / kScale, 0.f), 1.f);
+    box.ymax = std::min(std::max((x[1] + h * 0.5f) / kScale, 0.f), 1.f);
+    box.xmax = std::min(std::max((x[0] + w * 0.5f) / kScale, 0.f), 1.f);
+
+    return box;
+}
+
+void Tracker::Add(const Detection& detection) {
+    float z[kMeasure];
+
+    box_to_measure(detection.box, z);
+
+    _ids.push_back(_next_id++);
+    _classes.push_back(detection.class_id);
+    _scores.push_back(detection.score);
+    _hits.push_back(1);
+    _misses.push_back(0);
+
+    _x.insert(_x.end(), z, z + kMeasure);
+    _x.insert(_x.end(), kState - kMeasure, 0.f);
+
+    const size_t p = _p.size();
+    _p.resize(p + kState * kState, 0.f);
+    for (int i = 0; i < kState; ++i) {
+        _p[p + i * kState + i] = kInitialVariance[i];
+    }
+}
+
+void Tracker::Remove(size_t track) {
+    const size_t last = Count() - 1;
+
+    if (track != last) {
+        _ids[track] = _ids[last];
+        _classes[track] = _classes[last];
+        _scores[track] = _scores[last];
+        _hits[track] = _hits[last];
+        _misses[track] = _misses[last];
+        std::copy_n(&_x[last * kState], kState, &_x[track * kState]);
+        std::copy_n(&_p[last * kState * kState], kState * kState,
+                &_p[track * kState * kState]);
+    }
+
+    _ids.pop_back();
+    _classes.pop_back();
+    _scores.pop_back();
+    _hits.pop_back();
+    _misses.pop_back();
+    _x.resize(last * kState);
+    _p.resize(last * kState * kState);
+}
+
+void Tracker::Step() {
+    for (size_t track = 0; track < Count(); ++track) {
+        float* x = &_x[track * kState];
+        float* p = &_p[track * kState * kState];
+
+        /* Area can't shrink below zero. */
+        if (x[2] + x[6] <= 0) {
+            x[6] = 0;
+        }
+        x[0] += x[4];
+        x[1] += x[5];
+        x[2] += x[6];
+
+        /* P = F P F' + Q, F adds velocity i + 4 to position i. */
+        for (int i = 0; i < 3; ++i) {
+            for (int k = 0; k < kState; ++k) {
+                p[i * kState + k] += p[(i + 4) * kState + k];
+            }
+        }
+        for (int r = 0; r < kState; ++r) {
+            for (int i = 0; i < 3; ++i) {
+                p[r * kState + i] += p[r * kState + i + 4];
+            }
+        }
+        for (int i = 0; i < kState; ++i) {
+            p[i * kState + i] += kProcessNoise[i];
+        }
+    }
+}
+
+void Tracker::Correct(size_t track, const Detection& detection) {
+    float* x = &_x[track * kState];
+    float* p = &_p[track * kState * kState];
+    float z[kMeasure];
+    double s[kMeasure][kMeasure];
+    double gain[kState][kMeasure];
+    double innovation[kMeasure];
+
+    box_to_measure(detection.box, z);
+
+    /* S = H P H' + R, H takes the first kMeasure state values. */
+    for (int r = 0; r < kMeasure; ++r) {
+        for (int c = 0; c < kMeasure; ++c) {
+            s[r][c] = p[r * kState + c] + (r == c ? kMeasureNoise[r] : 0.f);
+        }
+        innovation[r] = z[r] - x[r];
+    }
+    if (!invert4(s)) {
+        return;
+    }
+
+    /* K = P H' S^-1 */
+    for (int r = 0; r < kState; ++r) {
+        for (int c = 0; c < kMeasure; ++c) {
+            double sum = 0;
+            for (int k = 0; k < kMeasure; ++k) {
+                sum += p[r * kState + k] * s[k][c];
+            }
+            gain[r][c] = sum;
+        }
+    }
+
+    /* x += K y, P -= K H P */
+    double update[kState][kState];
+    for (int r = 0; r < kState; ++r) {
+        double dx = 0;
+        for (int k = 0; k < kMeasure; ++k) {
+            dx += gain[r][k] * innovation[k];
+        }
+        x[r] += static_cast<float>(dx);
+
+        for (int c = 0; c < kState; ++c) {
+            double sum = 0;
+            for (int k = 0; k < kMeasure; ++k) {
+                sum += gain[r][k] * p[k * kState + c];
+            }
+            update[r][c] = sum;
+        }
+    }
+    for (int r = 0; r < kState; ++r) {
+        for (int c = 0; c < kState; ++c) {
+            p[r * kState + c] -= static_cast<float>(update[r][c]);
+        }
+    }
+}
+
+void Tracker::Assign(size_t tracks, const std::vector<Detection>& detections) {
+    const size_t count = detections.size();
+    std::vector<Box> boxes;
+
+    _track_of.assign(count, -1);
+    if (tracks == 0 || count == 0) {
+        return;
+    }
+
+    /* Tracks only take detections of their own class. */
+    _iou.assign(tracks * count, 0.f);
+    for (size_t t = 0; t < tracks; ++t) {
+        const Box box = TrackBox(t);
+
+        for (size_t d = 0; d < count; ++d) {
+            if (detections[d].class_id == _classes[t]) {
+                _iou[t * count + d] = IoU(box, detections[d].box);
+            }
+        }
+    }
+
+    if (_options.assignment == Assignment::HUNGARIAN) {
+        std::vector<int> match;
+
+        MaxWeightMatching(_iou, tracks, count, match);
+        for (size_t t = 0; t < tracks; ++t) {
+            if (match[t] >= 0 &&
+                _iou[t * count + match[t]] >= _options.iou_threshold) {
+                _track_of[match[t]] = static_cast<int>(t);
+            }
+        }
+        return;
+    }
+
+    std::vector<std::tuple<float, int, int>> pairs;
+    for (size_t t = 0; t < tracks; ++t) {
+        for (size_t d = 0; d < count; ++d) {
+            if (_iou[t * count + d] >= _options.iou_threshold) {
+                pairs.emplace_back(_iou[t * count + d], t, d);
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(),
+            [](const std::tuple<float, int, int>& a,
+               const std::tuple<float, int, int>& b) {
+        return std::get<0>(a) > std::get<0>(b);
+    });
+
+    _matched.assign(tracks, 0);
+    for (const auto& pair : pairs) {
+        const int t = std::get<1>(pair);
+        const int d = std::get<2>(pair);
+
+        if (!_matched[t] && _track_of[d] < 0) {
+            _matched[t] = 1;
+            _track_of[d] = t;
+        }
+    }
+}
+
+void Tracker::Update(const std::vector<Detection>& detections,
+        std::vector<TrackedObject>& objects) {
+    ++_updates;
+    Step();
+
+    const size_t tracks = Count();
+    Assign(tracks, detections);
+
+    _matched.assign(tracks, 0);
+    for (size_t d = 0; d < detections.size(); ++d) {
+        const int t = _track_of[d];
+        if (t < 0) {
+            continue;
+        }
+
+        Correct(t, detections[d]);
+        _scores[t] = detections[d].score;
+        ++_hits[t];
+        _misses[t] = 0;
+        _matched[t] = 1;
+    }
+
+    /* From the end, Remove moves the last track into the hole. */
+    for (size_t t = tracks; t-- > 0;) {
+        if (!_matched[t] && ++_misses[t] > _options.max_misses) {
+            Remove(t);
+        }
+    }
+
+    for (size_t d = 0; d < detections.size(); ++d) {
+        if (_track_of[d] < 0) {
+            Add(detections[d]);
+        }
+    }
+
+    Report(objects);
+}
+
+void Tracker::Predict(std::vector<TrackedObject>& objects) {
+    Step();
+    Report(objects);
+}
+
+void Tracker::Report(std::vector<TrackedObject>& objects) const {
+    /* Like SORT, the first updates of a stream report new tracks at once. */
+    const bool warming_up = _updates <= static_cast<uint64_t>(
+            _options.min_hits);
+
+    objects.clear();
+    for (size_t t = 0; t < Count(); ++t) {
+        if (_misses[t] > 0 || (_hits[t] < _options.min_hits && !warming_up)) {
+            continue;
+        }
+
+        TrackedObject object;
+        object.track_id = _ids[t];
+        object.detection.box = TrackBox(t);
+        object.detection.class_id = _classes[t];
+        object.detection.score = _scores[t];
+        objects.push_back(object);
+    }
+}
+
+void MaxWeightMatching(const std::vector<float>& weights, size_t rows,
+        size_t cols, std::vector<int>& match) {
+    const double inf = std::numeric_limits<double>::infinity();
+    const bool transposed = rows > cols;
+    const size_t n = transposed ? cols : rows; // n <= m
+    const size_t m = transposed ? rows : cols;
+
+    /* Minimum cost assignment of -weights, 1-based with potentials. */
+    auto cost = [&](size_t i, size_t j) -> double {
+        return -(transposed ? weights[(j - 1) * cols + (i - 1)] :
+                              weights[(i - 1) * cols + (j - 1)]);
+    };
+
+    std::vector<double> u(n + 1, 0), v(m + 1, 0), min_v(m + 1);
+    std::vector<size_t> owner(m + 1, 0), way(m + 1, 0);
+    std::vector<char> used(m + 1);
+
+    for (size_t i = 1; i <= n; ++i) {
+        size_t j0 = 0;
+
+        owner[0] = i;
+        std::fill(min_v.begin(), min_v.end(), inf);
+        std::fill(used.begin(), used.end(), 0);
+
+        do {
+            const size_t i0 = owner[j0];
+            double delta = inf;
+            size_t j1 = 0;
+
+            used[j0] = 1;
+            for (size_t j = 1; j <= m; ++j) {
+                if (used[j]) {
+                    continue;
+                }
+                const double reduced = cost(i0, j) - u[i0] - v[j];
+                if (reduced < min_v[j]) {
+                    min_v[j] = reduced;
+                    way[j] = j0;
+                }
+                if (min_v[j] < delta) {
+                    delta = min_v[j];
+                    j1 = j;
+                }
+            }
+            for (size_t j = 0; j <= m; ++j) {
+                if (used[j]) {
+                    u[owner[j]] += delta;
+                    v[j] -= delta;
+                } else {
+                    min_v[j] -= delta;
+                }
+            }
+            j0 = j1;
+        } while (owner[j0] != 0);
+
+        do {
+            const size_t j1 = way[j0];
+            owner[j0] = owner[j1];
+            j0 = j1;
+        } while (j0 != 0);
+    }
+
+    match.assign(rows, -1);
+    for (size_t j = 1; j <= m; ++j) {
+        if (owner[j] == 0) {
+            continue;
+        }
+        if (transposed) {
+            match[j - 1] = static_cast<int>(owner[j] - 1);
+        } else {
+            match[owner[j] - 1] = static_cast<int>(j - 1);
+        }
+    }
+}
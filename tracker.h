@@ -0,0 +1,97 @@
+#ifndef __TRACKER_H__
+#define __TRACKER_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "detection_postprocess.h"
+
+enum class Assignment {
+    GREEDY,    // Pairs by descending IoU, O(n*m*log(n*m))
+    HUNGARIAN, // Max total IoU, O(n^3)
+};
+
+/* "--track_assignment" value: greedy or hungarian. */
+bool ParseAssignment(const std::string& value, Assignment& assignment);
+
+struct TrackerOptions {
+    Assignment assignment = Assignment::GREEDY;
+    float iou_threshold = 0.3f; // Min IoU of a detection and its track
+    int min_hits = 2;           // Matched updates before a track is reported
+    int max_misses = 2;         // Unmatched updates before a track is dropped
+};
+
+struct TrackedObject {
+    uint32_t track_id;
+    Detection detection; // Box of this frame, class and score last detected
+};
+
+/* SORT-style multi-object tracker of one stream.
+ *
+ * Every track is a constant velocity Kalman filter over box center,
+ * area and aspect ratio. Update takes the detections of an inferred
+ * frame, matches them to the predicted tracks by IoU of the same class,
+ * corrects the matched ones and starts tracks for the rest. Predict
+ * only moves the tracks by their velocity, it is all a frame without
+ * inference costs: a few hundred flops per track.
+ *
+ * Tracks are stored as struct of arrays, state and covariance of all
+ * tracks in two flat arrays, so Predict walks memory linearly.
+ * Call Update or Predict once per decoded frame, in frame order.
+ * */
+class Tracker {
+public:
+    static const int kState = 7;   // cx, cy, s, r, vcx, vcy, vs
+    static const int kMeasure = 4; // cx, cy, s, r
+
+private:
+    TrackerOptions _options;
+    uint32_t _next_id = 1;
+    uint64_t _updates = 0;
+
+    std::vector<uint32_t> _ids;
+    std::vector<int32_t> _classes;
+    std::vector<float> _scores;
+    std::vector<int> _hits;   // Matched updates
+    std::vector<int> _misses; // Unmatched updates in a row
+    std::vector<float> _x;    // kState per track
+    std::vector<float> _p;    // kState x kState per track, row major
+
+    /* Scratch of Update, kept between frames. */
+    std::vector<float> _iou;
+    std::vector<int> _track_of; // Per detection, -1 - new track
+    std::vector<char> _matched; // Per track
+
+    size_t Count() const { return _ids.size(); }
+    void Step();
+    Box TrackBox(size_t track) const;
+    void Add(const Detection& detection);
+    void Remove(size_t track);
+    void Correct(size_t track, const Detection& detection);
+    void Assign(size_t tracks, const std::vector<Detection>& detections);
+    void Report(std::vector<TrackedObject>& objects) const;
+
+public:
+    explicit Tracker(const TrackerOptions& options);
+
+    /* Inferred frame: predict, match, correct, start and drop tracks.
+     * objects are the reported tracks with their corrected boxes.
+     * */
+    void Update(const std::vector<Detection>& detections,
+            std::vector<TrackedObject>& objects);
+
+    /* Frame without inference: tracks moved by one frame. */
+    void Predict(std::vector<TrackedObject>& objects);
+
+    size_t Tracks() const { return Count(); }
+    uint32_t Started() const { return _next_id - 1; }
+};
+
+/* Max total weight matching of a rows x cols matrix, row major.
+ * match[r] is the column of row r or -1. Kuhn-Munkres with potentials.
+ * */
+void MaxWeightMatching(const std::vector<float>& weights, size_t rows,
+        size_t cols, std::vector<int>& match);
+
+#endif /* __TRACKER_H__ */
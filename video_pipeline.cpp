@@ -0,0 +1,254 @@
+#include "video_pipeline.h"
+
+#include "metrics.h"
+
+VideoPipeline::VideoPipeline(StreamScheduler& scheduler, int stream_id,
+        const PipelineOptions& options, AVRational time_base) :
+    _stream_id(stream_id), _options(options),
+    _sampler(options.sampling, time_base),
+    _tracker(options.tracker),
+    _buckets(options.buckets),
+    _decoded(options.queue_capacity),
+    _batcher(scheduler, stream_id, options.max_batch_size,
+            options.max_batch_wait, options.queue_capacity),
+    _results(options.queue_capacity) {
+    _convert_thread = std::thread(&VideoPipeline::ConvertStage, this);
+    _output_thread = std::thread(&VideoPipeline::OutputStage, this);
+}
+
+VideoPipeline::~VideoPipeline() {
+    Finish();
+}
+
+bool VideoPipeline::PushDecoded(const AVFrame* frame, int frame_number) {
+    DecodedFrame decoded;
+
+    decoded.frame_number = frame_number;
+    decoded.infer = _sampler.ShouldInfer(frame, frame_number);
+    if (!decoded.infer) {
+        Metrics::Global().Add(Counter::FRAMES_SKIPPED);
+        if (!_options.track) {
+            return true;
+        }
+    }
+
+    /* Tracker needs no pixels of a skipped frame, only the sink does. */
+    if (decoded.infer || _options.sink != nullptr) {
+        decoded.frame = av_frame_clone(frame);
+        if (decoded.frame == nullptr) {
+            LOG(ERROR) << "Stream " << _stream_id
+                       << ": failed to reference frame " << frame_number;
+            return false;
+        }
+    }
+
+    if (!_decoded.Push(decoded)) {
+        av_frame_free(&decoded.frame);
+        return false;
+    }
+
+    return true;
+}
+
+void VideoPipeline::Finish() {
+    if (_finished) {
+        return;
+    }
+    _finished = true;
+
+    /* Closing the first queue drains the rest stage by stage. */
+    _decoded.Close();
+
+    if (_convert_thread.joinable()) {
+        _convert_thread.join();
+    }
+    if (_output_thread.joinable()) {
+        _output_thread.join();
+    }
+
+    /* Sink holds buffers of this stream's pool until they are written. */
+    if (_options.sink != nullptr) {
+        _options.sink->FinishStream(_stream_id);
+    }
+
+    LogStats();
+}
+
+void VideoPipeline::ConvertStage() {
+    DecodedFrame decoded;
+
+    while (_decoded.Pop(decoded)) {
+        const int frame_number = decoded.frame_number;
+        std::shared_ptr<FrameBuffer> buffer;
+        std::shared_ptr<FrameBuffer> input;
+
+        if (!decoded.infer) {
+            /* Tracked frame, full frame for the sink or nothing. */
+            if (decoded.frame != nullptr) {
+                buffer = _converter.Convert(decoded.frame);
+            }
+        } else if (!_buckets.Enabled()) {
+            buffer = _converter.Convert(decoded.frame);
+            input = buffer;
+        } else if (_options.sink == nullptr) {
+            /* Nothing shows the full frame, convert into the bucket only. */
+            buffer = _converter.ConvertToBucket(decoded.frame, _buckets);
+            input = buffer;
+        } else {
+            buffer = _converter.Convert(decoded.frame);
+            if (buffer) {
+                StageTimer timer(Stage::TENSOR_BUILD);
+                auto status = _buckets.Fit(buffer->image, input);
+                if (!status.ok()) {
+                    LOG(ERROR) << "Stream " << _stream_id << ": "
+                               << status.ToString();
+                    input.reset();
+                }
+            }
+        }
+
+        av_frame_free(&decoded.frame);
+        if (decoded.infer && !input) {
+            continue;
+        }
+
+        /* Callback owns the buffers, so they return to their pools
+         * only after inference and output are done with them.
+         * */
+        _batcher.Submit(decoded.infer ? input->tensor : Tensor(),
+                decoded.infer,
+                [this, buffer, input, frame_number](bool inferred,
+                        std::vector<Detection>& detections) {
+            ResultFrame result;
+
+            if (inferred && _buckets.Enabled()) {
+                RestoreBoxes(input->content, detections);
+            }
+
+            result.buffer = buffer;
+            result.frame_number = frame_number;
+            result.inferred = inferred;
+            result.detections = std::move(detections);
+
+            _results.Push(std::move(result));
+        });
+    }
+
+    /* No more frames: flush the last batch, then release output stage. */
+    _batcher.Stop();
+    _results.Close();
+}
+
+static
+void log_tracks(int stream_id, int frame_number,
+        const std::vector<TrackedObject>& objects) {
+    LOG(INFO) << "Stream " << stream_id << " frame " << frame_number
+              << " tracks: " << objects.size();
+
+    for (const auto& object : objects) {
+        const Detection& detection = object.detection;
+
+        LOG(INFO) << "  track " << object.track_id
+                  << " class " << detection.class_id
+                  << " score " << detection.score
+                  << " box [" << detection.box.ymin
+                  << ", " << detection.box.xmin
+                  << ", " << detection.box.ymax
+                  << ", " << detection.box.xmax << "]";
+    }
+}
+
+void VideoPipeline::OutputStage() {
+    ResultFrame result;
+    std::vector<TrackedObject> objects;
+
+    while (_results.Pop(result)) {
+        if (_options.track) {
+            StageTimer timer(Stage::TRACK);
+
+            /* Failed inference tells nothing, tracks are only moved. */
+            if (result.inferred) {
+                _tracker.Update(result.detections, objects);
+            } else {
+                _tracker.Predict(objects);
+                Metrics::Global().Add(Counter::FRAMES_TRACKED);
+            }
+        }
+
+        if (_options.track) {
+            log_tracks(_stream_id, result.frame_number, objects);
+        } else if (result.inferred) {
+            LOG(INFO) << "Stream " << _stream_id << " frame "
+                      << result.frame_number << " detections: "
+                      << result.detections.size();
+
+            for (const auto& detection : result.detections) {
+                LOG(INFO) << "  class " << detection.class_id
+                          << " score " << detection.score
+                          << " box [" << detection.box.ymin
+                          << ", " << detection.box.xmin
+                          << ", " << detection.box.ymax
+                          << ", " << detection.box.xmax << "]";
+            }
+        }
+
+        if (_options.sink != nullptr && result.buffer) {
+            OutputFrame frame;
+
+            frame.stream_id = _stream_id;
+            frame.frame_number = result.frame_number;
+            frame.buffer = std::move(result.buffer);
+            if (_options.track) {
+                for (const auto& object : objects) {
+                    frame.detections.push_back(object.detection);
+                    frame.track_ids.push_back(object.track_id);
+                }
+            } else {
+                frame.detections = std::move(result.detections);
+            }
+
+            _options.sink->Submit(std::move(frame));
+        }
+        result.buffer.reset();
+    }
+}
+
+static
+void log_queue_stats(int stream_id, const std::string& name,
+        const QueueStats& stats, size_t capacity) {
+    LOG(INFO) << "Stream " << stream_id << " queue " << name
+              << ": pushed " << stats.pushes
+              << ", capacity " << capacity
+              << ", max occupancy " << stats.max_occupancy
+              << ", avg occupancy " << stats.avg_occupancy
+              << ", producer stalls " << stats.producer_stalls
+              << ", consumer stalls " << stats.consumer_stalls;
+}
+
+void VideoPipeline::LogStats() const {
+    log_queue_stats(_stream_id, "decode -> convert", _decoded.Stats(),
+            _decoded.Capacity());
+    log_queue_stats(_stream_id, "convert -> infer", _batcher.Stats(),
+            _batcher.QueueCapacity());
+    log_queue_stats(_stream_id, "infer -> output", _results.Stats(),
+            _results.Capacity());
+
+    LOG(INFO) << "Stream " << _stream_id << " sampling: inferred "
+              << _sampler.Sampled() << ", skipped " << _sampler.Skipped();
+    if (_options.track) {
+        LOG(INFO) << "Stream " << _stream_id << " tracker: started "
+                  << _tracker.Started() << ", active " << _tracker.Tracks();
+    }
+    LOG(INFO) << "Stream " << _stream_id << " frame buffers: allocated "
+              << _converter.Pool().Allocated()
+              << ", reused " << _converter.Pool().Reused();
+
+    for (size_t i = 0; i < _buckets.Count(); ++i) {
+        const auto& shape = _buckets.Shape(i);
+
+        LOG(INFO) << "Stream " << _stream_id << " bucket " << shape.first
+                  << "x" << shape.second << " buffers: allocated "
+                  << _buckets.Pool(i).Allocated()
+                  << ", reused " << _buckets.Pool(i).Reused();
+    }
+}
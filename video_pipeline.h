@@ -0,0 +1,117 @@
+#ifndef __VIDEO_PIPELINE_H__
+#define __VIDEO_PIPELINE_H__
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "frame_converter.h"
+#include "frame_sampler.h"
+#include "micro_batcher.h"
+#include "output_sink.h"
+#include "shape_buckets.h"
+#include "spsc_queue.h"
+#include "stream_scheduler.h"
+#include "tracker.h"
+
+struct PipelineOptions {
+    size_t queue_capacity = 16;  // Slots of every queue between stages
+    SamplingOptions sampling;    // Which frames go to inference
+    size_t max_batch_size = 4;
+    std::chrono::microseconds max_batch_wait = std::chrono::milliseconds(50);
+    OutputSink* sink = nullptr;  // Shared frame writer, nullptr - no output
+    BucketOptions buckets;       // Input shapes of the model, empty - as is
+    bool track = false;          // Boxes on skipped frames from a tracker
+    TrackerOptions tracker;
+};
+
+/* Staged processing of one video stream:
+ *
+ *   demux + decode + sampling (caller thread)
+ *     -> [SPSC] -> color conversion thread
+ *     -> [SPSC] -> inference thread (MicroBatcher)
+ *     -> [SPSC] -> output thread -> OutputSink workers
+ *
+ * Every queue is bounded, a full queue blocks its producer, so a slow
+ * stage throttles the stages before it instead of growing memory.
+ * Without tracking frames rejected by the sampler are dropped right
+ * after decoding, they are never converted nor written. Output thread
+ * only logs and hands frames to the sink, encoding and disk writes run
+ * on its pool.
+ * Several pipelines share one model through StreamScheduler,
+ * results and logs are tagged by stream_id.
+ *
+ * With shape buckets frames are fitted into a bucket before inference
+ * and boxes are mapped back to the frame. Without a sink the frame is
+ * converted and scaled in one pass, otherwise the full frame is kept
+ * for output and scaled into the bucket from it.
+ *
+ * With tracking skipped frames go through the stages too, without
+ * inference: the output stage updates the tracker with detections of
+ * inferred frames and predicts boxes for the rest, so every frame gets
+ * boxes with stable track ids. Skipped frames are converted only if
+ * the sink writes them.
+ * */
+class VideoPipeline {
+private:
+    struct DecodedFrame {
+        AVFrame* frame = nullptr; // nullptr - skipped, nothing shows it
+        int frame_number = 0;
+        bool infer = true;
+    };
+
+    struct ResultFrame {
+        std::shared_ptr<FrameBuffer> buffer;
+        int frame_number = 0;
+        bool inferred = false;
+        std::vector<Detection> detections;
+    };
+
+    int _stream_id;
+    PipelineOptions _options;
+    FrameSampler _sampler; // Used only by decode stage
+    Tracker _tracker;      // Used only by output stage
+
+    /* Used only by conversion stage, declared first so pooled
+     * buffers held by queues are released before the pools.
+     * */
+    FrameConverter _converter;
+    ShapeBuckets _buckets;
+
+    SpscQueue<DecodedFrame> _decoded;
+    MicroBatcher _batcher;
+    SpscQueue<ResultFrame> _results;
+
+    std::thread _convert_thread;
+    std::thread _output_thread;
+    bool _finished = false;
+
+    void ConvertStage();
+    void OutputStage();
+
+public:
+    /* time_base of the video stream, for FPS sampling by PTS. */
+    VideoPipeline(StreamScheduler& scheduler, int stream_id,
+            const PipelineOptions& options, AVRational time_base);
+    ~VideoPipeline();
+
+    VideoPipeline(const VideoPipeline&) = delete;
+    VideoPipeline& operator=(const VideoPipeline&) = delete;
+
+    /* Decode stage entry. Frame chosen by the sampler is referenced
+     * and queued, blocks while the conversion stage is behind.
+     * Other frames are dropped at once, unless tracked.
+     * */
+    bool PushDecoded(const AVFrame* frame, int frame_number);
+
+    /* Drain all stages and join their threads. */
+    void Finish();
+
+    void LogStats() const;
+};
+
+#endif /* __VIDEO_PIPELINE_H__ */